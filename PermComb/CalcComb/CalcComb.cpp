@@ -1,21 +1,61 @@
 #include <iostream>
+#include <cmath>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <stdexcept>
 //#include <intrin.h>
 //#include <boost/multiprecision/cpp_int.hpp>
 #include "../permcomb/concurrent_comb.h"
+#include "../permcomb/shard_runner.h"
+#include "../permcomb/shard_plan.h"
+#include "../permcomb/arrangement_export.h"
+#include "../permcomb/arrangement_stream.h"
+#include "../permcomb/run_trace.h"
+//#define PERMCOMB_PERF_COUNTERS // print hardware counters after every timing, Linux only
 #include "../common/timer.h"
+#include "../common/allocation_counter.h"
 
 void test_find_comb(uint32_t fullset, uint32_t subset);
 void unit_test();
 void unit_test_threaded();
 void unit_test_threaded_predicate();
 void unit_test_threaded_shard();
+void unit_test_threaded_prune();
+void unit_test_threaded_dfs();
+void unit_test_threaded_prefix_shard();
+void unit_test_find_first();
+void unit_test_ordered();
+void unit_test_pipeline();
+void unit_test_reduce();
+void unit_test_async();
+void unit_test_generator();
+void unit_test_range();
+void unit_test_factory();
+void unit_test_affinity();
+void unit_test_auto();
+void unit_test_processes();
+void unit_test_lease();
+void unit_test_weighted();
+void unit_test_shard_plan();
+void unit_test_export();
+void unit_test_stream();
+void unit_test_sample();
+void unit_test_strided();
+void unit_test_instrumented();
+void unit_test_trace();
 void unit_test_comb_by_idx();
 void usage_of_comb_by_idx();
 void usage_of_next_comb();
 void usage_of_next_comb_with_state();
 void usage_of_comb_state_by_idx();
 void benchmark_comb();
+void benchmark_comb_prefix();
+void benchmark_comb_generator();
+void benchmark_comb_allocations();
+void benchmark_comb_affinity();
 
 template<typename T>
 bool compare_vec(T& results1, T& results2)
@@ -254,33 +294,1816 @@ bool test_threaded_comb_shard(int_type thread_cnt, uint32_t fullset_size, uint32
 	return true;
 }
 
+template<typename int_type>
+bool test_threaded_comb_prefix_shard(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_threaded_comb_prefix_shard(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::vector<std::vector< std::vector<uint32_t> > > vecvecvec((size_t)thread_cnt);
+
+	int_type cpu_cnt = 4;
+	std::vector<std::vector<std::vector< std::vector<uint32_t> > > > vecvecvecvec;
+	for (int_type i = 0; i < cpu_cnt; ++i)
+		vecvecvecvec.push_back(vecvecvec);
+
+	for (int_type i = 0; i < cpu_cnt; ++i)
+	{
+		int_type cpu_index = i;
+		int cpu_index_n = static_cast<int>(cpu_index);
+
+		concurrent_comb::compute_all_comb_prefix_shard(cpu_index, cpu_cnt, thread_cnt, subset_size, fullset,
+			[&vecvecvecvec, cpu_index_n](const int thread_index,
+				const size_t fullset_cnt,
+				const std::vector<uint32_t>& cont) -> bool
+		{
+			vecvecvecvec[cpu_index_n][(size_t)thread_index].push_back(cont);
+			return true;
+		},
+			[](const int thread_index,
+				const size_t fullset_cnt,
+				const std::vector<uint32_t>& cont, 
+                const std::string& error) -> void
+		{
+            std::cerr << error;
+		});
+	}
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	std::vector< std::vector<uint32_t> > vecvec;
+	do
+	{
+		vecvec.push_back(std::vector<uint32_t>(subset.begin(), subset.end()));
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end()));
+
+	// compare results
+	size_t cnt = 0;
+	bool error = false;
+	for (size_t k = 0; k < vecvecvecvec.size(); ++k)
+	{
+		for (size_t i = 0; i < vecvecvecvec[k].size(); ++i)
+		{
+			for (size_t j = 0; j < vecvecvecvec[k][i].size(); ++j, ++cnt)
+			{
+				if (!compare_vec(vecvec[cnt], vecvecvecvec[k][i][j]))
+				{
+					error = true;
+
+					std::cout << "Comb at " << cnt << " is not the same!" << std::endl;
+
+					display(vecvec[cnt]);
+					display(vecvecvecvec[k][i][j]);
+
+					return false;
+				}
+			}
+		}
+	}
+	std::cout << "test_threaded_comb_prefix_shard(" << thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return true;
+}
+
+// prune at the first gap wider than 2: every combination sharing that prefix is skipped
+template<typename T>
+uint32_t first_gap_depth(const T& cont)
+{
+	for (size_t i = 1; i < cont.size(); ++i)
+	{
+		if (cont[i] - cont[i - 1] > 2)
+			return static_cast<uint32_t>(i + 1);
+	}
+	return static_cast<uint32_t>(cont.size());
+}
+
+template<typename int_type>
+bool test_threaded_comb_prune(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_threaded_comb_prune(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::vector<std::vector< std::vector<uint32_t> > > vecvecvec((size_t)thread_cnt);
+
+	concurrent_comb::compute_all_comb_prune(thread_cnt, subset_size, fullset,
+		[&vecvecvec](const int thread_index,
+			const size_t fullset_cnt,
+			const std::vector<uint32_t>& cont,
+			uint32_t& prune_depth) -> bool
+		{
+			vecvecvec[(size_t)thread_index].push_back(cont);
+			prune_depth = first_gap_depth(cont);
+			return true;
+		},
+		[](const int thread_index,
+			const size_t fullset_cnt,
+			const std::vector<uint32_t>& cont,
+			const std::string& error) -> void
+		{
+			std::cerr << error;
+		});
+
+	// same pruning done sequentially: skip every combination starting with the last pruned prefix,
+	// a thread cannot see the prunes of the thread before it, so pruning restarts at each thread's first one
+	std::vector< std::vector<uint32_t> > thread_starts;
+	for (size_t i = 0; i < vecvecvec.size(); ++i)
+	{
+		if (!vecvecvec[i].empty())
+			thread_starts.push_back(vecvecvec[i][0]);
+	}
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	std::vector< std::vector<uint32_t> > vecvec;
+	std::vector<uint32_t> pruned_prefix;
+	do
+	{
+		if (std::find(thread_starts.begin(), thread_starts.end(), subset) != thread_starts.end())
+			pruned_prefix.clear();
+		if (!pruned_prefix.empty() && std::equal(pruned_prefix.begin(), pruned_prefix.end(), subset.begin()))
+			continue;
+		pruned_prefix.clear();
+		vecvec.push_back(std::vector<uint32_t>(subset.begin(), subset.end()));
+		uint32_t depth = first_gap_depth(subset);
+		if (depth < subset_size)
+			pruned_prefix.assign(subset.begin(), subset.begin() + depth);
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end()));
+
+	// compare results
+	size_t cnt = 0;
+	bool error = false;
+	for (size_t i = 0; i < vecvecvec.size(); ++i)
+	{
+		for (size_t j = 0; j < vecvecvec[i].size(); ++j, ++cnt)
+		{
+			if (cnt >= vecvec.size() || !compare_vec(vecvec[cnt], vecvecvec[i][j]))
+			{
+				error = true;
+
+				std::cout << "Comb at " << cnt << " is not the same!" << std::endl;
+
+				display(vecvecvec[i][j]);
+
+				return false;
+			}
+		}
+	}
+	if (cnt != vecvec.size())
+	{
+		error = true;
+		std::cout << "Comb count " << cnt << " is not " << vecvec.size() << "!" << std::endl;
+	}
+
+	std::cout << "test_threaded_comb_prune(" << thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// enter refuses an element right after the previous one, so only combinations without neighbours are reached
+template<typename int_type>
+bool test_threaded_comb_dfs(int_type thread_cnt, int_type cpu_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_threaded_comb_dfs(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::vector< std::vector<uint32_t> > leaves;
+	bool error = false;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		std::vector<std::vector< std::vector<uint32_t> > > vecvecvec((size_t)thread_cnt);
+		std::vector< std::vector<uint32_t> > stacks((size_t)thread_cnt);
+
+		concurrent_comb::compute_all_comb_dfs_shard(cpu_index, cpu_cnt, thread_cnt, subset_size, fullset,
+			[&stacks](const int thread_index, uint32_t depth, uint32_t elem) -> bool
+			{
+				if (depth > 0 && elem == stacks[(size_t)thread_index].back() + 1)
+					return false;
+				stacks[(size_t)thread_index].push_back(elem);
+				return true;
+			},
+			[&stacks](const int thread_index, uint32_t depth) -> void
+			{
+				stacks[(size_t)thread_index].pop_back();
+			},
+			[&vecvecvec, &stacks, &error](const int thread_index,
+				const size_t fullset_cnt,
+				const std::vector<uint32_t>& cont) -> bool
+			{
+				if (stacks[(size_t)thread_index] != cont)
+					error = true;
+				vecvecvec[(size_t)thread_index].push_back(cont);
+				return true;
+			},
+			[](const int thread_index,
+				const size_t fullset_cnt,
+				const std::vector<uint32_t>& cont,
+				const std::string& error) -> void
+			{
+				std::cerr << error;
+			});
+
+		for (size_t i = 0; i < stacks.size(); ++i)
+		{
+			if (!stacks[i].empty())
+				error = true;
+			leaves.insert(leaves.end(), vecvecvec[i].begin(), vecvecvec[i].end());
+		}
+	}
+	if (error)
+		std::cout << "enter and leave are not balanced!" << std::endl;
+
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	std::vector< std::vector<uint32_t> > vecvec;
+	do
+	{
+		bool neighbours = false;
+		for (size_t i = 1; i < subset.size(); ++i)
+		{
+			if (subset[i] == subset[i - 1] + 1)
+				neighbours = true;
+		}
+		if (!neighbours)
+			vecvec.push_back(std::vector<uint32_t>(subset.begin(), subset.end()));
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end()));
+
+	if (leaves.size() != vecvec.size())
+	{
+		error = true;
+		std::cout << "Comb count " << leaves.size() << " is not " << vecvec.size() << "!" << std::endl;
+	}
+	for (size_t i = 0; i < leaves.size() && i < vecvec.size(); ++i)
+	{
+		if (!compare_vec(vecvec[i], leaves[i]))
+		{
+			error = true;
+			std::cout << "Comb at " << i << " is not the same!" << std::endl;
+
+			display(vecvec[i]);
+			display(leaves[i]);
+			break;
+		}
+	}
+
+	std::cout << "test_threaded_comb_dfs(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// match the combinations starting with first_elem
+template<typename int_type>
+bool test_find_first_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size, uint32_t first_elem)
+{
+	std::cout << "test_find_first_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << first_elem << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	auto matched = [first_elem](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		return cont[0] == first_elem;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	int_type expected_index = 0;
+	std::vector<uint32_t> expected(subset_size);
+	std::iota(expected.begin(), expected.end(), 0);
+	while (!matched(0, fullset_size, expected))
+	{
+		stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end());
+		++expected_index;
+	}
+
+	bool error = false;
+	int_type found_index = -1;
+	std::vector<uint32_t> found;
+	if (!concurrent_comb::find_first_comb(thread_cnt, subset_size, fullset, matched, err_callback, found_index, found)
+		|| found_index != expected_index || !compare_vec(found, expected))
+	{
+		error = true;
+		std::cout << "find_first_comb found " << found_index << " instead of " << expected_index << std::endl;
+	}
+
+	found.clear();
+	if (!concurrent_comb::find_any_comb(thread_cnt, subset_size, fullset, matched, err_callback, found_index, found)
+		|| found.size() != subset_size || found[0] != first_elem
+		|| found != concurrent_comb::find_comb_by_idx(subset_size, found_index, fullset))
+	{
+		error = true;
+		std::cout << "find_any_comb found no match at " << found_index << std::endl;
+	}
+
+	std::cout << "test_find_first_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << first_elem <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// the ordered mode must deliver exactly the sequence of stdcomb::next_combination
+template<typename int_type>
+bool test_ordered_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_ordered_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::vector<uint32_t> expected(subset_size);
+	std::iota(expected.begin(), expected.end(), 0);
+	bool error = false;
+	bool more = true;
+	int_type count = 0;
+	auto callback = [&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		if (!more || cont != expected)
+		{
+			if (!error)
+				std::cout << "test_ordered_comb: mismatch at index " << count << std::endl;
+			error = true;
+			return false;
+		}
+		more = stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end());
+		++count;
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	if (!concurrent_comb::compute_all_comb_ordered(thread_cnt, subset_size, fullset, callback, err_callback) || more)
+		error = true;
+
+	std::cout << "test_ordered_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every combination must be evaluated exactly once, whatever the generator/evaluator ratio
+template<typename int_type>
+bool test_pipeline_comb(int_type gen_cnt, int_type eval_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_pipeline_comb(" << gen_cnt << ", " << eval_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::mutex evaluated_mutex;
+	std::vector<std::vector<uint32_t> > evaluated;
+	bool error = false;
+	auto callback = [&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		if (thread_index < 0 || thread_index >= eval_cnt)
+			error = true;
+		std::lock_guard<std::mutex> lock(evaluated_mutex);
+		evaluated.push_back(cont);
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	concurrent_comb::pipeline_stats stats;
+	if (!concurrent_comb::compute_all_comb_pipeline(gen_cnt, eval_cnt, subset_size, fullset, callback, err_callback, stats))
+		error = true;
+
+	std::sort(evaluated.begin(), evaluated.end());
+	std::vector<uint32_t> expected(subset_size);
+	std::iota(expected.begin(), expected.end(), 0);
+	size_t i = 0;
+	do
+	{
+		if (i >= evaluated.size() || evaluated[i] != expected)
+		{
+			error = true;
+			break;
+		}
+		++i;
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end()));
+	if (i != evaluated.size())
+		error = true;
+
+	std::cout << "batches:" << stats.batches << ", full_waits:" << stats.full_waits << ", empty_waits:" << stats.empty_waits;
+	std::cout << ", mean occupancy:" << ((stats.batches) ? double(stats.occupancy_sum) / stats.batches : 0.0) << "/" << stats.capacity << std::endl;
+	std::cout << "test_pipeline_comb(" << gen_cnt << ", " << eval_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// a floating-point sum must be bit-identical for every thread count and shard layout
+template<typename int_type>
+bool test_reduce_comb(int_type max_thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_reduce_comb(" << max_thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	auto map = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> double
+	{
+		double value = 0.0;
+		for (size_t i = 0; i < cont.size(); ++i)
+			value = value * 0.37 + 1.0 / ((cont[i] + 1) * (i + 1));
+		return value;
+	};
+	auto combine = [](double a, double b) -> double
+	{
+		return a + b;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	double expected = 0.0;
+	if (!concurrent_comb::compute_all_comb_reduce(int_type(1), subset_size, fullset, 0.0, map, combine, expected, err_callback))
+		error = true;
+
+	double sequential = 0.0;
+	std::vector<uint32_t> cont(subset_size);
+	std::iota(cont.begin(), cont.end(), 0);
+	do
+	{
+		sequential += map(0, fullset_size, cont);
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), cont.begin(), cont.end()));
+	if (std::abs(sequential - expected) > 1e-9 * std::abs(sequential))
+	{
+		error = true;
+		std::cout << "compute_all_comb_reduce: " << expected << " instead of " << sequential << std::endl;
+	}
+
+	for (int_type thread_cnt = 2; thread_cnt <= max_thread_cnt; ++thread_cnt)
+	{
+		double result = 0.0;
+		if (!concurrent_comb::compute_all_comb_reduce(thread_cnt, subset_size, fullset, 0.0, map, combine, result, err_callback) || result != expected)
+		{
+			error = true;
+			std::cout << "compute_all_comb_reduce with " << thread_cnt << " threads differs" << std::endl;
+		}
+
+		// thread_cnt shards of (thread_cnt + 1) threads each
+		std::vector<double> all_chunks;
+		for (int_type cpu_index = 0; cpu_index < thread_cnt; ++cpu_index)
+		{
+			std::vector<double> chunks;
+			if (!concurrent_comb::compute_all_comb_reduce_shard(cpu_index, thread_cnt, thread_cnt + 1, subset_size, fullset, 0.0, map, combine, chunks, err_callback))
+				error = true;
+			all_chunks.insert(all_chunks.end(), chunks.begin(), chunks.end());
+		}
+		if (concurrent_comb::reduce_chunks(all_chunks, 0.0, combine) != expected)
+		{
+			error = true;
+			std::cout << "compute_all_comb_reduce_shard with " << thread_cnt << " shards differs" << std::endl;
+		}
+	}
+
+	std::cout << "test_reduce_comb(" << max_thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// runs a job to completion, then cancels a long one
+template<typename int_type>
+bool test_async_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size, concurrent_comb::thread_pool& pool)
+{
+	std::cout << "test_async_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::atomic<uint64_t> count(0);
+	auto callback = [&count](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		++count;
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	concurrent_comb::job job = concurrent_comb::async_compute_all_comb(thread_cnt, subset_size, fullset, callback, err_callback, concurrent_comb::no_predicate_type(), pool);
+	job.wait();
+	uint64_t total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	if (!job.result().get() || count != total_comb || job.progress() != 1.0)
+	{
+		error = true;
+		std::cout << "async_compute_all_comb processed " << count << " of " << total_comb << std::endl;
+	}
+
+	std::vector<uint32_t> large(40);
+	std::iota(large.begin(), large.end(), 0);
+	job = concurrent_comb::async_compute_all_comb(thread_cnt, 10, large, callback, err_callback, concurrent_comb::no_predicate_type(), pool);
+	job.wait_for(std::chrono::milliseconds(10));
+	job.cancel();
+	if (job.wait_for(std::chrono::seconds(10)) != std::future_status::ready || job.result().get() || job.progress() >= 1.0)
+	{
+		error = true;
+		std::cout << "async_compute_all_comb was not cancelled" << std::endl;
+	}
+
+	std::cout << "test_async_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// sub-range generators must match next_combination and the threaded generators must cover every combination once
+template<typename int_type>
+bool test_generator_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_generator_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+
+	bool error = false;
+	const int_type step = total_comb / 7 + 1;
+	for (int_type start_index = 0; start_index < total_comb; start_index += step)
+	{
+		const int_type end_index = (std::min)(start_index + step * 2, total_comb);
+		std::vector<uint32_t> expected = concurrent_comb::find_comb_by_idx(subset_size, start_index, fullset);
+		int_type count = 0;
+		for (const auto& comb : concurrent_comb::make_comb_generator(subset_size, fullset, start_index, end_index))
+		{
+			if (comb != expected)
+			{
+				error = true;
+				std::cout << "comb_generator differs at index " << start_index + count << std::endl;
+				break;
+			}
+			stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end());
+			++count;
+		}
+		if (count != end_index - start_index)
+			error = true;
+	}
+
+	std::mutex generated_mutex;
+	std::vector<std::vector<uint32_t> > generated;
+	auto worker = [&](const int thread_index, concurrent_comb::comb_generator<std::vector<uint32_t>, int_type>& gen)
+	{
+		std::vector<std::vector<uint32_t> > local;
+		while (!gen.done())
+		{
+			local.push_back(gen.current());
+			gen.advance();
+		}
+		std::lock_guard<std::mutex> lock(generated_mutex);
+		generated.insert(generated.end(), local.begin(), local.end());
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+	if (!concurrent_comb::compute_all_comb_generators(thread_cnt, subset_size, fullset, worker, err_callback))
+		error = true;
+
+	std::sort(generated.begin(), generated.end());
+	std::vector<uint32_t> expected(subset_size);
+	std::iota(expected.begin(), expected.end(), 0);
+	for (size_t i = 0; i < generated.size(); ++i)
+	{
+		if (generated[i] != expected)
+		{
+			error = true;
+			break;
+		}
+		stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end());
+	}
+	if (int_type(generated.size()) != total_comb)
+		error = true;
+
+	std::cout << "test_generator_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// a trivial amount of work per combination, to measure the per-item overhead
+template<typename container_type>
+struct checksum_callback_t
+{
+	bool operator()(const int thread_index, const size_t fullset_cnt, const container_type& cont)
+	{
+		sum += cont[0] ^ cont[cont.size() - 1];
+		return sum != 1;
+	}
+
+	uint64_t sum = 0;
+};
+
+// stands in for tbb::split
+struct split_t {};
+
+// random access must unrank like find_comb_by_idx, and splitting down to the grainsize must cover every combination once
+template<typename int_type>
+bool test_range_comb(uint32_t fullset_size, uint32_t subset_size, int_type grainsize)
+{
+	std::cout << "test_range_comb(" << fullset_size << ", " << subset_size << ", " << grainsize << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+
+	bool error = false;
+	auto range = concurrent_comb::make_comb_range(subset_size, fullset, int_type(0), total_comb, grainsize);
+	if (range.size() != total_comb || range.end() - range.begin() != total_comb)
+		error = true;
+	for (int_type i = 0; i < total_comb; i += total_comb / 5 + 1)
+	{
+		if (*(range.begin() + i) != concurrent_comb::find_comb_by_idx(subset_size, i, fullset) || range.begin()[i] != *(range.end() - (total_comb - i)))
+		{
+			error = true;
+			std::cout << "comb_range differs at index " << i << std::endl;
+		}
+	}
+
+	std::vector<uint32_t> expected(subset_size);
+	std::iota(expected.begin(), expected.end(), 0);
+	std::for_each(range.begin(), range.end(), [&](const std::vector<uint32_t>& cont)
+	{
+		if (cont != expected)
+			error = true;
+		stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end());
+	});
+
+	// split like a scheduler would, then walk the leaves on their own threads
+	std::vector<decltype(range)> leaves;
+	std::vector<decltype(range)> pending(1, range);
+	while (!pending.empty())
+	{
+		decltype(range) r = pending.back();
+		pending.pop_back();
+		if (r.is_divisible())
+		{
+			decltype(range) second(r, split_t());
+			pending.push_back(r);
+			pending.push_back(second);
+		}
+		else
+			leaves.push_back(r);
+	}
+
+	std::vector<std::vector<std::vector<uint32_t> > > walked(leaves.size());
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (size_t i = 0; i < leaves.size(); ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread([&leaves, &walked, i]()
+		{
+			for (auto it = leaves[i].begin(); it != leaves[i].end(); ++it)
+				walked[i].push_back(*it);
+		})));
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i]->join();
+
+	std::vector<std::vector<uint32_t> > all;
+	for (size_t i = 0; i < walked.size(); ++i)
+	{
+		if (leaves[i].size() > grainsize)
+			error = true;
+		all.insert(all.end(), walked[i].begin(), walked[i].end());
+	}
+	std::sort(all.begin(), all.end());
+	std::iota(expected.begin(), expected.end(), 0);
+	for (size_t i = 0; i < all.size(); ++i)
+	{
+		if (all[i] != expected)
+		{
+			error = true;
+			break;
+		}
+		stdcomb::next_combination(fullset.begin(), fullset.end(), expected.begin(), expected.end());
+	}
+	if (int_type(all.size()) != total_comb)
+		error = true;
+
+	std::cout << "test_range_comb(" << fullset_size << ", " << subset_size << ", " << grainsize <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// counts the combinations it sees and adds them to total when the thread is done, cannot be copied
+struct counting_evaluator_t
+{
+	counting_evaluator_t(std::atomic<uint64_t>& total_) : total(total_), count(0) {}
+	counting_evaluator_t(counting_evaluator_t&& other) : total(other.total), count(other.count) { other.count = 0; }
+	counting_evaluator_t(const counting_evaluator_t&) = delete;
+	~counting_evaluator_t() { total += count; }
+
+	bool operator()(const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont)
+	{
+		++count;
+		return true;
+	}
+
+	std::atomic<uint64_t>& total;
+	uint64_t count;
+};
+
+// every thread must construct its own callback exactly once, and the callbacks must see every combination
+template<typename int_type>
+bool test_factory_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_factory_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+
+	std::atomic<uint64_t> total(0);
+	std::mutex made_mutex;
+	std::vector<int> made;
+	auto make_callback = [&](const int thread_index)
+	{
+		std::lock_guard<std::mutex> lock(made_mutex);
+		made.push_back(thread_index);
+		return counting_evaluator_t(total);
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	if (!concurrent_comb::compute_all_comb_factory(thread_cnt, subset_size, fullset, make_callback, err_callback) || int_type(total) != total_comb)
+		error = true;
+
+	std::sort(made.begin(), made.end());
+	for (size_t i = 0; i < made.size(); ++i)
+	{
+		if (made[i] != static_cast<int>(i))
+			error = true;
+	}
+	if (made.empty() || int_type(made.size()) > thread_cnt)
+		error = true;
+
+	std::cout << "test_factory_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// scores every combination in a temporary vector allocated per combination
+template<typename container_type>
+struct allocating_callback_t
+{
+	bool operator()(const int thread_index, const size_t fullset_cnt, const container_type& cont)
+	{
+		std::vector<int> scratch(cont.begin(), cont.end());
+		std::partial_sum(scratch.begin(), scratch.end(), scratch.begin());
+		sum += scratch.back();
+		return sum != 1;
+	}
+
+	uint64_t sum = 0;
+};
+
+// scores every combination in a scratch buffer preallocated once per thread
+template<typename container_type>
+struct arena_callback_t
+{
+	explicit arena_callback_t(size_t size)
+	{
+		scratch.reserve(size);
+	}
+
+	bool operator()(const int thread_index, const size_t fullset_cnt, const container_type& cont)
+	{
+		scratch.assign(cont.begin(), cont.end());
+		std::partial_sum(scratch.begin(), scratch.end(), scratch.begin());
+		sum += scratch.back();
+		return sum != 1;
+	}
+
+	std::vector<int> scratch;
+	uint64_t sum = 0;
+};
+
+// every combination must be processed once whatever the policy, on the CPU chosen for its thread,
+// and the calling thread must get its affinity back
+template<typename int_type>
+bool test_affinity_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size, const concurrent_comb::affinity_policy& policy)
+{
+	std::cout << "test_affinity_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << static_cast<int>(policy.kind) << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+
+	const std::vector<int> cpus = concurrent_comb::affinity_cpu_order(policy);
+	std::atomic<uint64_t> count(0);
+	std::atomic<bool> misplaced(false);
+	auto callback = [&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		++count;
+#if defined(__linux__)
+		if (!cpus.empty() && sched_getcpu() != cpus[thread_index % cpus.size()])
+			misplaced = true;
+#endif
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+#if defined(__linux__)
+	cpu_set_t before;
+	sched_getaffinity(0, sizeof(before), &before);
+#endif
+	if (!concurrent_comb::compute_all_comb_affinity(thread_cnt, subset_size, fullset, callback, err_callback, policy) || int_type(count) != total_comb)
+		error = true;
+	if (misplaced)
+	{
+		error = true;
+		std::cerr << "compute_all_comb_affinity ran a thread on another CPU" << std::endl;
+	}
+#if defined(__linux__)
+	cpu_set_t after;
+	sched_getaffinity(0, sizeof(after), &after);
+	if (!CPU_EQUAL(&before, &after))
+	{
+		error = true;
+		std::cerr << "compute_all_comb_affinity did not restore the affinity of the calling thread" << std::endl;
+	}
+#endif
+
+	std::cout << "test_affinity_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << static_cast<int>(policy.kind) <<
+		") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every combination must be processed once, and small sets must not spawn threads
+template<typename int_type>
+bool test_auto_comb(uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_auto_comb(" << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+
+	std::atomic<uint64_t> count(0);
+	std::atomic<uint64_t> checksum(0);
+	auto callback = [&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		++count;
+		checksum += cont[0] * cont[cont.size() - 1];
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	concurrent_comb::auto_plan plan;
+	if (!concurrent_comb::compute_all_comb_auto<int_type>(subset_size, fullset, callback, err_callback, plan) || int_type(count) != total_comb)
+		error = true;
+	if (plan.thread_cnt < 1 || plan.thread_cnt > concurrent_comb::available_cpu_cnt() || (int_type(plan.warmup_cnt) == total_comb && plan.thread_cnt != 1))
+		error = true;
+
+	uint64_t expected = 0;
+	std::vector<uint32_t> cont(subset_size);
+	std::iota(cont.begin(), cont.end(), 0);
+	do
+	{
+		expected += cont[0] * cont[cont.size() - 1];
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), cont.begin(), cont.end()));
+	if (checksum != expected)
+		error = true;
+
+	std::cout << "threads:" << plan.thread_cnt << ", chunk_size:" << plan.chunk_size << ", warmup_cnt:" << plan.warmup_cnt << ", item_ns:" << plan.item_ns << std::endl;
+	std::cout << "test_auto_comb(" << fullset_size << ", " << subset_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
 // return false to stop processing
 template<typename container_type>
 struct empty_callback_t
 {
-	bool operator()(const int thread_index, const size_t fullset_size, const container_type& cont)
+	bool operator()(const int thread_index, const size_t fullset_size, const container_type& cont)
+	{
+		return true;
+	}
+};
+
+template<typename container_type>
+struct error_callback_t
+{
+	void operator()(const int thread_index, const size_t fullset_size, const container_type& cont, const std::string& error)
+	{
+		std::cerr << error << std::endl;
+	}
+};
+
+// recomputes an expensive cost only when the prefix (all but the last 2 elements) changes
+template<typename container_type>
+struct prefix_cache_callback_t
+{
+	bool operator()(const int thread_index, const size_t fullset_cnt, const container_type& cont)
+	{
+		const size_t prefix_size = cont.size() - 2;
+		if (prefix.size() != prefix_size || !std::equal(prefix.begin(), prefix.end(), cont.begin()))
+		{
+			prefix.assign(cont.begin(), cont.begin() + prefix_size);
+			cost = 0;
+			for (int repeat = 0; repeat < 16; ++repeat)
+			{
+				for (size_t i = 0; i < prefix_size; ++i)
+					cost = cost * 31 + prefix[i] * (i + repeat);
+			}
+		}
+		return cost != 1;
+	}
+
+	std::vector<typename container_type::value_type> prefix;
+	uint64_t cost = 0;
+};
+
+//typedef boost::multiprecision::cpp_int int_type;
+//typedef boost::multiprecision::int128_t int_type;
+typedef int64_t int_type;
+
+// nodes must get shares proportional to their weights and, together, every combination in order
+template<typename int_type>
+bool test_weighted_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size, const std::vector<uint32_t>& weights)
+{
+	std::cout << "test_weighted_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << weights.size() << " nodes) starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	const uint64_t sum = std::accumulate(weights.begin(), weights.end(), uint64_t(0));
+
+	bool error = false;
+	std::vector< std::vector<uint32_t> > vecvec;
+	uint64_t cum = 0;
+	for (size_t k = 0; k < weights.size(); ++k)
+	{
+		std::vector<std::vector< std::vector<uint32_t> > > vecvecvec((size_t)thread_cnt);
+		if (!concurrent_comb::compute_all_comb_weighted_shard(int_type(k), weights, thread_cnt, subset_size, fullset,
+			[&vecvecvec](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+			{
+				vecvecvec[thread_index].push_back(cont);
+				return true;
+			},
+			[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+			{
+				std::cerr << error;
+			}))
+			error = true;
+
+		size_t node_cnt = 0;
+		for (size_t i = 0; i < vecvecvec.size(); ++i)
+		{
+			vecvec.insert(vecvec.end(), vecvecvec[i].begin(), vecvecvec[i].end());
+			node_cnt += vecvecvec[i].size();
+		}
+		const uint64_t expected_cnt = static_cast<uint64_t>(total_comb) * (cum + weights[k]) / sum - static_cast<uint64_t>(total_comb) * cum / sum;
+		if (node_cnt != expected_cnt)
+		{
+			error = true;
+			std::cout << "node " << k << " got " << node_cnt << " instead of " << expected_cnt << " combinations" << std::endl;
+		}
+		cum += weights[k];
+	}
+
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	size_t cnt = 0;
+	do
+	{
+		if (cnt >= vecvec.size() || !compare_vec(vecvec[cnt], subset))
+		{
+			error = true;
+			std::cout << "Comb at " << cnt << " is not the same!" << std::endl;
+			break;
+		}
+		++cnt;
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end()));
+	if (cnt != vecvec.size())
+		error = true;
+
+	std::cout << "test_weighted_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << weights.size() << " nodes) finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// jobs read back from their JSON manifests must produce every combination in order from their seeds,
+// and the merge step must accept their records and reject missing or duplicated ones
+template<typename int_type>
+bool test_shard_plan_comb(uint32_t fullset_size, uint32_t subset_size, const std::vector<uint32_t>& weights, uint32_t jobs_per_node)
+{
+	std::cout << "test_shard_plan_comb(" << fullset_size << ", " << subset_size << ", " << weights.size() << " nodes, " << jobs_per_node << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	std::vector<std::string> nodes;
+	for (size_t i = 0; i < weights.size(); ++i)
+		nodes.push_back("node" + std::to_string(i));
+
+	bool error = false;
+	std::string plan_error;
+	concurrent_shard::shard_plan<int_type> plan;
+	concurrent_shard::shard_plan<int_type> parsed_plan;
+	if (!concurrent_shard::make_shard_plan("comb", fullset_size, subset_size, nodes, weights, jobs_per_node, plan, plan_error)
+		|| !concurrent_shard::parse_shard_plan(concurrent_shard::plan_to_json(plan), parsed_plan, plan_error))
+	{
+		std::cout << plan_error << std::endl;
+		return false;
+	}
+
+	std::vector<concurrent_shard::shard_job<int_type> > jobs;
+	for (size_t i = 0; i < plan.jobs.size(); ++i)
+	{
+		concurrent_shard::shard_plan<int_type> job_plan;
+		if (!concurrent_shard::parse_shard_plan(concurrent_shard::job_to_json(plan, plan.jobs[i]), job_plan, plan_error) || job_plan.jobs.size() != 1)
+		{
+			error = true;
+			std::cout << plan_error << std::endl;
+			continue;
+		}
+		jobs.push_back(job_plan.jobs[0]);
+	}
+
+	std::vector<std::vector< std::vector<uint32_t> > > vecvecvec(jobs.size());
+	std::vector<concurrent_shard::shard_record<int_type> > records;
+	if (!concurrent_shard::compute_comb_jobs(jobs, fullset,
+		[&vecvecvec](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+		{
+			vecvecvec[thread_index].push_back(cont);
+			return true;
+		},
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+		{
+			std::cerr << error;
+		}, records))
+		error = true;
+
+	size_t cnt = 0;
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	for (size_t k = 0; k < vecvecvec.size(); ++k)
+	{
+		for (size_t j = 0; j < vecvecvec[k].size(); ++j, ++cnt)
+		{
+			if (!compare_vec(vecvecvec[k][j], subset))
+			{
+				error = true;
+				std::cout << "Comb at " << cnt << " is not the same!" << std::endl;
+				break;
+			}
+			stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end());
+		}
+	}
+
+	std::vector<concurrent_shard::shard_record<int_type> > parsed_records;
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		concurrent_shard::shard_record<int_type> record;
+		if (!concurrent_shard::parse_shard_record(concurrent_shard::record_to_json(records[i]), record, plan_error))
+			error = true;
+		parsed_records.push_back(record);
+	}
+
+	std::string report;
+	if (!concurrent_shard::verify_coverage(parsed_plan, parsed_records, report) || int_type(cnt) != parsed_plan.total)
+	{
+		error = true;
+		std::cout << report;
+	}
+	std::vector<concurrent_shard::shard_record<int_type> > bad_records = parsed_records;
+	bad_records.push_back(parsed_records.front());
+	std::string bad_report;
+	if (concurrent_shard::verify_coverage(parsed_plan, bad_records, bad_report))
+		error = true;
+	bad_records.pop_back();
+	bad_records.pop_back();
+	if (concurrent_shard::verify_coverage(parsed_plan, bad_records, bad_report))
+		error = true;
+
+	std::cout << "test_shard_plan_comb(" << fullset_size << ", " << subset_size << ", " << weights.size() << " nodes, " << jobs_per_node << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// streams of every shard must decode in parallel to the next_combination sequence, or to its kept part
+template<typename int_type>
+bool test_stream_comb(int_type thread_cnt, int_type cpu_cnt, uint32_t fullset_size, uint32_t subset_size, uint64_t chunk_records, bool sparse)
+{
+	std::cout << "test_stream_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ", " << chunk_records << ", " << (sparse ? "sparse" : "dense") << ") starting" << std::endl;
+
+	bool error = false;
+	concurrent_export::stream_options options;
+	options.chunk_records = chunk_records;
+	auto keep = [](const int thread_index, const std::vector<uint32_t>& indices) { return (indices[0] + 2 * indices.back()) % 5 == 1; };
+	std::vector<std::string> streams;
+	std::vector<concurrent_export::stream_chunk<int_type> > all_chunks;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		std::ostringstream os;
+		std::string stream_error;
+		const bool encoded = sparse ? concurrent_export::encode_all_comb_shard(cpu_index, cpu_cnt, thread_cnt, fullset_size, subset_size, os, options, stream_error, keep)
+			: concurrent_export::encode_all_comb_shard(cpu_index, cpu_cnt, thread_cnt, fullset_size, subset_size, os, options, stream_error);
+		concurrent_export::stream_header<int_type> header;
+		std::vector<concurrent_export::stream_chunk<int_type> > chunks;
+		if (!encoded || !concurrent_export::read_stream_index(os.str(), header, chunks, stream_error))
+		{
+			error = true;
+			std::cerr << stream_error << std::endl;
+		}
+		all_chunks.insert(all_chunks.end(), chunks.begin(), chunks.end());
+		streams.push_back(os.str());
+	}
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	std::string report;
+	if (!concurrent_export::verify_stream_coverage(int_type(0), total_comb, all_chunks, report))
+	{
+		error = true;
+		std::cerr << report;
+	}
+
+	std::mutex mutex;
+	std::vector<std::pair<int_type, std::vector<uint32_t> > > decoded;
+	size_t stream_bytes = 0;
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		stream_bytes += streams[i].size();
+		if (!concurrent_export::decode_stream(thread_cnt, streams[i],
+			[&](const int thread_index, const int_type& rank, const std::vector<uint32_t>& indices) -> bool
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				decoded.push_back(std::make_pair(rank, indices));
+				return true;
+			},
+			[](const int thread_index, const std::string& error) { std::cerr << error << std::endl; }))
+			error = true;
+	}
+	std::sort(decoded.begin(), decoded.end());
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	std::vector<uint32_t> cont(subset_size);
+	std::iota(cont.begin(), cont.end(), 0);
+	std::vector<std::pair<int_type, std::vector<uint32_t> > > expected;
+	int_type rank = 0;
+	do
+	{
+		if (!sparse || keep(0, cont))
+			expected.push_back(std::make_pair(rank, cont));
+		++rank;
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), cont.begin(), cont.end()));
+	if (decoded != expected)
+	{
+		error = true;
+		std::cerr << "decoded " << decoded.size() << " records, expected " << expected.size() << std::endl;
+	}
+	std::cout << stream_bytes << " bytes for " << expected.size() << " records" << std::endl;
+
+	// returning false from the callback stops every thread, each after at most the record it is on;
+	// the stream is given as a pointer and a length, as a mapped file would be
+	std::atomic<uint64_t> stopped_cnt(0);
+	if (!concurrent_export::decode_stream(thread_cnt, streams[0].data(), streams[0].size(),
+		[&stopped_cnt](const int thread_index, const int_type& rank, const std::vector<uint32_t>& indices) -> bool
+		{
+			++stopped_cnt;
+			return false;
+		},
+		[](const int thread_index, const std::string& error) { std::cerr << error << std::endl; })
+		|| stopped_cnt > static_cast<uint64_t>(thread_cnt))
+	{
+		error = true;
+		std::cerr << "decode_stream went on for " << stopped_cnt << " records after the callback returned false" << std::endl;
+	}
+
+	// a truncated stream and a missing chunk must be caught
+	concurrent_export::stream_header<int_type> header;
+	std::vector<concurrent_export::stream_chunk<int_type> > chunks;
+	std::string stream_error;
+	if (concurrent_export::read_stream_index(streams[0].substr(0, streams[0].size() - 1), header, chunks, stream_error)
+		|| (all_chunks.size() > 1 && concurrent_export::verify_stream_coverage(int_type(0), total_comb, std::vector<concurrent_export::stream_chunk<int_type> >(all_chunks.begin() + 1, all_chunks.end()), report)))
+	{
+		error = true;
+		std::cerr << "damaged stream accepted" << std::endl;
+	}
+
+	std::cout << "test_stream_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// samples must not depend on thread_cnt, must be roughly uniform, and distinct ones must not repeat
+template<typename int_type>
+bool test_sample_comb(uint32_t fullset_size, uint32_t subset_size, int_type sample_cnt, uint64_t seed, bool distinct)
+{
+	std::cout << "test_sample_comb(" << fullset_size << ", " << subset_size << ", " << sample_cnt << ", " << seed << ", " << (distinct ? "distinct" : "with replacement") << ") starting" << std::endl;
+
+	bool error = false;
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	std::vector<std::vector<uint32_t> > first_run;
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::vector<std::vector<std::vector<uint32_t> > > per_thread((size_t)thread_cnt);
+		auto callback = [&per_thread](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+		{
+			per_thread[(size_t)thread_index].push_back(cont);
+			return true;
+		};
+		auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error << std::endl; };
+		if (!(distinct ? concurrent_comb::sample_comb_distinct(thread_cnt, subset_size, fullset, sample_cnt, seed, callback, err_callback)
+			: concurrent_comb::sample_comb(thread_cnt, subset_size, fullset, sample_cnt, seed, callback, err_callback)))
+			error = true;
+
+		std::vector<std::vector<uint32_t> > samples;
+		for (size_t i = 0; i < per_thread.size(); ++i)
+		{
+			samples.insert(samples.end(), per_thread[i].begin(), per_thread[i].end());
+		}
+		if (thread_cnt == 1)
+			first_run = samples;
+		else if (samples != first_run)
+		{
+			error = true;
+			std::cerr << "samples of " << thread_cnt << " threads differ from 1 thread" << std::endl;
+		}
+	}
+
+	std::map<std::vector<uint32_t>, int64_t> counts;
+	for (size_t i = 0; i < first_run.size(); ++i)
+	{
+		const std::vector<uint32_t>& sample = first_run[i];
+		if (sample.size() != subset_size || std::adjacent_find(sample.begin(), sample.end(), std::greater_equal<uint32_t>()) != sample.end() || sample.back() >= fullset_size)
+			error = true;
+		++counts[sample];
+	}
+	int64_t total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	if (distinct)
+	{
+		if (int_type(counts.size()) != sample_cnt)
+		{
+			error = true;
+			std::cerr << counts.size() << " distinct of " << sample_cnt << " samples" << std::endl;
+		}
+	}
+	else if (sample_cnt / 50 >= int_type(total_comb))
+	{
+		// every combination within 6 standard deviations of its expected count
+		const double expected = static_cast<double>(sample_cnt) / total_comb;
+		for (auto it = counts.begin(); it != counts.end(); ++it)
+		{
+			if (std::abs(it->second - expected) > 6 * std::sqrt(expected))
+				error = true;
+		}
+		if (int64_t(counts.size()) != total_comb)
+			error = true;
+	}
+
+	std::cout << "test_sample_comb(" << fullset_size << ", " << subset_size << ", " << sample_cnt << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// the strided chunks of all shards and threads must visit every combination exactly once
+// thread chunk counts must differ by at most 1, and the first two chunks of every thread with more than one
+// must lie in both halves of the range, whatever chunk_cnt and thread_cnt are
+template<typename int_type>
+bool test_strided_spread(int_type thread_cnt, uint64_t chunk_cnt)
+{
+	std::vector<std::vector<uint64_t> > visits(static_cast<size_t>(thread_cnt));
+	concurrent_comb::run_strided_range(thread_cnt, int_type(0), int_type(chunk_cnt * 10), chunk_cnt,
+		[&visits](int_type thread_index, int_type start_index, int_type end_index) -> bool
+		{
+			visits[static_cast<size_t>(thread_index)].push_back(static_cast<uint64_t>(start_index / 10));
+			return end_index == start_index + 10;
+		});
+
+	bool error = false;
+	std::vector<int> seen(static_cast<size_t>(chunk_cnt), 0);
+	size_t min_cnt = visits[0].size();
+	size_t max_cnt = visits[0].size();
+	for (size_t t = 0; t < visits.size(); ++t)
+	{
+		min_cnt = (std::min)(min_cnt, visits[t].size());
+		max_cnt = (std::max)(max_cnt, visits[t].size());
+		for (size_t i = 0; i < visits[t].size(); ++i)
+			++seen[static_cast<size_t>(visits[t][i])];
+		if (visits[t].size() > 1 && !(visits[t][0] < chunk_cnt / 2 && visits[t][1] >= chunk_cnt / 2))
+			error = true;
+	}
+	if (max_cnt > min_cnt + 1 || std::count(seen.begin(), seen.end(), 1) != int(chunk_cnt))
+		error = true;
+	std::cout << "strided spread of " << chunk_cnt << " chunks over " << thread_cnt << " thread(s) " << ((error) ? "failed" : "passed") << std::endl;
+	return !error;
+}
+
+template<typename int_type>
+bool test_strided_comb(int_type thread_cnt, int_type cpu_cnt, uint32_t fullset_size, uint32_t subset_size, uint64_t chunk_cnt)
+{
+	std::cout << "test_strided_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ", " << chunk_cnt << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	std::atomic<uint64_t> count(0);
+	std::atomic<uint64_t> checksum(0);
+	bool error = false;
+	auto hash = [](const std::vector<uint32_t>& cont)
+	{
+		uint64_t h = 1469598103934665603ULL;
+		for (size_t i = 0; i < cont.size(); ++i)
+			h = (h ^ cont[i]) * 1099511628211ULL;
+		return h;
+	};
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		if (!concurrent_comb::compute_all_comb_strided_shard(cpu_index, cpu_cnt, thread_cnt, chunk_cnt, subset_size, fullset,
+			[&count, &checksum, &hash](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+			{
+				++count;
+				checksum += hash(cont);
+				return true;
+			},
+			[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error << std::endl; }))
+			error = true;
+	}
+
+	uint64_t expected_count = 0;
+	uint64_t expected_checksum = 0;
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	do
+	{
+		++expected_count;
+		expected_checksum += hash(subset);
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end()));
+	if (count != expected_count || checksum != expected_checksum)
+	{
+		error = true;
+		std::cerr << "visited " << count << " of " << expected_count << " combinations" << std::endl;
+	}
+
+	std::cout << "test_strided_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ", " << chunk_cnt << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// the report must account for every item and sample
+template<typename int_type>
+bool test_instrumented_comb(int_type thread_cnt, uint32_t fullset_size, uint32_t subset_size, uint32_t sample_every)
+{
+	std::cout << "test_instrumented_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << sample_every << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	concurrent_comb::instrument_options options;
+	options.sample_every = sample_every;
+	concurrent_comb::run_report report;
+	bool error = !concurrent_comb::compute_all_comb_instrumented(thread_cnt, subset_size, fullset,
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+		{
+			volatile uint64_t sink = 0;
+			for (size_t i = 0; i < cont.size(); ++i)
+				sink += cont[i];
+			return true;
+		},
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error << std::endl; },
+		options, report);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	int_type items = 0;
+	uint64_t samples = 0;
+	for (size_t i = 0; i < report.threads.size(); ++i)
+	{
+		items += int_type(report.threads[i].items);
+		samples += report.threads[i].items / sample_every;
+		if (report.threads[i].finish_ms < report.threads[i].start_ms)
+			error = true;
+	}
+	if (items != total_comb || samples != report.callback_ns.count || int_type(report.threads.size()) != (std::min)(thread_cnt, total_comb))
+	{
+		error = true;
+		std::cerr << "report has " << items << " items and " << report.callback_ns.count << " samples in " << report.threads.size() << " threads" << std::endl;
+	}
+	if (report.callback_ns.percentile(50.0) > report.callback_ns.percentile(99.0) || report.callback_ns.percentile(99.0) > report.callback_ns.max_ns)
+		error = true;
+	std::cout << report.to_string();
+
+	std::cout << "test_instrumented_comb(" << thread_cnt << ", " << fullset_size << ", " << subset_size << ", " << sample_every << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// counts the spans by name and the items of the "callbacks" spans of a trace, which must be valid JSON
+inline bool parse_trace_json(const concurrent_trace::run_trace& trace, std::map<std::string, size_t>& span_cnt, uint64_t& callback_items)
+{
+	concurrent_shard::json_value root;
+	std::string error;
+	if (!concurrent_shard::json_parser(trace.to_json()).parse(root, error))
+	{
+		std::cerr << error << std::endl;
+		return false;
+	}
+	const concurrent_shard::json_value* events = root.find("traceEvents");
+	if (events == nullptr || events->kind != concurrent_shard::json_value::array_kind)
+		return false;
+	for (size_t i = 0; i < events->items.size(); ++i)
+	{
+		const concurrent_shard::json_value& e = events->items[i];
+		const concurrent_shard::json_value* name = e.find("name");
+		const concurrent_shard::json_value* ph = e.find("ph");
+		if (name == nullptr || ph == nullptr || e.find("tid") == nullptr)
+			return false;
+		if (ph->text != "X")
+			continue;
+		if (e.find("ts") == nullptr || e.find("dur") == nullptr)
+			return false;
+		++span_cnt[name->text];
+		const concurrent_shard::json_value* args = e.find("args");
+		if (name->text == "callbacks" && args != nullptr && args->find("items") != nullptr)
+			callback_items += std::strtoull(args->find("items")->text.c_str(), nullptr, 10);
+	}
+	return true;
+}
+
+// every shard of a traced run must visit its combinations once, and its trace must account for every chunk and item
+template<typename int_type>
+bool test_traced_comb(int_type thread_cnt, int_type cpu_cnt, uint32_t fullset_size, uint32_t subset_size, uint64_t chunks_per_thread)
+{
+	std::cout << "test_traced_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ", " << chunks_per_thread << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	concurrent_trace::trace_options options;
+	options.chunks_per_thread = chunks_per_thread;
+	options.batch_items = 7;
+	bool error = false;
+	std::map<std::vector<uint32_t>, int> all;
+	uint64_t steals = 0;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		std::vector<std::map<std::vector<uint32_t>, int> > seen(static_cast<size_t>(thread_cnt));
+		concurrent_trace::run_trace trace;
+		if (!concurrent_trace::compute_all_comb_traced_shard(cpu_index, cpu_cnt, thread_cnt, subset_size, fullset,
+			[&seen](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+			{
+				++seen[thread_index][cont];
+				return true;
+			},
+			[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error << std::endl; },
+			options, trace))
+		{
+			error = true;
+			continue;
+		}
+
+		uint64_t items = 0;
+		for (size_t t = 0; t < seen.size(); ++t)
+		{
+			for (std::map<std::vector<uint32_t>, int>::const_iterator it = seen[t].begin(); it != seen[t].end(); ++it)
+			{
+				all[it->first] += it->second;
+				items += it->second;
+			}
+		}
+		std::map<std::string, size_t> span_cnt;
+		uint64_t callback_items = 0;
+		if (!parse_trace_json(trace, span_cnt, callback_items) || trace.process_id != int(cpu_index) || trace.dropped() != 0)
+		{
+			error = true;
+			std::cerr << "shard " << cpu_index << " trace is not valid" << std::endl;
+		}
+		if (callback_items != items || span_cnt["chunk"] != span_cnt["unrank"] || (items > 0 && span_cnt["chunk"] == 0)
+			|| span_cnt["join"] != ((items > 0) ? 1 : 0) || span_cnt["chunk"] > trace.threads.size() * chunks_per_thread)
+		{
+			error = true;
+			std::cerr << "shard " << cpu_index << " trace has " << span_cnt["chunk"] << " chunks, " << span_cnt["join"] << " joins and " << callback_items << " of " << items << " items" << std::endl;
+		}
+		steals += span_cnt["steal"];
+	}
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	if (int_type(all.size()) != total_comb)
+		error = true;
+	for (std::map<std::vector<uint32_t>, int>::const_iterator it = all.begin(); it != all.end(); ++it)
+	{
+		if (it->second != 1)
+			error = true;
+	}
+	std::cout << all.size() << " combinations, " << steals << " steals" << std::endl;
+
+	std::cout << "test_traced_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ", " << chunks_per_thread << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// shards run in child processes must merge to the same bits as compute_all_comb_reduce
+template<typename int_type>
+bool test_process_comb(int_type thread_cnt, int cpu_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_process_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+
+	auto map = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> double
+	{
+		double value = 0.0;
+		for (size_t i = 0; i < cont.size(); ++i)
+			value = value * 0.37 + 1.0 / ((cont[i] + 1) * (i + 1));
+		return value;
+	};
+	auto combine = [](double a, double b) -> double
+	{
+		return a + b;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	double expected = 0.0;
+	if (!concurrent_comb::compute_all_comb_reduce(int_type(1), subset_size, fullset, 0.0, map, combine, expected, err_callback))
+		error = true;
+
+	auto shard = [&](int cpu_index, int shard_cnt, concurrent_shard::shard_channel& channel) -> bool
+	{
+		std::atomic<uint64_t> done(0);
+		auto counting_map = [&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> double
+		{
+			if (++done % 4096 == 0)
+				channel.progress(done, static_cast<uint64_t>(total_comb));
+			return map(thread_index, fullset_cnt, cont);
+		};
+		std::vector<double> chunks;
+		if (!concurrent_comb::compute_all_comb_reduce_shard(int_type(cpu_index), int_type(shard_cnt), thread_cnt, subset_size, fullset, 0.0, counting_map, combine, chunks,
+			[&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& text) { channel.error(text); }))
+			return false;
+
+		channel.progress(done, static_cast<uint64_t>(total_comb));
+		std::string data;
+		concurrent_shard::append_values(data, chunks);
+		return channel.result(data);
+	};
+
+	std::vector<uint64_t> progress(cpu_cnt, 0);
+	auto progress_callback = [&](int cpu_index, uint64_t done, uint64_t total)
+	{
+		progress[cpu_index] = done;
+	};
+	auto shard_err_callback = [](int cpu_index, const std::string& error)
+	{
+		std::cerr << "shard " << cpu_index << ": " << error << std::endl;
+	};
+
+	std::vector<std::string> shard_results;
+	if (!concurrent_shard::run_local_shards(cpu_cnt, shard, shard_results, progress_callback, shard_err_callback))
+		error = true;
+
+	std::vector<double> all_chunks;
+	for (size_t i = 0; i < shard_results.size(); ++i)
+	{
+		if (!concurrent_shard::read_values(shard_results[i], all_chunks))
+			error = true;
+	}
+	if (concurrent_comb::reduce_chunks(all_chunks, 0.0, combine) != expected)
+	{
+		error = true;
+		std::cerr << "run_local_shards merged result differs" << std::endl;
+	}
+	if (std::accumulate(progress.begin(), progress.end(), uint64_t(0)) != static_cast<uint64_t>(total_comb))
+	{
+		error = true;
+		std::cerr << "run_local_shards progress does not add up to " << total_comb << std::endl;
+	}
+
+	std::cout << "test_process_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every combination must be processed once by a pool of lease workers, even when one of them
+// takes a lease and never reports back
+template<typename int_type>
+bool test_lease_comb(int worker_cnt, int thread_cnt, uint32_t fullset_size, uint32_t subset_size)
+{
+	std::cout << "test_lease_comb(" << worker_cnt << ", " << thread_cnt << ", " << fullset_size << ", " << subset_size << ") starting" << std::endl;
+
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_size, subset_size, total_comb);
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	concurrent_comb::split_chunks(total_comb, chunk_size, chunk_cnt);
+
+	bool error = false;
+	// live workers report every few milliseconds, so a 2 second timeout only ever expires the dead worker's lease
+	// even on a loaded machine or under a sanitizer, and the exact count below holds
+	concurrent_shard::lease_coordinator coordinator(chunk_cnt, 2, std::chrono::milliseconds(2000), 1);
+	std::string listen_error;
+	if (!coordinator.listen("127.0.0.1", 0, listen_error))
+	{
+		std::cerr << listen_error << std::endl;
+		return false;
+	}
+
+	bool served = false;
+	std::thread server([&]()
+	{
+		served = coordinator.serve([](const std::string& error) { std::cerr << error << std::endl; });
+	});
+
+	// a worker that dies right after taking a lease
+	{
+		concurrent_shard::lease_client dead;
+		std::string connect_error;
+		uint64_t id = 0, begin = 0, end = 0, wait_ms = 0;
+		if (!dead.connect("127.0.0.1", coordinator.port(), connect_error) || dead.lease(id, begin, end, wait_ms) != concurrent_shard::lease_reply::range)
+			error = true;
+	}
+
+	std::atomic<uint64_t> count(0);
+	std::atomic<uint64_t> checksum(0);
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+	auto node = [&](int worker_index)
+	{
+		auto callback = [&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+		{
+			++count;
+			uint64_t hash = 0;
+			for (size_t i = 0; i < cont.size(); ++i)
+				hash = hash * 1000003 + cont[i];
+			checksum += hash;
+			return true;
+		};
+		auto chunk_worker = [&](int thread_index, uint64_t chunk_begin, uint64_t chunk_end) -> bool
+		{
+			if (worker_index == 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(2)); // a slow node gets its leases split
+			return concurrent_comb::compute_comb_chunks(int_type(thread_index), subset_size, fullset, chunk_begin, chunk_end, callback, err_callback);
+		};
+		if (!concurrent_shard::run_lease_worker("localhost", coordinator.port(), thread_cnt, chunk_worker,
+			[](int thread_index, const std::string& error) { std::cerr << error << std::endl; }))
+			error = true;
+	};
+	std::vector<std::shared_ptr<std::thread> > nodes;
+	for (int i = 0; i < worker_cnt; ++i)
+	{
+		nodes.push_back(std::shared_ptr<std::thread>(new std::thread(node, i)));
+	}
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		nodes[i]->join();
+	}
+	server.join();
+
+	uint64_t expected_checksum = 0;
+	std::vector<uint32_t> cont(subset_size);
+	std::iota(cont.begin(), cont.end(), 0);
+	do
 	{
-		return true;
+		uint64_t hash = 0;
+		for (size_t i = 0; i < cont.size(); ++i)
+			hash = hash * 1000003 + cont[i];
+		expected_checksum += hash;
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), cont.begin(), cont.end()));
+
+	const concurrent_shard::lease_stats& stats = coordinator.stats();
+	if (!served || int_type(count.load()) != total_comb || checksum != expected_checksum || stats.expired == 0)
+	{
+		error = true;
+		std::cerr << "lease_coordinator processed " << count << " of " << total_comb << " combinations, " << stats.expired << " expired leases" << std::endl;
 	}
-};
+	std::cout << "leases:" << stats.leases << ", splits:" << stats.splits << ", expired:" << stats.expired << ", waits:" << stats.waits << std::endl;
 
-template<typename container_type>
-struct error_callback_t
+	std::cout << "test_lease_comb(" << worker_cnt << ", " << thread_cnt << ", " << fullset_size << ", " << subset_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every shard writes its records in place; the file must read back as the next_combination sequence
+template<typename int_type>
+bool test_export_comb(int_type thread_cnt, int_type cpu_cnt, uint32_t fullset_size, uint32_t subset_size, const concurrent_export::export_options& options)
 {
-	void operator()(const int thread_index, const size_t fullset_size, const container_type& cont, const std::string& error)
+	std::cout << "test_export_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ", " << ((options.method == concurrent_export::export_method::mmap_write) ? "mmap" : "pwrite") << ") starting" << std::endl;
+
+	bool error = false;
+	const std::string path = "test_export_comb.bin";
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
 	{
-		std::cerr << error << std::endl;
+		std::string export_error;
+		if (!concurrent_export::export_all_comb_shard(cpu_index, cpu_cnt, thread_cnt, fullset_size, subset_size, path, options, export_error))
+		{
+			error = true;
+			std::cerr << export_error << std::endl;
+		}
 	}
-};
 
-//typedef boost::multiprecision::cpp_int int_type;
-//typedef boost::multiprecision::int128_t int_type;
-typedef int64_t int_type;
+	std::ifstream ifs(path.c_str(), std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	std::remove(path.c_str());
+
+	const uint32_t record_size = concurrent_export::export_record_size(fullset_size, subset_size);
+	std::vector<uint32_t> fullset(fullset_size);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	std::vector<uint32_t> subset(subset_size);
+	std::iota(subset.begin(), subset.end(), 0);
+	std::vector<uint32_t> indices;
+	size_t offset = 0;
+	do
+	{
+		if (offset + record_size > data.size())
+		{
+			error = true;
+			std::cerr << "export file too short: " << data.size() << " bytes" << std::endl;
+			break;
+		}
+		concurrent_export::decode_record(reinterpret_cast<const unsigned char*>(&data[offset]), subset_size, concurrent_export::export_index_bytes(fullset_size), indices);
+		if (indices != subset)
+		{
+			error = true;
+			std::cerr << "wrong record at offset " << offset << std::endl;
+			break;
+		}
+		offset += record_size;
+	} while (stdcomb::next_combination(fullset.begin(), fullset.end(), subset.begin(), subset.end()));
+	if (!error && offset != data.size())
+	{
+		error = true;
+		std::cerr << "export file has " << data.size() << " bytes instead of " << offset << std::endl;
+	}
+
+	std::cout << "test_export_comb(" << thread_cnt << ", " << cpu_cnt << ", " << fullset_size << ", " << subset_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+#endif
 
 int main(int argc, char* argv[])
 {
 	//benchmark_comb();
 
+	//benchmark_comb_prefix();
+
+	//benchmark_comb_generator();
+
+	//benchmark_comb_allocations();
+
+	//benchmark_comb_affinity();
+
 	//unit_test();
 
 	//unit_test_threaded();
@@ -289,6 +2112,52 @@ int main(int argc, char* argv[])
 
 	//unit_test_threaded_shard();
 
+	//unit_test_threaded_prune();
+
+	//unit_test_threaded_dfs();
+
+	//unit_test_threaded_prefix_shard();
+
+	//unit_test_find_first();
+
+	//unit_test_ordered();
+
+	//unit_test_pipeline();
+
+	//unit_test_reduce();
+
+	//unit_test_async();
+
+	//unit_test_generator();
+
+	//unit_test_range();
+
+	//unit_test_factory();
+
+	//unit_test_affinity();
+
+	//unit_test_auto();
+
+	//unit_test_processes();
+
+	//unit_test_lease();
+
+	//unit_test_weighted();
+
+	//unit_test_shard_plan();
+
+	//unit_test_export();
+
+	//unit_test_stream();
+
+	//unit_test_sample();
+
+	//unit_test_strided();
+
+	//unit_test_instrumented();
+
+	//unit_test_trace();
+
 	//unit_test_comb_by_idx();
 
 	//usage_of_next_comb();
@@ -348,6 +2217,147 @@ void benchmark_comb()
 	stopwatch.stop();
 }
 
+void benchmark_comb_prefix()
+{
+	std::vector<uint32_t> fullset_vec(24);
+	std::iota(fullset_vec.begin(), fullset_vec.end(), 0);
+	uint32_t subset = 12;
+
+	timer stopwatch;
+	typedef prefix_cache_callback_t<decltype(fullset_vec)> callback_t;
+	typedef error_callback_t<decltype(fullset_vec)> err_callback_t;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::ostringstream oss;
+		oss << "index " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_comb::compute_all_comb(thread_cnt, subset, fullset_vec, callback_t(), err_callback_t());
+		stopwatch.stop();
+
+		oss.str("");
+		oss << "prefix " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_comb::compute_all_comb_prefix(thread_cnt, subset, fullset_vec, callback_t(), err_callback_t());
+		stopwatch.stop();
+	}
+}
+
+void benchmark_comb_generator()
+{
+	std::vector<uint32_t> fullset_vec(24);
+	std::iota(fullset_vec.begin(), fullset_vec.end(), 0);
+	uint32_t subset = 12;
+
+	timer stopwatch;
+	typedef checksum_callback_t<decltype(fullset_vec)> callback_t;
+	typedef error_callback_t<decltype(fullset_vec)> err_callback_t;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::ostringstream oss;
+		oss << "callback " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_comb::compute_all_comb(thread_cnt, subset, fullset_vec, callback_t(), err_callback_t());
+		stopwatch.stop();
+
+		oss.str("");
+		oss << "generator " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_comb::compute_all_comb_generators(thread_cnt, subset, fullset_vec, 
+			[](const int thread_index, concurrent_comb::comb_generator<std::vector<uint32_t>, int_type>& gen)
+			{
+				uint64_t sum = 0;
+				for (const auto& cont : gen)
+				{
+					sum += cont[0] ^ cont[cont.size() - 1];
+					if (sum == 1)
+						break;
+				}
+			}, err_callback_t());
+		stopwatch.stop();
+	}
+}
+
+void benchmark_comb_allocations()
+{
+	std::vector<uint32_t> fullset_vec(24);
+	std::iota(fullset_vec.begin(), fullset_vec.end(), 0);
+	uint32_t subset = 12;
+
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(fullset_vec.size(), subset, total_comb);
+
+	timer stopwatch;
+	typedef allocating_callback_t<decltype(fullset_vec)> callback_t;
+	typedef error_callback_t<decltype(fullset_vec)> err_callback_t;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::ostringstream oss;
+		oss << "copied " << thread_cnt << " thread(s)";
+		uint64_t allocations = allocation_cnt();
+		stopwatch.start(oss.str());
+		concurrent_comb::compute_all_comb(thread_cnt, subset, fullset_vec, callback_t(), err_callback_t());
+		stopwatch.stop();
+		allocations = allocation_cnt() - allocations;
+		std::cout << "allocations: " << allocations << ", per combination: " << double(allocations) / total_comb << std::endl;
+
+		oss.str("");
+		oss << "factory " << thread_cnt << " thread(s)";
+		allocations = allocation_cnt();
+		stopwatch.start(oss.str());
+		concurrent_comb::compute_all_comb_factory(thread_cnt, subset, fullset_vec, 
+			[subset](const int thread_index) { return arena_callback_t<std::vector<uint32_t> >(subset); }, err_callback_t());
+		stopwatch.stop();
+		allocations = allocation_cnt() - allocations;
+		std::cout << "allocations: " << allocations << ", per combination: " << double(allocations) / total_comb << std::endl;
+
+		// the arena and the empty callback must not allocate per combination: the first of two shards of the same
+		// container unranks the same thread starts as the whole run, so it allocates as much with half the combinations
+		auto count_allocations = [&](int_type cpu_cnt, bool arena) -> uint64_t
+		{
+			const uint64_t before = allocation_cnt();
+			if (arena)
+				concurrent_comb::compute_all_comb_factory_shard(int_type(0), cpu_cnt, thread_cnt, subset, fullset_vec,
+					[subset](const int thread_index) { return arena_callback_t<std::vector<uint32_t> >(subset); }, err_callback_t());
+			else
+				concurrent_comb::compute_all_comb_shard(int_type(0), cpu_cnt, thread_cnt, subset, fullset_vec, empty_callback_t<std::vector<uint32_t> >(), err_callback_t());
+			return allocation_cnt() - before;
+		};
+		const bool arena_zero = count_allocations(1, true) == count_allocations(2, true);
+		const bool empty_zero = count_allocations(1, false) == count_allocations(2, false);
+		std::cout << "zero allocations per combination with " << thread_cnt << " thread(s): " << ((arena_zero && empty_zero) ? "passed" : "failed") << std::endl;
+	}
+}
+
+// scaling up to every hardware thread, with threads left to the OS and pinned compactly or scattered over NUMA nodes
+void benchmark_comb_affinity()
+{
+	std::vector<uint32_t> fullset_vec(28);
+	std::iota(fullset_vec.begin(), fullset_vec.end(), 0);
+	uint32_t subset = 14;
+
+	timer stopwatch;
+	typedef empty_callback_t<decltype(fullset_vec)> callback_t;
+	typedef error_callback_t<decltype(fullset_vec)> err_callback_t;
+
+	const char* names[] = { "none", "compact", "scatter" };
+	const concurrent_comb::affinity_kind kinds[] = { concurrent_comb::affinity_kind::none, concurrent_comb::affinity_kind::compact, concurrent_comb::affinity_kind::scatter };
+	const int_type max_thread_cnt = (std::max)(1u, std::thread::hardware_concurrency());
+	for (int_type thread_cnt = 1; thread_cnt <= max_thread_cnt; thread_cnt = (thread_cnt < 4) ? thread_cnt + 1 : thread_cnt * 2)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			std::ostringstream oss;
+			oss << names[k] << " " << thread_cnt << " thread(s)";
+			stopwatch.start(oss.str());
+			concurrent_comb::compute_all_comb_affinity(thread_cnt, subset, fullset_vec, callback_t(), err_callback_t(), concurrent_comb::affinity_policy(kinds[k]));
+			stopwatch.stop();
+		}
+	}
+}
+
 void test_find_comb(uint32_t fullset, uint32_t subset)
 {
 	std::cout << "test_find_comb(" << fullset << "," << subset << ") starting" << std::endl;
@@ -445,6 +2455,399 @@ void unit_test_threaded_shard()
 	//test_threaded_comb_shard(thread_cnt, 2, 1); // should fail
 }
 
+void unit_test_threaded_prune()
+{
+	int_type thread_cnt = 4;
+	test_threaded_comb_prune(thread_cnt, 5, 3);
+	test_threaded_comb_prune(thread_cnt, 6, 3);
+	test_threaded_comb_prune(thread_cnt, 7, 4);
+	test_threaded_comb_prune(thread_cnt, 8, 4);
+	test_threaded_comb_prune(thread_cnt, 9, 5);
+	test_threaded_comb_prune(thread_cnt, 10, 5);
+	test_threaded_comb_prune(thread_cnt, 16, 6);
+}
+
+void unit_test_threaded_dfs()
+{
+	int_type thread_cnt = 4;
+	int_type cpu_cnt = 1;
+	test_threaded_comb_dfs(thread_cnt, cpu_cnt, 5, 3);
+	test_threaded_comb_dfs(thread_cnt, cpu_cnt, 10, 5);
+	test_threaded_comb_dfs(thread_cnt, cpu_cnt, 20, 6);
+	cpu_cnt = 3;
+	test_threaded_comb_dfs(thread_cnt, cpu_cnt, 6, 2);
+	test_threaded_comb_dfs(thread_cnt, cpu_cnt, 12, 4);
+	test_threaded_comb_dfs(thread_cnt, cpu_cnt, 18, 9);
+}
+
+void unit_test_threaded_prefix_shard()
+{
+	int_type thread_cnt = 2;
+	test_threaded_comb_prefix_shard(thread_cnt, 5, 3);
+	test_threaded_comb_prefix_shard(thread_cnt, 6, 3);
+	test_threaded_comb_prefix_shard(thread_cnt, 7, 4);
+	test_threaded_comb_prefix_shard(thread_cnt, 8, 4);
+	test_threaded_comb_prefix_shard(thread_cnt, 9, 5);
+	test_threaded_comb_prefix_shard(thread_cnt, 10, 5);
+	test_threaded_comb_prefix_shard(thread_cnt, 20, 6);
+}
+
+void unit_test_find_first()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_find_first_comb(thread_cnt, 5, 3, 2);
+		test_find_first_comb(thread_cnt, 12, 6, 1);
+		test_find_first_comb(thread_cnt, 20, 8, 3);
+		test_find_first_comb(thread_cnt, 20, 8, 9);
+	}
+}
+
+void unit_test_ordered()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_ordered_comb(thread_cnt, 5, 3);
+		test_ordered_comb(thread_cnt, 5, 5);
+		test_ordered_comb(thread_cnt, 20, 8);
+		test_ordered_comb(thread_cnt, 24, 6);
+	}
+}
+
+void unit_test_pipeline()
+{
+	for (int_type gen_cnt = 1; gen_cnt <= 3; ++gen_cnt)
+	{
+		for (int_type eval_cnt = 1; eval_cnt <= 3; ++eval_cnt)
+		{
+			test_pipeline_comb(gen_cnt, eval_cnt, 5, 3);
+			test_pipeline_comb(gen_cnt, eval_cnt, 20, 6);
+		}
+	}
+}
+
+void unit_test_reduce()
+{
+	test_reduce_comb(int_type(8), 5, 3);
+	test_reduce_comb(int_type(8), 20, 8);
+	test_reduce_comb(int_type(8), 24, 6);
+}
+
+void unit_test_async()
+{
+	concurrent_comb::thread_pool pool(4);
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_async_comb(thread_cnt, 5, 3, pool);
+		test_async_comb(thread_cnt, 20, 8, pool);
+		test_async_comb(thread_cnt, 20, 8, concurrent_comb::thread_pool::instance());
+	}
+}
+
+void unit_test_generator()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_generator_comb(thread_cnt, 5, 3);
+		test_generator_comb(thread_cnt, 5, 5);
+		test_generator_comb(thread_cnt, 20, 8);
+	}
+}
+
+void unit_test_range()
+{
+	test_range_comb(5, 3, int_type(1));
+	test_range_comb(5, 5, int_type(1));
+	test_range_comb(12, 6, int_type(50));
+	test_range_comb(20, 8, int_type(4096));
+}
+
+void unit_test_factory()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_factory_comb(thread_cnt, 5, 3);
+		test_factory_comb(thread_cnt, 5, 5);
+		test_factory_comb(thread_cnt, 20, 8);
+	}
+}
+
+void unit_test_affinity()
+{
+	std::vector<int> cpus = concurrent_comb::parse_cpu_list("0-3,8,10-11");
+	std::vector<int> expected = { 0, 1, 2, 3, 8, 10, 11 };
+	std::cout << "parse_cpu_list " << ((cpus == expected) ? "passed" : "failed") << std::endl;
+
+	const std::vector<int> available = concurrent_comb::affinity_cpu_order(concurrent_comb::affinity_policy(concurrent_comb::affinity_kind::compact));
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_affinity_comb(thread_cnt, 20, 8, concurrent_comb::affinity_policy());
+		test_affinity_comb(thread_cnt, 20, 8, concurrent_comb::affinity_policy(concurrent_comb::affinity_kind::compact));
+		test_affinity_comb(thread_cnt, 20, 8, concurrent_comb::affinity_policy(concurrent_comb::affinity_kind::scatter));
+		test_affinity_comb(thread_cnt, 20, 8, concurrent_comb::affinity_policy(concurrent_comb::affinity_kind::cpu_list, std::vector<int>(1, available.back())));
+	}
+
+	// compact and scatter must stay within the CPUs this process may run on
+	const std::vector<int> allowed = concurrent_comb::allowed_cpus();
+	bool subset = true;
+	const std::vector<int> scattered = concurrent_comb::affinity_cpu_order(concurrent_comb::affinity_policy(concurrent_comb::affinity_kind::scatter));
+	for (size_t i = 0; i < scattered.size(); ++i)
+	{
+		if (!allowed.empty() && !std::binary_search(allowed.begin(), allowed.end(), scattered[i]))
+			subset = false;
+	}
+	for (size_t i = 0; i < available.size(); ++i)
+	{
+		if (!allowed.empty() && !std::binary_search(allowed.begin(), allowed.end(), available[i]))
+			subset = false;
+	}
+	std::cout << "affinity_cpu_order within allowed_cpus " << ((subset) ? "passed" : "failed") << std::endl;
+
+#if defined(__linux__)
+	// a CPU that cannot be pinned is reported, and the work still runs unpinned
+	std::vector<uint32_t> fullset(20);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	int_type total_comb = 0;
+	concurrent_comb::compute_total_comb(20, 8, total_comb);
+	std::atomic<uint64_t> count(0);
+	std::atomic<int> reported(0);
+	auto callback = [&count](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		++count;
+		return true;
+	};
+	auto err_callback = [&reported](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+		++reported;
+	};
+	const bool ok = concurrent_comb::compute_all_comb_affinity(int_type(2), 8, fullset, callback, err_callback,
+		concurrent_comb::affinity_policy(concurrent_comb::affinity_kind::cpu_list, std::vector<int>(1, 100000)));
+	std::cout << "pin failure reported " << ((ok && reported == 2 && int_type(count) == total_comb) ? "passed" : "failed") << std::endl;
+#endif
+}
+
+void unit_test_auto()
+{
+	std::cout << "available_cpu_cnt:" << concurrent_comb::available_cpu_cnt() << std::endl;
+	test_auto_comb<int_type>(5, 3);
+	test_auto_comb<int_type>(5, 5);
+	test_auto_comb<int_type>(20, 8);
+	test_auto_comb<int_type>(28, 10);
+
+	// an expensive callback must end the warm-up after an item or two, not after 16
+	concurrent_comb::auto_plan plan;
+	std::atomic<int> count(0);
+	const bool done = concurrent_comb::compute_all_comb_auto<int_type>(3, std::vector<uint32_t>{ 0, 1, 2, 3, 4, 5 },
+		[&count](const int /*thread_index*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& /*cont*/) -> bool
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			++count;
+			return true;
+		},
+		[](const int /*thread_index*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& /*cont*/, const std::string& error) { std::cerr << error << std::endl; }, plan);
+	std::cout << "short warm-up of " << plan.warmup_cnt << " item(s) " << ((done && count == 20 && plan.warmup_cnt <= 2) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_processes()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	for (int cpu_cnt = 1; cpu_cnt <= 4; ++cpu_cnt)
+	{
+		test_process_comb(int_type(1), cpu_cnt, 5, 3);
+		test_process_comb(int_type(2), cpu_cnt, 20, 8);
+		test_process_comb(int_type(3), cpu_cnt, 24, 10);
+	}
+
+	// a failing shard must be reported, not merged silently
+	std::vector<std::string> shard_results;
+	auto ignore_progress = [](int, uint64_t, uint64_t) {};
+	auto print_error = [](int cpu_index, const std::string& error) { std::cerr << "expected error from shard " << cpu_index << ": " << error << std::endl; };
+	const bool failed = !concurrent_shard::run_local_shards(3, [](int cpu_index, int, concurrent_shard::shard_channel& channel) { return cpu_index != 1 || !channel.error("Error: shard 1 gave up"); }, shard_results, ignore_progress, print_error);
+	std::cout << "shard failures " << (failed ? "passed" : "failed") << std::endl;
+#endif
+}
+
+void unit_test_lease()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	test_lease_comb<int_type>(1, 1, 5, 3);
+	test_lease_comb<int_type>(2, 2, 20, 8);
+	test_lease_comb<int_type>(3, 2, 24, 10);
+#endif
+
+	// a chunk range whose callback throws must not count as done
+	std::vector<uint32_t> fullset(20);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	uint64_t calls = 0;
+	auto throwing_callback = [&calls](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+	{
+		if (++calls == 100)
+			throw std::runtime_error("callback failed");
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) -> void
+	{
+	};
+	const bool done = concurrent_comb::compute_comb_chunks(int_type(0), 8, fullset, 0, 1, throwing_callback, err_callback);
+	std::cout << "compute_comb_chunks failed on exception " << ((!done) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_weighted()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_weighted_comb(thread_cnt, 5, 3, std::vector<uint32_t>{ 1 });
+		test_weighted_comb(thread_cnt, 16, 8, std::vector<uint32_t>{ 16, 96 });
+		test_weighted_comb(thread_cnt, 16, 8, std::vector<uint32_t>{ 1, 2, 3, 4 });
+		test_weighted_comb(thread_cnt, 16, 8, std::vector<uint32_t>{ 0, 5, 0, 1 });
+	}
+
+	// a calibration run on one node, then weights for a fleet where the other node is 6 times faster
+	std::vector<uint32_t> fullset(28);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	double items_per_sec = 0.0;
+	concurrent_comb::measure_comb_throughput(int_type(2), 14, fullset,
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) { return true; },
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error; },
+		int_type(1000000), items_per_sec);
+	const std::vector<uint32_t> weights = concurrent_comb::throughput_weights(std::vector<double>{ items_per_sec, 6 * items_per_sec, 0.0 });
+	std::cout << "items_per_sec:" << items_per_sec << ", weights:" << weights[0] << " " << weights[1] << " " << weights[2] << std::endl;
+	std::cout << "throughput_weights " << ((weights[1] / 6 == weights[0] && weights[2] == 0) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_shard_plan()
+{
+	test_shard_plan_comb<int_type>(5, 3, std::vector<uint32_t>{ 1 }, 1);
+	test_shard_plan_comb<int_type>(5, 5, std::vector<uint32_t>{ 1, 1 }, 1);
+	test_shard_plan_comb<int_type>(16, 8, std::vector<uint32_t>{ 16, 96 }, 3);
+	test_shard_plan_comb<int_type>(20, 6, std::vector<uint32_t>{ 1, 0, 2 }, 2);
+}
+
+void unit_test_export()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	concurrent_export::export_options mmap_options;
+	concurrent_export::export_options pwrite_options;
+	pwrite_options.method = concurrent_export::export_method::pwrite_write;
+	pwrite_options.staging_bytes = 100; // many flushes per thread
+	pwrite_options.huge_pages = true;
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_export_comb(thread_cnt, int_type(1), 5, 5, mmap_options);
+		test_export_comb(thread_cnt, int_type(1), 16, 8, mmap_options);
+		test_export_comb(thread_cnt, int_type(3), 20, 6, mmap_options);
+		test_export_comb(thread_cnt, int_type(1), 16, 8, pwrite_options);
+		test_export_comb(thread_cnt, int_type(3), 300, 2, pwrite_options); // 2 byte indices
+	}
+#endif
+}
+
+void unit_test_stream()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_stream_comb(thread_cnt, int_type(1), 5, 5, 1 << 16, false);
+		test_stream_comb(thread_cnt, int_type(1), 16, 8, 1 << 16, false);
+		test_stream_comb(thread_cnt, int_type(3), 20, 6, 1000, false);
+		test_stream_comb(thread_cnt, int_type(1), 16, 8, 1000, true);
+		test_stream_comb(thread_cnt, int_type(2), 300, 2, 777, true);
+	}
+}
+
+void unit_test_sample()
+{
+	test_sample_comb<int_type>(5, 5, 10, 1, false);
+	test_sample_comb<int_type>(6, 3, 20 * 200, 7, false);
+	test_sample_comb<int_type>(30, 10, 1000, 42, false);
+	test_sample_comb<int_type>(6, 3, 20, 3, true);
+	test_sample_comb<int_type>(16, 8, 500, 9, true);
+	test_sample_comb<int_type>(28, 12, 1000, 11, true);
+
+	// more distinct samples than combinations must be refused
+	const bool refused = !concurrent_comb::sample_comb_distinct(int_type(2), 2, std::vector<uint32_t>{ 0, 1, 2 }, int_type(4), 1,
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) { return true; },
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cout << "expected " << error << std::endl; });
+	std::cout << "sample_comb_distinct bound " << (refused ? "passed" : "failed") << std::endl;
+
+	// a callback that throws something other than std::exception must still be reported
+	std::atomic<int> reported(0);
+	concurrent_comb::sample_comb(int_type(2), 2, std::vector<uint32_t>{ 0, 1, 2, 3 }, int_type(10), 1,
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool { throw 1; },
+		[&reported](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { ++reported; });
+	std::cout << "sample_comb reports unknown exceptions " << ((reported == 2) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_strided()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_strided_comb(thread_cnt, int_type(1), 5, 5, 16);
+		test_strided_comb(thread_cnt, int_type(1), 10, 4, 1);
+		test_strided_comb(thread_cnt, int_type(1), 16, 8, 100);
+		test_strided_comb(thread_cnt, int_type(3), 20, 6, 64);
+		test_strided_comb(thread_cnt, int_type(2), 12, 5, 1000000);
+	}
+	for (int_type thread_cnt = 2; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_strided_spread(thread_cnt, 5);
+		test_strided_spread(thread_cnt, 16);
+		test_strided_spread(thread_cnt, 33);
+		test_strided_spread(thread_cnt, thread_cnt * 16);
+	}
+
+	// stopped after half of the combinations, a strided run has seen the leading elements 0 to 6 (7 leads only the
+	// last combination), a block run only 0 and 1
+	std::vector<uint32_t> fullset(10);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	std::set<uint32_t> leading;
+	int visited = 0;
+	concurrent_comb::compute_all_comb_strided(int_type(1), 64, 3, fullset,
+		[&](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) -> bool
+		{
+			leading.insert(cont[0]);
+			return ++visited < 60;
+		},
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error << std::endl; });
+	std::cout << "early coverage " << ((visited == 60 && leading.size() == 7) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_instrumented()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_instrumented_comb(thread_cnt, 5, 5, 1);
+		test_instrumented_comb(thread_cnt, 16, 8, 1);
+		test_instrumented_comb(thread_cnt, 20, 10, 64);
+	}
+}
+
+void unit_test_trace()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_traced_comb(thread_cnt, int_type(1), 5, 5, 16);
+		test_traced_comb(thread_cnt, int_type(1), 10, 4, 1);
+		test_traced_comb(thread_cnt, int_type(3), 14, 6, 16);
+	}
+
+	// a full buffer drops events instead of growing, and a stopping callback ends only its thread
+	std::vector<uint32_t> fullset(14);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	concurrent_trace::trace_options options;
+	options.max_events_per_thread = 4;
+	concurrent_trace::run_trace trace;
+	concurrent_trace::compute_all_comb_traced(int_type(2), 6, fullset,
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont) { return cont[0] != 3; },
+		[](const int thread_index, const size_t fullset_cnt, const std::vector<uint32_t>& cont, const std::string& error) { std::cerr << error << std::endl; },
+		options, trace);
+	std::cout << "bounded trace " << ((trace.threads.size() == 2 && trace.threads[0].events.size() == 4 && trace.dropped() > 0) ? "passed" : "failed") << std::endl;
+	std::string error;
+	if (trace.write_json("trace_comb.json", error))
+		std::cout << "open trace_comb.json in chrome://tracing or https://ui.perfetto.dev" << std::endl;
+	else
+		std::cerr << error << std::endl;
+}
+
 void unit_test_comb_by_idx()
 {
 	uint64_t index_to_find = 0;
@@ -1,20 +1,60 @@
 #include <iostream>
+#include <cmath>
 #include <numeric>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <stdexcept>
 //#include <intrin.h>
 //#include <boost/multiprecision/cpp_int.hpp>
 #include "../permcomb/concurrent_perm.h"
+#include "../permcomb/shard_runner.h"
+#include "../permcomb/shard_plan.h"
+#include "../permcomb/arrangement_export.h"
+#include "../permcomb/arrangement_stream.h"
+#include "../permcomb/run_trace.h"
+//#define PERMCOMB_PERF_COUNTERS // print hardware counters after every timing, Linux only
 #include "../common/timer.h"
+#include "../common/allocation_counter.h"
 
 void test_find_perm(uint32_t PermSetSize);
 void unit_test();
 void unit_test_threaded();
 void unit_test_threaded_predicate();
 void unit_test_threaded_shard();
+void unit_test_threaded_prune();
+void unit_test_threaded_dfs();
+void unit_test_threaded_prefix_shard();
+void unit_test_find_first();
+void unit_test_ordered();
+void unit_test_pipeline();
+void unit_test_reduce();
+void unit_test_async();
+void unit_test_generator();
+void unit_test_range();
+void unit_test_factory();
+void unit_test_affinity();
+void unit_test_auto();
+void unit_test_processes();
+void unit_test_lease();
+void unit_test_weighted();
+void unit_test_shard_plan();
+void unit_test_export();
+void unit_test_stream();
+void unit_test_sample();
+void unit_test_strided();
+void unit_test_instrumented();
+void unit_test_trace();
 void unit_test_perm_by_idx();
 void usage_of_perm_by_idx();
 void usage_of_next_perm();
 void benchmark_perm();
+void benchmark_perm_prefix();
+void benchmark_perm_generator();
+void benchmark_perm_allocations();
+void benchmark_perm_affinity();
 
 template<typename T>
 bool compare_vec(T& results1, T& results2)
@@ -211,33 +251,1814 @@ bool test_threaded_perm_shard(int_type thread_cnt, uint32_t set_size)
 	return true;
 }
 
+template<typename int_type>
+bool test_threaded_perm_prefix_shard(int_type thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_threaded_perm_prefix_shard(" << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::vector<std::vector< std::vector<char> > > vecvecvec((size_t)thread_cnt);
+
+	int_type cpu_cnt = 4;
+	std::vector<std::vector<std::vector< std::vector<char> > > > vecvecvecvec;
+	for (int_type i = 0; i < cpu_cnt; ++i)
+		vecvecvecvec.push_back(vecvecvec);
+
+	for (int_type i = 0; i < cpu_cnt; ++i)
+	{
+		int_type cpu_index = i;
+		int cpu_index_n = static_cast<int>(cpu_index);
+		concurrent_perm::compute_all_perm_prefix_shard(cpu_index, cpu_cnt, thread_cnt, results,
+			[&vecvecvecvec, cpu_index_n](const int thread_index, const std::vector<char>& cont) -> bool
+		{
+			vecvecvecvec[cpu_index_n][thread_index].push_back(cont);
+			return true;
+		},
+        	[](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+		{
+            std::cerr << error;
+		});
+	}
+
+	std::vector< std::vector<char> > vecvec;
+	do
+	{
+		vecvec.push_back(std::vector<char>(results.begin(), results.end()));
+	} while (std::next_permutation(results.begin(), results.end()));
+
+	// compare results
+	size_t cnt = 0;
+	bool error = false;
+	for (size_t k = 0; k < vecvecvecvec.size(); ++k)
+	{
+		for (size_t i = 0; i < vecvecvecvec[k].size(); ++i)
+		{
+			for (size_t j = 0; j < vecvecvecvec[k][i].size(); ++j, ++cnt)
+			{
+				if (!compare_vec(vecvec[cnt], vecvecvecvec[k][i][j]))
+				{
+					error = true;
+					std::cerr << "Perm at " << cnt << " is not the same!" << std::endl;
+
+					display(vecvec[cnt]);
+					display(vecvecvecvec[k][i][j]);
+
+					return false;
+				}
+			}
+		}
+	}
+	std::cout << "test_threaded_perm_prefix_shard(" << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return true;
+}
+
+// prune at the first descent: every permutation sharing that prefix is skipped
+template<typename T>
+uint32_t first_descent_depth(const T& cont)
+{
+	for (size_t i = 1; i < cont.size(); ++i)
+	{
+		if (cont[i] < cont[i - 1])
+			return static_cast<uint32_t>(i + 1);
+	}
+	return static_cast<uint32_t>(cont.size());
+}
+
+template<typename int_type>
+bool test_threaded_perm_prune(int_type thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_threaded_perm_prune(" << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::vector<std::vector< std::vector<char> > > vecvecvec((size_t)thread_cnt);
+
+	concurrent_perm::compute_all_perm_prune(thread_cnt, results,
+		[&vecvecvec](const int thread_index, const std::vector<char>& cont, uint32_t& prune_depth) -> bool
+	{
+		vecvecvec[thread_index].push_back(cont);
+		prune_depth = first_descent_depth(cont);
+		return true;
+	},
+		[](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	});
+
+	// same pruning done sequentially: skip every permutation starting with the last pruned prefix,
+	// a thread cannot see the prunes of the thread before it, so pruning restarts at each thread's first one
+	std::vector< std::vector<char> > thread_starts;
+	for (size_t i = 0; i < vecvecvec.size(); ++i)
+	{
+		if (!vecvecvec[i].empty())
+			thread_starts.push_back(vecvecvec[i][0]);
+	}
+	std::vector< std::vector<char> > vecvec;
+	std::vector<char> pruned_prefix;
+	do
+	{
+		if (std::find(thread_starts.begin(), thread_starts.end(), results) != thread_starts.end())
+			pruned_prefix.clear();
+		if (!pruned_prefix.empty() && std::equal(pruned_prefix.begin(), pruned_prefix.end(), results.begin()))
+			continue;
+		pruned_prefix.clear();
+		vecvec.push_back(std::vector<char>(results.begin(), results.end()));
+		uint32_t depth = first_descent_depth(results);
+		if (depth < set_size)
+			pruned_prefix.assign(results.begin(), results.begin() + depth);
+	} while (std::next_permutation(results.begin(), results.end()));
+
+	// compare results
+	size_t cnt = 0;
+	bool error = false;
+	for (size_t i = 0; i < vecvecvec.size(); ++i)
+	{
+		for (size_t j = 0; j < vecvecvec[i].size(); ++j, ++cnt)
+		{
+			if (cnt >= vecvec.size() || !compare_vec(vecvec[cnt], vecvecvec[i][j]))
+			{
+				error = true;
+				std::cerr << "Perm at " << cnt << " is not the same!" << std::endl;
+
+				display(vecvecvec[i][j]);
+
+				return false;
+			}
+		}
+	}
+	if (cnt != vecvec.size())
+	{
+		error = true;
+		std::cerr << "Perm count " << cnt << " is not " << vecvec.size() << "!" << std::endl;
+	}
+	std::cout << "test_threaded_perm_prune(" << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// enter refuses a second element smaller than the first, so only permutations with cont[0] < cont[1] are reached
+template<typename int_type>
+bool test_threaded_perm_dfs(int_type thread_cnt, int_type cpu_cnt, uint32_t set_size)
+{
+	std::cout << "test_threaded_perm_dfs(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::vector< std::vector<char> > leaves;
+	bool error = false;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		std::vector<std::vector< std::vector<char> > > vecvecvec((size_t)thread_cnt);
+		std::vector< std::vector<char> > stacks((size_t)thread_cnt);
+
+		concurrent_perm::compute_all_perm_dfs_shard(cpu_index, cpu_cnt, thread_cnt, results,
+			[&stacks](const int thread_index, uint32_t depth, char elem) -> bool
+		{
+			if (depth == 1 && elem < stacks[thread_index][0])
+				return false;
+			stacks[thread_index].push_back(elem);
+			return true;
+		},
+			[&stacks](const int thread_index, uint32_t depth) -> void
+		{
+			stacks[thread_index].pop_back();
+		},
+			[&vecvecvec, &stacks, &error](const int thread_index, const std::vector<char>& cont) -> bool
+		{
+			if (stacks[thread_index] != cont)
+				error = true;
+			vecvecvec[thread_index].push_back(cont);
+			return true;
+		},
+			[](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+		{
+			std::cerr << error;
+		});
+
+		for (size_t i = 0; i < stacks.size(); ++i)
+		{
+			if (!stacks[i].empty())
+				error = true;
+			leaves.insert(leaves.end(), vecvecvec[i].begin(), vecvecvec[i].end());
+		}
+	}
+	if (error)
+		std::cerr << "enter and leave are not balanced!" << std::endl;
+
+	std::vector< std::vector<char> > vecvec;
+	do
+	{
+		if (results[0] < results[1])
+			vecvec.push_back(std::vector<char>(results.begin(), results.end()));
+	} while (std::next_permutation(results.begin(), results.end()));
+
+	if (leaves.size() != vecvec.size())
+	{
+		error = true;
+		std::cerr << "Perm count " << leaves.size() << " is not " << vecvec.size() << "!" << std::endl;
+	}
+	for (size_t i = 0; i < leaves.size() && i < vecvec.size(); ++i)
+	{
+		if (!compare_vec(vecvec[i], leaves[i]))
+		{
+			error = true;
+			std::cerr << "Perm at " << i << " is not the same!" << std::endl;
+
+			display(vecvec[i]);
+			display(leaves[i]);
+			break;
+		}
+	}
+	std::cout << "test_threaded_perm_dfs(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// match the permutations having 'A' at position pos
+template<typename int_type>
+bool test_find_first_perm(int_type thread_cnt, uint32_t set_size, size_t pos)
+{
+	std::cout << "test_find_first_perm(" << thread_cnt << ", " << set_size << ", " << pos << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	auto matched = [pos](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		return cont[pos] == 'A';
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	int_type expected_index = 0;
+	std::vector<char> expected = results;
+	while (!matched(0, expected))
+	{
+		std::next_permutation(expected.begin(), expected.end());
+		++expected_index;
+	}
+
+	bool error = false;
+	int_type found_index = -1;
+	std::vector<char> found;
+	if (!concurrent_perm::find_first_perm(thread_cnt, results, matched, err_callback, found_index, found)
+		|| found_index != expected_index || !compare_vec(found, expected))
+	{
+		error = true;
+		std::cerr << "find_first_perm found " << found_index << " instead of " << expected_index << std::endl;
+	}
+
+	found.clear();
+	if (!concurrent_perm::find_any_perm(thread_cnt, results, matched, err_callback, found_index, found)
+		|| found.size() != set_size || found[pos] != 'A'
+		|| found != concurrent_perm::find_perm_by_idx(found_index, results))
+	{
+		error = true;
+		std::cerr << "find_any_perm found no match at " << found_index << std::endl;
+	}
+
+	std::cout << "test_find_first_perm(" << thread_cnt << ", " << set_size << ", " << pos << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// the ordered mode must deliver exactly the sequence of std::next_permutation
+template<typename int_type>
+bool test_ordered_perm(int_type thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_ordered_perm(" << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::vector<char> expected = results;
+	bool error = false;
+	bool more = true;
+	int_type count = 0;
+	auto callback = [&](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		if (!more || cont != expected)
+		{
+			if (!error)
+				std::cerr << "test_ordered_perm: mismatch at index " << count << std::endl;
+			error = true;
+			return false;
+		}
+		more = std::next_permutation(expected.begin(), expected.end());
+		++count;
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	if (!concurrent_perm::compute_all_perm_ordered(thread_cnt, results, callback, err_callback) || more)
+		error = true;
+
+	std::cout << "test_ordered_perm(" << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every permutation must be evaluated exactly once, whatever the generator/evaluator ratio
+template<typename int_type>
+bool test_pipeline_perm(int_type gen_cnt, int_type eval_cnt, uint32_t set_size)
+{
+	std::cout << "test_pipeline_perm(" << gen_cnt << ", " << eval_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::mutex evaluated_mutex;
+	std::vector<std::vector<char> > evaluated;
+	bool error = false;
+	auto callback = [&](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		if (thread_index < 0 || thread_index >= eval_cnt)
+			error = true;
+		std::lock_guard<std::mutex> lock(evaluated_mutex);
+		evaluated.push_back(cont);
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	concurrent_perm::pipeline_stats stats;
+	if (!concurrent_perm::compute_all_perm_pipeline(gen_cnt, eval_cnt, results, callback, err_callback, stats))
+		error = true;
+
+	std::sort(evaluated.begin(), evaluated.end());
+	std::vector<char> expected = results;
+	size_t i = 0;
+	do
+	{
+		if (i >= evaluated.size() || evaluated[i] != expected)
+		{
+			error = true;
+			break;
+		}
+		++i;
+	} while (std::next_permutation(expected.begin(), expected.end()));
+	if (i != evaluated.size())
+		error = true;
+
+	std::cout << "batches:" << stats.batches << ", full_waits:" << stats.full_waits << ", empty_waits:" << stats.empty_waits;
+	std::cout << ", mean occupancy:" << ((stats.batches) ? double(stats.occupancy_sum) / stats.batches : 0.0) << "/" << stats.capacity << std::endl;
+	std::cout << "test_pipeline_perm(" << gen_cnt << ", " << eval_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// a floating-point sum must be bit-identical for every thread count and shard layout
+template<typename int_type>
+bool test_reduce_perm(int_type max_thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_reduce_perm(" << max_thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	auto map = [](const int thread_index, const std::vector<char>& cont) -> double
+	{
+		double value = 0.0;
+		for (size_t i = 0; i < cont.size(); ++i)
+			value = value * 0.37 + 1.0 / (cont[i] * (i + 1));
+		return value;
+	};
+	auto combine = [](double a, double b) -> double
+	{
+		return a + b;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	double expected = 0.0;
+	if (!concurrent_perm::compute_all_perm_reduce(int_type(1), results, 0.0, map, combine, expected, err_callback))
+		error = true;
+
+	double sequential = 0.0;
+	std::vector<char> cont = results;
+	do
+	{
+		sequential += map(0, cont);
+	} while (std::next_permutation(cont.begin(), cont.end()));
+	if (std::abs(sequential - expected) > 1e-9 * std::abs(sequential))
+	{
+		error = true;
+		std::cerr << "compute_all_perm_reduce: " << expected << " instead of " << sequential << std::endl;
+	}
+
+	for (int_type thread_cnt = 2; thread_cnt <= max_thread_cnt; ++thread_cnt)
+	{
+		double result = 0.0;
+		if (!concurrent_perm::compute_all_perm_reduce(thread_cnt, results, 0.0, map, combine, result, err_callback) || result != expected)
+		{
+			error = true;
+			std::cerr << "compute_all_perm_reduce with " << thread_cnt << " threads differs" << std::endl;
+		}
+
+		// thread_cnt shards of (thread_cnt + 1) threads each
+		std::vector<double> all_chunks;
+		for (int_type cpu_index = 0; cpu_index < thread_cnt; ++cpu_index)
+		{
+			std::vector<double> chunks;
+			if (!concurrent_perm::compute_all_perm_reduce_shard(cpu_index, thread_cnt, thread_cnt + 1, results, 0.0, map, combine, chunks, err_callback))
+				error = true;
+			all_chunks.insert(all_chunks.end(), chunks.begin(), chunks.end());
+		}
+		if (concurrent_perm::reduce_chunks(all_chunks, 0.0, combine) != expected)
+		{
+			error = true;
+			std::cerr << "compute_all_perm_reduce_shard with " << thread_cnt << " shards differs" << std::endl;
+		}
+	}
+
+	std::cout << "test_reduce_perm(" << max_thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// runs a job to completion, then cancels a long one
+template<typename int_type>
+bool test_async_perm(int_type thread_cnt, uint32_t set_size, concurrent_perm::thread_pool& pool)
+{
+	std::cout << "test_async_perm(" << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::atomic<uint64_t> count(0);
+	auto callback = [&count](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		++count;
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	concurrent_perm::job job = concurrent_perm::async_compute_all_perm(thread_cnt, results, callback, err_callback, concurrent_perm::no_predicate_type(), pool);
+	job.wait();
+	uint64_t factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	if (!job.result().get() || count != factorial || job.progress() != 1.0)
+	{
+		error = true;
+		std::cerr << "async_compute_all_perm processed " << count << " of " << factorial << std::endl;
+	}
+
+	std::vector<char> large(13);
+	std::iota(large.begin(), large.end(), 'A');
+	job = concurrent_perm::async_compute_all_perm(thread_cnt, large, callback, err_callback, concurrent_perm::no_predicate_type(), pool);
+	job.wait_for(std::chrono::milliseconds(10));
+	job.cancel();
+	if (job.wait_for(std::chrono::seconds(10)) != std::future_status::ready || job.result().get() || job.progress() >= 1.0)
+	{
+		error = true;
+		std::cerr << "async_compute_all_perm was not cancelled" << std::endl;
+	}
+
+	std::cout << "test_async_perm(" << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// sub-range generators must match std::next_permutation and the threaded generators must cover every permutation once
+template<typename int_type>
+bool test_generator_perm(int_type thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_generator_perm(" << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+
+	bool error = false;
+	const int_type step = factorial / 7 + 1;
+	for (int_type start_index = 0; start_index < factorial; start_index += step)
+	{
+		const int_type end_index = (std::min)(start_index + step * 2, factorial);
+		std::vector<char> expected = concurrent_perm::find_perm_by_idx(start_index, results);
+		int_type count = 0;
+		for (const auto& perm : concurrent_perm::make_perm_generator(results, start_index, end_index))
+		{
+			if (perm != expected)
+			{
+				error = true;
+				std::cerr << "perm_generator differs at index " << start_index + count << std::endl;
+				break;
+			}
+			std::next_permutation(expected.begin(), expected.end());
+			++count;
+		}
+		if (count != end_index - start_index)
+			error = true;
+	}
+
+	std::mutex generated_mutex;
+	std::vector<std::vector<char> > generated;
+	auto worker = [&](const int thread_index, concurrent_perm::perm_generator<std::vector<char>, int_type>& gen)
+	{
+		std::vector<std::vector<char> > local;
+		while (!gen.done())
+		{
+			local.push_back(gen.current());
+			gen.advance();
+		}
+		std::lock_guard<std::mutex> lock(generated_mutex);
+		generated.insert(generated.end(), local.begin(), local.end());
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+	if (!concurrent_perm::compute_all_perm_generators(thread_cnt, results, worker, err_callback))
+		error = true;
+
+	std::sort(generated.begin(), generated.end());
+	std::vector<char> expected = results;
+	for (size_t i = 0; i < generated.size(); ++i)
+	{
+		if (generated[i] != expected)
+		{
+			error = true;
+			break;
+		}
+		std::next_permutation(expected.begin(), expected.end());
+	}
+	if (int_type(generated.size()) != factorial)
+		error = true;
+
+	std::cout << "test_generator_perm(" << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// a trivial amount of work per permutation, to measure the per-item overhead
+template<typename container_type>
+struct checksum_callback_t
+{
+	bool operator()(const int thread_index, const container_type& cont)
+	{
+		sum += cont[0] ^ cont[cont.size() - 1];
+		return sum != 1;
+	}
+
+	uint64_t sum = 0;
+};
+
+// stands in for tbb::split
+struct split_t {};
+
+// random access must unrank like find_perm_by_idx, and splitting down to the grainsize must cover every permutation once
+template<typename int_type>
+bool test_range_perm(uint32_t set_size, int_type grainsize)
+{
+	std::cout << "test_range_perm(" << set_size << ", " << grainsize << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+
+	bool error = false;
+	auto range = concurrent_perm::make_perm_range(results, int_type(0), factorial, grainsize);
+	if (range.size() != factorial || range.end() - range.begin() != factorial)
+		error = true;
+	for (int_type i = 0; i < factorial; i += factorial / 5 + 1)
+	{
+		if (*(range.begin() + i) != concurrent_perm::find_perm_by_idx(i, results) || range.begin()[i] != *(range.end() - (factorial - i)))
+		{
+			error = true;
+			std::cerr << "perm_range differs at index " << i << std::endl;
+		}
+	}
+
+	std::vector<char> expected = results;
+	std::for_each(range.begin(), range.end(), [&](const std::vector<char>& cont)
+	{
+		if (cont != expected)
+			error = true;
+		std::next_permutation(expected.begin(), expected.end());
+	});
+
+	// split like a scheduler would, then walk the leaves on their own threads
+	std::vector<decltype(range)> leaves;
+	std::vector<decltype(range)> pending(1, range);
+	while (!pending.empty())
+	{
+		decltype(range) r = pending.back();
+		pending.pop_back();
+		if (r.is_divisible())
+		{
+			decltype(range) second(r, split_t());
+			pending.push_back(r);
+			pending.push_back(second);
+		}
+		else
+			leaves.push_back(r);
+	}
+
+	std::vector<std::vector<std::vector<char> > > walked(leaves.size());
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (size_t i = 0; i < leaves.size(); ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread([&leaves, &walked, i]()
+		{
+			for (auto it = leaves[i].begin(); it != leaves[i].end(); ++it)
+				walked[i].push_back(*it);
+		})));
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i]->join();
+
+	std::vector<std::vector<char> > all;
+	for (size_t i = 0; i < walked.size(); ++i)
+	{
+		if (leaves[i].size() > grainsize)
+			error = true;
+		all.insert(all.end(), walked[i].begin(), walked[i].end());
+	}
+	std::sort(all.begin(), all.end());
+	expected = results;
+	for (size_t i = 0; i < all.size(); ++i)
+	{
+		if (all[i] != expected)
+		{
+			error = true;
+			break;
+		}
+		std::next_permutation(expected.begin(), expected.end());
+	}
+	if (int_type(all.size()) != factorial)
+		error = true;
+
+	std::cout << "test_range_perm(" << set_size << ", " << grainsize << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// counts the permutations it sees and adds them to total when the thread is done, cannot be copied
+struct counting_evaluator_t
+{
+	counting_evaluator_t(std::atomic<uint64_t>& total_) : total(total_), count(0) {}
+	counting_evaluator_t(counting_evaluator_t&& other) : total(other.total), count(other.count) { other.count = 0; }
+	counting_evaluator_t(const counting_evaluator_t&) = delete;
+	~counting_evaluator_t() { total += count; }
+
+	bool operator()(const int thread_index, const std::vector<char>& cont)
+	{
+		++count;
+		return true;
+	}
+
+	std::atomic<uint64_t>& total;
+	uint64_t count;
+};
+
+// every thread must construct its own callback exactly once, and the callbacks must see every permutation
+template<typename int_type>
+bool test_factory_perm(int_type thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_factory_perm(" << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+
+	std::atomic<uint64_t> total(0);
+	std::mutex made_mutex;
+	std::vector<int> made;
+	auto make_callback = [&](const int thread_index)
+	{
+		std::lock_guard<std::mutex> lock(made_mutex);
+		made.push_back(thread_index);
+		return counting_evaluator_t(total);
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	if (!concurrent_perm::compute_all_perm_factory(thread_cnt, results, make_callback, err_callback) || int_type(total) != factorial)
+		error = true;
+
+	std::sort(made.begin(), made.end());
+	for (size_t i = 0; i < made.size(); ++i)
+	{
+		if (made[i] != static_cast<int>(i))
+			error = true;
+	}
+	if (made.empty() || int_type(made.size()) > thread_cnt)
+		error = true;
+
+	std::cout << "test_factory_perm(" << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// scores every permutation in a temporary vector allocated per permutation
+template<typename container_type>
+struct allocating_callback_t
+{
+	bool operator()(const int thread_index, const container_type& cont)
+	{
+		std::vector<int> scratch(cont.begin(), cont.end());
+		std::partial_sum(scratch.begin(), scratch.end(), scratch.begin());
+		sum += scratch.back();
+		return sum != 1;
+	}
+
+	uint64_t sum = 0;
+};
+
+// scores every permutation in a scratch buffer preallocated once per thread
+template<typename container_type>
+struct arena_callback_t
+{
+	explicit arena_callback_t(size_t size)
+	{
+		scratch.reserve(size);
+	}
+
+	bool operator()(const int thread_index, const container_type& cont)
+	{
+		scratch.assign(cont.begin(), cont.end());
+		std::partial_sum(scratch.begin(), scratch.end(), scratch.begin());
+		sum += scratch.back();
+		return sum != 1;
+	}
+
+	std::vector<int> scratch;
+	uint64_t sum = 0;
+};
+
+// every permutation must be processed once whatever the policy, on the CPU chosen for its thread,
+// and the calling thread must get its affinity back
+template<typename int_type>
+bool test_affinity_perm(int_type thread_cnt, uint32_t set_size, const concurrent_perm::affinity_policy& policy)
+{
+	std::cout << "test_affinity_perm(" << thread_cnt << ", " << set_size << ", " << static_cast<int>(policy.kind) << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+
+	const std::vector<int> cpus = concurrent_perm::affinity_cpu_order(policy);
+	std::atomic<uint64_t> count(0);
+	std::atomic<bool> misplaced(false);
+	auto callback = [&](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		++count;
+#if defined(__linux__)
+		if (!cpus.empty() && sched_getcpu() != cpus[thread_index % cpus.size()])
+			misplaced = true;
+#endif
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+#if defined(__linux__)
+	cpu_set_t before;
+	sched_getaffinity(0, sizeof(before), &before);
+#endif
+	if (!concurrent_perm::compute_all_perm_affinity(thread_cnt, results, callback, err_callback, policy) || int_type(count) != factorial)
+		error = true;
+	if (misplaced)
+	{
+		error = true;
+		std::cerr << "compute_all_perm_affinity ran a thread on another CPU" << std::endl;
+	}
+#if defined(__linux__)
+	cpu_set_t after;
+	sched_getaffinity(0, sizeof(after), &after);
+	if (!CPU_EQUAL(&before, &after))
+	{
+		error = true;
+		std::cerr << "compute_all_perm_affinity did not restore the affinity of the calling thread" << std::endl;
+	}
+#endif
+
+	std::cout << "test_affinity_perm(" << thread_cnt << ", " << set_size << ", " << static_cast<int>(policy.kind) << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every permutation must be processed once, and small sets must not spawn threads
+template<typename int_type>
+bool test_auto_perm(uint32_t set_size)
+{
+	std::cout << "test_auto_perm(" << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+
+	std::atomic<uint64_t> count(0);
+	std::atomic<uint64_t> checksum(0);
+	auto callback = [&](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		++count;
+		checksum += cont[0] * cont[cont.size() - 1];
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	concurrent_perm::auto_plan plan;
+	if (!concurrent_perm::compute_all_perm_auto<int_type>(results, callback, err_callback, plan) || int_type(count) != factorial)
+		error = true;
+	if (plan.thread_cnt < 1 || plan.thread_cnt > concurrent_perm::available_cpu_cnt() || (int_type(plan.warmup_cnt) == factorial && plan.thread_cnt != 1))
+		error = true;
+
+	uint64_t expected = 0;
+	std::vector<char> cont = results;
+	do
+	{
+		expected += cont[0] * cont[cont.size() - 1];
+	} while (std::next_permutation(cont.begin(), cont.end()));
+	if (checksum != expected)
+		error = true;
+
+	std::cout << "threads:" << plan.thread_cnt << ", chunk_size:" << plan.chunk_size << ", warmup_cnt:" << plan.warmup_cnt << ", item_ns:" << plan.item_ns << std::endl;
+	std::cout << "test_auto_perm(" << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
 // return false to stop processing
 template<typename container_type>
 struct empty_callback_t
 {
-	bool operator()(const int thread_index, const container_type& cont)
+	bool operator()(const int thread_index, const container_type& cont)
+	{
+		return true;
+	}
+};
+
+template<typename container_type>
+struct error_callback_t
+{
+	void operator()(const int thread_index, const container_type& cont, const std::string& error)
+	{
+		std::cerr << error << std::endl;
+	}
+};
+
+// recomputes an expensive cost only when the prefix (all but the last 3 elements) changes
+template<typename container_type>
+struct prefix_cache_callback_t
+{
+	bool operator()(const int thread_index, const container_type& cont)
+	{
+		const size_t prefix_size = cont.size() - 3;
+		if (prefix.size() != prefix_size || !std::equal(prefix.begin(), prefix.end(), cont.begin()))
+		{
+			prefix.assign(cont.begin(), cont.begin() + prefix_size);
+			cost = 0;
+			for (int repeat = 0; repeat < 16; ++repeat)
+			{
+				for (size_t i = 0; i < prefix_size; ++i)
+					cost = cost * 31 + prefix[i] * (i + repeat);
+			}
+		}
+		return cost != 1;
+	}
+
+	std::vector<typename container_type::value_type> prefix;
+	uint64_t cost = 0;
+};
+
+//typedef boost::multiprecision::cpp_int int_type;
+//typedef boost::multiprecision::int256_t int_type;
+typedef int64_t int_type;
+
+// nodes must get shares proportional to their weights and, together, every permutation in order
+template<typename int_type>
+bool test_weighted_perm(int_type thread_cnt, uint32_t set_size, const std::vector<uint32_t>& weights)
+{
+	std::cout << "test_weighted_perm(" << thread_cnt << ", " << set_size << ", " << weights.size() << " nodes) starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	const uint64_t sum = std::accumulate(weights.begin(), weights.end(), uint64_t(0));
+
+	bool error = false;
+	std::vector< std::vector<char> > vecvec;
+	uint64_t cum = 0;
+	for (size_t k = 0; k < weights.size(); ++k)
+	{
+		std::vector<std::vector< std::vector<char> > > vecvecvec((size_t)thread_cnt);
+		if (!concurrent_perm::compute_all_perm_weighted_shard(int_type(k), weights, thread_cnt, results,
+			[&vecvecvec](const int thread_index, const std::vector<char>& cont) -> bool
+			{
+				vecvecvec[thread_index].push_back(cont);
+				return true;
+			},
+			[](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+			{
+				std::cerr << error;
+			}))
+			error = true;
+
+		size_t node_cnt = 0;
+		for (size_t i = 0; i < vecvecvec.size(); ++i)
+		{
+			vecvec.insert(vecvec.end(), vecvecvec[i].begin(), vecvecvec[i].end());
+			node_cnt += vecvecvec[i].size();
+		}
+		const uint64_t expected_cnt = static_cast<uint64_t>(factorial) * (cum + weights[k]) / sum - static_cast<uint64_t>(factorial) * cum / sum;
+		if (node_cnt != expected_cnt)
+		{
+			error = true;
+			std::cerr << "node " << k << " got " << node_cnt << " instead of " << expected_cnt << " permutations" << std::endl;
+		}
+		cum += weights[k];
+	}
+
+	size_t cnt = 0;
+	do
+	{
+		if (cnt >= vecvec.size() || !compare_vec(vecvec[cnt], results))
+		{
+			error = true;
+			std::cerr << "Perm at " << cnt << " is not the same!" << std::endl;
+			break;
+		}
+		++cnt;
+	} while (std::next_permutation(results.begin(), results.end()));
+	if (cnt != vecvec.size())
+		error = true;
+
+	std::cout << "test_weighted_perm(" << thread_cnt << ", " << set_size << ", " << weights.size() << " nodes) finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// jobs read back from their JSON manifests must produce every permutation in order from their seeds,
+// and the merge step must accept their records and reject missing or duplicated ones
+template<typename int_type>
+bool test_shard_plan_perm(uint32_t set_size, const std::vector<uint32_t>& weights, uint32_t jobs_per_node)
+{
+	std::cout << "test_shard_plan_perm(" << set_size << ", " << weights.size() << " nodes, " << jobs_per_node << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	std::vector<std::string> nodes;
+	for (size_t i = 0; i < weights.size(); ++i)
+		nodes.push_back("node" + std::to_string(i));
+
+	bool error = false;
+	std::string plan_error;
+	concurrent_shard::shard_plan<int_type> plan;
+	concurrent_shard::shard_plan<int_type> parsed_plan;
+	if (!concurrent_shard::make_shard_plan("perm", set_size, 0, nodes, weights, jobs_per_node, plan, plan_error)
+		|| !concurrent_shard::parse_shard_plan(concurrent_shard::plan_to_json(plan), parsed_plan, plan_error))
+	{
+		std::cerr << plan_error << std::endl;
+		return false;
+	}
+
+	std::vector<concurrent_shard::shard_job<int_type> > jobs;
+	for (size_t i = 0; i < plan.jobs.size(); ++i)
+	{
+		concurrent_shard::shard_plan<int_type> job_plan;
+		if (!concurrent_shard::parse_shard_plan(concurrent_shard::job_to_json(plan, plan.jobs[i]), job_plan, plan_error) || job_plan.jobs.size() != 1)
+		{
+			error = true;
+			std::cerr << plan_error << std::endl;
+			continue;
+		}
+		jobs.push_back(job_plan.jobs[0]);
+	}
+
+	std::vector<std::vector< std::vector<char> > > vecvecvec(jobs.size());
+	std::vector<concurrent_shard::shard_record<int_type> > records;
+	if (!concurrent_shard::compute_perm_jobs(jobs, results,
+		[&vecvecvec](const int thread_index, const std::vector<char>& cont) -> bool
+		{
+			vecvecvec[thread_index].push_back(cont);
+			return true;
+		},
+		[](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+		{
+			std::cerr << error;
+		}, records))
+		error = true;
+
+	size_t cnt = 0;
+	std::vector<char> cont = results;
+	for (size_t k = 0; k < vecvecvec.size(); ++k)
+	{
+		for (size_t j = 0; j < vecvecvec[k].size(); ++j, ++cnt)
+		{
+			if (!compare_vec(vecvecvec[k][j], cont))
+			{
+				error = true;
+				std::cerr << "Perm at " << cnt << " is not the same!" << std::endl;
+				break;
+			}
+			std::next_permutation(cont.begin(), cont.end());
+		}
+	}
+
+	std::vector<concurrent_shard::shard_record<int_type> > parsed_records;
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		concurrent_shard::shard_record<int_type> record;
+		if (!concurrent_shard::parse_shard_record(concurrent_shard::record_to_json(records[i]), record, plan_error))
+			error = true;
+		parsed_records.push_back(record);
+	}
+	// the array that ShardPlan run writes reads back to the same records
+	std::vector<concurrent_shard::shard_record<int_type> > array_records;
+	if (!concurrent_shard::parse_shard_records(concurrent_shard::records_to_json(records), array_records, plan_error) || array_records.size() != records.size())
+		error = true;
+	for (size_t i = 0; i < array_records.size() && i < records.size(); ++i)
+	{
+		if (array_records[i].job_index != records[i].job_index || array_records[i].processed_cnt != records[i].processed_cnt)
+			error = true;
+	}
+
+	std::string report;
+	if (!concurrent_shard::verify_coverage(parsed_plan, parsed_records, report) || int_type(cnt) != parsed_plan.total)
+	{
+		error = true;
+		std::cerr << report;
+	}
+	std::vector<concurrent_shard::shard_record<int_type> > bad_records = parsed_records;
+	bad_records.push_back(parsed_records.front());
+	std::string bad_report;
+	if (concurrent_shard::verify_coverage(parsed_plan, bad_records, bad_report))
+		error = true;
+	bad_records.pop_back();
+	bad_records.pop_back();
+	if (concurrent_shard::verify_coverage(parsed_plan, bad_records, bad_report))
+		error = true;
+
+	std::cout << "test_shard_plan_perm(" << set_size << ", " << weights.size() << " nodes, " << jobs_per_node << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// streams of every shard must decode in parallel to the next_permutation sequence, or to its kept part
+template<typename int_type>
+bool test_stream_perm(int_type thread_cnt, int_type cpu_cnt, uint32_t set_size, uint64_t chunk_records, bool sparse)
+{
+	std::cout << "test_stream_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ", " << chunk_records << ", " << (sparse ? "sparse" : "dense") << ") starting" << std::endl;
+
+	bool error = false;
+	concurrent_export::stream_options options;
+	options.chunk_records = chunk_records;
+	auto keep = [](const int thread_index, const std::vector<uint32_t>& indices) { return (indices[0] + 2 * indices.back()) % 5 == 1; };
+	std::vector<std::string> streams;
+	std::vector<concurrent_export::stream_chunk<int_type> > all_chunks;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		std::ostringstream os;
+		std::string stream_error;
+		const bool encoded = sparse ? concurrent_export::encode_all_perm_shard(cpu_index, cpu_cnt, thread_cnt, set_size, os, options, stream_error, keep)
+			: concurrent_export::encode_all_perm_shard(cpu_index, cpu_cnt, thread_cnt, set_size, os, options, stream_error);
+		concurrent_export::stream_header<int_type> header;
+		std::vector<concurrent_export::stream_chunk<int_type> > chunks;
+		if (!encoded || !concurrent_export::read_stream_index(os.str(), header, chunks, stream_error))
+		{
+			error = true;
+			std::cerr << stream_error << std::endl;
+		}
+		all_chunks.insert(all_chunks.end(), chunks.begin(), chunks.end());
+		streams.push_back(os.str());
+	}
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	std::string report;
+	if (!concurrent_export::verify_stream_coverage(int_type(0), factorial, all_chunks, report))
+	{
+		error = true;
+		std::cerr << report;
+	}
+
+	std::mutex mutex;
+	std::vector<std::pair<int_type, std::vector<uint32_t> > > decoded;
+	size_t stream_bytes = 0;
+	for (size_t i = 0; i < streams.size(); ++i)
+	{
+		stream_bytes += streams[i].size();
+		if (!concurrent_export::decode_stream(thread_cnt, streams[i],
+			[&](const int thread_index, const int_type& rank, const std::vector<uint32_t>& indices) -> bool
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				decoded.push_back(std::make_pair(rank, indices));
+				return true;
+			},
+			[](const int thread_index, const std::string& error) { std::cerr << error << std::endl; }))
+			error = true;
+	}
+	std::sort(decoded.begin(), decoded.end());
+
+	std::vector<uint32_t> cont(set_size);
+	std::iota(cont.begin(), cont.end(), 0);
+	std::vector<std::pair<int_type, std::vector<uint32_t> > > expected;
+	int_type rank = 0;
+	do
+	{
+		if (!sparse || keep(0, cont))
+			expected.push_back(std::make_pair(rank, cont));
+		++rank;
+	} while (std::next_permutation(cont.begin(), cont.end()));
+	if (decoded != expected)
+	{
+		error = true;
+		std::cerr << "decoded " << decoded.size() << " records, expected " << expected.size() << std::endl;
+	}
+	std::cout << stream_bytes << " bytes for " << expected.size() << " records" << std::endl;
+
+	// returning false from the callback stops every thread, each after at most the record it is on;
+	// the stream is given as a pointer and a length, as a mapped file would be
+	std::atomic<uint64_t> stopped_cnt(0);
+	if (!concurrent_export::decode_stream(thread_cnt, streams[0].data(), streams[0].size(),
+		[&stopped_cnt](const int thread_index, const int_type& rank, const std::vector<uint32_t>& indices) -> bool
+		{
+			++stopped_cnt;
+			return false;
+		},
+		[](const int thread_index, const std::string& error) { std::cerr << error << std::endl; })
+		|| stopped_cnt > static_cast<uint64_t>(thread_cnt))
+	{
+		error = true;
+		std::cerr << "decode_stream went on for " << stopped_cnt << " records after the callback returned false" << std::endl;
+	}
+
+	// a truncated stream and a missing chunk must be caught
+	concurrent_export::stream_header<int_type> header;
+	std::vector<concurrent_export::stream_chunk<int_type> > chunks;
+	std::string stream_error;
+	if (concurrent_export::read_stream_index(streams[0].substr(0, streams[0].size() - 1), header, chunks, stream_error)
+		|| (all_chunks.size() > 1 && concurrent_export::verify_stream_coverage(int_type(0), factorial, std::vector<concurrent_export::stream_chunk<int_type> >(all_chunks.begin() + 1, all_chunks.end()), report)))
+	{
+		error = true;
+		std::cerr << "damaged stream accepted" << std::endl;
+	}
+
+	std::cout << "test_stream_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// samples must not depend on thread_cnt, must be roughly uniform, and distinct ones must not repeat
+template<typename int_type>
+bool test_sample_perm(uint32_t set_size, int_type sample_cnt, uint64_t seed, bool distinct)
+{
+	std::cout << "test_sample_perm(" << set_size << ", " << sample_cnt << ", " << seed << ", " << (distinct ? "distinct" : "with replacement") << ") starting" << std::endl;
+
+	bool error = false;
+	std::string results(set_size, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+	std::vector<std::string> first_run;
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::vector<std::vector<std::string> > per_thread((size_t)thread_cnt);
+		auto callback = [&per_thread](const int thread_index, const std::string& cont) -> bool
+		{
+			per_thread[(size_t)thread_index].push_back(cont);
+			return true;
+		};
+		auto err_callback = [](const int thread_index, const std::string& cont, const std::string& error) { std::cerr << error << std::endl; };
+		if (!(distinct ? concurrent_perm::sample_perm_distinct(thread_cnt, results, sample_cnt, seed, callback, err_callback)
+			: concurrent_perm::sample_perm(thread_cnt, results, sample_cnt, seed, callback, err_callback)))
+			error = true;
+
+		std::vector<std::string> samples;
+		for (size_t i = 0; i < per_thread.size(); ++i)
+		{
+			samples.insert(samples.end(), per_thread[i].begin(), per_thread[i].end());
+		}
+		if (thread_cnt == 1)
+			first_run = samples;
+		else if (samples != first_run)
+		{
+			error = true;
+			std::cerr << "samples of " << thread_cnt << " threads differ from 1 thread" << std::endl;
+		}
+	}
+
+	std::map<std::string, int64_t> counts;
+	for (size_t i = 0; i < first_run.size(); ++i)
+	{
+		std::string sorted = first_run[i];
+		std::sort(sorted.begin(), sorted.end());
+		if (sorted != results)
+			error = true;
+		++counts[first_run[i]];
+	}
+	int64_t factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	if (distinct)
+	{
+		if (int_type(counts.size()) != sample_cnt)
+		{
+			error = true;
+			std::cerr << counts.size() << " distinct of " << sample_cnt << " samples" << std::endl;
+		}
+	}
+	else if (sample_cnt / 50 >= int_type(factorial))
+	{
+		// every permutation within 6 standard deviations of its expected count
+		const double expected = static_cast<double>(sample_cnt) / factorial;
+		for (auto it = counts.begin(); it != counts.end(); ++it)
+		{
+			if (std::abs(it->second - expected) > 6 * std::sqrt(expected))
+				error = true;
+		}
+		if (int64_t(counts.size()) != factorial)
+			error = true;
+	}
+
+	std::cout << "test_sample_perm(" << set_size << ", " << sample_cnt << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// the strided chunks of all shards and threads must visit every permutation exactly once
+// thread chunk counts must differ by at most 1, and the first two chunks of every thread with more than one
+// must lie in both halves of the range, whatever chunk_cnt and thread_cnt are
+template<typename int_type>
+bool test_strided_spread(int_type thread_cnt, uint64_t chunk_cnt)
+{
+	std::vector<std::vector<uint64_t> > visits(static_cast<size_t>(thread_cnt));
+	concurrent_perm::run_strided_range(thread_cnt, int_type(0), int_type(chunk_cnt * 10), chunk_cnt,
+		[&visits](int_type thread_index, int_type start_index, int_type end_index) -> bool
+		{
+			visits[static_cast<size_t>(thread_index)].push_back(static_cast<uint64_t>(start_index / 10));
+			return end_index == start_index + 10;
+		});
+
+	bool error = false;
+	std::vector<int> seen(static_cast<size_t>(chunk_cnt), 0);
+	size_t min_cnt = visits[0].size();
+	size_t max_cnt = visits[0].size();
+	for (size_t t = 0; t < visits.size(); ++t)
+	{
+		min_cnt = (std::min)(min_cnt, visits[t].size());
+		max_cnt = (std::max)(max_cnt, visits[t].size());
+		for (size_t i = 0; i < visits[t].size(); ++i)
+			++seen[static_cast<size_t>(visits[t][i])];
+		if (visits[t].size() > 1 && !(visits[t][0] < chunk_cnt / 2 && visits[t][1] >= chunk_cnt / 2))
+			error = true;
+	}
+	if (max_cnt > min_cnt + 1 || std::count(seen.begin(), seen.end(), 1) != int(chunk_cnt))
+		error = true;
+	std::cout << "strided spread of " << chunk_cnt << " chunks over " << thread_cnt << " thread(s) " << ((error) ? "failed" : "passed") << std::endl;
+	return !error;
+}
+
+template<typename int_type>
+bool test_strided_perm(int_type thread_cnt, int_type cpu_cnt, uint32_t set_size, uint64_t chunk_cnt)
+{
+	std::cout << "test_strided_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ", " << chunk_cnt << ") starting" << std::endl;
+
+	std::string results(set_size, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+	std::atomic<uint64_t> count(0);
+	std::atomic<uint64_t> checksum(0);
+	bool error = false;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		if (!concurrent_perm::compute_all_perm_strided_shard(cpu_index, cpu_cnt, thread_cnt, chunk_cnt, results,
+			[&count, &checksum](const int thread_index, const std::string& cont) -> bool
+			{
+				++count;
+				checksum += std::hash<std::string>()(cont);
+				return true;
+			},
+			[](const int thread_index, const std::string& cont, const std::string& error) { std::cerr << error << std::endl; }))
+			error = true;
+	}
+
+	uint64_t expected_count = 0;
+	uint64_t expected_checksum = 0;
+	std::string cont = results;
+	do
+	{
+		++expected_count;
+		expected_checksum += std::hash<std::string>()(cont);
+	} while (std::next_permutation(cont.begin(), cont.end()));
+	if (count != expected_count || checksum != expected_checksum)
+	{
+		error = true;
+		std::cerr << "visited " << count << " of " << expected_count << " permutations" << std::endl;
+	}
+
+	std::cout << "test_strided_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ", " << chunk_cnt << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// the report must account for every item and sample, and show the imbalance of a skewed callback
+template<typename int_type>
+bool test_instrumented_perm(int_type thread_cnt, uint32_t set_size, uint32_t sample_every, bool skewed)
+{
+	std::cout << "test_instrumented_perm(" << thread_cnt << ", " << set_size << ", " << sample_every << ", " << (skewed ? "skewed" : "even") << ") starting" << std::endl;
+
+	std::string results(set_size, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+	concurrent_perm::instrument_options options;
+	options.sample_every = sample_every;
+	concurrent_perm::run_report report;
+	bool error = !concurrent_perm::compute_all_perm_instrumented(thread_cnt, results,
+		[skewed](const int thread_index, const std::string& cont) -> bool
+		{
+			// the first block of permutations costs ten times more when skewed
+			volatile uint64_t sink = 0;
+			for (int i = (skewed && cont[0] == 'A') ? 1000 : 100; i > 0; --i)
+				sink += i;
+			return true;
+		},
+		[](const int thread_index, const std::string& cont, const std::string& error) { std::cerr << error << std::endl; },
+		options, report);
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	int_type items = 0;
+	uint64_t samples = 0;
+	for (size_t i = 0; i < report.threads.size(); ++i)
+	{
+		items += int_type(report.threads[i].items);
+		samples += report.threads[i].items / sample_every;
+		if (report.threads[i].finish_ms < report.threads[i].start_ms)
+			error = true;
+	}
+	if (items != factorial || samples != report.callback_ns.count || int_type(report.threads.size()) != (std::min)(thread_cnt, factorial))
+	{
+		error = true;
+		std::cerr << "report has " << items << " items and " << report.callback_ns.count << " samples in " << report.threads.size() << " threads" << std::endl;
+	}
+	if (report.callback_ns.percentile(50.0) > report.callback_ns.percentile(99.0) || report.callback_ns.percentile(99.0) > report.callback_ns.max_ns)
+		error = true;
+	if (skewed && thread_cnt > 1 && report.imbalance() < 1.5)
+	{
+		error = true;
+		std::cerr << "skewed run reports an imbalance of " << report.imbalance() << std::endl;
+	}
+	std::cout << report.to_string();
+
+	std::cout << "test_instrumented_perm(" << thread_cnt << ", " << set_size << ", " << sample_every << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// counts the spans by name and the items of the "callbacks" spans of a trace, which must be valid JSON
+inline bool parse_trace_json(const concurrent_trace::run_trace& trace, std::map<std::string, size_t>& span_cnt, uint64_t& callback_items)
+{
+	concurrent_shard::json_value root;
+	std::string error;
+	if (!concurrent_shard::json_parser(trace.to_json()).parse(root, error))
+	{
+		std::cerr << error << std::endl;
+		return false;
+	}
+	const concurrent_shard::json_value* events = root.find("traceEvents");
+	if (events == nullptr || events->kind != concurrent_shard::json_value::array_kind)
+		return false;
+	for (size_t i = 0; i < events->items.size(); ++i)
+	{
+		const concurrent_shard::json_value& e = events->items[i];
+		const concurrent_shard::json_value* name = e.find("name");
+		const concurrent_shard::json_value* ph = e.find("ph");
+		if (name == nullptr || ph == nullptr || e.find("tid") == nullptr)
+			return false;
+		if (ph->text != "X")
+			continue;
+		if (e.find("ts") == nullptr || e.find("dur") == nullptr)
+			return false;
+		++span_cnt[name->text];
+		const concurrent_shard::json_value* args = e.find("args");
+		if (name->text == "callbacks" && args != nullptr && args->find("items") != nullptr)
+			callback_items += std::strtoull(args->find("items")->text.c_str(), nullptr, 10);
+	}
+	return true;
+}
+
+// every shard of a traced run must visit its permutations once, and its trace must account for every chunk and item
+template<typename int_type>
+bool test_traced_perm(int_type thread_cnt, int_type cpu_cnt, uint32_t set_size, uint64_t chunks_per_thread)
+{
+	std::cout << "test_traced_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ", " << chunks_per_thread << ") starting" << std::endl;
+
+	std::string results(set_size, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+	concurrent_trace::trace_options options;
+	options.chunks_per_thread = chunks_per_thread;
+	options.batch_items = 7;
+	bool error = false;
+	std::map<std::string, int> all;
+	uint64_t steals = 0;
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
+	{
+		std::vector<std::map<std::string, int> > seen(static_cast<size_t>(thread_cnt));
+		concurrent_trace::run_trace trace;
+		if (!concurrent_trace::compute_all_perm_traced_shard(cpu_index, cpu_cnt, thread_cnt, results,
+			[&seen](const int thread_index, const std::string& cont) -> bool
+			{
+				++seen[thread_index][cont];
+				return true;
+			},
+			[](const int thread_index, const std::string& cont, const std::string& error) { std::cerr << error << std::endl; },
+			options, trace))
+		{
+			error = true;
+			continue;
+		}
+
+		uint64_t items = 0;
+		for (size_t t = 0; t < seen.size(); ++t)
+		{
+			for (std::map<std::string, int>::const_iterator it = seen[t].begin(); it != seen[t].end(); ++it)
+			{
+				all[it->first] += it->second;
+				items += it->second;
+			}
+		}
+		std::map<std::string, size_t> span_cnt;
+		uint64_t callback_items = 0;
+		if (!parse_trace_json(trace, span_cnt, callback_items) || trace.process_id != int(cpu_index) || trace.dropped() != 0)
+		{
+			error = true;
+			std::cerr << "shard " << cpu_index << " trace is not valid" << std::endl;
+		}
+		if (callback_items != items || span_cnt["chunk"] != span_cnt["unrank"] || (items > 0 && span_cnt["chunk"] == 0)
+			|| span_cnt["join"] != ((items > 0) ? 1 : 0) || span_cnt["chunk"] > trace.threads.size() * chunks_per_thread)
+		{
+			error = true;
+			std::cerr << "shard " << cpu_index << " trace has " << span_cnt["chunk"] << " chunks, " << span_cnt["join"] << " joins and " << callback_items << " of " << items << " items" << std::endl;
+		}
+		steals += span_cnt["steal"];
+	}
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	if (int_type(all.size()) != factorial)
+		error = true;
+	for (std::map<std::string, int>::const_iterator it = all.begin(); it != all.end(); ++it)
+	{
+		if (it->second != 1)
+			error = true;
+	}
+	std::cout << all.size() << " permutations, " << steals << " steals" << std::endl;
+
+	std::cout << "test_traced_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ", " << chunks_per_thread << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// shards run in child processes must merge to the same bits as compute_all_perm_reduce
+template<typename int_type>
+bool test_process_perm(int_type thread_cnt, int cpu_cnt, uint32_t set_size)
+{
+	std::cout << "test_process_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+
+	auto map = [](const int thread_index, const std::vector<char>& cont) -> double
+	{
+		double value = 0.0;
+		for (size_t i = 0; i < cont.size(); ++i)
+			value = value * 0.37 + 1.0 / (cont[i] * (i + 1));
+		return value;
+	};
+	auto combine = [](double a, double b) -> double
+	{
+		return a + b;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+
+	bool error = false;
+	double expected = 0.0;
+	if (!concurrent_perm::compute_all_perm_reduce(int_type(1), results, 0.0, map, combine, expected, err_callback))
+		error = true;
+
+	auto shard = [&](int cpu_index, int shard_cnt, concurrent_shard::shard_channel& channel) -> bool
+	{
+		std::atomic<uint64_t> done(0);
+		auto counting_map = [&](const int thread_index, const std::vector<char>& cont) -> double
+		{
+			if (++done % 4096 == 0)
+				channel.progress(done, static_cast<uint64_t>(factorial));
+			return map(thread_index, cont);
+		};
+		std::vector<double> chunks;
+		if (!concurrent_perm::compute_all_perm_reduce_shard(int_type(cpu_index), int_type(shard_cnt), thread_cnt, results, 0.0, counting_map, combine, chunks,
+			[&](const int thread_index, const std::vector<char>& cont, const std::string& text) { channel.error(text); }))
+			return false;
+
+		channel.progress(done, static_cast<uint64_t>(factorial));
+		std::string data;
+		concurrent_shard::append_values(data, chunks);
+		return channel.result(data);
+	};
+
+	std::vector<uint64_t> progress(cpu_cnt, 0);
+	auto progress_callback = [&](int cpu_index, uint64_t done, uint64_t total)
+	{
+		progress[cpu_index] = done;
+	};
+	auto shard_err_callback = [](int cpu_index, const std::string& error)
+	{
+		std::cerr << "shard " << cpu_index << ": " << error << std::endl;
+	};
+
+	std::vector<std::string> shard_results;
+	if (!concurrent_shard::run_local_shards(cpu_cnt, shard, shard_results, progress_callback, shard_err_callback))
+		error = true;
+
+	std::vector<double> all_chunks;
+	for (size_t i = 0; i < shard_results.size(); ++i)
+	{
+		if (!concurrent_shard::read_values(shard_results[i], all_chunks))
+			error = true;
+	}
+	if (concurrent_perm::reduce_chunks(all_chunks, 0.0, combine) != expected)
+	{
+		error = true;
+		std::cerr << "run_local_shards merged result differs" << std::endl;
+	}
+	if (std::accumulate(progress.begin(), progress.end(), uint64_t(0)) != static_cast<uint64_t>(factorial))
+	{
+		error = true;
+		std::cerr << "run_local_shards progress does not add up to " << factorial << std::endl;
+	}
+
+	std::cout << "test_process_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every permutation must be processed once by a pool of lease workers, even when one of them
+// takes a lease and never reports back
+template<typename int_type>
+bool test_lease_perm(int worker_cnt, int thread_cnt, uint32_t set_size)
+{
+	std::cout << "test_lease_perm(" << worker_cnt << ", " << thread_cnt << ", " << set_size << ") starting" << std::endl;
+
+	std::vector<char> results(set_size);
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	concurrent_perm::split_chunks(factorial, chunk_size, chunk_cnt);
+
+	bool error = false;
+	// live workers report every few milliseconds, so a 2 second timeout only ever expires the dead worker's lease
+	// even on a loaded machine or under a sanitizer, and the exact count below holds
+	concurrent_shard::lease_coordinator coordinator(chunk_cnt, 2, std::chrono::milliseconds(2000), 1);
+	std::string listen_error;
+	if (!coordinator.listen("127.0.0.1", 0, listen_error))
+	{
+		std::cerr << listen_error << std::endl;
+		return false;
+	}
+
+	bool served = false;
+	std::thread server([&]()
+	{
+		served = coordinator.serve([](const std::string& error) { std::cerr << error << std::endl; });
+	});
+
+	// a worker that dies right after taking a lease
+	{
+		concurrent_shard::lease_client dead;
+		std::string connect_error;
+		uint64_t id = 0, begin = 0, end = 0, wait_ms = 0;
+		if (!dead.connect("127.0.0.1", coordinator.port(), connect_error) || dead.lease(id, begin, end, wait_ms) != concurrent_shard::lease_reply::range)
+			error = true;
+	}
+
+	std::atomic<uint64_t> count(0);
+	std::atomic<uint64_t> checksum(0);
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+		std::cerr << error;
+	};
+	auto node = [&](int worker_index)
+	{
+		auto callback = [&](const int thread_index, const std::vector<char>& cont) -> bool
+		{
+			++count;
+			checksum += std::hash<std::string>()(std::string(cont.begin(), cont.end()));
+			return true;
+		};
+		auto chunk_worker = [&](int thread_index, uint64_t chunk_begin, uint64_t chunk_end) -> bool
+		{
+			if (worker_index == 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(2)); // a slow node gets its leases split
+			return concurrent_perm::compute_perm_chunks(int_type(thread_index), results, chunk_begin, chunk_end, callback, err_callback);
+		};
+		if (!concurrent_shard::run_lease_worker("localhost", coordinator.port(), thread_cnt, chunk_worker,
+			[](int thread_index, const std::string& error) { std::cerr << error << std::endl; }))
+			error = true;
+	};
+	std::vector<std::shared_ptr<std::thread> > nodes;
+	for (int i = 0; i < worker_cnt; ++i)
+	{
+		nodes.push_back(std::shared_ptr<std::thread>(new std::thread(node, i)));
+	}
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		nodes[i]->join();
+	}
+	server.join();
+
+	uint64_t expected_checksum = 0;
+	std::vector<char> cont = results;
+	do
+	{
+		expected_checksum += std::hash<std::string>()(std::string(cont.begin(), cont.end()));
+	} while (std::next_permutation(cont.begin(), cont.end()));
+
+	const concurrent_shard::lease_stats& stats = coordinator.stats();
+	if (!served || int_type(count.load()) != factorial || checksum != expected_checksum || stats.expired == 0)
+	{
+		error = true;
+		std::cerr << "lease_coordinator processed " << count << " of " << factorial << " permutations, " << stats.expired << " expired leases" << std::endl;
+	}
+	std::cout << "leases:" << stats.leases << ", splits:" << stats.splits << ", expired:" << stats.expired << ", waits:" << stats.waits << std::endl;
+
+	std::cout << "test_lease_perm(" << worker_cnt << ", " << thread_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// a claim that outlives lease_timeout must keep its lease while another worker thread polls for work,
+// instead of expiring, being leased again and having its report turned down as stale
+template<typename int_type>
+bool test_lease_heartbeat()
+{
+	std::cout << "test_lease_heartbeat() starting" << std::endl;
+
+	std::vector<char> results(4);
+	std::iota(results.begin(), results.end(), 'A');
+
+	bool error = false;
+	concurrent_shard::lease_coordinator coordinator(1, 1, std::chrono::milliseconds(200), 1);
+	std::string listen_error;
+	if (!coordinator.listen("127.0.0.1", 0, listen_error))
+	{
+		std::cerr << listen_error << std::endl;
+		return false;
+	}
+
+	bool served = false;
+	std::thread server([&]()
+	{
+		served = coordinator.serve([](const std::string& error) { std::cerr << error << std::endl; });
+	});
+
+	std::atomic<uint64_t> count(0);
+	auto callback = [&count](const int /*thread_index*/, const std::vector<char>& /*cont*/) -> bool
+	{
+		++count;
+		return true;
+	};
+	auto chunk_worker = [&](int thread_index, uint64_t chunk_begin, uint64_t chunk_end) -> bool
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(700));
+		return concurrent_perm::compute_perm_chunks(int_type(thread_index), results, chunk_begin, chunk_end, callback,
+			[](const int /*thread_index*/, const std::vector<char>& /*cont*/, const std::string& error) { std::cerr << error << std::endl; });
+	};
+	if (!concurrent_shard::run_lease_worker("localhost", coordinator.port(), 2, chunk_worker,
+		[](int thread_index, const std::string& error) { std::cerr << error << std::endl; }))
+		error = true;
+	server.join();
+
+	const concurrent_shard::lease_stats& stats = coordinator.stats();
+	if (!served || count != 24 || stats.expired != 0 || stats.stale_reports != 0 || stats.renewals == 0)
 	{
-		return true;
+		error = true;
+		std::cerr << "processed " << count << " of 24 permutations, " << stats.expired << " expired leases, "
+			<< stats.stale_reports << " stale reports, " << stats.renewals << " renewals" << std::endl;
 	}
-};
 
-template<typename container_type>
-struct error_callback_t
+	std::cout << "test_lease_heartbeat() finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+
+// every shard writes its records in place; the file must read back as the next_permutation sequence
+template<typename int_type>
+bool test_export_perm(int_type thread_cnt, int_type cpu_cnt, uint32_t set_size, const concurrent_export::export_options& options)
 {
-	void operator()(const int thread_index, const container_type& cont, const std::string& error)
+	std::cout << "test_export_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ", " << ((options.method == concurrent_export::export_method::mmap_write) ? "mmap" : "pwrite") << ") starting" << std::endl;
+
+	bool error = false;
+	const std::string path = "test_export_perm.bin";
+	for (int_type cpu_index = 0; cpu_index < cpu_cnt; ++cpu_index)
 	{
-		std::cerr << error << std::endl;
+		std::string export_error;
+		if (!concurrent_export::export_all_perm_shard(cpu_index, cpu_cnt, thread_cnt, set_size, path, options, export_error))
+		{
+			error = true;
+			std::cerr << export_error << std::endl;
+		}
 	}
-};
 
-//typedef boost::multiprecision::cpp_int int_type;
-//typedef boost::multiprecision::int256_t int_type;
-typedef int64_t int_type;
+	std::ifstream ifs(path.c_str(), std::ios::binary);
+	std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	std::remove(path.c_str());
+
+	const uint32_t record_size = concurrent_export::export_record_size(set_size, set_size);
+	std::vector<uint32_t> expected(set_size);
+	std::iota(expected.begin(), expected.end(), 0);
+	std::vector<uint32_t> indices;
+	size_t offset = 0;
+	do
+	{
+		if (offset + record_size > data.size())
+		{
+			error = true;
+			std::cerr << "export file too short: " << data.size() << " bytes" << std::endl;
+			break;
+		}
+		concurrent_export::decode_record(reinterpret_cast<const unsigned char*>(&data[offset]), set_size, concurrent_export::export_index_bytes(set_size), indices);
+		if (indices != expected)
+		{
+			error = true;
+			std::cerr << "wrong record at offset " << offset << std::endl;
+			break;
+		}
+		offset += record_size;
+	} while (std::next_permutation(expected.begin(), expected.end()));
+	if (!error && offset != data.size())
+	{
+		error = true;
+		std::cerr << "export file has " << data.size() << " bytes instead of " << offset << std::endl;
+	}
+
+	std::cout << "test_export_perm(" << thread_cnt << ", " << cpu_cnt << ", " << set_size << ") finished with" << ((error) ? " errors" : " no errors") << std::endl;
+
+	return !error;
+}
+#endif
 
 int main(int argc, char* argv[])
 {
 	//benchmark_perm();
 
+	//benchmark_perm_prefix();
+
+	//benchmark_perm_generator();
+
+	//benchmark_perm_allocations();
+
+	//benchmark_perm_affinity();
+
 	//unit_test();
 
 	//unit_test_threaded();
@@ -246,6 +2067,52 @@ int main(int argc, char* argv[])
 
 	//unit_test_threaded_shard();
 
+	//unit_test_threaded_prune();
+
+	//unit_test_threaded_dfs();
+
+	//unit_test_threaded_prefix_shard();
+
+	//unit_test_find_first();
+
+	//unit_test_ordered();
+
+	//unit_test_pipeline();
+
+	//unit_test_reduce();
+
+	//unit_test_async();
+
+	//unit_test_generator();
+
+	//unit_test_range();
+
+	//unit_test_factory();
+
+	//unit_test_affinity();
+
+	//unit_test_auto();
+
+	//unit_test_processes();
+
+	//unit_test_lease();
+
+	//unit_test_weighted();
+
+	//unit_test_shard_plan();
+
+	//unit_test_export();
+
+	//unit_test_stream();
+
+	//unit_test_sample();
+
+	//unit_test_strided();
+
+	//unit_test_instrumented();
+
+	//unit_test_trace();
+
 	//unit_test_perm_by_idx();
 
 	usage_of_perm_by_idx();
@@ -298,6 +2165,143 @@ void benchmark_perm()
 	stopwatch.stop();
 }
 
+void benchmark_perm_prefix()
+{
+	std::string results(11, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+
+	timer stopwatch;
+	typedef prefix_cache_callback_t<decltype(results)> callback_t;
+	typedef error_callback_t<decltype(results)> err_callback_t;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::ostringstream oss;
+		oss << "index " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_perm::compute_all_perm(thread_cnt, results, callback_t(), err_callback_t());
+		stopwatch.stop();
+
+		oss.str("");
+		oss << "prefix " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_perm::compute_all_perm_prefix(thread_cnt, results, callback_t(), err_callback_t());
+		stopwatch.stop();
+	}
+}
+
+void benchmark_perm_generator()
+{
+	std::string results(11, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+
+	timer stopwatch;
+	typedef checksum_callback_t<decltype(results)> callback_t;
+	typedef error_callback_t<decltype(results)> err_callback_t;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::ostringstream oss;
+		oss << "callback " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_perm::compute_all_perm(thread_cnt, results, callback_t(), err_callback_t());
+		stopwatch.stop();
+
+		oss.str("");
+		oss << "generator " << thread_cnt << " thread(s)";
+		stopwatch.start(oss.str());
+		concurrent_perm::compute_all_perm_generators(thread_cnt, results, 
+			[](const int thread_index, concurrent_perm::perm_generator<std::string, int_type>& gen)
+			{
+				uint64_t sum = 0;
+				for (const auto& cont : gen)
+				{
+					sum += cont[0] ^ cont[cont.size() - 1];
+					if (sum == 1)
+						break;
+				}
+			}, err_callback_t());
+		stopwatch.stop();
+	}
+}
+
+void benchmark_perm_allocations()
+{
+	std::string results(11, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(results.size(), factorial);
+
+	timer stopwatch;
+	typedef allocating_callback_t<decltype(results)> callback_t;
+	typedef error_callback_t<decltype(results)> err_callback_t;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		std::ostringstream oss;
+		oss << "copied " << thread_cnt << " thread(s)";
+		uint64_t allocations = allocation_cnt();
+		stopwatch.start(oss.str());
+		concurrent_perm::compute_all_perm(thread_cnt, results, callback_t(), err_callback_t());
+		stopwatch.stop();
+		allocations = allocation_cnt() - allocations;
+		std::cout << "allocations: " << allocations << ", per permutation: " << double(allocations) / factorial << std::endl;
+
+		oss.str("");
+		oss << "factory " << thread_cnt << " thread(s)";
+		allocations = allocation_cnt();
+		stopwatch.start(oss.str());
+		concurrent_perm::compute_all_perm_factory(thread_cnt, results, 
+			[&results](const int thread_index) { return arena_callback_t<std::string>(results.size()); }, err_callback_t());
+		stopwatch.stop();
+		allocations = allocation_cnt() - allocations;
+		std::cout << "allocations: " << allocations << ", per permutation: " << double(allocations) / factorial << std::endl;
+
+		// the arena and the empty callback must not allocate per permutation: the first of two shards of the same
+		// container unranks the same thread starts as the whole run, so it allocates as much with half the permutations
+		auto count_allocations = [&](int_type cpu_cnt, bool arena) -> uint64_t
+		{
+			const uint64_t before = allocation_cnt();
+			if (arena)
+				concurrent_perm::compute_all_perm_factory_shard(int_type(0), cpu_cnt, thread_cnt, results,
+					[&results](const int thread_index) { return arena_callback_t<std::string>(results.size()); }, err_callback_t());
+			else
+				concurrent_perm::compute_all_perm_shard(int_type(0), cpu_cnt, thread_cnt, results, empty_callback_t<std::string>(), err_callback_t());
+			return allocation_cnt() - before;
+		};
+		const bool arena_zero = count_allocations(1, true) == count_allocations(2, true);
+		const bool empty_zero = count_allocations(1, false) == count_allocations(2, false);
+		std::cout << "zero allocations per permutation with " << thread_cnt << " thread(s): " << ((arena_zero && empty_zero) ? "passed" : "failed") << std::endl;
+	}
+}
+
+// scaling up to every hardware thread, with threads left to the OS and pinned compactly or scattered over NUMA nodes
+void benchmark_perm_affinity()
+{
+	std::string results(12, 'A');
+	std::iota(results.begin(), results.end(), 'A');
+
+	timer stopwatch;
+	typedef empty_callback_t<decltype(results)> callback_t;
+	typedef error_callback_t<decltype(results)> err_callback_t;
+
+	const char* names[] = { "none", "compact", "scatter" };
+	const concurrent_perm::affinity_kind kinds[] = { concurrent_perm::affinity_kind::none, concurrent_perm::affinity_kind::compact, concurrent_perm::affinity_kind::scatter };
+	const int_type max_thread_cnt = (std::max)(1u, std::thread::hardware_concurrency());
+	for (int_type thread_cnt = 1; thread_cnt <= max_thread_cnt; thread_cnt = (thread_cnt < 4) ? thread_cnt + 1 : thread_cnt * 2)
+	{
+		for (int k = 0; k < 3; ++k)
+		{
+			std::ostringstream oss;
+			oss << names[k] << " " << thread_cnt << " thread(s)";
+			stopwatch.start(oss.str());
+			concurrent_perm::compute_all_perm_affinity(thread_cnt, results, callback_t(), err_callback_t(), concurrent_perm::affinity_policy(kinds[k]));
+			stopwatch.stop();
+		}
+	}
+}
+
 void test_find_perm(uint32_t set_size)
 {
 	std::cout << "test_find_perm(" << set_size << ") starting" << std::endl;
@@ -378,6 +2382,454 @@ void unit_test_threaded_shard()
 	//test_threaded_perm_shard(thread_cnt, 2); // should fail
 }
 
+void unit_test_threaded_prune()
+{
+	int_type thread_cnt = 4;
+	test_threaded_perm_prune(thread_cnt, 5);
+	test_threaded_perm_prune(thread_cnt, 6);
+	test_threaded_perm_prune(thread_cnt, 7);
+	test_threaded_perm_prune(thread_cnt, 8);
+	test_threaded_perm_prune(thread_cnt, 9);
+	test_threaded_perm_prune(thread_cnt, 10);
+}
+
+void unit_test_threaded_dfs()
+{
+	int_type thread_cnt = 4;
+	int_type cpu_cnt = 1;
+	test_threaded_perm_dfs(thread_cnt, cpu_cnt, 2);
+	test_threaded_perm_dfs(thread_cnt, cpu_cnt, 5);
+	test_threaded_perm_dfs(thread_cnt, cpu_cnt, 8);
+	cpu_cnt = 3;
+	test_threaded_perm_dfs(thread_cnt, cpu_cnt, 4);
+	test_threaded_perm_dfs(thread_cnt, cpu_cnt, 7);
+	test_threaded_perm_dfs(thread_cnt, cpu_cnt, 9);
+}
+
+void unit_test_threaded_prefix_shard()
+{
+	int_type thread_cnt = 2;
+	test_threaded_perm_prefix_shard(thread_cnt, 4);
+	test_threaded_perm_prefix_shard(thread_cnt, 6);
+	test_threaded_perm_prefix_shard(thread_cnt, 7);
+	test_threaded_perm_prefix_shard(thread_cnt, 8);
+	//test_threaded_perm_prefix_shard(thread_cnt, 2); // should fail
+}
+
+void unit_test_find_first()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_find_first_perm(thread_cnt, 4, 3);
+		test_find_first_perm(thread_cnt, 8, 5);
+		test_find_first_perm(thread_cnt, 10, 0);
+		test_find_first_perm(thread_cnt, 10, 1);
+	}
+}
+
+void unit_test_ordered()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_ordered_perm(thread_cnt, 1);
+		test_ordered_perm(thread_cnt, 4);
+		test_ordered_perm(thread_cnt, 8);
+		test_ordered_perm(thread_cnt, 9);
+	}
+}
+
+void unit_test_pipeline()
+{
+	for (int_type gen_cnt = 1; gen_cnt <= 3; ++gen_cnt)
+	{
+		for (int_type eval_cnt = 1; eval_cnt <= 3; ++eval_cnt)
+		{
+			test_pipeline_perm(gen_cnt, eval_cnt, 3);
+			test_pipeline_perm(gen_cnt, eval_cnt, 8);
+		}
+	}
+}
+
+void unit_test_reduce()
+{
+	test_reduce_perm(int_type(8), 3);
+	test_reduce_perm(int_type(8), 7);
+	test_reduce_perm(int_type(8), 9);
+}
+
+void unit_test_async()
+{
+	concurrent_perm::thread_pool pool(4);
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_async_perm(thread_cnt, 3, pool);
+		test_async_perm(thread_cnt, 9, pool);
+		test_async_perm(thread_cnt, 9, concurrent_perm::thread_pool::instance());
+	}
+
+	// permutation and combination jobs must share one pool rather than oversubscribe the machine with two
+	std::cout << "shared pool " << ((&concurrent_perm::thread_pool::instance() == &concurrent_comb::thread_pool::instance()) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_generator()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_generator_perm(thread_cnt, 1);
+		test_generator_perm(thread_cnt, 4);
+		test_generator_perm(thread_cnt, 8);
+	}
+}
+
+void unit_test_range()
+{
+	test_range_perm(1, int_type(1));
+	test_range_perm(4, int_type(1));
+	test_range_perm(4, int_type(5));
+	test_range_perm(8, int_type(1024));
+	test_range_perm(9, int_type(3000));
+}
+
+void unit_test_factory()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_factory_perm(thread_cnt, 1);
+		test_factory_perm(thread_cnt, 4);
+		test_factory_perm(thread_cnt, 8);
+	}
+}
+
+void unit_test_affinity()
+{
+	std::vector<int> cpus = concurrent_perm::parse_cpu_list("0-3,8,10-11");
+	std::vector<int> expected = { 0, 1, 2, 3, 8, 10, 11 };
+	std::cout << "parse_cpu_list " << ((cpus == expected) ? "passed" : "failed") << std::endl;
+
+	const std::vector<int> available = concurrent_perm::affinity_cpu_order(concurrent_perm::affinity_policy(concurrent_perm::affinity_kind::compact));
+	for (int_type thread_cnt = 1; thread_cnt <= 8; ++thread_cnt)
+	{
+		test_affinity_perm(thread_cnt, 8, concurrent_perm::affinity_policy());
+		test_affinity_perm(thread_cnt, 8, concurrent_perm::affinity_policy(concurrent_perm::affinity_kind::compact));
+		test_affinity_perm(thread_cnt, 8, concurrent_perm::affinity_policy(concurrent_perm::affinity_kind::scatter));
+		test_affinity_perm(thread_cnt, 8, concurrent_perm::affinity_policy(concurrent_perm::affinity_kind::cpu_list, std::vector<int>(1, available.back())));
+	}
+
+	// compact and scatter must stay within the CPUs this process may run on
+	const std::vector<int> allowed = concurrent_perm::allowed_cpus();
+	bool subset = true;
+	const std::vector<int> scattered = concurrent_perm::affinity_cpu_order(concurrent_perm::affinity_policy(concurrent_perm::affinity_kind::scatter));
+	for (size_t i = 0; i < scattered.size(); ++i)
+	{
+		if (!allowed.empty() && !std::binary_search(allowed.begin(), allowed.end(), scattered[i]))
+			subset = false;
+	}
+	for (size_t i = 0; i < available.size(); ++i)
+	{
+		if (!allowed.empty() && !std::binary_search(allowed.begin(), allowed.end(), available[i]))
+			subset = false;
+	}
+	std::cout << "affinity_cpu_order within allowed_cpus " << ((subset) ? "passed" : "failed") << std::endl;
+
+#if defined(__linux__)
+	// a CPU that cannot be pinned is reported, and the work still runs unpinned
+	std::string value = "12345678";
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(value.size(), factorial);
+	std::atomic<uint64_t> count(0);
+	std::atomic<int> reported(0);
+	auto callback = [&count](const int thread_index, const std::string& cont) -> bool
+	{
+		++count;
+		return true;
+	};
+	auto err_callback = [&reported](const int thread_index, const std::string& cont, const std::string& error) -> void
+	{
+		++reported;
+	};
+	const bool ok = concurrent_perm::compute_all_perm_affinity(int_type(2), value, callback, err_callback,
+		concurrent_perm::affinity_policy(concurrent_perm::affinity_kind::cpu_list, std::vector<int>(1, 100000)));
+	std::cout << "pin failure reported " << ((ok && reported == 2 && int_type(count) == factorial) ? "passed" : "failed") << std::endl;
+#endif
+}
+
+void unit_test_auto()
+{
+	std::cout << "available_cpu_cnt:" << concurrent_perm::available_cpu_cnt() << std::endl;
+	test_auto_perm<int_type>(1);
+	test_auto_perm<int_type>(4);
+	test_auto_perm<int_type>(8);
+	test_auto_perm<int_type>(10);
+	test_auto_perm<int_type>(11);
+
+	// an expensive callback must end the warm-up after an item or two, not after 16
+	concurrent_perm::auto_plan plan;
+	std::atomic<int> count(0);
+	const bool done = concurrent_perm::compute_all_perm_auto<int_type>(std::string("ABCD"),
+		[&count](const int /*thread_index*/, const std::string& /*cont*/) -> bool
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			++count;
+			return true;
+		},
+		[](const int /*thread_index*/, const std::string& /*cont*/, const std::string& error) { std::cerr << error << std::endl; }, plan);
+	std::cout << "short warm-up of " << plan.warmup_cnt << " item(s) " << ((done && count == 24 && plan.warmup_cnt <= 2) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_processes()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	int cpu_index = 0;
+	int cpu_cnt = 0;
+	const bool parsed = concurrent_shard::parse_shard_arg("2/4", cpu_index, cpu_cnt) && cpu_index == 2 && cpu_cnt == 4
+		&& !concurrent_shard::parse_shard_arg("4/4", cpu_index, cpu_cnt) && !concurrent_shard::parse_shard_arg("1/2x", cpu_index, cpu_cnt);
+	std::cout << "parse_shard_arg " << (parsed ? "passed" : "failed") << std::endl;
+
+	for (int cpu_cnt = 1; cpu_cnt <= 4; ++cpu_cnt)
+	{
+		test_process_perm(int_type(1), cpu_cnt, 3);
+		test_process_perm(int_type(2), cpu_cnt, 8);
+		test_process_perm(int_type(3), cpu_cnt, 9);
+	}
+
+	// a failing shard must be reported, not merged silently
+	std::vector<std::string> shard_results;
+	auto ignore_progress = [](int, uint64_t, uint64_t) {};
+	auto print_error = [](int cpu_index, const std::string& error) { std::cerr << "expected error from shard " << cpu_index << ": " << error << std::endl; };
+	const bool failed = !concurrent_shard::run_local_shards(2, [](int cpu_index, int, concurrent_shard::shard_channel&) { return cpu_index == 0; }, shard_results, ignore_progress, print_error)
+		&& !concurrent_shard::run_command_shards({ "true", "exit 3" }, shard_results, ignore_progress, print_error)
+		&& concurrent_shard::run_command_shards({ "true", "true" }, shard_results, ignore_progress, print_error);
+	std::cout << "shard failures " << (failed ? "passed" : "failed") << std::endl;
+#endif
+}
+
+void unit_test_lease()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	test_lease_perm<int_type>(1, 1, 4);
+	test_lease_perm<int_type>(2, 2, 8);
+	test_lease_perm<int_type>(3, 2, 9);
+	test_lease_heartbeat<int_type>();
+#endif
+
+	// a chunk range whose callback throws must not count as done
+	std::vector<char> results(9);
+	std::iota(results.begin(), results.end(), 'A');
+	uint64_t calls = 0;
+	auto throwing_callback = [&calls](const int thread_index, const std::vector<char>& cont) -> bool
+	{
+		if (++calls == 100)
+			throw std::runtime_error("callback failed");
+		return true;
+	};
+	auto err_callback = [](const int thread_index, const std::vector<char>& cont, const std::string& error) -> void
+	{
+	};
+	const bool done = concurrent_perm::compute_perm_chunks(int_type(0), results, 0, 1, throwing_callback, err_callback);
+	std::cout << "compute_perm_chunks failed on exception " << ((!done) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_weighted()
+{
+	int64_t start_index = 0;
+	int64_t end_index = 0;
+	int64_t factorial = 0;
+	concurrent_perm::compute_factorial(20, factorial);
+	bool exact = true;
+	concurrent_perm::split_weighted_range(factorial, std::vector<uint32_t>{ 1, 4294967294u }, 1, start_index, end_index);
+	exact = exact && start_index == 566454140LL && end_index == factorial;
+	concurrent_perm::split_weighted_range(factorial, std::vector<uint32_t>{ 3, 4 }, 1, start_index, end_index);
+	exact = exact && start_index == 1042672289218560000LL;
+	concurrent_perm::split_weighted_range(factorial, std::vector<uint32_t>{ 4294967290u, 5 }, 0, start_index, end_index);
+	exact = exact && start_index == 0 && end_index == 2432902005344369296LL;
+	std::cout << "split_weighted_range " << (exact ? "passed" : "failed") << std::endl;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_weighted_perm(thread_cnt, 4, std::vector<uint32_t>{ 1 });
+		test_weighted_perm(thread_cnt, 8, std::vector<uint32_t>{ 16, 96 });
+		test_weighted_perm(thread_cnt, 8, std::vector<uint32_t>{ 1, 2, 3, 4 });
+		test_weighted_perm(thread_cnt, 8, std::vector<uint32_t>{ 0, 5, 0, 1 });
+	}
+
+	// a calibration run on one node, then weights for a fleet where the other node is 6 times faster
+	std::vector<char> results(11);
+	std::iota(results.begin(), results.end(), 'A');
+	double items_per_sec = 0.0;
+	concurrent_perm::measure_perm_throughput(int_type(2), results, 
+		[](const int thread_index, const std::vector<char>& cont) { return true; },
+		[](const int thread_index, const std::vector<char>& cont, const std::string& error) { std::cerr << error; },
+		int_type(1000000), items_per_sec);
+	const std::vector<uint32_t> weights = concurrent_perm::throughput_weights(std::vector<double>{ items_per_sec, 6 * items_per_sec, 0.0 });
+	std::cout << "items_per_sec:" << items_per_sec << ", weights:" << weights[0] << " " << weights[1] << " " << weights[2] << std::endl;
+	std::cout << "throughput_weights " << ((weights[1] / 6 == weights[0] && weights[2] == 0) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_shard_plan()
+{
+	test_shard_plan_perm<int_type>(1, std::vector<uint32_t>{ 1 }, 1);
+	test_shard_plan_perm<int_type>(5, std::vector<uint32_t>{ 1, 1 }, 4);
+	test_shard_plan_perm<int_type>(8, std::vector<uint32_t>{ 16, 96 }, 3);
+	test_shard_plan_perm<int_type>(8, std::vector<uint32_t>{ 1, 0, 2 }, 2);
+}
+
+void unit_test_export()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	concurrent_export::export_options mmap_options;
+	concurrent_export::export_options pwrite_options;
+	pwrite_options.method = concurrent_export::export_method::pwrite_write;
+	pwrite_options.staging_bytes = 100; // many flushes per thread
+	pwrite_options.huge_pages = true;
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_export_perm(thread_cnt, int_type(1), 1, mmap_options);
+		test_export_perm(thread_cnt, int_type(1), 8, mmap_options);
+		test_export_perm(thread_cnt, int_type(3), 8, mmap_options);
+		test_export_perm(thread_cnt, int_type(1), 8, pwrite_options);
+		test_export_perm(thread_cnt, int_type(3), 9, pwrite_options);
+	}
+
+	// a buffer on MAP_HUGETLB must map whole huge pages, or munmap fails
+	concurrent_export::staging_buffer buffer(100, true);
+	const size_t mapped = buffer.mapped_size();
+	const bool whole = (mapped == buffer.size()) || (mapped >= buffer.size() && mapped % concurrent_export::huge_page_size() == 0);
+	std::cout << "staging_buffer mapped " << mapped << " bytes " << ((buffer.data() != nullptr && whole) ? "passed" : "failed") << std::endl;
+
+#if !defined(__APPLE__)
+	// the export file must be allocated, not sparse, so mapped writes cannot run out of space
+	{
+		const std::string path = "test_export_allocated.bin";
+		const uint64_t size = 1 << 20;
+		concurrent_export::export_file file;
+		std::string open_error;
+		struct stat st;
+		const bool opened = file.open(path, size, concurrent_export::export_method::mmap_write, open_error) && ::stat(path.c_str(), &st) == 0;
+		if (!opened)
+			std::cerr << open_error << std::endl;
+		file.close();
+		std::remove(path.c_str());
+		std::cout << "export_file allocated " << ((opened && uint64_t(st.st_size) == size && uint64_t(st.st_blocks) * 512 >= size) ? "passed" : "failed") << std::endl;
+	}
+#endif
+#endif
+}
+
+void unit_test_stream()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_stream_perm(thread_cnt, int_type(1), 1, 1 << 16, false);
+		test_stream_perm(thread_cnt, int_type(1), 8, 1 << 16, false);
+		test_stream_perm(thread_cnt, int_type(3), 8, 1000, false);
+		test_stream_perm(thread_cnt, int_type(1), 8, 1000, true);
+		test_stream_perm(thread_cnt, int_type(2), 9, 777, true);
+	}
+}
+
+void unit_test_sample()
+{
+	test_sample_perm<int_type>(1, 10, 1, false);
+	test_sample_perm<int_type>(4, 24 * 200, 7, false);
+	test_sample_perm<int_type>(5, 1000, 42, false);
+	test_sample_perm<int_type>(20, 1000, 42, false);
+	test_sample_perm<int_type>(4, 24, 3, true);
+	test_sample_perm<int_type>(6, 500, 9, true);
+	test_sample_perm<int_type>(20, 1000, 11, true);
+
+	// more distinct samples than permutations must be refused
+	const bool refused = !concurrent_perm::sample_perm_distinct(int_type(2), std::string("ABC"), int_type(7), 1,
+		[](const int thread_index, const std::string& cont) { return true; },
+		[](const int thread_index, const std::string& cont, const std::string& error) { std::cout << "expected " << error << std::endl; });
+	std::cout << "sample_perm_distinct bound " << (refused ? "passed" : "failed") << std::endl;
+
+	// a callback that throws something other than std::exception must still be reported
+	std::atomic<int> reported(0);
+	concurrent_perm::sample_perm(int_type(2), std::string("ABCD"), int_type(10), 1,
+		[](const int thread_index, const std::string& cont) -> bool { throw 1; },
+		[&reported](const int thread_index, const std::string& cont, const std::string& error) { ++reported; });
+	std::cout << "sample_perm reports unknown exceptions " << ((reported == 2) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_strided()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_strided_perm(thread_cnt, int_type(1), 1, 16);
+		test_strided_perm(thread_cnt, int_type(1), 6, 1);
+		test_strided_perm(thread_cnt, int_type(1), 8, 100);
+		test_strided_perm(thread_cnt, int_type(3), 8, 64);
+		test_strided_perm(thread_cnt, int_type(2), 9, 1000000);
+	}
+	for (int_type thread_cnt = 2; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_strided_spread(thread_cnt, 5);
+		test_strided_spread(thread_cnt, 16);
+		test_strided_spread(thread_cnt, 33);
+		test_strided_spread(thread_cnt, thread_cnt * 16);
+	}
+
+	// stopped after half of the permutations, a strided run has seen every leading element, a block run only half
+	std::string results = "ABCDEF";
+	std::set<char> leading;
+	int visited = 0;
+	concurrent_perm::compute_all_perm_strided(int_type(1), 16, results,
+		[&](const int thread_index, const std::string& cont) -> bool
+		{
+			leading.insert(cont[0]);
+			return ++visited < 360;
+		},
+		[](const int thread_index, const std::string& cont, const std::string& error) { std::cerr << error << std::endl; });
+	std::cout << "early coverage " << ((visited == 360 && leading.size() == 6) ? "passed" : "failed") << std::endl;
+}
+
+void unit_test_instrumented()
+{
+	// percentiles of 1..100000 ns must be within the 6% bucket precision
+	concurrent_perm::latency_histogram histogram;
+	for (uint64_t ns = 1; ns <= 100000; ++ns)
+	{
+		histogram.record(ns);
+	}
+	const bool precise = histogram.percentile(50.0) >= 50000 && histogram.percentile(50.0) <= 53000
+		&& histogram.percentile(99.0) >= 99000 && histogram.percentile(100.0) == 100000 && histogram.min_ns == 1 && histogram.percentile(0.0) == 1;
+	std::cout << "latency_histogram " << (precise ? "passed" : "failed") << std::endl;
+
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_instrumented_perm(thread_cnt, 1, 1, false);
+		test_instrumented_perm(thread_cnt, 8, 1, false);
+		test_instrumented_perm(thread_cnt, 9, 64, false);
+	}
+	test_instrumented_perm(int_type(4), 8, 16, true);
+}
+
+void unit_test_trace()
+{
+	for (int_type thread_cnt = 1; thread_cnt <= 4; ++thread_cnt)
+	{
+		test_traced_perm(thread_cnt, int_type(1), 1, 16);
+		test_traced_perm(thread_cnt, int_type(1), 6, 1);
+		test_traced_perm(thread_cnt, int_type(3), 7, 16);
+	}
+
+	// a full buffer drops events instead of growing, and a stopping callback ends only its thread
+	std::string results = "ABCDEFG";
+	concurrent_trace::trace_options options;
+	options.max_events_per_thread = 4;
+	concurrent_trace::run_trace trace;
+	concurrent_trace::compute_all_perm_traced(int_type(2), results,
+		[](const int thread_index, const std::string& cont) { return cont[0] != 'D'; },
+		[](const int thread_index, const std::string& cont, const std::string& error) { std::cerr << error << std::endl; },
+		options, trace);
+	std::cout << "bounded trace " << ((trace.threads.size() == 2 && trace.threads[0].events.size() == 4 && trace.dropped() > 0) ? "passed" : "failed") << std::endl;
+	std::string error;
+	if (trace.write_json("trace_perm.json", error))
+		std::cout << "open trace_perm.json in chrome://tracing or https://ui.perfetto.dev" << std::endl;
+	else
+		std::cerr << error << std::endl;
+}
+
 void unit_test_perm_by_idx()
 {
 	uint64_t index_to_find = 0;
@@ -0,0 +1,208 @@
+// Shard planner: writes the JSON manifests of a job split over several nodes,
+// runs a job from its manifest, and merges the completion records of all jobs.
+//
+//   ShardPlan plan perm|comb <n> <k> <node[=weight]>... [--jobs-per-node <t>] [--out <prefix>]
+//       writes <prefix>.plan.json and one <prefix>.job<i>.json per job
+//   ShardPlan run <prefix.job<i>.json> [--out <records.json>]
+//       runs the job (or every job of a plan) over the elements 0..n-1 and writes
+//       the completion records as one JSON array, to standard output without --out
+//   ShardPlan merge <prefix.plan.json> <records.json>...
+//       checks that the records cover every arrangement exactly once
+//
+// Indices are exact for any n: they are boost::multiprecision::cpp_int and are written as JSON strings.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <boost/multiprecision/cpp_int.hpp>
+#include "../permcomb/shard_plan.h"
+
+typedef boost::multiprecision::cpp_int int_type;
+
+void usage()
+{
+	std::cerr << "usage: ShardPlan plan perm|comb <n> <k> <node[=weight]>... [--jobs-per-node <t>] [--out <prefix>]" << std::endl;
+	std::cerr << "       ShardPlan run <job.json> [--out <records.json>]" << std::endl;
+	std::cerr << "       ShardPlan merge <plan.json> <records.json>..." << std::endl;
+}
+
+bool read_file(const std::string& path, std::string& text)
+{
+	std::ifstream ifs(path.c_str(), std::ios::binary);
+	if (!ifs)
+	{
+		std::cerr << "Error: cannot read " << path << std::endl;
+		return false;
+	}
+	std::ostringstream oss;
+	oss << ifs.rdbuf();
+	text = oss.str();
+	return true;
+}
+
+bool write_file(const std::string& path, const std::string& text)
+{
+	std::ofstream ofs(path.c_str(), std::ios::binary);
+	ofs << text;
+	if (!ofs)
+	{
+		std::cerr << "Error: cannot write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int plan_command(int argc, char* argv[])
+{
+	if (argc < 6)
+	{
+		usage();
+		return 2;
+	}
+
+	const std::string mode = argv[2];
+	const uint32_t n = static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10));
+	const uint32_t k = static_cast<uint32_t>(std::strtoul(argv[4], nullptr, 10));
+	std::vector<std::string> nodes;
+	std::vector<uint32_t> weights;
+	uint32_t jobs_per_node = 1;
+	std::string prefix = "shard";
+	for (int i = 5; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--jobs-per-node" && i + 1 < argc)
+			jobs_per_node = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--out" && i + 1 < argc)
+			prefix = argv[++i];
+		else
+		{
+			const size_t eq = arg.find('=');
+			nodes.push_back(arg.substr(0, eq));
+			weights.push_back((eq == std::string::npos) ? 1 : static_cast<uint32_t>(std::strtoul(arg.c_str() + eq + 1, nullptr, 10)));
+		}
+	}
+
+	concurrent_shard::shard_plan<int_type> plan;
+	std::string error;
+	if (!concurrent_shard::make_shard_plan(mode, n, k, nodes, weights, jobs_per_node, plan, error))
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	if (!write_file(prefix + ".plan.json", concurrent_shard::plan_to_json(plan)))
+		return 1;
+	for (size_t i = 0; i < plan.jobs.size(); ++i)
+	{
+		std::ostringstream path;
+		path << prefix << ".job" << plan.jobs[i].job_index << ".json";
+		if (!write_file(path.str(), concurrent_shard::job_to_json(plan, plan.jobs[i])))
+			return 1;
+		std::cout << path.str() << ": " << plan.jobs[i].node << " [" << plan.jobs[i].start_index << ", " << plan.jobs[i].end_index << ")" << std::endl;
+	}
+	std::cout << prefix << ".plan.json: " << plan.jobs.size() << " jobs, " << plan.total << " arrangements" << std::endl;
+	return 0;
+}
+
+int run_command(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	std::string out;
+	if (argc >= 5 && std::string(argv[3]) == "--out")
+		out = argv[4];
+
+	std::string text;
+	std::string error;
+	concurrent_shard::shard_plan<int_type> plan;
+	if (!read_file(argv[2], text) || !concurrent_shard::parse_shard_plan(text, plan, error))
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::vector<uint32_t> cont(plan.n);
+	std::iota(cont.begin(), cont.end(), 0);
+	std::vector<concurrent_shard::shard_record<int_type> > records;
+	bool ok = false;
+	if (plan.mode == "perm")
+	{
+		ok = concurrent_shard::compute_perm_jobs(plan.jobs, cont,
+			[](const int /*thread_index*/, const std::vector<uint32_t>& /*arrangement*/) { return true; },
+			[](const int /*thread_index*/, const std::vector<uint32_t>& /*arrangement*/, const std::string& error) { std::cerr << error << std::endl; },
+			records);
+	}
+	else
+	{
+		ok = concurrent_shard::compute_comb_jobs(plan.jobs, cont,
+			[](const int /*thread_index*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& /*arrangement*/) { return true; },
+			[](const int /*thread_index*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& /*arrangement*/, const std::string& error) { std::cerr << error << std::endl; },
+			records);
+	}
+
+	// a single array, so the records of every job land in the one file merge reads
+	const std::string json = concurrent_shard::records_to_json(records);
+	if (out.empty())
+		std::cout << json;
+	else if (!write_file(out, json))
+		return 1;
+	return ok ? 0 : 1;
+}
+
+int merge_command(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		usage();
+		return 2;
+	}
+
+	std::string text;
+	std::string error;
+	concurrent_shard::shard_plan<int_type> plan;
+	if (!read_file(argv[2], text) || !concurrent_shard::parse_shard_plan(text, plan, error))
+	{
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::vector<concurrent_shard::shard_record<int_type> > records;
+	for (int i = 3; i < argc; ++i)
+	{
+		if (!read_file(argv[i], text) || !concurrent_shard::parse_shard_records(text, records, error))
+		{
+			std::cerr << argv[i] << ": " << error << std::endl;
+			return 1;
+		}
+	}
+
+	std::string report;
+	if (!concurrent_shard::verify_coverage(plan, records, report))
+	{
+		std::cerr << report;
+		return 1;
+	}
+	std::cout << "all " << plan.total << " arrangements covered exactly once by " << records.size() << " records" << std::endl;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	const std::string command = (argc > 1) ? argv[1] : "";
+	if (command == "plan")
+		return plan_command(argc, argv);
+	if (command == "run")
+		return run_command(argc, argv);
+	if (command == "merge")
+		return merge_command(argc, argv);
+
+	usage();
+	return 2;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// Replaces the global operator new to count heap allocations.
+// Include it in one translation unit only, the program's main one.
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Heap allocations so far. A function-local static, so the counter has a single definition even though
+// the header must define operator new, and is constant-initialized before any allocation.
+inline std::atomic<uint64_t>& allocation_cnt()
+{
+	static std::atomic<uint64_t> cnt(0);
+	return cnt;
+}
+
+void* operator new(std::size_t size)
+{
+	++allocation_cnt();
+	if (void* p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // GCC does not see that free matches the malloc above
+#endif
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,202 @@
+#pragma once
+
+// Hardware counters of the calling thread and of the threads it starts while counting, read with perf_event_open.
+// Threads must be joined before stop() for their counts to be included, which every compute_all_* does.
+// Inheritance only reaches threads created after the counters open: the persistent thread_pool workers, which run the
+// compute_all_*_auto and async_compute_all_* engines, exist from the first use of the pool and are not counted.
+// Define PERMCOMB_PERF_COUNTERS before including timer.h to print them after every timing.
+// Elsewhere than Linux, or when perf_event_paranoid or the VM forbids a counter, that counter reads as unavailable.
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <sstream>
+#include <iomanip>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class perf_counters
+{
+public:
+	enum counter_kind { cycles, instructions, branch_misses, l1d_misses, llc_misses, context_switches, counter_cnt };
+
+	perf_counters()
+	{
+		for (int i = 0; i < counter_cnt; ++i)
+		{
+			fds[i] = -1;
+			values[i] = -1.0;
+		}
+#if defined(__linux__)
+		const uint32_t types[counter_cnt] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE };
+		const uint64_t configs[counter_cnt] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+			PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES };
+		// the first counter that opens leads the group, so the others are scheduled on and off the PMU with it
+		int leader = -1;
+		for (int i = 0; i < counter_cnt; ++i)
+		{
+			fds[i] = open_counter(types[i], configs[i], leader, false);
+			if (fds[i] < 0 && errno == EACCES)
+				fds[i] = open_counter(types[i], configs[i], leader, true);
+			if (fds[i] < 0)
+			{
+				if (reason.empty())
+					reason = std::string(names()[i]) + ": " + std::strerror(errno);
+			}
+			else if (leader < 0)
+				leader = fds[i];
+		}
+#else
+		reason = "perf_event_open is Linux only";
+#endif
+	}
+
+	~perf_counters()
+	{
+#if defined(__linux__)
+		for (int i = counter_cnt - 1; i >= 0; --i)
+		{
+			if (fds[i] >= 0)
+				close(fds[i]);
+		}
+#endif
+	}
+
+	perf_counters(const perf_counters&) = delete;
+	perf_counters& operator=(const perf_counters&) = delete;
+
+	// true when at least one counter opened; error() names the first that did not
+	bool available() const
+	{
+		return leader_fd() >= 0;
+	}
+
+	const std::string& error() const
+	{
+		return reason;
+	}
+
+	void start()
+	{
+#if defined(__linux__)
+		const int leader = leader_fd();
+		if (leader < 0)
+			return;
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	void stop()
+	{
+#if defined(__linux__)
+		const int leader = leader_fd();
+		if (leader < 0)
+			return;
+		ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		for (int i = 0; i < counter_cnt; ++i)
+		{
+			// value, time enabled, time running; scaled up when the PMU was shared with other groups
+			uint64_t data[3] = { 0, 0, 0 };
+			values[i] = -1.0;
+			if (fds[i] >= 0 && read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+				values[i] = double(data[0]) * double(data[1]) / double(data[2]);
+		}
+#endif
+	}
+
+	// count of the last start() to stop(), or -1.0 when the counter is unavailable
+	double value(counter_kind kind) const
+	{
+		return values[kind];
+	}
+
+	static const char* const* names()
+	{
+		static const char* const counter_names[counter_cnt] = { "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses", "context-switches" };
+		return counter_names;
+	}
+
+	// one line with every available counter, instructions per cycle and misses per thousand instructions
+	std::string to_string() const
+	{
+		std::ostringstream oss;
+		if (!available())
+		{
+			oss << "counters unavailable (" << reason << ")";
+			return oss.str();
+		}
+		oss << std::fixed << std::setprecision(0);
+		const char* separator = "";
+		for (int i = 0; i < counter_cnt; ++i)
+		{
+			if (values[i] >= 0.0)
+			{
+				oss << separator << names()[i] << " " << values[i];
+				separator = ", ";
+			}
+		}
+		oss << std::setprecision(2);
+		if (values[cycles] > 0.0 && values[instructions] >= 0.0)
+			oss << ", IPC " << values[instructions] / values[cycles];
+		if (values[instructions] > 0.0)
+		{
+			const int per_kilo[] = { branch_misses, l1d_misses, llc_misses };
+			for (int i = 0; i < 3; ++i)
+			{
+				if (values[per_kilo[i]] >= 0.0)
+					oss << ", " << names()[per_kilo[i]] << "/Kinstr " << values[per_kilo[i]] * 1000.0 / values[instructions];
+			}
+		}
+		separator = " (not counted: ";
+		for (int i = 0; i < counter_cnt; ++i)
+		{
+			if (fds[i] < 0)
+			{
+				oss << separator << names()[i];
+				separator = ", ";
+			}
+		}
+		if (!reason.empty())
+			oss << "; " << reason << ")";
+		return oss.str();
+	}
+
+private:
+	int leader_fd() const
+	{
+		for (int i = 0; i < counter_cnt; ++i)
+		{
+			if (fds[i] >= 0)
+				return fds[i];
+		}
+		return -1;
+	}
+
+#if defined(__linux__)
+	static int open_counter(uint32_t type, uint64_t config, int group_fd, bool user_only)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = (group_fd < 0) ? 1 : 0;
+		attr.inherit = 1; // worker threads created after this are counted too, but not the already running thread_pool workers
+		attr.exclude_kernel = user_only ? 1 : 0;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+	}
+#endif
+
+	int fds[counter_cnt];
+	double values[counter_cnt];
+	std::string reason;
+};
@@ -4,6 +4,10 @@
 #include <iostream>
 #include <iomanip>
 
+#if defined(PERMCOMB_PERF_COUNTERS)
+#include "perf_counters.h"
+#endif
+
 class timer
 {
 public:
@@ -11,17 +15,29 @@ public:
 	void start(const std::string& text_)
 	{
 		text = text_;
+#if defined(PERMCOMB_PERF_COUNTERS)
+		counters.start();
+#endif
 		begin = std::chrono::system_clock::now();
 	}
 	void stop()
 	{
 		auto end = std::chrono::system_clock::now();
+#if defined(PERMCOMB_PERF_COUNTERS)
+		counters.stop();
+#endif
 		auto dur = end - begin;
 		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
 		std::cout << std::setw(16) << text << ":" << std::setw(5) << ms << "ms" << std::endl;
+#if defined(PERMCOMB_PERF_COUNTERS)
+		std::cout << std::setw(17) << " " << counters.to_string() << std::endl;
+#endif
 	}
 
 private:
 	std::string text;
 	std::chrono::system_clock::time_point begin;
+#if defined(PERMCOMB_PERF_COUNTERS)
+	perf_counters counters;
+#endif
 };
@@ -23,7 +23,23 @@
 #include <numeric> // for iota
 #include <cstdint>
 #include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "combination.h"
+#include "concurrent_common.h"
 
 namespace concurrent_comb
 {
@@ -235,6 +251,114 @@ bool find_comb(const uint32_t fullset,
 	return true;
 };
 
+// A prefix of length depth holds the first depth positions of a combination. It is valid while it can still be
+// completed, and its subtree then holds C(fullset - 1 - last position, subset - depth) combinations.
+inline bool next_comb_prefix(const uint32_t fullset, const uint32_t subset, std::vector<uint32_t>& prefix)
+{
+	const uint32_t depth = static_cast<uint32_t>(prefix.size());
+	for (uint32_t i = depth; i > 0; --i)
+	{
+		if (prefix[i - 1] < fullset - subset + i - 1)
+		{
+			++prefix[i - 1];
+			for (uint32_t j = i; j < depth; ++j)
+				prefix[j] = prefix[j - 1] + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+template<typename int_type>
+int_type comb_prefix_weight(const uint32_t fullset, const uint32_t subset, const std::vector<uint32_t>& prefix)
+{
+	int_type weight = 0;
+	compute_total_comb(fullset - 1 - prefix.back(), subset - static_cast<uint32_t>(prefix.size()), weight);
+	return weight;
+}
+
+// Shortest prefix length whose largest subtree is at most 1/16 of a part, so weighted prefix blocks stay balanced.
+template<typename int_type>
+uint32_t comb_prefix_depth(const uint32_t fullset, const uint32_t subset, uint64_t part_cnt)
+{
+	int_type total = 0;
+	compute_total_comb(fullset, subset, total);
+
+	for (uint32_t depth = 1; depth < subset; ++depth)
+	{
+		int_type largest = 0;
+		compute_total_comb(fullset - depth, subset - depth, largest);
+		if (largest <= total / int_type(part_cnt * 16))
+			return depth;
+	}
+	return subset;
+}
+
+// Split the prefixes in [first, last) into part_cnt blocks holding about the same number of combinations.
+// bounds receives part_cnt + 1 prefixes where an empty prefix stands for the end of all prefixes.
+template<typename int_type>
+void split_comb_prefixes(const uint32_t fullset, const uint32_t subset, const std::vector<uint32_t>& first, const std::vector<uint32_t>& last, uint64_t part_cnt, std::vector<std::vector<uint32_t> >& bounds)
+{
+	bounds.assign(part_cnt + 1, last);
+	bounds[0] = first;
+	if (first.empty())
+		return;
+
+	int_type total = 0;
+	std::vector<uint32_t> prefix = first;
+	bool has_prefix = true;
+	while (has_prefix && (last.empty() || prefix < last))
+	{
+		total += comb_prefix_weight<int_type>(fullset, subset, prefix);
+		has_prefix = next_comb_prefix(fullset, subset, prefix);
+	}
+
+	const int_type each = total / int_type(part_cnt);
+	int_type count = 0;
+	uint64_t part = 1;
+	prefix = first;
+	has_prefix = true;
+	while (part < part_cnt && has_prefix && (last.empty() || prefix < last))
+	{
+		while (part < part_cnt && count >= each * int_type(part))
+		{
+			bounds[part] = prefix;
+			++part;
+		}
+		count += comb_prefix_weight<int_type>(fullset, subset, prefix);
+		has_prefix = next_comb_prefix(fullset, subset, prefix);
+	}
+}
+
+inline void extend_comb_prefix(uint32_t depth, std::vector<uint32_t>& prefix)
+{
+	while (!prefix.empty() && prefix.size() < depth)
+	{
+		prefix.push_back(prefix.back() + 1);
+	}
+}
+
+// The cpu level split only depends on cpu_cnt so that every machine agrees on it whatever its thread_cnt.
+// thread_bounds receives the prefix blocks of every thread of cpu_index.
+template<typename int_type>
+void comb_prefix_shard(const uint32_t fullset, const uint32_t subset, uint64_t cpu_index, uint64_t cpu_cnt, uint64_t thread_cnt, uint32_t& depth, std::vector<std::vector<uint32_t> >& thread_bounds)
+{
+	const uint32_t cpu_depth = comb_prefix_depth<int_type>(fullset, subset, cpu_cnt);
+	std::vector<uint32_t> first(cpu_depth);
+	std::iota(first.begin(), first.end(), 0);
+
+	std::vector<std::vector<uint32_t> > cpu_bounds;
+	split_comb_prefixes<int_type>(fullset, subset, first, std::vector<uint32_t>(), cpu_cnt, cpu_bounds);
+
+	depth = comb_prefix_depth<int_type>(fullset, subset, cpu_cnt * thread_cnt);
+	std::vector<uint32_t> cpu_first = cpu_bounds[cpu_index];
+	std::vector<uint32_t> cpu_last = cpu_bounds[cpu_index + 1];
+	extend_comb_prefix(depth, cpu_first);
+	extend_comb_prefix(depth, cpu_last);
+
+	split_comb_prefixes<int_type>(fullset, subset, cpu_first, cpu_last, thread_cnt, thread_bounds);
+}
+
 template<typename container_type, typename index_type, typename callback_type, typename error_callback_type, typename predicate_type>
 typename std::enable_if<!std::is_same<predicate_type, no_predicate_type>::value>::type 
 comb_loop(const int thread_index, container_type& cont_full_set, container_type& cont, const index_type& start, const index_type& end, callback_type callback, error_callback_type err_callback, predicate_type pred)
@@ -271,7 +395,7 @@ comb_loop(const int thread_index, container_type& cont_full_set, container_type&
 
 template<typename container_type, typename index_type, typename callback_type, typename error_callback_type, typename predicate_type>
 typename std::enable_if<std::is_same<predicate_type, no_predicate_type>::value>::type 
-comb_loop(const int thread_index, container_type& cont_full_set, container_type& cont, const index_type& start, const index_type& end, callback_type callback, error_callback_type err_callback, predicate_type pred)
+comb_loop(const int thread_index, container_type& cont_full_set, container_type& cont, const index_type& start, const index_type& end, callback_type callback, error_callback_type err_callback, predicate_type /*pred*/)
 {
     index_type j = start;
     try
@@ -303,6 +427,123 @@ comb_loop(const int thread_index, container_type& cont_full_set, container_type&
     }
 }
 
+struct default_equal
+{
+	template<typename T>
+	bool operator()(const T& a, const T& b) const
+	{
+		return a == b;
+	}
+};
+
+// Pascal's triangle with every entry clamped to limit, so no intermediate can overflow index_type.
+template<typename index_type>
+index_type bounded_total_comb(uint32_t fullset, uint32_t subset, const index_type& limit)
+{
+	if (subset > fullset)
+		return index_type(0);
+
+	std::vector<index_type> row(subset + 1, index_type(0));
+	row[0] = 1;
+	for (uint32_t n = 1; n <= fullset; ++n)
+	{
+		for (uint32_t r = std::min(n, subset); r > 0; --r)
+		{
+			if (row[r] >= limit || row[r - 1] >= limit - row[r])
+				row[r] = limit;
+			else
+				row[r] += row[r - 1];
+		}
+	}
+	return row[subset];
+}
+
+// Move cont to the first combination after every combination sharing its first depth elements.
+// skipped receives the distance in indices. Returns false if that distance reaches remaining.
+template<typename container_type, typename index_type, typename equal_type>
+bool skip_comb_subtree(container_type& cont_full_set, container_type& cont, uint32_t depth, const index_type& remaining, index_type& skipped, equal_type equal)
+{
+	const uint32_t fullset = static_cast<uint32_t>(cont_full_set.size());
+	const uint32_t subset = static_cast<uint32_t>(cont.size());
+
+	// distance = 1 + sum of C(elements after position i, subset - i) for i in [depth, subset)
+	skipped = 1;
+	uint32_t pos = 0;
+	for (uint32_t i = 0; i < subset; ++i)
+	{
+		while (pos < fullset && !equal(cont[i], cont_full_set[pos]))
+			++pos;
+		if (i >= depth)
+		{
+			index_type rest = bounded_total_comb(fullset - 1 - pos, subset - i, remaining);
+			if (rest >= remaining - skipped)
+				return false;
+			skipped += rest;
+		}
+	}
+
+	for (uint32_t i = depth; i < subset; ++i)
+	{
+		cont[i] = cont_full_set[fullset - subset + i];
+	}
+	stdcomb::next_combination(cont_full_set.begin(), cont_full_set.end(), cont.begin(), cont.end(), equal);
+	return true;
+}
+
+template<typename container_type, typename index_type, typename callback_type, typename error_callback_type, typename predicate_type>
+typename std::enable_if<!std::is_same<predicate_type, no_predicate_type>::value>::type 
+comb_loop_prune(const int thread_index, container_type& cont_full_set, container_type& cont, const index_type& start, const index_type& end, callback_type callback, error_callback_type err_callback, predicate_type pred)
+{
+    const uint32_t subset = static_cast<uint32_t>(cont.size());
+    index_type j = start;
+    try
+    {
+        while (j < end)
+        {
+            uint32_t prune_depth = subset;
+            if (!callback(thread_index, cont_full_set.size(), cont, prune_depth))
+                return;
+            if (prune_depth < subset)
+            {
+                index_type skipped = 0;
+                if (!skip_comb_subtree(cont_full_set, cont, prune_depth, index_type(end - j), skipped, pred))
+                    return;
+                j += skipped;
+            }
+            else
+            {
+                stdcomb::next_combination(cont_full_set.begin(), cont_full_set.end(), cont.begin(), cont.end(), pred);
+                ++j;
+            }
+        }
+    }
+    catch(std::exception& ex)
+    {
+        std::ostringstream oss;
+        oss << "Exception thrown in comb_loop_prune:" << ex.what();
+        oss << ", start index:" << start;
+        oss << ", end index:" << end;
+        oss << ", counting index:" << j;
+        err_callback(thread_index, cont_full_set.size(), cont, oss.str());
+    }
+    catch(...)
+    {
+        std::ostringstream oss;
+        oss << "Unknown exception thrown in comb_loop_prune:";
+        oss << ", start index:" << start;
+        oss << ", end index:" << end;
+        oss << ", counting index:" << j;
+        err_callback(thread_index, cont_full_set.size(), cont, oss.str());
+    }
+}
+
+template<typename container_type, typename index_type, typename callback_type, typename error_callback_type, typename predicate_type>
+typename std::enable_if<std::is_same<predicate_type, no_predicate_type>::value>::type 
+comb_loop_prune(const int thread_index, container_type& cont_full_set, container_type& cont, const index_type& start, const index_type& end, callback_type callback, error_callback_type err_callback, predicate_type /*pred*/)
+{
+    comb_loop_prune(thread_index, cont_full_set, cont, start, end, callback, err_callback, default_equal());
+}
+
 template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type>
 void worker_thread_proc(const int_type thread_index, 
 						const container_type& cont,
@@ -347,8 +588,132 @@ void worker_thread_proc(const int_type thread_index,
 	}
 }
 
-template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
-bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+// Like worker_thread_proc, but starts from seed, the element indices of the combination at start_index
+// as returned by find_comb, such as the seed of a shard manifest, so start_index is not unranked again.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type>
+void worker_thread_proc_seeded(const int_type thread_index, 
+						const container_type& cont,
+						const std::vector<uint32_t>& seed,
+						int_type start_index, 
+						int_type end_index, 
+						callback_type callback,
+                        error_callback_type err_callback,
+						predicate_type pred)
+{
+	const int thread_index_n = static_cast<const int>(thread_index);
+
+	container_type vec;
+	for(size_t i=0; i<seed.size(); ++i)
+	{
+		vec.push_back(cont[seed[i]]);
+	}
+	container_type cont_fullset(cont.begin(), cont.end());
+	if(end_index <= std::numeric_limits<int>::max()) // use POD counter when possible
+	{ 
+		const int start_i = static_cast<int>(start_index);
+		const int end_i = static_cast<int>(end_index);
+
+		comb_loop(thread_index_n, cont_fullset, vec, start_i, end_i, callback, err_callback, pred);
+	}
+	else if (end_index <= std::numeric_limits<int64_t>::max()) // use POD counter when possible
+	{
+		const int64_t start_i = static_cast<int64_t>(start_index);
+		const int64_t end_i = static_cast<int64_t>(end_index);
+		comb_loop(thread_index_n, cont_fullset, vec, start_i, end_i, callback, err_callback, pred);
+	}
+	else
+	{
+		comb_loop(thread_index_n, cont_fullset, vec, start_index, end_index, callback, err_callback, pred);
+	}
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type>
+void worker_thread_proc_prune(const int_type thread_index, 
+						const container_type& cont,
+						int_type start_index, 
+						int_type end_index, 
+						uint32_t subset, 
+						callback_type callback,
+                        error_callback_type err_callback,
+						predicate_type pred)
+{
+	const int thread_index_n = static_cast<const int>(thread_index);
+
+	std::vector<uint32_t> results(subset);
+	std::iota(results.begin(), results.end(), 0);
+
+	if(start_index>0)
+	{
+		find_comb(cont.size(), subset, start_index, results);
+	}
+	container_type vec;
+	for(size_t i=0; i<results.size(); ++i)
+	{
+		vec.push_back(cont[results[i]]);
+	}
+	container_type cont_fullset(cont.begin(), cont.end());
+	if(end_index <= std::numeric_limits<int>::max()) // use POD counter when possible
+	{ 
+		const int start_i = static_cast<int>(start_index);
+		const int end_i = static_cast<int>(end_index);
+
+		comb_loop_prune(thread_index_n, cont_fullset, vec, start_i, end_i, callback, err_callback, pred);
+	}
+	else if (end_index <= std::numeric_limits<int64_t>::max()) // use POD counter when possible
+	{
+		const int64_t start_i = static_cast<int64_t>(start_index);
+		const int64_t end_i = static_cast<int64_t>(end_index);
+		comb_loop_prune(thread_index_n, cont_fullset, vec, start_i, end_i, callback, err_callback, pred);
+	}
+	else
+	{
+		comb_loop_prune(thread_index_n, cont_fullset, vec, start_index, end_index, callback, err_callback, pred);
+	}
+}
+
+// Splits elem_cnt items starting at offset evenly over thread_cnt threads, the last thread taking the remainder,
+// and calls worker(thread_index, start_index, end_index) on each; thread 0 runs on the calling thread.
+template<typename int_type, typename worker_type>
+void run_comb_range(int_type thread_cnt, int_type offset, int_type elem_cnt, worker_type worker)
+{
+	if (elem_cnt < thread_cnt)
+	{
+		thread_cnt = 1;
+	}
+
+	int_type each_thread_elem_cnt = elem_cnt / thread_cnt;
+	int_type remainder = elem_cnt % thread_cnt;
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+
+	int_type bulk = each_thread_elem_cnt;
+	for(int_type i=1; i<thread_cnt; ++i)
+	{
+		// test for last thread
+		bulk = each_thread_elem_cnt;
+		if( i == (thread_cnt-1) && remainder > 0 )
+		{
+			bulk += remainder;
+		}
+		int_type start_index = i * each_thread_elem_cnt + offset;
+		int_type end_index = start_index + bulk;
+		threads.push_back( std::shared_ptr<std::thread>(new std::thread(worker, i, start_index, end_index)));
+	}
+
+	bulk = each_thread_elem_cnt; // reset remainder
+	int_type start_index = offset;
+	int_type end_index = start_index + bulk;
+	int_type thread_index=0;
+	worker(thread_index, start_index, end_index);
+
+	for(size_t i=0; i<threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+}
+
+template<typename int_type, typename container_type, typename error_callback_type, typename worker_type>
+bool run_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, error_callback_type err_callback, worker_type worker)
 {
 	if (cpu_cnt <= 0)
 	{
@@ -356,7 +721,7 @@ bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type threa
 		oss << "Error: cpu_cnt(" << cpu_cnt;
 		oss << ") <= 0";
 
-		err_callback(int_type(0), cont.size(), cont, oss.str());
+		err_callback(0, cont.size(), cont, oss.str());
 		return false;
 	}
 
@@ -366,7 +731,7 @@ bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type threa
 		oss << "Error: thread_cnt(" << thread_cnt;
 		oss << ") <= 0";
 
-		err_callback(int_type(0), cont.size(), cont, oss.str());
+		err_callback(0, cont.size(), cont, oss.str());
 		return false;
 	}
 
@@ -376,14 +741,14 @@ bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type threa
 		oss << "Error: subset(" << subset;
 		oss << ") <= 0";
 
-		err_callback(int_type(0), cont.size(), cont, oss.str());
+		err_callback(0, cont.size(), cont, oss.str());
 		return false;
 	}
 
 	int_type total_comb=0; 
 	if (!compute_total_comb(cont.size(), subset, total_comb))
 	{
-		err_callback(int_type(0), cont.size(), cont, "Error: compute_total_comb() return false");
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
 		return false;
 	}
 
@@ -393,7 +758,7 @@ bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type threa
 		oss << "Error: total_comb(" << total_comb;
 		oss << ") < cpu_cnt(" << cpu_cnt << ")";
 
-		err_callback(int_type(0), cont.size(), cont, oss.str());
+		err_callback(0, cont.size(), cont, oss.str());
 		return false;
 	}
 
@@ -411,47 +776,22 @@ bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type threa
 		oss << "Error: each_cpu_elem_cnt(" << each_cpu_elem_cnt;
 		oss << ") <= 0";
 
-		err_callback(int_type(0), cont.size(), cont, oss.str());
+		err_callback(0, cont.size(), cont, oss.str());
 		return false;
 	}
 
-	if (each_cpu_elem_cnt < thread_cnt)
-	{
-		thread_cnt = 1;
-	}
-
-	int_type each_thread_elem_cnt = each_cpu_elem_cnt / thread_cnt;
-	int_type remainder = each_cpu_elem_cnt % thread_cnt;
-
-	std::vector<std::shared_ptr<std::thread> > threads;
+	run_comb_range(thread_cnt, offset, each_cpu_elem_cnt, worker);
+	return true;
+}
 
-	int_type bulk = each_thread_elem_cnt;
-	for(int_type i=1; i<thread_cnt; ++i)
-	{
-		// test for last thread
-		bulk = each_thread_elem_cnt;
-		if( i == (thread_cnt-1) && remainder > 0 )
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	return run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, subset, callback, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
 		{
-			bulk += remainder;
-		}
-		int_type start_index = i * each_thread_elem_cnt + offset;
-		int_type end_index = start_index + bulk;
-		threads.push_back( std::shared_ptr<std::thread>(new std::thread(
-			std::bind(worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>, i, cont, start_index, end_index, subset, callback, err_callback, pred))));
-	}
-
-	bulk = each_thread_elem_cnt; // reset remainder
-	int_type start_index = offset;
-	int_type end_index = start_index + bulk;
-	int_type thread_index=0;
-	worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>( thread_index, cont, start_index, end_index, subset, callback, err_callback, pred);
-
-	for(size_t i=0; i<threads.size(); ++i)
-	{
-		threads[i]->join();
-	}
-
-	return true;
+			worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>(thread_index, cont, start_index, end_index, subset, callback, err_callback, pred);
+		});
 }
 
 template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
@@ -462,4 +802,1912 @@ bool compute_all_comb(int_type thread_cnt, uint32_t subset, const container_type
 	return compute_all_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, callback, err_callback, pred);
 }
 
-}
\ No newline at end of file
+using concurrent_common::reverse_bits;
+using concurrent_common::run_strided_range;
+
+// Like compute_all_comb_shard, but the shard is cut into chunk_cnt chunks that the threads visit in the
+// interleaved, bit-reversed order of run_strided_range, each seeded with find_comb. Every thread keeps one
+// copy of callback for all its chunks; returning false from it stops that thread.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_strided_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint64_t chunk_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	if (thread_cnt <= 0 || chunk_cnt == 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") or chunk_cnt(" << chunk_cnt << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	return run_comb_shard(cpu_index, cpu_cnt, int_type(1), subset, cont, err_callback,
+		[&cont, thread_cnt, chunk_cnt, subset, callback, err_callback, pred](const int_type /*shard_thread_index*/, int_type shard_start, int_type shard_end)
+		{
+			std::vector<callback_type> callbacks(static_cast<size_t>(thread_cnt), callback);
+			run_strided_range(thread_cnt, shard_start, int_type(shard_end - shard_start), chunk_cnt,
+				[&](const int_type thread_index, int_type start_index, int_type end_index) -> bool
+				{
+					callback_type& thread_callback = callbacks[static_cast<size_t>(thread_index)];
+					bool stopped = false;
+					worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+						[&thread_callback, &stopped](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+						{
+							stopped = !thread_callback(thread_index_n, fullset_cnt, arrangement);
+							return !stopped;
+						}, err_callback, pred);
+					return !stopped;
+				});
+		});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_strided(int_type thread_cnt, uint64_t chunk_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	return compute_all_comb_strided_shard(int_type(0), int_type(1), thread_cnt, chunk_cnt, subset, cont, callback, err_callback, pred);
+}
+
+using concurrent_common::latency_histogram;
+using concurrent_common::instrument_options;
+using concurrent_common::thread_report;
+using concurrent_common::run_report;
+using concurrent_common::elapsed_ms;
+using concurrent_common::collect_report;
+
+// Like compute_all_comb_shard, but times one callback in options.sample_every into per-thread histograms and
+// records when every thread starts and finishes and how many items it processes, returned in report.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_instrumented_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, const instrument_options& options, run_report& report, predicate_type pred=predicate_type())
+{
+	const uint32_t sample_every = (std::max)(options.sample_every, uint32_t(1));
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<thread_report> > reports(static_cast<size_t>((std::max)(thread_cnt, int_type(1))));
+	const bool result = run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, subset, callback, err_callback, pred, &reports, begin, sample_every](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			std::unique_ptr<thread_report> thread(new thread_report());
+			thread->thread_index = static_cast<int>(thread_index);
+			thread->start_ms = elapsed_ms(begin);
+			callback_type thread_callback = callback;
+			uint64_t items = 0;
+			uint32_t countdown = sample_every;
+			latency_histogram& histogram = thread->callback_ns;
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+				{
+					++items;
+					if (--countdown != 0)
+						return thread_callback(thread_index_n, fullset_cnt, arrangement);
+					countdown = sample_every;
+					const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+					const bool proceed = thread_callback(thread_index_n, fullset_cnt, arrangement);
+					histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count()));
+					return proceed;
+				}, err_callback, pred);
+			thread->items = items;
+			thread->finish_ms = elapsed_ms(begin);
+			reports[static_cast<size_t>(thread_index)] = std::move(thread);
+		});
+
+	collect_report(begin, reports, report);
+	return result;
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_instrumented(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, const instrument_options& options, run_report& report, predicate_type pred=predicate_type())
+{
+	return compute_all_comb_instrumented_shard(int_type(0), int_type(1), thread_cnt, subset, cont, callback, err_callback, options, report, pred);
+}
+
+// Boundaries of node index out of weights.size() nodes when total items are split in proportion to weights:
+// [total * (w0 + .. + w(index-1)) / sum, total * (w0 + .. + w(index)) / sum), rounded down, computed exactly
+// for any int_type. The sum of weights must not exceed UINT32_MAX; a node of weight 0 gets an empty range.
+template<typename int_type>
+void split_weighted_range(const int_type& total, const std::vector<uint32_t>& weights, size_t index, int_type& start_index, int_type& end_index)
+{
+	uint64_t sum = 0;
+	uint64_t before = 0;
+	for (size_t i = 0; i < weights.size(); ++i)
+	{
+		if (i < index)
+			before += weights[i];
+		sum += weights[i];
+	}
+	const uint64_t through = before + ((index < weights.size()) ? weights[index] : 0);
+
+	// total * cum / sum == (total / sum) * cum + (total % sum) * cum / sum, where the last product is below sum * sum <= 2^64
+	auto bound = [&](uint64_t cum) -> int_type
+	{
+		if (total <= std::numeric_limits<int64_t>::max())
+		{
+			const uint64_t t = static_cast<uint64_t>(total);
+			return int_type(t / sum * cum + (t % sum) * cum / sum);
+		}
+		const int_type q = total / int_type(sum);
+		const int_type r = total % int_type(sum);
+		return q * int_type(cum) + r * int_type(cum) / int_type(sum);
+	};
+	start_index = bound(before);
+	end_index = bound(through);
+}
+
+// Like compute_all_comb_shard, but node cpu_index gets a share of the combinations proportional to
+// weights[cpu_index], such as its core count or the items_per_sec from measure_comb_throughput.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_weighted_shard(int_type cpu_index, const std::vector<uint32_t>& weights, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	if (cpu_index < 0 || cpu_index >= int_type(weights.size()))
+	{
+		std::ostringstream oss;
+		oss << "Error: cpu_index(" << cpu_index;
+		oss << ") is outside of [0, " << weights.size() << ")";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	const uint64_t sum = std::accumulate(weights.begin(), weights.end(), uint64_t(0));
+	if (sum == 0 || sum > std::numeric_limits<uint32_t>::max())
+	{
+		std::ostringstream oss;
+		oss << "Error: sum of weights(" << sum;
+		oss << ") is 0 or above " << std::numeric_limits<uint32_t>::max();
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	int_type start_index = 0;
+	int_type end_index = 0;
+	split_weighted_range(total_comb, weights, static_cast<size_t>(cpu_index), start_index, end_index);
+	if (start_index >= end_index)
+		return true;
+
+	run_comb_range(thread_cnt, start_index, int_type(end_index - start_index),
+		[&cont, subset, callback, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>(thread_index, cont, start_index, end_index, subset, callback, err_callback, pred);
+		});
+	return true;
+}
+
+// Calibration run for compute_all_comb_weighted_shard: times callback on the first sample_cnt combinations
+// with thread_cnt threads and returns the combinations per second of this node in items_per_sec.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool measure_comb_throughput(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, int_type sample_cnt, double& items_per_sec, predicate_type pred=predicate_type())
+{
+	items_per_sec = 0.0;
+	if (thread_cnt <= 0 || sample_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") or sample_cnt(" << sample_cnt << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+	sample_cnt = (std::min)(sample_cnt, total_comb);
+
+	const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	run_comb_range(thread_cnt, int_type(0), sample_cnt,
+		[&cont, subset, callback, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>(thread_index, cont, start_index, end_index, subset, callback, err_callback, pred);
+		});
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+	items_per_sec = static_cast<double>(sample_cnt) / (std::max)(seconds, 1e-9);
+	return true;
+}
+
+// Turns measured throughputs (or any non-negative capacities) into weights for compute_all_comb_weighted_shard,
+// scaled to add up to about 2^24; a node with a positive throughput always gets a weight of at least 1.
+inline std::vector<uint32_t> throughput_weights(const std::vector<double>& throughputs)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < throughputs.size(); ++i)
+	{
+		sum += (std::max)(throughputs[i], 0.0);
+	}
+
+	std::vector<uint32_t> weights(throughputs.size(), 0);
+	for (size_t i = 0; i < throughputs.size() && sum > 0.0; ++i)
+	{
+		if (throughputs[i] > 0.0)
+			weights[i] = (std::max)(uint32_t(1), static_cast<uint32_t>(std::llround(throughputs[i] / sum * 16777216.0)));
+	}
+	return weights;
+}
+
+// Counter-based random stream for sampling: word j of stream stream_index under seed is a pure function
+// of (seed, stream_index, j), so sample i draws the same index whichever thread computes it.
+class counter_rng
+{
+public:
+	counter_rng(uint64_t seed, uint64_t stream_index) : key(mix64(seed ^ mix64(stream_index))), counter(0)
+	{
+	}
+
+	uint64_t next()
+	{
+		return mix64(key + 0xD1B54A32D192ED03ULL * counter++);
+	}
+
+	// splitmix64 finalizer
+	static uint64_t mix64(uint64_t x)
+	{
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+private:
+	const uint64_t key;
+	uint64_t counter;
+};
+
+// Uniform index in [0, bound) for sample sample_index, by rejection on the bit length of bound - 1,
+// so big-integer bounds such as compute_factorial(30) are exact.
+template<typename int_type>
+int_type random_index(uint64_t seed, uint64_t sample_index, const int_type& bound)
+{
+	uint32_t bits = 0;
+	for (int_type v = bound - 1; v > 0; v /= 2)
+	{
+		++bits;
+	}
+	if (bits == 0)
+		return int_type(0);
+
+	counter_rng rng(seed, sample_index);
+	const uint32_t words = (bits + 63) / 64;
+	const uint32_t top_bits = bits - (words - 1) * 64;
+	while (true)
+	{
+		int_type value = int_type(rng.next() >> (64 - top_bits));
+		for (uint32_t w = 1; w < words; ++w)
+		{
+			for (int s = 0; s < 4; ++s)
+				value *= int_type(65536);
+			value += int_type(rng.next());
+		}
+		if (value < bound)
+			return value;
+	}
+}
+
+// sample_cnt distinct indices below total (Floyd's algorithm), then shuffled, so every prefix
+// is itself a uniform sample without replacement. Keeps all sample_cnt indices in memory.
+template<typename int_type>
+bool sample_distinct_indices(const int_type& total, const int_type& sample_cnt, uint64_t seed, std::vector<int_type>& indices)
+{
+	indices.clear();
+	if (sample_cnt < 0 || sample_cnt > total)
+		return false;
+
+	std::set<int_type> chosen;
+	uint64_t step = 0;
+	for (int_type j = total - sample_cnt; j < total; ++j, ++step)
+	{
+		const int_type t = random_index(seed, step, int_type(j + 1));
+		indices.push_back(chosen.insert(t).second ? t : j);
+		chosen.insert(indices.back());
+	}
+	for (size_t i = indices.size(); i > 1; --i)
+	{
+		const uint64_t j = random_index(~seed, static_cast<uint64_t>(i), static_cast<uint64_t>(i));
+		std::swap(indices[i - 1], indices[static_cast<size_t>(j)]);
+	}
+	return true;
+}
+
+template<typename int_type, typename container_type, typename index_type, typename callback_type, typename error_callback_type>
+void sample_thread_proc(const int_type thread_index, const container_type& cont, int_type start_index, int_type end_index, uint32_t subset, index_type index_of, callback_type callback, error_callback_type err_callback)
+{
+	const int thread_index_n = static_cast<const int>(thread_index);
+	std::vector<uint32_t> results(subset);
+	container_type vec(cont.cbegin(), cont.cbegin() + subset);
+	int_type j = start_index;
+	try
+	{
+		for (; j < end_index; ++j)
+		{
+			std::iota(results.begin(), results.end(), 0);
+			find_comb(cont.size(), subset, index_of(j), results);
+			for (size_t i = 0; i < results.size(); ++i)
+			{
+				vec[i] = cont[results[i]];
+			}
+			if (!callback(thread_index_n, cont.size(), vec))
+				return;
+		}
+	}
+	catch (std::exception& ex)
+	{
+		std::ostringstream oss;
+		oss << "Exception thrown in sample_thread_proc:" << ex.what();
+		oss << ", sample index:" << j;
+		err_callback(thread_index_n, cont.size(), vec, oss.str());
+	}
+	catch (...)
+	{
+		std::ostringstream oss;
+		oss << "Unknown exception thrown in sample_thread_proc:";
+		oss << ", sample index:" << j;
+		err_callback(thread_index_n, cont.size(), vec, oss.str());
+	}
+}
+
+// Calls callback on sample_cnt uniformly random combinations of subset elements of cont, drawn with replacement.
+// Sample i is unranked from random_index(seed, i, total_comb), so the samples are the same for any thread_cnt;
+// each thread gets a contiguous block of samples in order.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type>
+bool sample_comb(int_type thread_cnt, uint32_t subset, const container_type& cont, int_type sample_cnt, uint64_t seed, callback_type callback, error_callback_type err_callback)
+{
+	int_type total_comb = 0;
+	if (thread_cnt <= 0 || sample_cnt < 0 || !compute_total_comb(cont.size(), subset, total_comb) || subset == 0 || subset > cont.size())
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt << ") <= 0, sample_cnt(" << sample_cnt;
+		oss << ") < 0 or subset(" << subset << ") not in [1, " << cont.size() << "]";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	run_comb_range(thread_cnt, int_type(0), sample_cnt,
+		[&cont, subset, total_comb, seed, callback, err_callback](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			sample_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&total_comb, seed](const int_type& i) { return random_index(seed, static_cast<uint64_t>(i), total_comb); },
+				callback, err_callback);
+		});
+	return true;
+}
+
+// Like sample_comb, but the sample_cnt combinations are distinct (sampling without replacement)
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type>
+bool sample_comb_distinct(int_type thread_cnt, uint32_t subset, const container_type& cont, int_type sample_cnt, uint64_t seed, callback_type callback, error_callback_type err_callback)
+{
+	int_type total_comb = 0;
+	std::vector<int_type> indices;
+	if (thread_cnt <= 0 || !compute_total_comb(cont.size(), subset, total_comb) || subset == 0 || subset > cont.size()
+		|| !sample_distinct_indices(total_comb, sample_cnt, seed, indices))
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt << ") <= 0, subset(" << subset << ") not in [1, " << cont.size();
+		oss << "] or sample_cnt(" << sample_cnt << ") not in [0, total_comb(" << total_comb << ")]";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	run_comb_range(thread_cnt, int_type(0), sample_cnt,
+		[&cont, subset, &indices, callback, err_callback](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			sample_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&indices](const int_type& i) { return indices[static_cast<size_t>(i)]; },
+				callback, err_callback);
+		});
+	return true;
+}
+
+// make_callback(thread_index) is called once on every worker thread to construct that thread's callback,
+// so the callback does not need to be copyable and can own per-thread state such as a preallocated scratch arena.
+template<typename int_type, typename container_type, typename factory_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_factory_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, factory_type make_callback, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	return run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, subset, make_callback, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			factory_type thread_factory = make_callback;
+			auto callback = thread_factory(static_cast<const int>(thread_index));
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&callback](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+				{
+					return callback(thread_index_n, fullset_cnt, arrangement);
+				}, err_callback, pred);
+		});
+}
+
+template<typename int_type, typename container_type, typename factory_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_factory(int_type thread_cnt, uint32_t subset, const container_type& cont, factory_type make_callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	int_type cpu_index = 0; 
+	int_type cpu_cnt = 1;
+	return compute_all_comb_factory_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, make_callback, err_callback, pred);
+}
+
+using concurrent_common::affinity_kind;
+using concurrent_common::affinity_policy;
+using concurrent_common::parse_cpu_list;
+using concurrent_common::numa_node_cpus;
+using concurrent_common::allowed_cpus;
+using concurrent_common::affinity_cpu_order;
+using concurrent_common::scoped_affinity;
+
+// Like compute_all_comb_shard, with every worker thread pinned to a CPU chosen by policy. The combination,
+// the copy of cont and the copy of callback are made on the worker thread once pinned, so that with the
+// usual first-touch policy they are allocated on the worker's local NUMA node.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_affinity_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, const affinity_policy& policy, predicate_type pred=predicate_type())
+{
+	const std::vector<int> cpus = affinity_cpu_order(policy);
+	return run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, &cpus, subset, callback, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			const int cpu = cpus.empty() ? -1 : cpus[static_cast<size_t>(thread_index) % cpus.size()];
+			scoped_affinity affinity(cpu);
+			if (affinity.error() != 0)
+			{
+				std::ostringstream oss;
+				oss << "Error: cannot pin thread " << thread_index << " to CPU " << cpu << ": " << std::strerror(affinity.error());
+				error_callback_type report = err_callback;
+				report(static_cast<int>(thread_index), cont.size(), cont, oss.str());
+			}
+			worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>(thread_index, cont, start_index, end_index, subset, callback, err_callback, pred);
+		});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_affinity(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, const affinity_policy& policy, predicate_type pred = predicate_type())
+{
+	int_type cpu_index = 0; 
+	int_type cpu_cnt = 1;
+	return compute_all_comb_affinity_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, callback, err_callback, policy, pred);
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_prune_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	return run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, subset, callback, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			worker_thread_proc_prune<int_type, container_type, callback_type, error_callback_type, predicate_type>(thread_index, cont, start_index, end_index, subset, callback, err_callback, pred);
+		});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_prune(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	int_type cpu_index = 0;
+	int_type cpu_cnt = 1;
+	return compute_all_comb_prune_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, callback, err_callback, pred);
+}
+
+template<typename int_type, typename container_type, typename error_callback_type, typename worker_type>
+bool run_comb_prefix_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, error_callback_type err_callback, worker_type worker)
+{
+	if (cpu_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: cpu_cnt(" << cpu_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	if (total_comb < cpu_cnt)
+	{
+		std::ostringstream oss;
+		oss << "Error: total_comb(" << total_comb;
+		oss << ") < cpu_cnt(" << cpu_cnt << ")";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	const uint64_t thread_cnt_n = static_cast<uint64_t>(thread_cnt);
+	uint32_t depth = 0;
+	std::vector<std::vector<uint32_t> > bounds;
+	comb_prefix_shard<int_type>(cont.size(), subset, static_cast<uint64_t>(cpu_index), static_cast<uint64_t>(cpu_cnt), thread_cnt_n, depth, bounds);
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+
+	for (uint64_t i = 1; i < thread_cnt_n; ++i)
+	{
+		if (bounds[i].empty() || bounds[i] == bounds[i + 1])
+			continue; // no work left for this thread
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread(worker, int_type(i), depth, bounds[i], bounds[i + 1])));
+	}
+
+	worker(int_type(0), depth, bounds[0], bounds[1]);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+
+	return true;
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type>
+void prefix_worker_thread_proc(const int_type thread_index, 
+						const container_type& cont,
+						uint32_t subset, 
+						const std::vector<uint32_t>& first,
+						const std::vector<uint32_t>& last,
+						callback_type callback,
+                        error_callback_type err_callback,
+						predicate_type pred)
+{
+	const int thread_index_n = static_cast<const int>(thread_index);
+	const uint32_t fullset = static_cast<uint32_t>(cont.size());
+	if (first.empty())
+		return;
+
+	// count the combinations under the prefixes instead of ranking the boundaries
+	int_type count = 0;
+	std::vector<uint32_t> prefix = first;
+	bool has_prefix = true;
+	while (has_prefix && (last.empty() || prefix < last))
+	{
+		count += comb_prefix_weight<int_type>(fullset, subset, prefix);
+		has_prefix = next_comb_prefix(fullset, subset, prefix);
+	}
+
+	// first combination of the prefix is the prefix followed by the next elements in order
+	std::vector<uint32_t> results = first;
+	extend_comb_prefix(subset, results);
+	container_type vec;
+	for(size_t i=0; i<results.size(); ++i)
+	{
+		vec.push_back(cont[results[i]]);
+	}
+	container_type cont_fullset(cont.begin(), cont.end());
+	if(count <= std::numeric_limits<int>::max()) // use POD counter when possible
+	{ 
+		const int end_i = static_cast<int>(count);
+		comb_loop(thread_index_n, cont_fullset, vec, 0, end_i, callback, err_callback, pred);
+	}
+	else if (count <= std::numeric_limits<int64_t>::max()) // use POD counter when possible
+	{
+		const int64_t end_i = static_cast<int64_t>(count);
+		comb_loop(thread_index_n, cont_fullset, vec, int64_t(0), end_i, callback, err_callback, pred);
+	}
+	else
+	{
+		comb_loop(thread_index_n, cont_fullset, vec, int_type(0), count, callback, err_callback, pred);
+	}
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_prefix_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	return run_comb_prefix_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, subset, callback, err_callback, pred](const int_type thread_index, uint32_t /*depth*/, const std::vector<uint32_t>& first, const std::vector<uint32_t>& last)
+		{
+			prefix_worker_thread_proc<int_type, container_type, callback_type, error_callback_type, predicate_type>(thread_index, cont, subset, first, last, callback, err_callback, pred);
+		});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_prefix(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	int_type cpu_index = 0;
+	int_type cpu_cnt = 1;
+	return compute_all_comb_prefix_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, callback, err_callback, pred);
+}
+
+template<typename container_type, typename enter_type, typename leave_type, typename leaf_type>
+bool comb_dfs(const int thread_index, const container_type& cont, container_type& vec, uint32_t depth, uint32_t next_pos, enter_type& enter, leave_type& leave, leaf_type& leaf)
+{
+	const uint32_t fullset = static_cast<uint32_t>(cont.size());
+	const uint32_t subset = static_cast<uint32_t>(vec.size());
+	if (depth == subset)
+		return leaf(thread_index, cont.size(), vec);
+
+	for (uint32_t i = next_pos; i + subset - depth <= fullset; ++i)
+	{
+		vec[depth] = cont[i];
+		if (!enter(thread_index, depth, vec[depth]))
+			continue;
+
+		const bool proceed = comb_dfs(thread_index, cont, vec, depth + 1, i + 1, enter, leave, leaf);
+		leave(thread_index, depth);
+		if (!proceed)
+			return false;
+	}
+	return true;
+}
+
+template<typename int_type, typename container_type, typename enter_type, typename leave_type, typename leaf_type, typename error_callback_type>
+void dfs_worker_thread_proc(const int_type thread_index,
+						const container_type& cont,
+						uint32_t subset,
+						uint32_t prefix_depth,
+						std::vector<uint32_t> prefix,
+						const std::vector<uint32_t>& last,
+						enter_type enter,
+						leave_type leave,
+						leaf_type leaf,
+						error_callback_type err_callback)
+{
+	const int thread_index_n = static_cast<const int>(thread_index);
+	const uint32_t fullset = static_cast<uint32_t>(cont.size());
+	container_type vec(cont.begin(), cont.begin() + subset);
+	std::vector<uint32_t> entered; // positions of the prefix elements currently entered
+
+	if (prefix.empty())
+		return;
+
+	try
+	{
+		do
+		{
+			if (!last.empty() && !(prefix < last))
+				break;
+
+			// only the part of the prefix which changed is left and entered again
+			size_t same = 0;
+			while (same < entered.size() && entered[same] == prefix[same])
+				++same;
+			while (entered.size() > same)
+			{
+				entered.pop_back();
+				leave(thread_index_n, static_cast<uint32_t>(entered.size()));
+			}
+
+			bool pruned = false;
+			for (uint32_t d = static_cast<uint32_t>(same); d < prefix_depth; ++d)
+			{
+				vec[d] = cont[prefix[d]];
+				if (!enter(thread_index_n, d, vec[d]))
+				{
+					// move to the last prefix sharing the first d+1 elements, so the next one leaves them
+					for (uint32_t k = d + 1; k < prefix_depth; ++k)
+						prefix[k] = fullset - subset + k;
+					pruned = true;
+					break;
+				}
+				entered.push_back(prefix[d]);
+			}
+
+			if (!pruned && !comb_dfs(thread_index_n, cont, vec, prefix_depth, prefix.back() + 1, enter, leave, leaf))
+				return;
+		} while (next_comb_prefix(fullset, subset, prefix));
+
+		while (!entered.empty())
+		{
+			entered.pop_back();
+			leave(thread_index_n, static_cast<uint32_t>(entered.size()));
+		}
+	}
+	catch(std::exception& ex)
+	{
+		std::ostringstream oss;
+		oss << "Exception thrown in dfs_worker_thread_proc:" << ex.what();
+		oss << ", prefix depth:" << prefix_depth;
+		err_callback(thread_index_n, cont.size(), vec, oss.str());
+	}
+	catch(...)
+	{
+		std::ostringstream oss;
+		oss << "Unknown exception thrown in dfs_worker_thread_proc:";
+		oss << ", prefix depth:" << prefix_depth;
+		err_callback(thread_index_n, cont.size(), vec, oss.str());
+	}
+}
+
+template<typename int_type, typename container_type, typename enter_type, typename leave_type, typename leaf_type, typename error_callback_type>
+bool compute_all_comb_dfs_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, enter_type enter, leave_type leave, leaf_type leaf, error_callback_type err_callback)
+{
+	return run_comb_prefix_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&cont, subset, enter, leave, leaf, err_callback](const int_type thread_index, uint32_t depth, const std::vector<uint32_t>& first, const std::vector<uint32_t>& last)
+		{
+			dfs_worker_thread_proc<int_type, container_type, enter_type, leave_type, leaf_type, error_callback_type>(thread_index, cont, subset, depth, first, last, enter, leave, leaf, err_callback);
+		});
+}
+
+template<typename int_type, typename container_type, typename enter_type, typename leave_type, typename leaf_type, typename error_callback_type>
+bool compute_all_comb_dfs(int_type thread_cnt, uint32_t subset, const container_type& cont, enter_type enter, leave_type leave, leaf_type leaf, error_callback_type err_callback)
+{
+	int_type cpu_index = 0;
+	int_type cpu_cnt = 1;
+	return compute_all_comb_dfs_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, enter, leave, leaf, err_callback);
+}
+
+using concurrent_common::split_chunks;
+
+// Chunks are claimed in increasing order and every chunk below the best match is scanned to the end,
+// so the lowest matching index is found whatever thread_cnt is.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool find_first_comb(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, int_type& found_index, container_type& found, predicate_type pred = predicate_type())
+{
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	split_chunks(total_comb, chunk_size, chunk_cnt);
+
+	std::atomic<uint64_t> next_chunk(0);
+	std::atomic<uint64_t> best_chunk(chunk_cnt);
+	std::mutex found_mutex;
+
+	auto worker = [&](const int_type thread_index)
+	{
+		callback_type thread_callback = callback;
+		while (true)
+		{
+			const uint64_t chunk = next_chunk.fetch_add(1);
+			if (chunk >= chunk_cnt || chunk > best_chunk.load())
+				return;
+
+			const int_type start_index = int_type(chunk) * chunk_size;
+			const int_type end_index = (std::min)(int_type(start_index + chunk_size), total_comb);
+			uint64_t offset = 0;
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+				{
+					if (best_chunk.load(std::memory_order_relaxed) < chunk)
+						return false; // a lower index has already matched
+					if (thread_callback(thread_index_n, fullset_cnt, arrangement))
+					{
+						std::lock_guard<std::mutex> lock(found_mutex);
+						if (chunk < best_chunk.load())
+						{
+							best_chunk.store(chunk);
+							found_index = start_index + int_type(offset);
+							found = arrangement;
+						}
+						return false;
+					}
+					++offset;
+					return true;
+				}, err_callback, pred);
+		}
+	};
+
+	if (int_type(chunk_cnt) < thread_cnt)
+	{
+		thread_cnt = int_type(chunk_cnt);
+	}
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (int_type i = 1; i < thread_cnt; ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread(worker, i)));
+	}
+	worker(int_type(0));
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+
+	return best_chunk.load() < chunk_cnt;
+}
+
+// Returns on the first match of any thread, which is not necessarily the lowest index.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool find_any_comb(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, int_type& found_index, container_type& found, predicate_type pred = predicate_type())
+{
+	std::atomic<bool> done(false);
+	std::mutex found_mutex;
+
+	int_type cpu_index = 0;
+	int_type cpu_cnt = 1;
+	if (!run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, cont, err_callback,
+		[&](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			callback_type thread_callback = callback;
+			uint64_t offset = 0;
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+				{
+					if (done.load(std::memory_order_relaxed))
+						return false;
+					if (thread_callback(thread_index_n, fullset_cnt, arrangement))
+					{
+						std::lock_guard<std::mutex> lock(found_mutex);
+						if (!done.load())
+						{
+							done.store(true);
+							found_index = start_index + int_type(offset);
+							found = arrangement;
+						}
+						return false;
+					}
+					++offset;
+					return true;
+				}, err_callback, pred);
+		}))
+	{
+		return false;
+	}
+
+	return done.load();
+}
+
+template<typename container_type>
+struct ordered_chunk
+{
+	std::vector<container_type> items; // reused from chunk to chunk, count is the number filled
+	size_t count = 0;
+	uint64_t chunk = 0;
+	bool ready = false;
+};
+
+// thread_cnt threads generate chunks in parallel while the calling thread hands them to callback in index order.
+// At most 2 * thread_cnt chunks are buffered: a thread waits before generating further ahead of the callback.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type = no_predicate_type>
+bool compute_all_comb_ordered(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred = predicate_type())
+{
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	split_chunks(total_comb, chunk_size, chunk_cnt);
+
+	if (int_type(chunk_cnt) < thread_cnt)
+	{
+		thread_cnt = int_type(chunk_cnt);
+	}
+
+	const uint64_t window = 2 * static_cast<uint64_t>(thread_cnt);
+	std::vector<ordered_chunk<container_type> > chunks(window);
+	std::mutex chunk_mutex;
+	std::condition_variable chunk_ready;
+	std::condition_variable chunk_free;
+	uint64_t next_chunk = 0;
+	uint64_t consumed = 0;
+	bool stop = false;
+	bool failed = false;
+
+	auto producer = [&](const int_type thread_index)
+	{
+		while (true)
+		{
+			uint64_t chunk = 0;
+			{
+				std::unique_lock<std::mutex> lock(chunk_mutex);
+				if (stop || next_chunk >= chunk_cnt)
+					return;
+				chunk = next_chunk++;
+				chunk_free.wait(lock, [&] { return stop || chunk < consumed + window; });
+				if (stop)
+					return;
+			}
+
+			ordered_chunk<container_type>& slot = chunks[chunk % window];
+			const int_type start_index = int_type(chunk) * chunk_size;
+			const int_type end_index = (std::min)(int_type(start_index + chunk_size), total_comb);
+			slot.count = 0;
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&slot](const int /*thread_index_n*/, const size_t /*fullset_cnt*/, const container_type& arrangement) -> bool
+				{
+					if (slot.count < slot.items.size())
+						slot.items[slot.count] = arrangement;
+					else
+						slot.items.push_back(arrangement);
+					++slot.count;
+					return true;
+				}, err_callback, pred);
+
+			{
+				std::lock_guard<std::mutex> lock(chunk_mutex);
+				if (int_type(slot.count) != end_index - start_index)
+				{
+					failed = true; // err_callback was called by comb_loop
+					stop = true;
+				}
+				slot.chunk = chunk;
+				slot.ready = true;
+			}
+			chunk_ready.notify_all();
+		}
+	};
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (int_type i = 0; i < thread_cnt; ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread(producer, i)));
+	}
+
+	for (uint64_t chunk = 0; chunk < chunk_cnt; ++chunk)
+	{
+		ordered_chunk<container_type>& slot = chunks[chunk % window];
+		{
+			std::unique_lock<std::mutex> lock(chunk_mutex);
+			chunk_ready.wait(lock, [&] { return stop || (slot.ready && slot.chunk == chunk); });
+			if (stop)
+				break;
+		}
+
+		bool proceed = true;
+		size_t i = 0;
+		try
+		{
+			for (; i < slot.count && proceed; ++i)
+			{
+				proceed = callback(0, cont.size(), slot.items[i]);
+			}
+		}
+		catch(std::exception& ex)
+		{
+			std::ostringstream oss;
+			oss << "Exception thrown in compute_all_comb_ordered:" << ex.what();
+			oss << ", counting index:" << int_type(chunk) * chunk_size + int_type(i);
+			err_callback(0, cont.size(), slot.items[i], oss.str());
+			proceed = false;
+		}
+		catch(...)
+		{
+			std::ostringstream oss;
+			oss << "Unknown exception thrown in compute_all_comb_ordered:";
+			oss << ", counting index:" << int_type(chunk) * chunk_size + int_type(i);
+			err_callback(0, cont.size(), slot.items[i], oss.str());
+			proceed = false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(chunk_mutex);
+			slot.ready = false;
+			++consumed;
+			if (!proceed)
+				stop = true;
+		}
+		chunk_free.notify_all();
+		if (!proceed)
+			break;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(chunk_mutex);
+		stop = true;
+	}
+	chunk_free.notify_all();
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+
+	return !failed;
+}
+
+using concurrent_common::spmc_ring;
+using concurrent_common::pipeline_batch;
+using concurrent_common::pipeline_stats;
+using concurrent_common::pipeline_batch_size;
+using concurrent_common::pipeline_queue_capacity;
+
+// gen_cnt threads generate batches of combinations into one bounded queue each, and eval_cnt other threads
+// take the batches from any queue and call callback on them. thread_index in callback is the evaluator index.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_pipeline(int_type gen_cnt, int_type eval_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, pipeline_stats& stats, predicate_type pred=predicate_type())
+{
+	stats = pipeline_stats();
+	stats.capacity = pipeline_queue_capacity;
+
+	if (eval_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: eval_cnt(" << eval_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (gen_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: gen_cnt(" << gen_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	typedef pipeline_batch<container_type> batch_type;
+	std::vector<std::unique_ptr<spmc_ring<batch_type> > > queues;
+	for (int_type i = 0; i < gen_cnt; ++i)
+	{
+		queues.push_back(std::unique_ptr<spmc_ring<batch_type> >(new spmc_ring<batch_type>(pipeline_queue_capacity)));
+	}
+
+	std::atomic<bool> generated(false);
+	std::atomic<bool> stop(false);
+	std::mutex stats_mutex;
+
+	auto evaluator = [&](const int_type eval_index)
+	{
+		callback_type thread_callback = callback;
+		const int thread_index_n = static_cast<const int>(eval_index);
+		pipeline_stats local;
+		batch_type batch;
+		size_t next_queue = static_cast<size_t>(eval_index) % queues.size();
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			// generated is read before the queues so that a last scan after it is set sees every batch
+			const bool last_scan = generated.load(std::memory_order_acquire);
+			bool popped = false;
+			for (size_t k = 0; k < queues.size() && !popped; ++k)
+			{
+				popped = queues[next_queue]->pop(batch);
+				next_queue = (next_queue + 1) % queues.size();
+			}
+			if (!popped)
+			{
+				if (last_scan)
+					break;
+				++local.empty_waits;
+				std::this_thread::yield();
+				continue;
+			}
+
+			size_t i = 0;
+			try
+			{
+				for (; i < batch.count; ++i)
+				{
+					if (!thread_callback(thread_index_n, cont.size(), batch.items[i]))
+					{
+						stop.store(true);
+						break;
+					}
+				}
+			}
+			catch(std::exception& ex)
+			{
+				std::ostringstream oss;
+				oss << "Exception thrown in compute_all_comb_pipeline:" << ex.what();
+				err_callback(thread_index_n, cont.size(), batch.items[i], oss.str());
+				stop.store(true);
+			}
+			catch(...)
+			{
+				err_callback(thread_index_n, cont.size(), batch.items[i], "Unknown exception thrown in compute_all_comb_pipeline");
+				stop.store(true);
+			}
+		}
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.merge(local);
+	};
+
+	auto generator = [&](const int_type gen_index, int_type start_index, int_type end_index)
+	{
+		spmc_ring<batch_type>& queue = *queues[static_cast<size_t>(gen_index)];
+		pipeline_stats local;
+		batch_type batch;
+		auto flush = [&]() -> bool
+		{
+			const uint64_t occupancy = queue.size();
+			while (!queue.push(batch))
+			{
+				if (stop.load(std::memory_order_relaxed))
+					return false;
+				++local.full_waits;
+				std::this_thread::yield();
+			}
+			++local.batches;
+			local.occupancy_sum += occupancy;
+			local.max_occupancy = (std::max)(local.max_occupancy, occupancy + 1);
+			batch.count = 0;
+			return true;
+		};
+		worker_thread_proc(gen_index, cont, start_index, end_index, subset,
+			[&](const int /*thread_index_n*/, const size_t /*fullset_cnt*/, const container_type& arrangement) -> bool
+			{
+				if (batch.count < batch.items.size())
+					batch.items[batch.count] = arrangement;
+				else
+					batch.items.push_back(arrangement);
+				if (++batch.count == pipeline_batch_size)
+					return flush();
+				return !stop.load(std::memory_order_relaxed);
+			}, err_callback, pred);
+		if (batch.count > 0)
+			flush();
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.merge(local);
+	};
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (int_type i = 0; i < eval_cnt; ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread(evaluator, i)));
+	}
+
+	const bool result = run_comb_shard(int_type(0), int_type(1), gen_cnt, subset, cont, err_callback, generator);
+	generated.store(true, std::memory_order_release);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+
+	return result;
+}
+
+// Combines chunk results pairwise in a fixed tree order: ((0,1),(2,3)),((4,5),(6,7)) and so on.
+// The result depends only on the number of chunks, not on which thread or shard computed them.
+template<typename value_type, typename combine_type>
+value_type reduce_chunks(std::vector<value_type>& chunk_results, value_type init, combine_type combine)
+{
+	if (chunk_results.empty())
+		return init;
+
+	for (size_t stride = 1; stride < chunk_results.size(); stride *= 2)
+	{
+		for (size_t i = 0; i + stride < chunk_results.size(); i += 2 * stride)
+		{
+			chunk_results[i] = combine(chunk_results[i], chunk_results[i + stride]);
+		}
+	}
+	return chunk_results[0];
+}
+
+// Reduces the chunks of this shard into chunk_results, one value per chunk starting from init,
+// which must be the identity of combine. Chunks have a fixed size whatever thread_cnt and cpu_cnt are:
+// concatenate the chunk_results of all shards in cpu_index order and call reduce_chunks
+// to get a result that is bit-identical for any thread count and shard layout.
+template<typename int_type, typename container_type, typename value_type, typename map_type, typename combine_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_reduce_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, value_type init, map_type map, combine_type combine, std::vector<value_type>& chunk_results, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	chunk_results.clear();
+
+	if (cpu_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: cpu_cnt(" << cpu_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	split_chunks(total_comb, chunk_size, chunk_cnt);
+
+	const uint64_t cpus = static_cast<uint64_t>(cpu_cnt);
+	const uint64_t cpu = static_cast<uint64_t>(cpu_index);
+	const uint64_t first_chunk = chunk_cnt / cpus * cpu + (std::min)(cpu, chunk_cnt % cpus);
+	const uint64_t last_chunk = first_chunk + chunk_cnt / cpus + ((cpu < chunk_cnt % cpus) ? 1 : 0);
+	chunk_results.assign(static_cast<size_t>(last_chunk - first_chunk), init);
+
+	if (int_type(chunk_results.size()) < thread_cnt)
+	{
+		thread_cnt = int_type(chunk_results.size());
+	}
+
+	std::atomic<uint64_t> next_chunk(first_chunk);
+	std::atomic<bool> failed(false);
+
+	auto worker = [&](const int_type thread_index)
+	{
+		map_type thread_map = map;
+		while (!failed.load(std::memory_order_relaxed))
+		{
+			const uint64_t chunk = next_chunk.fetch_add(1);
+			if (chunk >= last_chunk)
+				return;
+
+			const int_type start_index = int_type(chunk) * chunk_size;
+			const int_type end_index = (std::min)(int_type(start_index + chunk_size), total_comb);
+			value_type acc = init;
+			int_type count = 0;
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+				{
+					acc = combine(acc, thread_map(thread_index_n, fullset_cnt, arrangement));
+					++count;
+					return true;
+				}, err_callback, pred);
+
+			if (count != end_index - start_index)
+				failed.store(true); // err_callback was called by comb_loop
+			chunk_results[static_cast<size_t>(chunk - first_chunk)] = acc;
+		}
+	};
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (int_type i = 1; i < thread_cnt; ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread(worker, i)));
+	}
+	worker(int_type(0));
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+
+	return !failed.load();
+}
+
+// result is combine applied to map of every combination of subset elements, in an order that does not depend on thread_cnt
+template<typename int_type, typename container_type, typename value_type, typename map_type, typename combine_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_reduce(int_type thread_cnt, uint32_t subset, const container_type& cont, value_type init, map_type map, combine_type combine, value_type& result, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	std::vector<value_type> chunk_results;
+	if (!compute_all_comb_reduce_shard(int_type(0), int_type(1), thread_cnt, subset, cont, init, map, combine, chunk_results, err_callback, pred))
+		return false;
+
+	result = reduce_chunks(chunk_results, init, combine);
+	return true;
+}
+
+using concurrent_common::thread_pool;
+using concurrent_common::job_state;
+using concurrent_common::job;
+
+// Runs compute_all_comb as thread_cnt tasks in pool and returns at once; the calling thread does no work.
+// cont, callback, err_callback and pred are copied, and every task has its own copy of callback.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+job async_compute_all_comb(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, predicate_type pred=predicate_type(), thread_pool& pool=thread_pool::instance())
+{
+	std::shared_ptr<job_state> state(new job_state());
+	job handle(state);
+
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		state->promise.set_value(false);
+		return handle;
+	}
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		state->promise.set_value(false);
+		return handle;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		state->promise.set_value(false);
+		return handle;
+	}
+
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	split_chunks(total_comb, chunk_size, chunk_cnt);
+	state->chunk_cnt = chunk_cnt;
+
+	if (int_type(chunk_cnt) < thread_cnt)
+	{
+		thread_cnt = int_type(chunk_cnt);
+	}
+	state->tasks_left.store(static_cast<int>(thread_cnt));
+
+	std::shared_ptr<const container_type> shared_cont(new container_type(cont));
+	std::shared_ptr<std::atomic<uint64_t> > next_chunk(new std::atomic<uint64_t>(0));
+
+	for (int_type i = 0; i < thread_cnt; ++i)
+	{
+		pool.post([state, shared_cont, next_chunk, i, chunk_size, chunk_cnt, total_comb, callback, subset, err_callback, pred]()
+		{
+			callback_type thread_callback = callback;
+			while (!state->cancelled.load(std::memory_order_relaxed) && !state->failed.load(std::memory_order_relaxed))
+			{
+				const uint64_t chunk = next_chunk->fetch_add(1);
+				if (chunk >= chunk_cnt)
+					break;
+
+				const int_type start_index = int_type(chunk) * chunk_size;
+				const int_type end_index = (std::min)(int_type(start_index + chunk_size), total_comb);
+				int_type count = 0;
+				bool proceed = true;
+				worker_thread_proc(i, *shared_cont, start_index, end_index, subset,
+					[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+					{
+						if (state->cancelled.load(std::memory_order_relaxed))
+							return false;
+						proceed = thread_callback(thread_index_n, fullset_cnt, arrangement);
+						++count;
+						return proceed;
+					}, err_callback, pred);
+
+				if (!proceed || count != end_index - start_index)
+				{
+					state->failed.store(true); // stopped by callback, or err_callback was called by comb_loop
+					break;
+				}
+				state->chunks_done.fetch_add(1);
+			}
+			state->finish_task();
+		});
+	}
+
+	return handle;
+}
+
+template<typename container_type, typename predicate_type>
+typename std::enable_if<!std::is_same<predicate_type, no_predicate_type>::value, bool>::type
+next_comb(container_type& cont_full_set, container_type& cont, predicate_type pred)
+{
+	return stdcomb::next_combination(cont_full_set.begin(), cont_full_set.end(), cont.begin(), cont.end(), pred);
+}
+
+template<typename container_type, typename predicate_type>
+typename std::enable_if<std::is_same<predicate_type, no_predicate_type>::value, bool>::type
+next_comb(container_type& cont_full_set, container_type& cont, predicate_type /*pred*/)
+{
+	return stdcomb::next_combination(cont_full_set.begin(), cont_full_set.end(), cont.begin(), cont.end());
+}
+
+// Pull interface over the combinations [start_index, end_index) of subset elements of cont, in lexicographic order:
+// for (const auto& comb : make_comb_generator(subset, cont, start_index, end_index)) ...
+// or, to interleave with other streams, while (!gen.done()) { use(gen.current()); gen.advance(); }
+template<typename container_type, typename int_type, typename predicate_type=no_predicate_type>
+class comb_generator
+{
+public:
+	class iterator
+	{
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef container_type value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const container_type* pointer;
+		typedef const container_type& reference;
+
+		explicit iterator(comb_generator* gen_ = nullptr) : gen(gen_) {}
+		const container_type& operator*() const { return gen->current(); }
+		const container_type* operator->() const { return &gen->current(); }
+		iterator& operator++() { gen->advance(); return *this; }
+		bool operator==(const iterator& other) const { return at_end() == other.at_end(); }
+		bool operator!=(const iterator& other) const { return at_end() != other.at_end(); }
+
+	private:
+		bool at_end() const { return gen == nullptr || gen->done(); }
+		comb_generator* gen;
+	};
+
+	comb_generator(uint32_t subset, const container_type& cont, int_type start_index, int_type end_index, predicate_type pred_=predicate_type())
+		: cont_full_set(cont.begin(), cont.end()), remaining(0), big_remaining(0), pred(pred_)
+	{
+		if (end_index <= start_index || subset == 0 || subset > cont.size())
+			return;
+
+		std::vector<uint32_t> results(subset);
+		std::iota(results.begin(), results.end(), 0);
+		if (start_index > 0)
+		{
+			find_comb(cont.size(), subset, start_index, results);
+		}
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			vec.push_back(cont[results[i]]);
+		}
+		big_remaining = end_index - start_index;
+		refill();
+	}
+
+	bool done() const
+	{
+		return remaining == 0;
+	}
+
+	const container_type& current() const
+	{
+		return vec;
+	}
+
+	void advance()
+	{
+		if (--remaining == 0 && !refill())
+			return;
+		next_comb(cont_full_set, vec, pred);
+	}
+
+	iterator begin() { return iterator(this); }
+	iterator end() { return iterator(); }
+
+private:
+	// counts down with a POD counter, taken from big_remaining in blocks when int_type is larger
+	bool refill()
+	{
+		if (big_remaining <= 0)
+			return false;
+		if (big_remaining <= std::numeric_limits<int64_t>::max())
+		{
+			remaining = static_cast<uint64_t>(big_remaining);
+			big_remaining = 0;
+		}
+		else
+		{
+			remaining = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+			big_remaining -= std::numeric_limits<int64_t>::max();
+		}
+		return true;
+	}
+
+	container_type cont_full_set;
+	container_type vec;
+	uint64_t remaining;
+	int_type big_remaining;
+	predicate_type pred;
+};
+
+template<typename container_type, typename int_type, typename predicate_type=no_predicate_type>
+comb_generator<container_type, int_type, predicate_type> make_comb_generator(uint32_t subset, const container_type& cont, int_type start_index, int_type end_index, predicate_type pred=predicate_type())
+{
+	return comb_generator<container_type, int_type, predicate_type>(subset, cont, start_index, end_index, pred);
+}
+
+// Gives each of thread_cnt threads its own comb_generator over its share of the combinations:
+// worker(thread_index, generator) is called once per thread.
+template<typename int_type, typename container_type, typename worker_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_generators(int_type thread_cnt, uint32_t subset, const container_type& cont, worker_type worker, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	return run_comb_shard(int_type(0), int_type(1), thread_cnt, subset, cont, err_callback,
+		[&cont, subset, worker, err_callback, pred](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			const int thread_index_n = static_cast<const int>(thread_index);
+			comb_generator<container_type, int_type, predicate_type> gen(subset, cont, start_index, end_index, pred);
+			worker_type thread_worker = worker;
+			error_callback_type thread_err_callback = err_callback;
+			try
+			{
+				thread_worker(thread_index_n, gen);
+			}
+			catch(std::exception& ex)
+			{
+				std::ostringstream oss;
+				oss << "Exception thrown in compute_all_comb_generators:" << ex.what();
+				thread_err_callback(thread_index_n, cont.size(), gen.current(), oss.str());
+			}
+			catch(...)
+			{
+				thread_err_callback(thread_index_n, cont.size(), gen.current(), "Unknown exception thrown in compute_all_comb_generators");
+			}
+		});
+}
+
+// Random access iterator over combination indexes, for parallel algorithm backends.
+// Dereferencing unranks the combination lazily with find_comb, except when the iterator was just
+// incremented from the last dereferenced index: then the cursor moves on with next_combination,
+// so a backend walking a contiguous sub-range pays the unranking once per sub-range.
+// The reference returned is to a cursor inside the iterator, valid until the iterator changes.
+template<typename container_type, typename int_type, typename predicate_type=no_predicate_type>
+class comb_index_iterator
+{
+public:
+	typedef std::random_access_iterator_tag iterator_category;
+	typedef container_type value_type;
+	typedef int_type difference_type;
+	typedef const container_type* pointer;
+	typedef const container_type& reference;
+
+	comb_index_iterator() : cont(nullptr), subset(0), index(0), cursor_index(0), has_cursor(false) {}
+	comb_index_iterator(container_type* cont_, uint32_t subset_, int_type index_, predicate_type pred_=predicate_type())
+		: cont(cont_), subset(subset_), index(index_), cursor_index(0), has_cursor(false), pred(pred_) {}
+
+	reference operator*() const
+	{
+		if (!has_cursor || cursor_index != index)
+			seek();
+		return cursor;
+	}
+	pointer operator->() const { return &**this; }
+	value_type operator[](difference_type n) const { return *(*this + n); }
+
+	comb_index_iterator& operator++() { ++index; return *this; }
+	comb_index_iterator operator++(int) { comb_index_iterator it = *this; ++index; return it; }
+	comb_index_iterator& operator--() { --index; return *this; }
+	comb_index_iterator operator--(int) { comb_index_iterator it = *this; --index; return it; }
+	comb_index_iterator& operator+=(difference_type n) { index += n; return *this; }
+	comb_index_iterator& operator-=(difference_type n) { index -= n; return *this; }
+	comb_index_iterator operator+(difference_type n) const { comb_index_iterator it = *this; it.index += n; return it; }
+	friend comb_index_iterator operator+(difference_type n, const comb_index_iterator& it) { return it + n; }
+	comb_index_iterator operator-(difference_type n) const { comb_index_iterator it = *this; it.index -= n; return it; }
+	difference_type operator-(const comb_index_iterator& other) const { return index - other.index; }
+
+	bool operator==(const comb_index_iterator& other) const { return index == other.index; }
+	bool operator!=(const comb_index_iterator& other) const { return index != other.index; }
+	bool operator<(const comb_index_iterator& other) const { return index < other.index; }
+	bool operator>(const comb_index_iterator& other) const { return index > other.index; }
+	bool operator<=(const comb_index_iterator& other) const { return index <= other.index; }
+	bool operator>=(const comb_index_iterator& other) const { return index >= other.index; }
+
+	int_type get_index() const { return index; }
+
+private:
+	void seek() const
+	{
+		if (has_cursor && cursor_index + 1 == index)
+		{
+			next_comb(*cont, cursor, pred);
+		}
+		else
+		{
+			std::vector<uint32_t> results(subset);
+			std::iota(results.begin(), results.end(), 0);
+			if (index > 0)
+			{
+				find_comb(cont->size(), subset, index, results);
+			}
+			cursor.clear();
+			for (size_t i = 0; i < results.size(); ++i)
+			{
+				cursor.push_back((*cont)[results[i]]);
+			}
+		}
+		cursor_index = index;
+		has_cursor = true;
+	}
+
+	container_type* cont; // not modified, next_combination only needs the same iterator type as the cursor
+	uint32_t subset;
+	int_type index;
+	mutable container_type cursor;
+	mutable int_type cursor_index;
+	mutable bool has_cursor;
+	predicate_type pred;
+};
+
+// Combinations [start_index, end_index) of subset elements of cont as a range of comb_index_iterator, for
+// std::for_each(std::execution::par, range.begin(), range.end(), ...) and similar algorithms.
+// It is also a TBB-style splittable range (empty, is_divisible and a splitting constructor taking tbb::split),
+// so tbb::parallel_for(range, body) can schedule it; body iterates its sub-range with begin() and end().
+template<typename container_type, typename int_type, typename predicate_type=no_predicate_type>
+class comb_range
+{
+public:
+	typedef comb_index_iterator<container_type, int_type, predicate_type> iterator;
+	typedef iterator const_iterator;
+
+	comb_range(uint32_t subset_, const container_type& cont_, int_type start_index_, int_type end_index_, int_type grainsize_=int_type(1024), predicate_type pred_=predicate_type())
+		: cont(new container_type(cont_)), subset(subset_), start_index(start_index_), end_index((std::max)(start_index_, end_index_)), grainsize((std::max)(grainsize_, int_type(1))), pred(pred_) {}
+
+	// splitting constructor: other keeps the first half and this range takes the second half
+	template<typename split_type>
+	comb_range(comb_range& other, split_type)
+		: cont(other.cont), subset(other.subset), start_index(other.start_index + (other.end_index - other.start_index) / 2), end_index(other.end_index), grainsize(other.grainsize), pred(other.pred)
+	{
+		other.end_index = start_index;
+	}
+
+	iterator begin() const { return iterator(cont.get(), subset, start_index, pred); }
+	iterator end() const { return iterator(cont.get(), subset, end_index, pred); }
+	int_type size() const { return end_index - start_index; }
+	bool empty() const { return end_index <= start_index; }
+	bool is_divisible() const { return size() > grainsize; }
+
+private:
+	std::shared_ptr<container_type> cont;
+	uint32_t subset;
+	int_type start_index;
+	int_type end_index;
+	int_type grainsize;
+	predicate_type pred;
+};
+
+template<typename container_type, typename int_type, typename predicate_type=no_predicate_type>
+comb_range<container_type, int_type, predicate_type> make_comb_range(uint32_t subset, const container_type& cont, int_type start_index, int_type end_index, int_type grainsize=int_type(1024), predicate_type pred=predicate_type())
+{
+	return comb_range<container_type, int_type, predicate_type>(subset, cont, start_index, end_index, grainsize, pred);
+}
+
+using concurrent_common::available_cpu_cnt;
+using concurrent_common::auto_plan;
+using concurrent_common::auto_warmup_ns;
+using concurrent_common::auto_min_thread_ns;
+using concurrent_common::auto_chunk_ns;
+using concurrent_common::plan_auto;
+using concurrent_common::run_on_pool;
+
+// Picks the thread count and the chunk size itself: the calling thread first processes combinations for a
+// short warm-up to measure their cost, then the rest is split into chunks claimed by up to available_cpu_cnt()
+// threads, the calling thread and threads of pool, and by fewer when there is too little work left to be worth a thread.
+// Returning false from callback stops every thread. int_type defaults to int64_t, give it explicitly for larger sets.
+template<typename int_type = int64_t, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_all_comb_auto(uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, auto_plan& plan, predicate_type pred=predicate_type(), thread_pool& pool=thread_pool::instance())
+{
+	plan = auto_plan();
+
+	if (subset <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: subset(" << subset;
+		oss << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(0, cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	std::atomic<bool> stop(false);
+	std::atomic<bool> failed(false);
+
+	// warm-up on the calling thread, which keeps its copy of callback for chunks afterwards
+	callback_type first_callback = callback;
+	uint64_t warmup_cnt = 0;
+	bool warmup_stopped = false;
+	const std::chrono::steady_clock::time_point warmup_start = std::chrono::steady_clock::now();
+	double elapsed_ns = 0.0;
+	// the clock is read after 1, 2, 4, 8 and 16 items and then every 16, so an expensive item ends the warm-up
+	// at once and a cheap one is not slowed down by the clock
+	uint64_t next_check = 1;
+	worker_thread_proc(int_type(0), cont, int_type(0), total_comb, subset,
+		[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+		{
+			if (!first_callback(thread_index_n, fullset_cnt, arrangement))
+			{
+				warmup_stopped = true;
+				return false;
+			}
+			++warmup_cnt;
+			if (warmup_cnt == next_check)
+			{
+				next_check += (std::min)(next_check, uint64_t(16));
+				elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - warmup_start).count());
+				if (elapsed_ns >= auto_warmup_ns)
+					return false;
+			}
+			return true;
+		}, err_callback, pred);
+	if (elapsed_ns < auto_warmup_ns)
+		elapsed_ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - warmup_start).count());
+
+	plan.warmup_cnt = warmup_cnt;
+	plan.item_ns = elapsed_ns / static_cast<double>((std::max)(warmup_cnt, uint64_t(1)));
+	plan.thread_cnt = 1;
+	const int_type start = int_type(warmup_cnt);
+	if (warmup_stopped || start >= total_comb)
+		return true;
+	if (elapsed_ns < auto_warmup_ns)
+		return false; // err_callback was called by comb_loop
+
+	const int_type remaining = total_comb - start;
+	plan_auto(remaining, plan.item_ns, available_cpu_cnt(), plan);
+	const int_type chunk_size = int_type(plan.chunk_size);
+	const uint64_t chunk_cnt = static_cast<uint64_t>((remaining + chunk_size - 1) / chunk_size);
+
+	std::atomic<uint64_t> next_chunk(0);
+	auto worker = [&](const int_type thread_index, callback_type& thread_callback)
+	{
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			const uint64_t chunk = next_chunk.fetch_add(1);
+			if (chunk >= chunk_cnt)
+				return;
+
+			const int_type start_index = start + int_type(chunk) * chunk_size;
+			const int_type end_index = (std::min)(int_type(start_index + chunk_size), total_comb);
+			int_type count = 0;
+			bool proceed = true;
+			worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+				[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+				{
+					if (stop.load(std::memory_order_relaxed))
+						return false;
+					proceed = thread_callback(thread_index_n, fullset_cnt, arrangement);
+					++count;
+					return proceed;
+				}, err_callback, pred);
+
+			if (!proceed)
+				stop.store(true);
+			else if (count != end_index - start_index && !stop.load())
+			{
+				failed.store(true); // err_callback was called by comb_loop
+				stop.store(true);
+			}
+		}
+	};
+
+	// the other threads come from pool, each with its own copy of callback
+	plan.thread_cnt = (std::min)(plan.thread_cnt, static_cast<uint32_t>(pool.size() + 1));
+	auto task = [&worker, &first_callback, callback](const uint32_t i)
+	{
+		if (i == 0)
+		{
+			worker(int_type(0), first_callback);
+			return;
+		}
+		callback_type thread_callback = callback;
+		worker(int_type(i), thread_callback);
+	};
+	run_on_pool(pool, plan.thread_cnt - 1, task);
+
+	return !failed.load();
+}
+
+// Calls callback on the combinations of chunks [chunk_begin, chunk_end), chunks as split by split_chunks,
+// unranking the first one with find_comb, so a worker leased any chunk range can start there.
+// callback is taken by reference to keep its state across ranges. Returns false if callback stopped early
+// or an exception was reported through err_callback.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=no_predicate_type>
+bool compute_comb_chunks(const int_type thread_index, uint32_t subset, const container_type& cont, uint64_t chunk_begin, uint64_t chunk_end, callback_type& callback, error_callback_type err_callback, predicate_type pred=predicate_type())
+{
+	int_type total_comb=0; 
+	if (!compute_total_comb(cont.size(), subset, total_comb))
+	{
+		err_callback(static_cast<int>(thread_index), cont.size(), cont, "Error: compute_total_comb() return false");
+		return false;
+	}
+
+	int_type chunk_size = 0;
+	uint64_t chunk_cnt = 0;
+	split_chunks(total_comb, chunk_size, chunk_cnt);
+
+	if (chunk_begin > chunk_end || chunk_end > chunk_cnt)
+	{
+		std::ostringstream oss;
+		oss << "Error: chunk range [" << chunk_begin << ", " << chunk_end;
+		oss << ") is outside of [0, " << chunk_cnt << ")";
+
+		err_callback(static_cast<int>(thread_index), cont.size(), cont, oss.str());
+		return false;
+	}
+
+	const int_type start_index = int_type(chunk_begin) * chunk_size;
+	const int_type end_index = (std::min)(int_type(int_type(chunk_end) * chunk_size), total_comb);
+	if (start_index >= end_index)
+		return true;
+
+	// counted after callback returns, so an exception caught and reported by the loop leaves the count short
+	int_type count = 0;
+	worker_thread_proc(thread_index, cont, start_index, end_index, subset,
+		[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+		{
+			if (!callback(thread_index_n, fullset_cnt, arrangement))
+				return false;
+			++count;
+			return true;
+		}, err_callback, pred);
+	return count == end_index - start_index;
+}
+
+}
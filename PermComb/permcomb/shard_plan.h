@@ -0,0 +1,755 @@
+///////////////////////////////////////////////////////////////////////////////
+// shard_plan.h header file
+//
+// Shard planning and JSON manifests for concurrent_perm and concurrent_comb
+// Copyright 2016 Wong Shao Voon
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+// Splits all permutations or combinations of a job into index ranges per node,
+// writes them as JSON manifests holding the seed arrangement of every range,
+// runs a range straight from its seed and checks the completion records of
+// all workers for full, non-overlapping coverage.
+
+#pragma once
+
+#include "concurrent_perm.h"
+#include "concurrent_comb.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <thread>
+
+namespace concurrent_shard
+{
+
+// Just enough JSON for manifests and completion records. Numbers keep their text, so big integers are not rounded.
+struct json_value
+{
+	enum kind_type { null_kind, bool_kind, number_kind, string_kind, array_kind, object_kind };
+
+	json_value() : kind(null_kind)
+	{
+	}
+
+	const json_value* find(const std::string& key) const
+	{
+		for (size_t i = 0; i < members.size(); ++i)
+		{
+			if (members[i].first == key)
+				return &members[i].second;
+		}
+		return nullptr;
+	}
+
+	kind_type kind;
+	std::string text; // number, string, "true" or "false"
+	std::vector<json_value> items;
+	std::vector<std::pair<std::string, json_value> > members;
+};
+
+class json_parser
+{
+public:
+	explicit json_parser(const std::string& text) : text(text), pos(0)
+	{
+	}
+
+	bool parse(json_value& value, std::string& error)
+	{
+		pos = 0;
+		if (!parse_value(value, 0) || (skip_space(), pos != text.size()))
+		{
+			std::ostringstream oss;
+			oss << "Error: invalid JSON at offset " << pos;
+			error = oss.str();
+			return false;
+		}
+		return true;
+	}
+
+private:
+	void skip_space()
+	{
+		while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+			++pos;
+	}
+
+	bool literal(const char* word)
+	{
+		const size_t len = std::char_traits<char>::length(word);
+		if (text.compare(pos, len, word) != 0)
+			return false;
+		pos += len;
+		return true;
+	}
+
+	bool parse_string(std::string& out)
+	{
+		if (pos >= text.size() || text[pos] != '"')
+			return false;
+		++pos;
+		out.clear();
+		while (pos < text.size() && text[pos] != '"')
+		{
+			char c = text[pos++];
+			if (c == '\\')
+			{
+				if (pos >= text.size())
+					return false;
+				c = text[pos++];
+				switch (c)
+				{
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'u':
+					{
+						unsigned code = 0;
+						if (pos + 4 > text.size() || std::sscanf(text.c_str() + pos, "%4x", &code) != 1 || code > 0x7f)
+							return false; // manifests only hold ASCII
+						c = static_cast<char>(code);
+						pos += 4;
+					}
+					break;
+				default: break; // '"', '\\' and '/' stand for themselves
+				}
+			}
+			out.push_back(c);
+		}
+		if (pos >= text.size())
+			return false;
+		++pos;
+		return true;
+	}
+
+	bool parse_value(json_value& value, int depth)
+	{
+		if (depth > 64)
+			return false;
+
+		skip_space();
+		if (pos >= text.size())
+			return false;
+
+		const char c = text[pos];
+		if (c == '{')
+		{
+			value.kind = json_value::object_kind;
+			++pos;
+			skip_space();
+			if (pos < text.size() && text[pos] == '}')
+			{
+				++pos;
+				return true;
+			}
+			while (true)
+			{
+				std::string key;
+				skip_space();
+				if (!parse_string(key))
+					return false;
+				skip_space();
+				if (pos >= text.size() || text[pos] != ':')
+					return false;
+				++pos;
+				value.members.push_back(std::make_pair(key, json_value()));
+				if (!parse_value(value.members.back().second, depth + 1))
+					return false;
+				skip_space();
+				if (pos < text.size() && text[pos] == ',')
+				{
+					++pos;
+					continue;
+				}
+				if (pos < text.size() && text[pos] == '}')
+				{
+					++pos;
+					return true;
+				}
+				return false;
+			}
+		}
+		if (c == '[')
+		{
+			value.kind = json_value::array_kind;
+			++pos;
+			skip_space();
+			if (pos < text.size() && text[pos] == ']')
+			{
+				++pos;
+				return true;
+			}
+			while (true)
+			{
+				value.items.push_back(json_value());
+				if (!parse_value(value.items.back(), depth + 1))
+					return false;
+				skip_space();
+				if (pos < text.size() && text[pos] == ',')
+				{
+					++pos;
+					continue;
+				}
+				if (pos < text.size() && text[pos] == ']')
+				{
+					++pos;
+					return true;
+				}
+				return false;
+			}
+		}
+		if (c == '"')
+		{
+			value.kind = json_value::string_kind;
+			return parse_string(value.text);
+		}
+		if (literal("true"))
+		{
+			value.kind = json_value::bool_kind;
+			value.text = "true";
+			return true;
+		}
+		if (literal("false"))
+		{
+			value.kind = json_value::bool_kind;
+			value.text = "false";
+			return true;
+		}
+		if (literal("null"))
+		{
+			value.kind = json_value::null_kind;
+			return true;
+		}
+
+		const size_t begin = pos;
+		while (pos < text.size() && (std::isdigit(static_cast<unsigned char>(text[pos])) || text[pos] == '-' || text[pos] == '+' || text[pos] == '.' || text[pos] == 'e' || text[pos] == 'E'))
+			++pos;
+		if (pos == begin)
+			return false;
+		value.kind = json_value::number_kind;
+		value.text = text.substr(begin, pos - begin);
+		return true;
+	}
+
+	const std::string& text;
+	size_t pos;
+};
+
+inline std::string json_quote(const std::string& text)
+{
+	std::string out = "\"";
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		const char c = text[i];
+		if (c == '"' || c == '\\')
+		{
+			out.push_back('\\');
+			out.push_back(c);
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+			out += escaped;
+		}
+		else
+			out.push_back(c);
+	}
+	return out + "\"";
+}
+
+// Reads an integer written as a JSON string or number, such as a big integer index
+template<typename int_type>
+bool json_integer(const json_value* value, int_type& result)
+{
+	if (value == nullptr || (value->kind != json_value::string_kind && value->kind != json_value::number_kind) || value->text.empty())
+		return false;
+	for (size_t i = 0; i < value->text.size(); ++i)
+	{
+		if (!std::isdigit(static_cast<unsigned char>(value->text[i])))
+			return false;
+	}
+	std::istringstream iss(value->text);
+	iss >> result;
+	return !iss.fail();
+}
+
+// One index range of a plan. seed holds the element indices of the arrangement at start_index,
+// so a worker starts there without unranking.
+template<typename int_type>
+struct shard_job
+{
+	shard_job() : job_index(0), start_index(0), end_index(0), expected_cnt(0)
+	{
+	}
+
+	uint64_t job_index;
+	std::string node;
+	int_type start_index;
+	int_type end_index;
+	int_type expected_cnt;
+	std::vector<uint32_t> seed;
+};
+
+template<typename int_type>
+struct shard_plan
+{
+	shard_plan() : n(0), k(0), total(0)
+	{
+	}
+
+	std::string mode; // "perm" or "comb"
+	uint32_t n; // set size, or full set size for combinations
+	uint32_t k; // subset size; n for permutations
+	int_type total;
+	std::vector<shard_job<int_type> > jobs;
+};
+
+// What a worker reports when it finishes a job
+template<typename int_type>
+struct shard_record
+{
+	shard_record() : job_index(0), start_index(0), end_index(0), processed_cnt(0)
+	{
+	}
+
+	uint64_t job_index;
+	int_type start_index;
+	int_type end_index;
+	int_type processed_cnt;
+};
+
+// Splits the permutations (mode "perm", k ignored) or combinations (mode "comb") of n elements
+// over nodes in proportion to weights (all 1 if empty), then every node range into jobs_per_node jobs.
+// Empty ranges get no job.
+template<typename int_type>
+bool make_shard_plan(const std::string& mode, uint32_t n, uint32_t k, const std::vector<std::string>& nodes, std::vector<uint32_t> weights, uint32_t jobs_per_node, shard_plan<int_type>& plan, std::string& error)
+{
+	plan = shard_plan<int_type>();
+	if (nodes.empty() || jobs_per_node == 0)
+	{
+		error = "Error: no nodes, or jobs_per_node is 0";
+		return false;
+	}
+	if (weights.empty())
+		weights.assign(nodes.size(), 1);
+	uint64_t sum = 0;
+	for (size_t i = 0; i < weights.size(); ++i)
+		sum += weights[i];
+	if (weights.size() != nodes.size() || sum == 0 || sum > std::numeric_limits<uint32_t>::max())
+	{
+		error = "Error: weights must be given for every node and add up to between 1 and UINT32_MAX";
+		return false;
+	}
+
+	std::vector<uint32_t> identity(n);
+	std::iota(identity.begin(), identity.end(), 0);
+	if (mode == "perm")
+	{
+		if (n == 0)
+		{
+			error = "Error: n is 0";
+			return false;
+		}
+		k = n;
+		concurrent_perm::compute_factorial(n, plan.total);
+	}
+	else if (mode == "comb")
+	{
+		if (k == 0 || !concurrent_comb::compute_total_comb(n, k, plan.total))
+		{
+			std::ostringstream oss;
+			oss << "Error: no combinations of " << k << " out of " << n;
+			error = oss.str();
+			return false;
+		}
+	}
+	else
+	{
+		error = "Error: mode(" + mode + ") is neither perm nor comb";
+		return false;
+	}
+	plan.mode = mode;
+	plan.n = n;
+	plan.k = k;
+
+	const std::vector<uint32_t> job_weights(jobs_per_node, 1);
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		int_type node_start = 0;
+		int_type node_end = 0;
+		concurrent_perm::split_weighted_range(plan.total, weights, i, node_start, node_end);
+		const int_type node_cnt = node_end - node_start;
+		for (uint32_t j = 0; j < jobs_per_node; ++j)
+		{
+			shard_job<int_type> job;
+			concurrent_perm::split_weighted_range(node_cnt, job_weights, j, job.start_index, job.end_index);
+			job.start_index += node_start;
+			job.end_index += node_start;
+			if (job.start_index >= job.end_index)
+				continue;
+
+			job.job_index = plan.jobs.size();
+			job.node = nodes[i];
+			job.expected_cnt = job.end_index - job.start_index;
+			if (mode == "perm")
+				job.seed = concurrent_perm::find_perm_by_idx(job.start_index, identity);
+			else
+				job.seed = concurrent_comb::find_comb_by_idx(k, job.start_index, identity);
+			plan.jobs.push_back(job);
+		}
+	}
+	return true;
+}
+
+template<typename int_type>
+std::string job_fields_to_json(const shard_job<int_type>& job, const std::string& indent)
+{
+	std::ostringstream oss;
+	oss << indent << "\"job\": " << job.job_index << ",\n";
+	oss << indent << "\"node\": " << json_quote(job.node) << ",\n";
+	oss << indent << "\"start_index\": \"" << job.start_index << "\",\n";
+	oss << indent << "\"end_index\": \"" << job.end_index << "\",\n";
+	oss << indent << "\"expected_cnt\": \"" << job.expected_cnt << "\",\n";
+	oss << indent << "\"seed\": [";
+	for (size_t i = 0; i < job.seed.size(); ++i)
+		oss << ((i > 0) ? ", " : "") << job.seed[i];
+	oss << "]";
+	return oss.str();
+}
+
+template<typename int_type>
+std::string plan_header_to_json(const shard_plan<int_type>& plan)
+{
+	std::ostringstream oss;
+	oss << "  \"mode\": " << json_quote(plan.mode) << ",\n";
+	oss << "  \"n\": " << plan.n << ",\n";
+	oss << "  \"k\": " << plan.k << ",\n";
+	oss << "  \"total\": \"" << plan.total << "\",\n";
+	return oss.str();
+}
+
+// Manifest of one job, for the worker that runs it. Indices are JSON strings so that big integers survive any JSON reader.
+template<typename int_type>
+std::string job_to_json(const shard_plan<int_type>& plan, const shard_job<int_type>& job)
+{
+	return "{\n" + plan_header_to_json(plan) + job_fields_to_json(job, "  ") + "\n}\n";
+}
+
+// Manifest of the whole plan, for the merge step
+template<typename int_type>
+std::string plan_to_json(const shard_plan<int_type>& plan)
+{
+	std::string json = "{\n" + plan_header_to_json(plan) + "  \"jobs\": [";
+	for (size_t i = 0; i < plan.jobs.size(); ++i)
+	{
+		json += (i > 0) ? ",\n    {\n" : "\n    {\n";
+		json += job_fields_to_json(plan.jobs[i], "      ") + "\n    }";
+	}
+	return json + "\n  ]\n}\n";
+}
+
+template<typename int_type>
+bool parse_job_fields(const json_value& object, shard_job<int_type>& job)
+{
+	const json_value* node = object.find("node");
+	const json_value* seed = object.find("seed");
+	if (!json_integer(object.find("job"), job.job_index)
+		|| node == nullptr || node->kind != json_value::string_kind
+		|| !json_integer(object.find("start_index"), job.start_index)
+		|| !json_integer(object.find("end_index"), job.end_index)
+		|| !json_integer(object.find("expected_cnt"), job.expected_cnt)
+		|| seed == nullptr || seed->kind != json_value::array_kind)
+		return false;
+
+	job.node = node->text;
+	job.seed.resize(seed->items.size());
+	for (size_t i = 0; i < seed->items.size(); ++i)
+	{
+		if (!json_integer(&seed->items[i], job.seed[i]))
+			return false;
+	}
+	return true;
+}
+
+// Reads a plan from plan_to_json, or a plan of a single job from job_to_json
+template<typename int_type>
+bool parse_shard_plan(const std::string& text, shard_plan<int_type>& plan, std::string& error)
+{
+	plan = shard_plan<int_type>();
+	json_value root;
+	if (!json_parser(text).parse(root, error))
+		return false;
+
+	const json_value* mode = root.find("mode");
+	if (root.kind != json_value::object_kind || mode == nullptr || mode->kind != json_value::string_kind
+		|| !json_integer(root.find("n"), plan.n) || !json_integer(root.find("k"), plan.k) || !json_integer(root.find("total"), plan.total))
+	{
+		error = "Error: manifest has no mode, n, k or total";
+		return false;
+	}
+	plan.mode = mode->text;
+
+	const json_value* jobs = root.find("jobs");
+	bool ok = true;
+	if (jobs == nullptr)
+	{
+		plan.jobs.resize(1);
+		ok = parse_job_fields(root, plan.jobs[0]);
+	}
+	else if (jobs->kind == json_value::array_kind)
+	{
+		plan.jobs.resize(jobs->items.size());
+		for (size_t i = 0; i < jobs->items.size() && ok; ++i)
+			ok = parse_job_fields(jobs->items[i], plan.jobs[i]);
+	}
+	else
+		ok = false;
+
+	if (!ok)
+		error = "Error: manifest has an invalid job";
+	return ok;
+}
+
+template<typename int_type>
+std::string record_to_json(const shard_record<int_type>& record)
+{
+	std::ostringstream oss;
+	oss << "{\n";
+	oss << "  \"job\": " << record.job_index << ",\n";
+	oss << "  \"start_index\": \"" << record.start_index << "\",\n";
+	oss << "  \"end_index\": \"" << record.end_index << "\",\n";
+	oss << "  \"processed_cnt\": \"" << record.processed_cnt << "\"\n";
+	oss << "}\n";
+	return oss.str();
+}
+
+template<typename int_type>
+bool parse_record_fields(const json_value& object, shard_record<int_type>& record)
+{
+	return json_integer(object.find("job"), record.job_index)
+		&& json_integer(object.find("start_index"), record.start_index)
+		&& json_integer(object.find("end_index"), record.end_index)
+		&& json_integer(object.find("processed_cnt"), record.processed_cnt);
+}
+
+template<typename int_type>
+bool parse_shard_record(const std::string& text, shard_record<int_type>& record, std::string& error)
+{
+	json_value root;
+	if (!json_parser(text).parse(root, error))
+		return false;
+	if (!parse_record_fields(root, record))
+	{
+		error = "Error: record has no job, start_index, end_index or processed_cnt";
+		return false;
+	}
+	return true;
+}
+
+// Records of all the jobs a worker ran, as one JSON array
+template<typename int_type>
+std::string records_to_json(const std::vector<shard_record<int_type> >& records)
+{
+	std::string json = "[";
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		json += (i > 0) ? ",\n" : "\n";
+		json += record_to_json(records[i]);
+		json.erase(json.size() - 1); // the newline after the closing brace
+	}
+	return json + "\n]\n";
+}
+
+// Appends the records of text, either a single record from record_to_json or an array from records_to_json
+template<typename int_type>
+bool parse_shard_records(const std::string& text, std::vector<shard_record<int_type> >& records, std::string& error)
+{
+	json_value root;
+	if (!json_parser(text).parse(root, error))
+		return false;
+	const std::vector<json_value> single(1, root);
+	const std::vector<json_value>& items = (root.kind == json_value::array_kind) ? root.items : single;
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		shard_record<int_type> record;
+		if (!parse_record_fields(items[i], record))
+		{
+			error = "Error: record has no job, start_index, end_index or processed_cnt";
+			return false;
+		}
+		records.push_back(record);
+	}
+	return true;
+}
+
+// Merge step: checks that the records cover [0, plan.total) exactly once, every record matches its job
+// and processed all of it. Every problem found is appended to report, one per line.
+template<typename int_type>
+bool verify_coverage(const shard_plan<int_type>& plan, std::vector<shard_record<int_type> > records, std::string& report)
+{
+	std::ostringstream oss;
+	std::sort(records.begin(), records.end(), [](const shard_record<int_type>& a, const shard_record<int_type>& b)
+	{
+		return a.start_index < b.start_index || (a.start_index == b.start_index && a.end_index < b.end_index);
+	});
+
+	std::vector<bool> reported(plan.jobs.size(), false);
+	int_type next = 0;
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		const shard_record<int_type>& record = records[i];
+		if (record.job_index >= plan.jobs.size())
+			oss << "job " << record.job_index << " is not in the plan\n";
+		else
+		{
+			const shard_job<int_type>& job = plan.jobs[static_cast<size_t>(record.job_index)];
+			if (job.start_index != record.start_index || job.end_index != record.end_index)
+				oss << "job " << record.job_index << " reported [" << record.start_index << ", " << record.end_index << ") instead of [" << job.start_index << ", " << job.end_index << ")\n";
+			if (reported[static_cast<size_t>(record.job_index)])
+				oss << "job " << record.job_index << " reported twice\n";
+			reported[static_cast<size_t>(record.job_index)] = true;
+		}
+		if (record.processed_cnt != record.end_index - record.start_index)
+			oss << "job " << record.job_index << " processed " << record.processed_cnt << " of " << (record.end_index - record.start_index) << "\n";
+
+		if (record.start_index > next)
+			oss << "[" << next << ", " << record.start_index << ") is not covered\n";
+		else if (record.start_index < next)
+			oss << "[" << record.start_index << ", " << (std::min)(next, record.end_index) << ") is covered twice\n";
+		next = (std::max)(next, record.end_index);
+	}
+	if (next < plan.total)
+		oss << "[" << next << ", " << plan.total << ") is not covered\n";
+	for (size_t i = 0; i < reported.size(); ++i)
+	{
+		if (!reported[i])
+			oss << "job " << i << " has no record\n";
+	}
+
+	report += oss.str();
+	return oss.str().empty();
+}
+
+// Runs one job of a permutation plan on the calling thread, starting from its seed.
+// cont must hold the plan.n elements that the seed indexes.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_perm::no_predicate_type>
+bool compute_perm_job(int thread_index, const shard_job<int_type>& job, const container_type& cont, callback_type callback, error_callback_type err_callback, shard_record<int_type>& record, predicate_type pred=predicate_type())
+{
+	record = shard_record<int_type>();
+	record.job_index = job.job_index;
+	record.start_index = job.start_index;
+	record.end_index = job.end_index;
+
+	bool valid = job.seed.size() == cont.size() && job.start_index < job.end_index;
+	for (size_t i = 0; i < job.seed.size() && valid; ++i)
+		valid = job.seed[i] < cont.size();
+	if (!valid)
+	{
+		std::ostringstream oss;
+		oss << "Error: job " << job.job_index << " has an invalid seed or range for " << cont.size() << " elements";
+
+		err_callback(thread_index, cont, oss.str());
+		return false;
+	}
+
+	uint64_t processed = 0;
+	concurrent_perm::worker_thread_proc_seeded(int_type(thread_index), cont, job.seed, job.start_index, job.end_index,
+		[&](const int thread_index_n, const container_type& arrangement) -> bool
+		{
+			++processed;
+			return callback(thread_index_n, arrangement);
+		}, err_callback, pred);
+	record.processed_cnt = int_type(processed);
+	return record.processed_cnt == job.expected_cnt;
+}
+
+// Runs one job of a combination plan on the calling thread, starting from its seed.
+// cont must hold the plan.n elements of the full set that the seed indexes.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_comb::no_predicate_type>
+bool compute_comb_job(int thread_index, const shard_job<int_type>& job, const container_type& cont, callback_type callback, error_callback_type err_callback, shard_record<int_type>& record, predicate_type pred=predicate_type())
+{
+	record = shard_record<int_type>();
+	record.job_index = job.job_index;
+	record.start_index = job.start_index;
+	record.end_index = job.end_index;
+
+	bool valid = !job.seed.empty() && job.seed.size() <= cont.size() && job.start_index < job.end_index;
+	for (size_t i = 0; i < job.seed.size() && valid; ++i)
+		valid = job.seed[i] < cont.size() && (i == 0 || job.seed[i - 1] < job.seed[i]);
+	if (!valid)
+	{
+		std::ostringstream oss;
+		oss << "Error: job " << job.job_index << " has an invalid seed or range for " << cont.size() << " elements";
+
+		err_callback(thread_index, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	uint64_t processed = 0;
+	concurrent_comb::worker_thread_proc_seeded(int_type(thread_index), cont, job.seed, job.start_index, job.end_index,
+		[&](const int thread_index_n, const size_t fullset_cnt, const container_type& arrangement) -> bool
+		{
+			++processed;
+			return callback(thread_index_n, fullset_cnt, arrangement);
+		}, err_callback, pred);
+	record.processed_cnt = int_type(processed);
+	return record.processed_cnt == job.expected_cnt;
+}
+
+// Runs every job of a node on its own thread, each with its own copy of callback; thread 0 is the calling thread.
+// records[i] is the completion record of jobs[i].
+template<typename int_type, typename job_runner_type>
+bool run_shard_jobs(const std::vector<shard_job<int_type> >& jobs, std::vector<shard_record<int_type> >& records, job_runner_type run_job)
+{
+	records.assign(jobs.size(), shard_record<int_type>());
+	std::vector<char> ok(jobs.size(), 0);
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (size_t i = 1; i < jobs.size(); ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread([&, i]()
+		{
+			ok[i] = run_job(static_cast<int>(i), jobs[i], records[i]);
+		})));
+	}
+	if (!jobs.empty())
+		ok[0] = run_job(0, jobs[0], records[0]);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+	return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_perm::no_predicate_type>
+bool compute_perm_jobs(const std::vector<shard_job<int_type> >& jobs, const container_type& cont, callback_type callback, error_callback_type err_callback, std::vector<shard_record<int_type> >& records, predicate_type pred=predicate_type())
+{
+	return run_shard_jobs(jobs, records, [&](int thread_index, const shard_job<int_type>& job, shard_record<int_type>& record) -> bool
+	{
+		return compute_perm_job(thread_index, job, cont, callback, err_callback, record, pred);
+	});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_comb::no_predicate_type>
+bool compute_comb_jobs(const std::vector<shard_job<int_type> >& jobs, const container_type& cont, callback_type callback, error_callback_type err_callback, std::vector<shard_record<int_type> >& records, predicate_type pred=predicate_type())
+{
+	return run_shard_jobs(jobs, records, [&](int thread_index, const shard_job<int_type>& job, shard_record<int_type>& record) -> bool
+	{
+		return compute_comb_job(thread_index, job, cont, callback, err_callback, record, pred);
+	});
+}
+
+}
@@ -0,0 +1,508 @@
+// Benchmark suite: sweeps set sizes, element types, engines and thread counts, repeats every run,
+// and writes the statistics as a table and as JSON for tracking throughput and scaling over time.
+//
+//   permcomb_benchmark [--reps <r>] [--max-threads <t>] [--perm <n>,...] [--comb <n>:<k>,...]
+//                      [--types char,int,string,payload64] [--engines index,prefix,strided,generator]
+//                      [--json <path>] [--quick]
+//
+// Every configuration runs once to warm up and then reps times, timed with steady_clock. Throughput is
+// arrangements per second over the median time; parallel efficiency is the throughput at t threads over
+// t times the single-thread throughput of the same engine, element type and set size.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include "concurrent_perm.h"
+#include "concurrent_comb.h"
+
+typedef int64_t int_type;
+
+// 64 bytes, compared by id only, so copying dominates like for a record type
+struct payload64
+{
+	uint32_t id;
+	char bytes[60];
+};
+
+bool operator<(const payload64& a, const payload64& b)
+{
+	return a.id < b.id;
+}
+
+bool operator==(const payload64& a, const payload64& b)
+{
+	return a.id == b.id;
+}
+
+// elements are created in sorted order, as next_permutation and next_combination start from there
+template<typename T>
+T make_element(uint32_t i);
+
+template<>
+char make_element<char>(uint32_t i)
+{
+	return static_cast<char>('A' + i);
+}
+
+template<>
+int make_element<int>(uint32_t i)
+{
+	return static_cast<int>(i);
+}
+
+template<>
+std::string make_element<std::string>(uint32_t i)
+{
+	std::ostringstream oss;
+	oss << "element" << std::setw(3) << std::setfill('0') << i;
+	return oss.str();
+}
+
+template<>
+payload64 make_element<payload64>(uint32_t i)
+{
+	payload64 p;
+	p.id = i;
+	std::memset(p.bytes, static_cast<int>(i), sizeof(p.bytes));
+	return p;
+}
+
+inline uint64_t touch(char c)
+{
+	return static_cast<uint64_t>(c);
+}
+
+inline uint64_t touch(int i)
+{
+	return static_cast<uint64_t>(i);
+}
+
+inline uint64_t touch(const std::string& s)
+{
+	return static_cast<uint64_t>(s[s.size() - 1]);
+}
+
+inline uint64_t touch(const payload64& p)
+{
+	return p.id ^ static_cast<uint64_t>(p.bytes[0]);
+}
+
+// a trivial amount of work per arrangement, to measure the per-item overhead of the engines
+template<typename container_type>
+struct checksum_perm_callback_t
+{
+	bool operator()(const int /*thread_index*/, const container_type& cont)
+	{
+		sum += touch(cont[0]) ^ touch(cont[cont.size() - 1]);
+		return sum != 1;
+	}
+
+	uint64_t sum = 0;
+};
+
+template<typename container_type>
+struct checksum_comb_callback_t
+{
+	bool operator()(const int /*thread_index*/, const size_t /*fullset_cnt*/, const container_type& cont)
+	{
+		sum += touch(cont[0]) ^ touch(cont[cont.size() - 1]);
+		return sum != 1;
+	}
+
+	uint64_t sum = 0;
+};
+
+struct options
+{
+	unsigned reps = 5;
+	int_type max_thread_cnt = (std::max)(1u, std::thread::hardware_concurrency());
+	std::vector<uint32_t> perm_sizes = { 9, 10 };
+	std::vector<std::pair<uint32_t, uint32_t> > comb_sizes = { { 20, 10 }, { 24, 12 } };
+	std::vector<std::string> types = { "char", "int", "string", "payload64" };
+	std::vector<std::string> engines = { "index", "prefix", "strided", "generator" };
+	std::string json_path = "permcomb_benchmark.json";
+};
+
+struct result
+{
+	std::string mode;
+	std::string engine;
+	std::string type;
+	uint32_t n = 0;
+	uint32_t k = 0;
+	int_type thread_cnt = 0;
+	int_type items = 0;
+	bool ok = true;
+	double min_ms = 0.0;
+	double median_ms = 0.0;
+	double mean_ms = 0.0;
+	double stddev_ms = 0.0;
+	double items_per_sec = 0.0;
+	double efficiency = 0.0;
+};
+
+// warm-up run, then reps timed runs; run() returns false when the engine reports an error
+template<typename run_type>
+void measure(unsigned reps, run_type run, result& res)
+{
+	res.ok = run();
+	std::vector<double> ms;
+	for (unsigned r = 0; r < reps && res.ok; ++r)
+	{
+		const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		res.ok = run();
+		ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+	}
+	if (ms.empty())
+		return;
+
+	std::sort(ms.begin(), ms.end());
+	res.min_ms = ms.front();
+	res.median_ms = (ms.size() % 2 == 1) ? ms[ms.size() / 2] : (ms[ms.size() / 2 - 1] + ms[ms.size() / 2]) / 2.0;
+	res.mean_ms = std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size();
+	double squares = 0.0;
+	for (size_t i = 0; i < ms.size(); ++i)
+		squares += (ms[i] - res.mean_ms) * (ms[i] - res.mean_ms);
+	res.stddev_ms = (ms.size() > 1) ? std::sqrt(squares / (ms.size() - 1)) : 0.0;
+	res.items_per_sec = (res.median_ms > 0.0) ? double(res.items) * 1000.0 / res.median_ms : 0.0;
+}
+
+// 1, 2, 3, 4, then doubling, and always the maximum
+std::vector<int_type> thread_counts(int_type max_thread_cnt)
+{
+	std::vector<int_type> counts;
+	for (int_type thread_cnt = 1; thread_cnt <= max_thread_cnt; thread_cnt = (thread_cnt < 4) ? thread_cnt + 1 : thread_cnt * 2)
+		counts.push_back(thread_cnt);
+	if (counts.back() != max_thread_cnt)
+		counts.push_back(max_thread_cnt);
+	return counts;
+}
+
+void print_result(const result& res)
+{
+	std::cout << std::left << std::setw(5) << res.mode << std::setw(10) << res.engine << std::setw(10) << res.type << std::right
+		<< std::setw(4) << res.n << std::setw(4) << res.k << std::setw(5) << res.thread_cnt;
+	if (!res.ok)
+	{
+		std::cout << "  failed" << std::endl;
+		return;
+	}
+	std::cout << std::fixed << std::setprecision(2) << std::setw(11) << res.median_ms << " ms +- " << std::setw(6) << res.stddev_ms
+		<< std::setprecision(1) << std::setw(10) << res.items_per_sec / 1e6 << " M/s" << std::endl;
+}
+
+template<typename elem_type>
+void sweep_perm(const options& opt, const std::string& type_name, std::vector<result>& results)
+{
+	typedef std::vector<elem_type> container_type;
+	typedef checksum_perm_callback_t<container_type> callback_t;
+	auto err_callback = [](const int /*thread_index*/, const container_type& /*cont*/, const std::string& error) { std::cerr << error << std::endl; };
+
+	for (size_t s = 0; s < opt.perm_sizes.size(); ++s)
+	{
+		container_type cont;
+		for (uint32_t i = 0; i < opt.perm_sizes[s]; ++i)
+			cont.push_back(make_element<elem_type>(i));
+
+		for (size_t e = 0; e < opt.engines.size(); ++e)
+		{
+			const std::string& engine = opt.engines[e];
+			const std::vector<int_type> counts = thread_counts(opt.max_thread_cnt);
+			for (size_t t = 0; t < counts.size(); ++t)
+			{
+				const int_type thread_cnt = counts[t];
+				result res;
+				res.mode = "perm";
+				res.engine = engine;
+				res.type = type_name;
+				res.n = res.k = opt.perm_sizes[s];
+				res.thread_cnt = thread_cnt;
+				concurrent_perm::compute_factorial(res.n, res.items);
+				measure(opt.reps, [&]() -> bool
+				{
+					if (engine == "prefix")
+						return concurrent_perm::compute_all_perm_prefix(thread_cnt, cont, callback_t(), err_callback);
+					if (engine == "strided")
+						return concurrent_perm::compute_all_perm_strided(thread_cnt, uint64_t(thread_cnt) * 16, cont, callback_t(), err_callback);
+					if (engine == "generator")
+						return concurrent_perm::compute_all_perm_generators(thread_cnt, cont,
+							[](const int thread_index, concurrent_perm::perm_generator<container_type, int_type>& gen)
+							{
+								callback_t callback;
+								for (const auto& arrangement : gen)
+								{
+									if (!callback(thread_index, arrangement))
+										break;
+								}
+							}, err_callback);
+					return concurrent_perm::compute_all_perm(thread_cnt, cont, callback_t(), err_callback);
+				}, res);
+				print_result(res);
+				results.push_back(res);
+			}
+		}
+	}
+}
+
+template<typename elem_type>
+void sweep_comb(const options& opt, const std::string& type_name, std::vector<result>& results)
+{
+	typedef std::vector<elem_type> container_type;
+	typedef checksum_comb_callback_t<container_type> callback_t;
+	auto err_callback = [](const int /*thread_index*/, const size_t /*fullset_cnt*/, const container_type& /*cont*/, const std::string& error) { std::cerr << error << std::endl; };
+
+	for (size_t s = 0; s < opt.comb_sizes.size(); ++s)
+	{
+		const uint32_t subset = opt.comb_sizes[s].second;
+		container_type cont;
+		for (uint32_t i = 0; i < opt.comb_sizes[s].first; ++i)
+			cont.push_back(make_element<elem_type>(i));
+
+		for (size_t e = 0; e < opt.engines.size(); ++e)
+		{
+			const std::string& engine = opt.engines[e];
+			const std::vector<int_type> counts = thread_counts(opt.max_thread_cnt);
+			for (size_t t = 0; t < counts.size(); ++t)
+			{
+				const int_type thread_cnt = counts[t];
+				result res;
+				res.mode = "comb";
+				res.engine = engine;
+				res.type = type_name;
+				res.n = opt.comb_sizes[s].first;
+				res.k = subset;
+				res.thread_cnt = thread_cnt;
+				concurrent_comb::compute_total_comb(res.n, res.k, res.items);
+				measure(opt.reps, [&]() -> bool
+				{
+					if (engine == "prefix")
+						return concurrent_comb::compute_all_comb_prefix(thread_cnt, subset, cont, callback_t(), err_callback);
+					if (engine == "strided")
+						return concurrent_comb::compute_all_comb_strided(thread_cnt, uint64_t(thread_cnt) * 16, subset, cont, callback_t(), err_callback);
+					if (engine == "generator")
+						return concurrent_comb::compute_all_comb_generators(thread_cnt, subset, cont,
+							[&cont](const int thread_index, concurrent_comb::comb_generator<container_type, int_type>& gen)
+							{
+								callback_t callback;
+								for (const auto& arrangement : gen)
+								{
+									if (!callback(thread_index, cont.size(), arrangement))
+										break;
+								}
+							}, err_callback);
+					return concurrent_comb::compute_all_comb(thread_cnt, subset, cont, callback_t(), err_callback);
+				}, res);
+				print_result(res);
+				results.push_back(res);
+			}
+		}
+	}
+}
+
+// parallel efficiency against the single-thread run of the same mode, engine, type and size
+void compute_efficiency(std::vector<result>& results)
+{
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		for (size_t j = 0; j < results.size(); ++j)
+		{
+			const result& base = results[j];
+			if (base.thread_cnt == 1 && base.ok && base.items_per_sec > 0.0 && base.mode == results[i].mode && base.engine == results[i].engine
+				&& base.type == results[i].type && base.n == results[i].n && base.k == results[i].k)
+			{
+				results[i].efficiency = results[i].items_per_sec / (double(results[i].thread_cnt) * base.items_per_sec);
+			}
+		}
+	}
+}
+
+std::string to_json(const options& opt, const std::vector<result>& results)
+{
+	std::ostringstream oss;
+	oss << std::setprecision(6);
+	oss << "{\n\"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n\"max_threads\": " << opt.max_thread_cnt
+		<< ",\n\"reps\": " << opt.reps << ",\n\"clock\": \"steady_clock\",\n\"results\": [";
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const result& res = results[i];
+		oss << ((i == 0) ? "\n" : ",\n") << "{\"mode\": \"" << res.mode << "\", \"engine\": \"" << res.engine << "\", \"type\": \"" << res.type
+			<< "\", \"n\": " << res.n << ", \"k\": " << res.k << ", \"threads\": " << res.thread_cnt << ", \"items\": " << res.items
+			<< ", \"ok\": " << (res.ok ? "true" : "false") << ", \"min_ms\": " << res.min_ms << ", \"median_ms\": " << res.median_ms
+			<< ", \"mean_ms\": " << res.mean_ms << ", \"stddev_ms\": " << res.stddev_ms << ", \"items_per_sec\": " << res.items_per_sec
+			<< ", \"efficiency\": " << res.efficiency << "}";
+	}
+	oss << "\n]\n}\n";
+	return oss.str();
+}
+
+std::vector<std::string> split(const std::string& text, char separator)
+{
+	std::vector<std::string> parts;
+	std::istringstream iss(text);
+	std::string part;
+	while (std::getline(iss, part, separator))
+	{
+		if (!part.empty())
+			parts.push_back(part);
+	}
+	return parts;
+}
+
+void usage()
+{
+	std::cerr << "usage: permcomb_benchmark [--reps <r>] [--max-threads <t>] [--perm <n>,...] [--comb <n>:<k>,...]" << std::endl;
+	std::cerr << "                          [--types char,int,string,payload64] [--engines index,prefix,strided,generator]" << std::endl;
+	std::cerr << "                          [--json <path>] [--quick]" << std::endl;
+}
+
+bool parse_options(int argc, char* argv[], options& opt)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if (arg == "--quick")
+		{
+			opt.reps = 3;
+			opt.perm_sizes = { 8 };
+			opt.comb_sizes = { { 16, 8 } };
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+		const std::string value = argv[++i];
+		if (arg == "--reps")
+			opt.reps = static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+		else if (arg == "--max-threads")
+			opt.max_thread_cnt = static_cast<int_type>(std::strtoul(value.c_str(), nullptr, 10));
+		else if (arg == "--perm")
+		{
+			opt.perm_sizes.clear();
+			const std::vector<std::string> sizes = split(value, ',');
+			for (size_t s = 0; s < sizes.size(); ++s)
+				opt.perm_sizes.push_back(static_cast<uint32_t>(std::strtoul(sizes[s].c_str(), nullptr, 10)));
+		}
+		else if (arg == "--comb")
+		{
+			opt.comb_sizes.clear();
+			const std::vector<std::string> sizes = split(value, ',');
+			for (size_t s = 0; s < sizes.size(); ++s)
+			{
+				const std::vector<std::string> nk = split(sizes[s], ':');
+				if (nk.size() != 2)
+					return false;
+				opt.comb_sizes.push_back(std::make_pair(static_cast<uint32_t>(std::strtoul(nk[0].c_str(), nullptr, 10)), static_cast<uint32_t>(std::strtoul(nk[1].c_str(), nullptr, 10))));
+			}
+		}
+		else if (arg == "--types")
+			opt.types = split(value, ',');
+		else if (arg == "--engines")
+			opt.engines = split(value, ',');
+		else if (arg == "--json")
+			opt.json_path = value;
+		else
+			return false;
+	}
+	return opt.reps > 0 && opt.max_thread_cnt > 0;
+}
+
+int main(int argc, char* argv[])
+{
+	options opt;
+	if (!parse_options(argc, argv, opt))
+	{
+		usage();
+		return 2;
+	}
+	for (size_t i = 0; i < opt.perm_sizes.size(); ++i)
+	{
+		if (opt.perm_sizes[i] == 0 || opt.perm_sizes[i] > 20)
+		{
+			std::cerr << "Error: permutation size " << opt.perm_sizes[i] << " is not in 1..20" << std::endl;
+			return 2;
+		}
+	}
+	for (size_t i = 0; i < opt.comb_sizes.size(); ++i)
+	{
+		int_type total = 0;
+		if (opt.comb_sizes[i].second == 0 || opt.comb_sizes[i].second > opt.comb_sizes[i].first || opt.comb_sizes[i].first > 60
+			|| !concurrent_comb::compute_total_comb(opt.comb_sizes[i].first, opt.comb_sizes[i].second, total))
+		{
+			std::cerr << "Error: combination size " << opt.comb_sizes[i].first << ":" << opt.comb_sizes[i].second << " is not valid" << std::endl;
+			return 2;
+		}
+	}
+
+	for (size_t i = 0; i < opt.engines.size(); ++i)
+	{
+		if (opt.engines[i] != "index" && opt.engines[i] != "prefix" && opt.engines[i] != "strided" && opt.engines[i] != "generator")
+		{
+			std::cerr << "Error: unknown engine " << opt.engines[i] << std::endl;
+			return 2;
+		}
+	}
+
+	// before any sweep, so a typo does not cost the runs of the types before it
+	for (size_t i = 0; i < opt.types.size(); ++i)
+	{
+		if (opt.types[i] != "char" && opt.types[i] != "int" && opt.types[i] != "string" && opt.types[i] != "payload64")
+		{
+			std::cerr << "Error: unknown element type " << opt.types[i] << std::endl;
+			return 2;
+		}
+	}
+
+	std::cout << std::left << std::setw(5) << "mode" << std::setw(10) << "engine" << std::setw(10) << "type" << std::right
+		<< std::setw(4) << "n" << std::setw(4) << "k" << std::setw(5) << "thr" << std::setw(11) << "median" << " ms +- " << std::setw(6) << "stddev" << std::setw(10) << "items" << " M/s" << std::endl;
+	std::vector<result> results;
+	for (size_t i = 0; i < opt.types.size(); ++i)
+	{
+		const std::string& type = opt.types[i];
+		if (type == "char")
+		{
+			sweep_perm<char>(opt, type, results);
+			sweep_comb<char>(opt, type, results);
+		}
+		else if (type == "int")
+		{
+			sweep_perm<int>(opt, type, results);
+			sweep_comb<int>(opt, type, results);
+		}
+		else if (type == "string")
+		{
+			sweep_perm<std::string>(opt, type, results);
+			sweep_comb<std::string>(opt, type, results);
+		}
+		else if (type == "payload64")
+		{
+			sweep_perm<payload64>(opt, type, results);
+			sweep_comb<payload64>(opt, type, results);
+		}
+	}
+	compute_efficiency(results);
+
+	std::ofstream ofs(opt.json_path.c_str(), std::ios::binary);
+	ofs << to_json(opt, results);
+	if (!ofs)
+	{
+		std::cerr << "Error: cannot write " << opt.json_path << std::endl;
+		return 1;
+	}
+	std::cout << results.size() << " results written to " << opt.json_path << std::endl;
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (!results[i].ok)
+			return 1;
+	}
+	return 0;
+}
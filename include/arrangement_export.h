@@ -0,0 +1,470 @@
+///////////////////////////////////////////////////////////////////////////////
+// arrangement_export.h header file
+//
+// Binary export of all permutations or combinations
+// Copyright 2016 Wong Shao Voon
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+// Every arrangement is a fixed-width record of element indices, written at
+// offset index * record_size of a preallocated file, so every thread of every
+// shard writes its own block with no locks and no ordering.
+// POSIX only: on other platforms this header declares nothing.
+
+#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include "concurrent_perm.h"
+#include "concurrent_comb.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+#include <cerrno>
+#include <limits>
+#include <fstream>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+namespace concurrent_export
+{
+
+enum class export_method
+{
+	mmap_write, // every thread copies its records straight into a shared mapping of the file
+	pwrite_write // every thread fills its own staging buffer and writes it with pwrite at its offset
+};
+
+struct export_options
+{
+	export_options() : method(export_method::mmap_write), staging_bytes(1 << 20), huge_pages(false)
+	{
+	}
+
+	export_method method;
+	size_t staging_bytes; // per-thread staging buffer of pwrite_write
+	bool huge_pages; // back the staging buffers with huge pages when the system allows it
+};
+
+// Element indices are stored little-endian in the fewest of 1, 2 or 4 bytes that hold set_size - 1
+inline uint32_t export_index_bytes(uint32_t set_size)
+{
+	return (set_size <= 0x100) ? 1 : (set_size <= 0x10000) ? 2 : 4;
+}
+
+// Bytes per record of width element indices out of a set of set_size elements
+inline uint32_t export_record_size(uint32_t set_size, uint32_t width)
+{
+	return export_index_bytes(set_size) * width;
+}
+
+inline void encode_record(const std::vector<uint32_t>& indices, uint32_t index_bytes, unsigned char* dst)
+{
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		for (uint32_t b = 0; b < index_bytes; ++b)
+			*dst++ = static_cast<unsigned char>(indices[i] >> (8 * b));
+	}
+}
+
+inline void decode_record(const unsigned char* src, uint32_t width, uint32_t index_bytes, std::vector<uint32_t>& indices)
+{
+	indices.resize(width);
+	for (uint32_t i = 0; i < width; ++i)
+	{
+		uint32_t value = 0;
+		for (uint32_t b = 0; b < index_bytes; ++b)
+			value |= static_cast<uint32_t>(*src++) << (8 * b);
+		indices[i] = value;
+	}
+}
+
+// Default huge page size from the Hugepagesize line of /proc/meminfo, or 2 MiB when it cannot be read
+inline size_t huge_page_size()
+{
+	std::ifstream meminfo("/proc/meminfo");
+	std::string line;
+	while (std::getline(meminfo, line))
+	{
+		if (line.compare(0, 13, "Hugepagesize:") == 0)
+		{
+			const size_t kb = static_cast<size_t>(std::strtoull(line.c_str() + 13, nullptr, 10));
+			if (kb > 0)
+				return kb * 1024;
+		}
+	}
+	return size_t(2) << 20;
+}
+
+// Anonymous buffer, on huge pages when asked and available. A MAP_HUGETLB mapping is rounded up to
+// a whole number of huge pages, as munmap rejects any other length for it.
+class staging_buffer
+{
+public:
+	staging_buffer(size_t size, bool huge_pages) : data_(nullptr), size_(size), map_size_(size)
+	{
+		void* p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+		if (huge_pages)
+		{
+			const size_t page = huge_page_size();
+			map_size_ = (size_ + page - 1) / page * page;
+			p = ::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		}
+#endif
+		if (p == MAP_FAILED)
+		{
+			map_size_ = size_;
+			p = ::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#if defined(MADV_HUGEPAGE)
+			if (p != MAP_FAILED && huge_pages)
+				::madvise(p, map_size_, MADV_HUGEPAGE);
+#endif
+		}
+		if (p != MAP_FAILED)
+			data_ = static_cast<unsigned char*>(p);
+	}
+
+	~staging_buffer()
+	{
+		if (data_ != nullptr)
+			::munmap(data_, map_size_);
+	}
+
+	staging_buffer(const staging_buffer&) = delete;
+	staging_buffer& operator=(const staging_buffer&) = delete;
+
+	unsigned char* data() const
+	{
+		return data_;
+	}
+
+	// usable bytes, as asked for
+	size_t size() const
+	{
+		return size_;
+	}
+
+	// bytes mapped, size() rounded up to whole huge pages when on MAP_HUGETLB
+	size_t mapped_size() const
+	{
+		return map_size_;
+	}
+
+private:
+	unsigned char* data_;
+	size_t size_;
+	size_t map_size_;
+};
+
+inline bool pwrite_all(int fd, const unsigned char* data, size_t size, uint64_t offset)
+{
+	while (size > 0)
+	{
+		const ssize_t written = ::pwrite(fd, data, size, static_cast<off_t>(offset));
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		size -= static_cast<size_t>(written);
+		offset += static_cast<uint64_t>(written);
+	}
+	return true;
+}
+
+// Output file sized for total records, shared by the threads of a shard. Shards of one export
+// open the same path (on a shared file system, or separate files merged later): each writes only its own range.
+class export_file
+{
+public:
+	export_file() : fd(-1), map(nullptr), map_size(0)
+	{
+	}
+
+	~export_file()
+	{
+		close();
+	}
+
+	export_file(const export_file&) = delete;
+	export_file& operator=(const export_file&) = delete;
+
+	bool open(const std::string& path, uint64_t size, export_method method, std::string& error)
+	{
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		struct stat st;
+		if (fd < 0 || ::fstat(fd, &st) != 0)
+		{
+			error = "Error: cannot open " + path + ": " + std::strerror(errno);
+			return false;
+		}
+		// allocated, not only sized, so a full disk is reported here instead of as SIGBUS on a mapped page;
+		// a file system without fallocate only gets a sparse file
+		int rc = 0;
+		if (static_cast<uint64_t>(st.st_size) > size)
+			rc = (::ftruncate(fd, static_cast<off_t>(size)) == 0) ? 0 : errno;
+		if (rc == 0 && size > 0)
+			rc = allocate(size);
+		if (rc == EOPNOTSUPP)
+			rc = (static_cast<uint64_t>(st.st_size) >= size || ::ftruncate(fd, static_cast<off_t>(size)) == 0) ? 0 : errno;
+		if (rc != 0)
+		{
+			error = "Error: cannot allocate " + path + ": " + std::strerror(rc);
+			return false;
+		}
+		if (method == export_method::mmap_write && size > 0)
+		{
+			void* p = ::mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (p == MAP_FAILED)
+			{
+				error = "Error: cannot map " + path + ": " + std::strerror(errno);
+				return false;
+			}
+			map = static_cast<unsigned char*>(p);
+			map_size = static_cast<size_t>(size);
+		}
+		return true;
+	}
+
+	// Flushes and closes; returns false if the data may not have reached the file
+	bool close()
+	{
+		bool ok = true;
+		if (map != nullptr)
+		{
+			ok = ::msync(map, map_size, MS_SYNC) == 0 && ok;
+			::munmap(map, map_size);
+			map = nullptr;
+		}
+		if (fd >= 0)
+		{
+			ok = ::close(fd) == 0 && ok;
+			fd = -1;
+		}
+		return ok;
+	}
+
+	int handle() const
+	{
+		return fd;
+	}
+
+	unsigned char* mapping() const
+	{
+		return map;
+	}
+
+private:
+	// posix_fallocate of the whole file: 0 or an error number, EOPNOTSUPP where it is not available
+	int allocate(uint64_t size)
+	{
+#if defined(__APPLE__)
+		(void)size;
+		return EOPNOTSUPP;
+#else
+		return ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+	}
+
+	int fd;
+	unsigned char* map;
+	size_t map_size;
+};
+
+// Writes the records of one thread range, either straight into the mapping or through a staging buffer
+class record_writer
+{
+public:
+	record_writer(export_file& file, const export_options& options, uint32_t record_size, uint64_t offset)
+		: file(file)
+		, record_size(record_size)
+		, offset(offset)
+		, staging((options.method == export_method::pwrite_write) ? new staging_buffer((std::max)(options.staging_bytes / record_size, size_t(1)) * record_size, options.huge_pages) : nullptr)
+		, used(0)
+		, failed(staging && staging->data() == nullptr)
+	{
+	}
+
+	// Room for the next record
+	unsigned char* next()
+	{
+		if (!staging)
+		{
+			unsigned char* dst = file.mapping() + offset;
+			offset += record_size;
+			return dst;
+		}
+		if (used + record_size > staging->size())
+			flush();
+		unsigned char* dst = staging->data() + used;
+		used += record_size;
+		return dst;
+	}
+
+	bool flush()
+	{
+		if (staging && used > 0 && !failed)
+		{
+			failed = !pwrite_all(file.handle(), staging->data(), used, offset);
+			offset += used;
+		}
+		used = 0;
+		return !failed;
+	}
+
+	bool ok() const
+	{
+		return !failed;
+	}
+
+private:
+	export_file& file;
+	const uint32_t record_size;
+	uint64_t offset;
+	std::unique_ptr<staging_buffer> staging;
+	size_t used;
+	bool failed;
+};
+
+// Writes the records of shard cpu_index out of cpu_cnt, split as compute_all_perm_shard splits it, to path.
+// Record i, at offset i * export_record_size(set_size, set_size), holds the element indices of permutation i.
+template<typename int_type>
+bool export_all_perm_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t set_size, const std::string& path, const export_options& options, std::string& error)
+{
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	const uint32_t index_bytes = export_index_bytes(set_size);
+	const uint32_t record_size = export_record_size(set_size, set_size);
+	if (factorial > int_type(std::numeric_limits<int64_t>::max() / (std::max)(record_size, uint32_t(1))))
+	{
+		std::ostringstream oss;
+		oss << "Error: " << factorial << " records of " << record_size << " bytes do not fit in a file";
+		error = oss.str();
+		return false;
+	}
+
+	export_file file;
+	if (!file.open(path, static_cast<uint64_t>(factorial) * record_size, options.method, error))
+		return false;
+
+	std::vector<uint32_t> identity(set_size);
+	std::iota(identity.begin(), identity.end(), 0);
+	std::mutex error_mutex;
+	bool failed = false;
+	auto err_callback = [&](const int /*thread_index*/, const std::vector<uint32_t>& /*cont*/, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(error_mutex);
+		failed = true;
+		error = message;
+	};
+
+	const bool result = concurrent_perm::run_perm_shard(cpu_index, cpu_cnt, thread_cnt, identity, err_callback,
+		[&](const int_type& thread_index, int_type start_index, int_type end_index)
+		{
+			record_writer writer(file, options, record_size, static_cast<uint64_t>(start_index) * record_size);
+			concurrent_perm::worker_thread_proc(thread_index, identity, start_index, end_index,
+				[&](const int /*thread_index_n*/, const std::vector<uint32_t>& indices) -> bool
+				{
+					encode_record(indices, index_bytes, writer.next());
+					return writer.ok();
+				}, err_callback, concurrent_perm::no_predicate_type());
+			if (!writer.flush())
+				err_callback(static_cast<int>(thread_index), identity, std::string("Error: cannot write ") + path + ": " + std::strerror(errno));
+		});
+
+	if (!file.close() && !failed)
+	{
+		failed = true;
+		error = "Error: cannot flush " + path;
+	}
+	return result && !failed;
+}
+
+template<typename int_type>
+bool export_all_perm(int_type thread_cnt, uint32_t set_size, const std::string& path, const export_options& options, std::string& error)
+{
+	return export_all_perm_shard(int_type(0), int_type(1), thread_cnt, set_size, path, options, error);
+}
+
+// Writes the records of shard cpu_index out of cpu_cnt, split as compute_all_comb_shard splits it, to path.
+// Record i, at offset i * export_record_size(fullset, subset), holds the element indices of combination i.
+template<typename int_type>
+bool export_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t fullset, uint32_t subset, const std::string& path, const export_options& options, std::string& error)
+{
+	int_type total_comb = 0;
+	if (!concurrent_comb::compute_total_comb(fullset, subset, total_comb))
+	{
+		error = "Error: compute_total_comb() return false";
+		return false;
+	}
+	const uint32_t index_bytes = export_index_bytes(fullset);
+	const uint32_t record_size = export_record_size(fullset, subset);
+	if (total_comb > int_type(std::numeric_limits<int64_t>::max() / (std::max)(record_size, uint32_t(1))))
+	{
+		std::ostringstream oss;
+		oss << "Error: " << total_comb << " records of " << record_size << " bytes do not fit in a file";
+		error = oss.str();
+		return false;
+	}
+
+	export_file file;
+	if (!file.open(path, static_cast<uint64_t>(total_comb) * record_size, options.method, error))
+		return false;
+
+	std::vector<uint32_t> identity(fullset);
+	std::iota(identity.begin(), identity.end(), 0);
+	std::mutex error_mutex;
+	bool failed = false;
+	auto err_callback = [&](const int /*thread_index*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& /*cont*/, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(error_mutex);
+		failed = true;
+		error = message;
+	};
+
+	const bool result = concurrent_comb::run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, identity, err_callback,
+		[&](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			record_writer writer(file, options, record_size, static_cast<uint64_t>(start_index) * record_size);
+			concurrent_comb::worker_thread_proc(thread_index, identity, start_index, end_index, subset,
+				[&](const int /*thread_index_n*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& indices) -> bool
+				{
+					encode_record(indices, index_bytes, writer.next());
+					return writer.ok();
+				}, err_callback, concurrent_comb::no_predicate_type());
+			if (!writer.flush())
+				err_callback(static_cast<int>(thread_index), identity.size(), identity, std::string("Error: cannot write ") + path + ": " + std::strerror(errno));
+		});
+
+	if (!file.close() && !failed)
+	{
+		failed = true;
+		error = "Error: cannot flush " + path;
+	}
+	return result && !failed;
+}
+
+template<typename int_type>
+bool export_all_comb(int_type thread_cnt, uint32_t fullset, uint32_t subset, const std::string& path, const export_options& options, std::string& error)
+{
+	return export_all_comb_shard(int_type(0), int_type(1), thread_cnt, fullset, subset, path, options, error);
+}
+
+}
+
+#endif
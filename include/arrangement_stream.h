@@ -0,0 +1,610 @@
+///////////////////////////////////////////////////////////////////////////////
+// arrangement_stream.h header file
+//
+// Compact streaming format for enumeration results
+// Copyright 2016 Wong Shao Voon
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+// Layout, every number a LEB128 varint:
+//   header  "PCZS" version mode('p'|'c') flags(1 = sparse) n k chunk_records range_start range_end total
+//   chunk   'C' start_index end_index record_cnt payload_size payload
+//   trailer 'E' chunk_cnt record_cnt
+// A chunk covers the arrangements [start_index, end_index) whether or not it keeps them, and chunks
+// are written in the order threads finish them. Dense payloads hold the first record in full and then,
+// for every following record, the position of the first changed element and the changed suffix;
+// next_permutation and next_combination only change a suffix, so a record takes a few bytes.
+// Sparse payloads hold the ranks of the kept records as deltas from the previous one (the first from start_index).
+
+#pragma once
+
+#include "concurrent_perm.h"
+#include "concurrent_comb.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <ostream>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+
+namespace concurrent_export
+{
+
+struct no_filter_type
+{
+};
+
+struct stream_options
+{
+	stream_options() : chunk_records(1 << 16)
+	{
+	}
+
+	uint64_t chunk_records; // arrangements covered by one chunk, the unit of parallel decoding
+};
+
+template<typename int_type>
+struct stream_header
+{
+	char mode; // 'p' or 'c'
+	bool sparse;
+	uint32_t n;
+	uint32_t k; // n for permutations
+	uint64_t chunk_records;
+	int_type range_start; // arrangements covered by the stream
+	int_type range_end;
+	int_type total; // arrangements of the whole job
+	int_type chunk_cnt;
+	int_type record_cnt;
+};
+
+template<typename int_type>
+struct stream_chunk
+{
+	int_type start_index;
+	int_type end_index;
+	int_type record_cnt;
+	size_t payload_offset;
+	size_t payload_size;
+};
+
+template<typename int_type>
+void put_varint(std::string& out, int_type value)
+{
+	do
+	{
+		unsigned char byte = static_cast<unsigned char>(static_cast<unsigned>(value % 128));
+		value /= 128;
+		if (value > 0)
+			byte |= 0x80;
+		out.push_back(static_cast<char>(byte));
+	} while (value > 0);
+}
+
+template<typename int_type>
+bool get_varint(const char*& pos, const char* end, int_type& value)
+{
+	value = 0;
+	int_type mult = 1;
+	for (int shift = 0; pos < end; shift += 7)
+	{
+		if (std::numeric_limits<int_type>::is_bounded && shift >= std::numeric_limits<int_type>::digits)
+			return false;
+		const unsigned char byte = static_cast<unsigned char>(*pos++);
+		value += int_type(byte & 0x7f) * mult;
+		if ((byte & 0x80) == 0)
+			return true;
+		mult *= 128;
+	}
+	return false;
+}
+
+// Encodes one record after prev, the previous record of the chunk (empty for the first)
+inline void put_suffix_delta(std::string& out, const std::vector<uint32_t>& prev, const std::vector<uint32_t>& indices)
+{
+	size_t pos = 0;
+	if (!prev.empty())
+	{
+		while (pos < indices.size() && prev[pos] == indices[pos])
+			++pos;
+		put_varint(out, static_cast<uint32_t>(pos));
+	}
+	for (size_t i = pos; i < indices.size(); ++i)
+		put_varint(out, indices[i]);
+}
+
+inline bool get_suffix_delta(const char*& pos, const char* end, uint32_t n, bool first, std::vector<uint32_t>& indices)
+{
+	uint32_t changed = 0;
+	if (!first && (!get_varint(pos, end, changed) || changed > indices.size()))
+		return false;
+	for (size_t i = changed; i < indices.size(); ++i)
+	{
+		if (!get_varint(pos, end, indices[i]) || indices[i] >= n)
+			return false;
+	}
+	return true;
+}
+
+// Appends chunks from several threads; each chunk is written whole under the lock
+class stream_sink
+{
+public:
+	explicit stream_sink(std::ostream& os) : os(os), chunk_cnt(0), record_cnt(0)
+	{
+	}
+
+	bool write_chunk(const std::string& head, const std::string& payload, uint64_t records)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		os.write(head.data(), head.size());
+		os.write(payload.data(), payload.size());
+		++chunk_cnt;
+		record_cnt += records;
+		return !os.fail();
+	}
+
+	bool write_trailer()
+	{
+		std::string trailer(1, 'E');
+		put_varint(trailer, chunk_cnt);
+		put_varint(trailer, record_cnt);
+		os.write(trailer.data(), trailer.size());
+		os.flush();
+		return !os.fail();
+	}
+
+private:
+	std::ostream& os;
+	std::mutex mutex;
+	uint64_t chunk_cnt;
+	uint64_t record_cnt;
+};
+
+// Encodes the records of one chunk in the order the enumeration delivers them
+template<typename int_type, typename filter_type>
+class chunk_encoder
+{
+public:
+	chunk_encoder(const int_type& start_index, filter_type& filter) : start_index(start_index), filter(filter), position(0), last_rank(start_index), record_cnt(0)
+	{
+	}
+
+	void add(int thread_index, const std::vector<uint32_t>& indices)
+	{
+		add(thread_index, indices, std::is_same<filter_type, no_filter_type>());
+	}
+
+	bool flush(stream_sink& sink, const int_type& end_index)
+	{
+		std::string head(1, 'C');
+		put_varint(head, start_index);
+		put_varint(head, end_index);
+		put_varint(head, record_cnt);
+		put_varint(head, static_cast<uint64_t>(payload.size()));
+		return sink.write_chunk(head, payload, record_cnt);
+	}
+
+private:
+	void add(int /*thread_index*/, const std::vector<uint32_t>& indices, std::true_type)
+	{
+		put_suffix_delta(payload, prev, indices);
+		prev = indices;
+		++record_cnt;
+	}
+
+	void add(int thread_index, const std::vector<uint32_t>& indices, std::false_type)
+	{
+		const int_type rank = start_index + int_type(position);
+		++position;
+		if (!filter(thread_index, indices))
+			return;
+		put_varint(payload, int_type(rank - last_rank));
+		last_rank = rank;
+		++record_cnt;
+	}
+
+	const int_type start_index;
+	filter_type& filter;
+	uint64_t position;
+	int_type last_rank;
+	uint64_t record_cnt;
+	std::vector<uint32_t> prev;
+	std::string payload;
+};
+
+template<typename int_type>
+std::string stream_header_bytes(char mode, bool sparse, uint32_t n, uint32_t k, uint64_t chunk_records, const int_type& range_start, const int_type& range_end, const int_type& total)
+{
+	std::string head("PCZS");
+	head.push_back(1);
+	head.push_back(mode);
+	head.push_back(sparse ? 1 : 0);
+	put_varint(head, n);
+	put_varint(head, k);
+	put_varint(head, chunk_records);
+	put_varint(head, range_start);
+	put_varint(head, range_end);
+	put_varint(head, total);
+	return head;
+}
+
+// Streams the arrangements of shard cpu_index out of cpu_cnt to os, in chunks of options.chunk_records.
+// With no filter every arrangement is stored; with filter(thread_index, indices) -> bool only the ranks of kept ones.
+template<typename int_type, typename filter_type=no_filter_type>
+bool encode_all_perm_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t set_size, std::ostream& os, const stream_options& options, std::string& error, filter_type filter=filter_type())
+{
+	int_type factorial = 0;
+	concurrent_perm::compute_factorial(set_size, factorial);
+	std::vector<uint32_t> identity(set_size);
+	std::iota(identity.begin(), identity.end(), 0);
+	std::mutex error_mutex;
+	std::atomic<bool> failed(false);
+	auto err_callback = [&](const int /*thread_index*/, const std::vector<uint32_t>& /*cont*/, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(error_mutex);
+		failed = true;
+		error = message;
+	};
+
+	// the header needs the range of the shard before any chunk, so it is taken from the same split with one thread
+	int_type range_start = 0;
+	int_type range_end = 0;
+	if (!concurrent_perm::run_perm_shard(cpu_index, cpu_cnt, int_type(1), identity, err_callback,
+		[&range_start, &range_end](const int_type&, int_type start_index, int_type end_index)
+		{
+			range_start = start_index;
+			range_end = end_index;
+		}))
+		return false;
+
+	const int_type chunk_records = int_type((std::max)(options.chunk_records, uint64_t(1)));
+	stream_sink sink(os);
+	const std::string head = stream_header_bytes('p', !std::is_same<filter_type, no_filter_type>::value, set_size, set_size, options.chunk_records, range_start, range_end, factorial);
+	os.write(head.data(), head.size());
+
+	const bool result = concurrent_perm::run_perm_shard(cpu_index, cpu_cnt, thread_cnt, identity, err_callback,
+		[&](const int_type& thread_index, int_type start_index, int_type end_index)
+		{
+			filter_type thread_filter = filter;
+			for (int_type chunk_start = start_index; chunk_start < end_index && !failed; chunk_start += chunk_records)
+			{
+				const int_type chunk_end = (std::min)(int_type(chunk_start + chunk_records), end_index);
+				chunk_encoder<int_type, filter_type> encoder(chunk_start, thread_filter);
+				concurrent_perm::worker_thread_proc(thread_index, identity, chunk_start, chunk_end,
+					[&encoder](const int thread_index_n, const std::vector<uint32_t>& indices) -> bool
+					{
+						encoder.add(thread_index_n, indices);
+						return true;
+					}, err_callback, concurrent_perm::no_predicate_type());
+				if (!encoder.flush(sink, chunk_end))
+					err_callback(static_cast<int>(thread_index), identity, "Error: cannot write the stream");
+			}
+		});
+
+	if (result && !failed && !sink.write_trailer())
+	{
+		failed = true;
+		error = "Error: cannot write the stream";
+	}
+	return result && !failed;
+}
+
+template<typename int_type, typename filter_type=no_filter_type>
+bool encode_all_perm(int_type thread_cnt, uint32_t set_size, std::ostream& os, const stream_options& options, std::string& error, filter_type filter=filter_type())
+{
+	return encode_all_perm_shard(int_type(0), int_type(1), thread_cnt, set_size, os, options, error, filter);
+}
+
+// Streams the combinations of shard cpu_index out of cpu_cnt to os; see encode_all_perm_shard
+template<typename int_type, typename filter_type=no_filter_type>
+bool encode_all_comb_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t fullset, uint32_t subset, std::ostream& os, const stream_options& options, std::string& error, filter_type filter=filter_type())
+{
+	int_type total_comb = 0;
+	if (!concurrent_comb::compute_total_comb(fullset, subset, total_comb))
+	{
+		error = "Error: compute_total_comb() return false";
+		return false;
+	}
+	std::vector<uint32_t> identity(fullset);
+	std::iota(identity.begin(), identity.end(), 0);
+	std::mutex error_mutex;
+	std::atomic<bool> failed(false);
+	auto err_callback = [&](const int /*thread_index*/, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& /*cont*/, const std::string& message)
+	{
+		std::lock_guard<std::mutex> lock(error_mutex);
+		failed = true;
+		error = message;
+	};
+
+	// the header needs the range of the shard before any chunk, so it is taken from the same split with one thread
+	int_type range_start = 0;
+	int_type range_end = 0;
+	if (!concurrent_comb::run_comb_shard(cpu_index, cpu_cnt, int_type(1), subset, identity, err_callback,
+		[&range_start, &range_end](const int_type, int_type start_index, int_type end_index)
+		{
+			range_start = start_index;
+			range_end = end_index;
+		}))
+		return false;
+
+	const int_type chunk_records = int_type((std::max)(options.chunk_records, uint64_t(1)));
+	stream_sink sink(os);
+	const std::string head = stream_header_bytes('c', !std::is_same<filter_type, no_filter_type>::value, fullset, subset, options.chunk_records, range_start, range_end, total_comb);
+	os.write(head.data(), head.size());
+
+	const bool result = concurrent_comb::run_comb_shard(cpu_index, cpu_cnt, thread_cnt, subset, identity, err_callback,
+		[&](const int_type thread_index, int_type start_index, int_type end_index)
+		{
+			filter_type thread_filter = filter;
+			for (int_type chunk_start = start_index; chunk_start < end_index && !failed; chunk_start += chunk_records)
+			{
+				const int_type chunk_end = (std::min)(int_type(chunk_start + chunk_records), end_index);
+				chunk_encoder<int_type, filter_type> encoder(chunk_start, thread_filter);
+				concurrent_comb::worker_thread_proc(thread_index, identity, chunk_start, chunk_end, subset,
+					[&encoder](const int thread_index_n, const size_t /*fullset_cnt*/, const std::vector<uint32_t>& indices) -> bool
+					{
+						encoder.add(thread_index_n, indices);
+						return true;
+					}, err_callback, concurrent_comb::no_predicate_type());
+				if (!encoder.flush(sink, chunk_end))
+					err_callback(static_cast<int>(thread_index), identity.size(), identity, "Error: cannot write the stream");
+			}
+		});
+
+	if (result && !failed && !sink.write_trailer())
+	{
+		failed = true;
+		error = "Error: cannot write the stream";
+	}
+	return result && !failed;
+}
+
+template<typename int_type, typename filter_type=no_filter_type>
+bool encode_all_comb(int_type thread_cnt, uint32_t fullset, uint32_t subset, std::ostream& os, const stream_options& options, std::string& error, filter_type filter=filter_type())
+{
+	return encode_all_comb_shard(int_type(0), int_type(1), thread_cnt, fullset, subset, os, options, error, filter);
+}
+
+// Reads the header and the chunk table of the size bytes at data, such as a mapped file, without decoding
+// any payload, and checks the trailer counts. Payload offsets are relative to data.
+template<typename int_type>
+bool read_stream_index(const char* data, size_t size, stream_header<int_type>& header, std::vector<stream_chunk<int_type> >& chunks, std::string& error)
+{
+	chunks.clear();
+	const char* pos = data;
+	const char* end = pos + size;
+	if (size < 7 || std::memcmp(data, "PCZS", 4) != 0 || data[4] != 1 || (data[5] != 'p' && data[5] != 'c'))
+	{
+		error = "Error: not a version 1 arrangement stream";
+		return false;
+	}
+	header.mode = data[5];
+	header.sparse = data[6] != 0;
+	pos += 7;
+	if (!get_varint(pos, end, header.n) || !get_varint(pos, end, header.k) || !get_varint(pos, end, header.chunk_records)
+		|| !get_varint(pos, end, header.range_start) || !get_varint(pos, end, header.range_end) || !get_varint(pos, end, header.total)
+		|| header.k > header.n || (header.mode == 'p' && header.k != header.n))
+	{
+		error = "Error: bad stream header";
+		return false;
+	}
+
+	int_type record_cnt = 0;
+	while (pos < end && *pos == 'C')
+	{
+		++pos;
+		stream_chunk<int_type> chunk;
+		uint64_t payload_size = 0;
+		if (!get_varint(pos, end, chunk.start_index) || !get_varint(pos, end, chunk.end_index) || !get_varint(pos, end, chunk.record_cnt)
+			|| !get_varint(pos, end, payload_size) || payload_size > static_cast<uint64_t>(end - pos))
+		{
+			std::ostringstream oss;
+			oss << "Error: truncated chunk " << chunks.size();
+			error = oss.str();
+			return false;
+		}
+		if (chunk.start_index >= chunk.end_index || chunk.record_cnt > chunk.end_index - chunk.start_index
+			|| (!header.sparse && chunk.record_cnt != chunk.end_index - chunk.start_index))
+		{
+			std::ostringstream oss;
+			oss << "Error: chunk [" << chunk.start_index << ", " << chunk.end_index << ") has " << chunk.record_cnt << " records";
+			error = oss.str();
+			return false;
+		}
+		chunk.payload_offset = static_cast<size_t>(pos - data);
+		chunk.payload_size = static_cast<size_t>(payload_size);
+		pos += payload_size;
+		record_cnt += chunk.record_cnt;
+		chunks.push_back(chunk);
+	}
+
+	if (pos == end || *pos++ != 'E' || !get_varint(pos, end, header.chunk_cnt) || !get_varint(pos, end, header.record_cnt) || pos != end)
+	{
+		error = "Error: missing stream trailer, the stream is truncated";
+		return false;
+	}
+	if (header.chunk_cnt != int_type(chunks.size()) || header.record_cnt != record_cnt)
+	{
+		std::ostringstream oss;
+		oss << "Error: trailer counts " << header.chunk_cnt << " chunks and " << header.record_cnt << " records, found " << chunks.size() << " and " << record_cnt;
+		error = oss.str();
+		return false;
+	}
+	return true;
+}
+
+template<typename int_type>
+bool read_stream_index(const std::string& data, stream_header<int_type>& header, std::vector<stream_chunk<int_type> >& chunks, std::string& error)
+{
+	return read_stream_index(data.data(), data.size(), header, chunks, error);
+}
+
+// Checks that the chunks, of one stream or of the streams of all shards, cover [begin, end) exactly once
+template<typename int_type>
+bool verify_stream_coverage(const int_type& begin, const int_type& end, std::vector<stream_chunk<int_type> > chunks, std::string& report)
+{
+	std::sort(chunks.begin(), chunks.end(), [](const stream_chunk<int_type>& a, const stream_chunk<int_type>& b) { return a.start_index < b.start_index; });
+	std::ostringstream oss;
+	int_type next = begin;
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		if (chunks[i].start_index > next)
+			oss << "gap: [" << next << ", " << chunks[i].start_index << ")" << std::endl;
+		else if (chunks[i].start_index < next)
+			oss << "overlap: [" << chunks[i].start_index << ", " << (std::min)(next, chunks[i].end_index) << ")" << std::endl;
+		next = (std::max)(next, chunks[i].end_index);
+	}
+	if (next < end)
+		oss << "gap: [" << next << ", " << end << ")" << std::endl;
+	else if (next > end)
+		oss << "beyond the end: [" << end << ", " << next << ")" << std::endl;
+	report = oss.str();
+	return report.empty();
+}
+
+template<typename int_type>
+bool unrank_record(const stream_header<int_type>& header, const int_type& rank, std::vector<uint32_t>& indices)
+{
+	if (header.mode == 'p')
+		return concurrent_perm::find_perm(header.n, rank, indices);
+	indices.resize(header.k);
+	std::iota(indices.begin(), indices.end(), 0);
+	return concurrent_comb::find_comb(header.n, header.k, rank, indices);
+}
+
+// Decodes one chunk of the stream at data, calling callback(thread_index, rank, indices) for every stored record.
+// When callback returns false, or stop is set by another thread, decoding stops and stop is set.
+template<typename int_type, typename callback_type>
+bool decode_chunk(int thread_index, const char* data, const stream_header<int_type>& header, const stream_chunk<int_type>& chunk, callback_type& callback, std::atomic<bool>& stop, std::string& error)
+{
+	const char* pos = data + chunk.payload_offset;
+	const char* end = pos + chunk.payload_size;
+	std::vector<uint32_t> fullset(header.n);
+	std::iota(fullset.begin(), fullset.end(), 0);
+	std::vector<uint32_t> indices(header.k);
+	int_type rank = chunk.start_index;
+	bool valid = true;
+	for (int_type i = 0; i < chunk.record_cnt; ++i)
+	{
+		if (!header.sparse)
+		{
+			if (!get_suffix_delta(pos, end, header.n, i == 0, indices))
+			{
+				valid = false;
+				break;
+			}
+			if (i > 0)
+				++rank;
+		}
+		else
+		{
+			int_type delta = 0;
+			if (!get_varint(pos, end, delta) || (i > 0 && delta == 0) || rank + delta >= chunk.end_index)
+			{
+				valid = false;
+				break;
+			}
+			rank += delta;
+			if (i > 0 && delta <= 16) // a few steps are cheaper than unranking
+			{
+				for (int_type step = 0; step < delta; ++step)
+				{
+					if (header.mode == 'p')
+						std::next_permutation(indices.begin(), indices.end());
+					else
+						stdcomb::next_combination(fullset.begin(), fullset.end(), indices.begin(), indices.end());
+				}
+			}
+			else if (!unrank_record(header, rank, indices))
+			{
+				valid = false;
+				break;
+			}
+		}
+		if (stop.load(std::memory_order_relaxed))
+			return true;
+		if (!callback(thread_index, rank, indices))
+		{
+			stop = true;
+			return true;
+		}
+	}
+	if (!valid || pos != end)
+	{
+		std::ostringstream oss;
+		oss << "Error: corrupt chunk [" << chunk.start_index << ", " << chunk.end_index << ")";
+		error = oss.str();
+		return false;
+	}
+	return true;
+}
+
+// Decodes the chunks of the size bytes at data in parallel, each thread taking the next undecoded chunk.
+// Every thread gets its own copy of callback(thread_index, rank, indices) -> bool; chunks arrive in no particular order.
+// Returning false from callback stops every thread. err_callback(thread_index, error) is called under a lock.
+template<typename int_type, typename callback_type, typename error_callback_type>
+bool decode_stream(int_type thread_cnt, const char* data, size_t size, callback_type callback, error_callback_type err_callback)
+{
+	stream_header<int_type> header;
+	std::vector<stream_chunk<int_type> > chunks;
+	std::string error;
+	if (!read_stream_index(data, size, header, chunks, error))
+	{
+		err_callback(0, error);
+		return false;
+	}
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt << ") <= 0";
+		err_callback(0, oss.str());
+		return false;
+	}
+
+	std::atomic<size_t> next_chunk(0);
+	std::atomic<bool> failed(false);
+	std::atomic<bool> stop(false);
+	std::mutex error_mutex;
+	const int threads = static_cast<int>((std::min)(thread_cnt, int_type((std::max)(chunks.size(), size_t(1)))));
+	std::vector<std::shared_ptr<std::thread> > workers;
+	for (int i = 0; i < threads; ++i)
+	{
+		workers.push_back(std::shared_ptr<std::thread>(new std::thread(
+			[&, i, callback]() mutable
+			{
+				for (size_t c = next_chunk++; c < chunks.size() && !failed && !stop; c = next_chunk++)
+				{
+					std::string chunk_error;
+					if (!decode_chunk(i, data, header, chunks[c], callback, stop, chunk_error))
+					{
+						failed = true;
+						std::lock_guard<std::mutex> lock(error_mutex);
+						err_callback(i, chunk_error);
+					}
+				}
+			})));
+	}
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->join();
+	}
+	return !failed;
+}
+
+template<typename int_type, typename callback_type, typename error_callback_type>
+bool decode_stream(int_type thread_cnt, const std::string& data, callback_type callback, error_callback_type err_callback)
+{
+	return decode_stream(thread_cnt, data.data(), data.size(), callback, err_callback);
+}
+
+}
@@ -0,0 +1,902 @@
+///////////////////////////////////////////////////////////////////////////////
+// concurrent_common.h header file
+//
+// Infrastructure shared by concurrent_perm and concurrent_comb
+// Copyright 2016 Wong Shao Voon
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+// Everything here is independent of whether permutations or combinations are enumerated, and is
+// brought into both namespaces with using-declarations, so that concurrent_perm::X and
+// concurrent_comb::X name the same type or function and process-wide state, such as
+// thread_pool::instance(), exists once.
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <future>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <numeric>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace concurrent_common
+{
+
+// Largest chunk count split_chunks uses: 2^62, or less when int_type cannot hold it (2^30 for a 32-bit int).
+template<typename int_type>
+int_type max_chunk_cnt()
+{
+	const int digits = std::numeric_limits<int_type>::is_bounded ? std::numeric_limits<int_type>::digits : 63;
+	return int_type(1) << (std::min)(digits - 1, 62);
+}
+
+// Fixed-size chunks of 4096 arrangements, so find_first, ordered delivery and leases keep their granularity on
+// large sets. Only a total above 4096 * max_chunk_cnt (about 1.9e22, beyond 22!, so only with a big integer
+// int_type) gets longer chunks, to keep the chunk count within 64 bits.
+template<typename int_type>
+void split_chunks(const int_type& total, int_type& chunk_size, uint64_t& chunk_cnt)
+{
+	chunk_size = 4096;
+	const int_type max_cnt = max_chunk_cnt<int_type>();
+	if (total / chunk_size >= max_cnt)
+		chunk_size = total / max_cnt + 1;
+	chunk_cnt = static_cast<uint64_t>((total + chunk_size - 1) / chunk_size);
+}
+
+// Bit-reversal of the low bits of q: the van der Corput order, which visits 0..2^bits-1 so that
+// every prefix of the sequence is spread evenly over the whole range.
+inline uint64_t reverse_bits(uint64_t q, uint32_t bits)
+{
+	uint64_t r = 0;
+	for (uint32_t i = 0; i < bits; ++i)
+	{
+		r = (r << 1) | (q & 1);
+		q >>= 1;
+	}
+	return r;
+}
+
+// Cuts [offset, offset + elem_cnt) into chunk_cnt chunks (the first elem_cnt % chunk_cnt one longer) and
+// gives thread t chunks t, t + thread_cnt, t + 2 * thread_cnt, ..., so thread chunk counts differ by at most 1.
+// Every thread visits its own chunks in van der Corput order, so a run stopped early has visited chunks
+// spread over the whole range. worker(thread_index, start, end) returns false to stop its thread.
+template<typename int_type, typename worker_type>
+void run_strided_range(int_type thread_cnt, int_type offset, int_type elem_cnt, uint64_t chunk_cnt, worker_type worker)
+{
+	if (int_type(chunk_cnt) > elem_cnt)
+		chunk_cnt = static_cast<uint64_t>(elem_cnt);
+	if (chunk_cnt == 0)
+		return;
+	if (int_type(chunk_cnt) < thread_cnt)
+		thread_cnt = int_type(chunk_cnt);
+
+	const int_type each_chunk_elem_cnt = elem_cnt / int_type(chunk_cnt);
+	const uint64_t remainder = static_cast<uint64_t>(elem_cnt % int_type(chunk_cnt));
+	const uint64_t stride = static_cast<uint64_t>(thread_cnt);
+
+	auto thread_proc = [=](int_type thread_index) mutable
+	{
+		const uint64_t first = static_cast<uint64_t>(thread_index);
+		const uint64_t own_cnt = (chunk_cnt - first - 1) / stride + 1;
+		uint32_t bits = 0;
+		while (bits < 64 && (uint64_t(1) << bits) < own_cnt)
+		{
+			++bits;
+		}
+		const uint64_t last_q = (bits == 64) ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+		for (uint64_t q = 0; ; ++q)
+		{
+			// positions past own_cnt are skipped, which leaves every prefix of the visit order evenly spread
+			const uint64_t i = reverse_bits(q, bits);
+			if (i < own_cnt)
+			{
+				const uint64_t chunk = first + i * stride;
+				const int_type start_index = offset + each_chunk_elem_cnt * int_type(chunk) + int_type((std::min)(chunk, remainder));
+				const int_type end_index = start_index + each_chunk_elem_cnt + int_type(chunk < remainder ? 1 : 0);
+				if (!worker(thread_index, start_index, end_index))
+					return;
+			}
+			if (q == last_q)
+				return;
+		}
+	};
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for(int_type i=1; i<thread_cnt; ++i)
+	{
+		threads.push_back( std::shared_ptr<std::thread>(new std::thread(thread_proc, i)));
+	}
+	thread_proc(int_type(0));
+
+	for(size_t i=0; i<threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+}
+
+// Bounded lock-free queue with one producer and many consumers, after Dmitry Vyukov's bounded MPMC queue.
+// Items are swapped in and out so that their buffers are reused instead of reallocated.
+template<typename T>
+class spmc_ring
+{
+public:
+	explicit spmc_ring(size_t capacity) : cells(new cell[capacity]), mask(capacity - 1), head(0), tail(0)
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	// producer only, returns false when full
+	bool push(T& item)
+	{
+		const size_t pos = tail.load(std::memory_order_relaxed);
+		cell& c = cells[pos & mask];
+		if (c.seq.load(std::memory_order_acquire) != pos)
+			return false;
+		std::swap(c.data, item);
+		c.seq.store(pos + 1, std::memory_order_release);
+		tail.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// any thread, returns false when empty
+	bool pop(T& item)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell& c = cells[pos & mask];
+			const size_t seq = c.seq.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0)
+			{
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					std::swap(item, c.data);
+					c.seq.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = head.load(std::memory_order_relaxed);
+		}
+	}
+
+	// approximate, for statistics
+	size_t size() const
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		const size_t h = head.load(std::memory_order_relaxed);
+		return (t > h) ? t - h : 0;
+	}
+
+private:
+	struct cell
+	{
+		std::atomic<size_t> seq;
+		T data;
+	};
+	std::unique_ptr<cell[]> cells;
+	const size_t mask;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+};
+
+template<typename container_type>
+struct pipeline_batch
+{
+	std::vector<container_type> items; // reused from batch to batch, count is the number filled
+	size_t count = 0;
+};
+
+// Queue statistics of a pipelined run, to tune the generator/evaluator ratio.
+// Mostly full queues with many full_waits mean more evaluators are needed,
+// mostly empty queues with many empty_waits mean more generators are needed.
+struct pipeline_stats
+{
+	uint64_t batches = 0;       // batches passed from generators to evaluators
+	uint64_t full_waits = 0;    // times a generator found its queue full
+	uint64_t empty_waits = 0;   // times an evaluator found all queues empty
+	uint64_t occupancy_sum = 0; // queue size sampled at every push, divided by batches gives the mean occupancy
+	uint64_t max_occupancy = 0;
+	uint64_t capacity = 0;      // batches per queue
+
+	void merge(const pipeline_stats& other)
+	{
+		batches += other.batches;
+		full_waits += other.full_waits;
+		empty_waits += other.empty_waits;
+		occupancy_sum += other.occupancy_sum;
+		max_occupancy = (std::max)(max_occupancy, other.max_occupancy);
+	}
+};
+
+const size_t pipeline_batch_size = 256;
+const size_t pipeline_queue_capacity = 16; // must be a power of 2
+
+// Fixed set of threads running posted tasks in order. Tasks left when the pool is destroyed are still run.
+class thread_pool
+{
+public:
+	explicit thread_pool(size_t thread_cnt = (std::max)(1u, std::thread::hardware_concurrency())) : stop(false)
+	{
+		for (size_t i = 0; i < thread_cnt; ++i)
+		{
+			threads.push_back(std::shared_ptr<std::thread>(new std::thread(&thread_pool::run, this)));
+		}
+	}
+
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			stop = true;
+		}
+		tasks_ready.notify_all();
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			threads[i]->join();
+		}
+	}
+
+	void post(std::function<void()> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			tasks.push_back(std::move(task));
+		}
+		tasks_ready.notify_one();
+	}
+
+	size_t size() const
+	{
+		return threads.size();
+	}
+
+	// shared pool with one thread per hardware thread
+	static thread_pool& instance()
+	{
+		static thread_pool pool;
+		return pool;
+	}
+
+private:
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	void run()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(tasks_mutex);
+				tasks_ready.wait(lock, [this] { return stop || !tasks.empty(); });
+				if (tasks.empty())
+					return;
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	std::deque<std::function<void()> > tasks;
+	std::mutex tasks_mutex;
+	std::condition_variable tasks_ready;
+	bool stop;
+};
+
+struct job_state
+{
+	job_state() : cancelled(false), failed(false), chunks_done(0), chunk_cnt(0), tasks_left(0) {}
+
+	void finish_task()
+	{
+		if (tasks_left.fetch_sub(1) == 1)
+			promise.set_value(!failed.load() && !cancelled.load());
+	}
+
+	std::atomic<bool> cancelled;
+	std::atomic<bool> failed;
+	std::atomic<uint64_t> chunks_done;
+	uint64_t chunk_cnt;
+	std::atomic<int> tasks_left;
+	std::promise<bool> promise;
+};
+
+// Handle of a computation running in a thread_pool. The result is true when every arrangement was processed,
+// false when the job was cancelled, a callback returned false or an error was reported to err_callback.
+class job
+{
+public:
+	explicit job(std::shared_ptr<job_state> state_) : state(state_), status(state_->promise.get_future().share()) {}
+
+	void wait() const
+	{
+		status.wait();
+	}
+
+	template<typename rep_type, typename period_type>
+	std::future_status wait_for(const std::chrono::duration<rep_type, period_type>& timeout) const
+	{
+		return status.wait_for(timeout);
+	}
+
+	// callbacks already running finish their current arrangement
+	void cancel()
+	{
+		state->cancelled.store(true);
+	}
+
+	// fraction of the work done, from 0.0 to 1.0
+	double progress() const
+	{
+		if (state->chunk_cnt == 0)
+			return 1.0;
+		return static_cast<double>(state->chunks_done.load()) / static_cast<double>(state->chunk_cnt);
+	}
+
+	std::shared_future<bool> result() const
+	{
+		return status;
+	}
+
+private:
+	std::shared_ptr<job_state> state;
+	std::shared_future<bool> status;
+};
+
+enum class affinity_kind
+{
+	none,     // threads are left to the OS scheduler
+	compact,  // fill the CPUs of a NUMA node before moving on to the next node
+	scatter,  // round robin over the NUMA nodes, so thread i and i+1 are on different nodes
+	cpu_list  // thread i runs on cpus[i % cpus.size()]
+};
+
+struct affinity_policy
+{
+	affinity_policy(affinity_kind kind_ = affinity_kind::none, const std::vector<int>& cpus_ = std::vector<int>()) : kind(kind_), cpus(cpus_) {}
+
+	affinity_kind kind;
+	std::vector<int> cpus;
+};
+
+// Parses a Linux cpulist such as "0-3,8,10-11".
+inline std::vector<int> parse_cpu_list(const std::string& text)
+{
+	std::vector<int> cpus;
+	std::istringstream iss(text);
+	std::string item;
+	while (std::getline(iss, item, ','))
+	{
+		int first = 0;
+		int last = 0;
+		char dash = 0;
+		std::istringstream item_iss(item);
+		if (!(item_iss >> first))
+			continue;
+		if (item_iss >> dash >> last && dash == '-')
+		{
+			for (int cpu = first; cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+		}
+		else
+			cpus.push_back(first);
+	}
+	return cpus;
+}
+
+// CPUs of every NUMA node, read from sysfs on Linux. Elsewhere, or without sysfs, a single node with every CPU.
+inline std::vector<std::vector<int> > numa_node_cpus()
+{
+	std::vector<std::vector<int> > nodes;
+#if defined(__linux__)
+	for (int node = 0; ; ++node)
+	{
+		std::ostringstream path;
+		path << "/sys/devices/system/node/node" << node << "/cpulist";
+		std::ifstream file(path.str());
+		std::string text;
+		if (!file || !std::getline(file, text))
+			break;
+		std::vector<int> cpus = parse_cpu_list(text);
+		if (!cpus.empty())
+			nodes.push_back(cpus);
+	}
+#endif
+	if (nodes.empty())
+	{
+		std::vector<int> cpus((std::max)(1u, std::thread::hardware_concurrency()));
+		std::iota(cpus.begin(), cpus.end(), 0);
+		nodes.push_back(cpus);
+	}
+	return nodes;
+}
+
+// CPUs the calling thread may run on, from sched_getaffinity, which a cpuset or a container can restrict.
+// Empty on platforms other than Linux or when the mask cannot be read, meaning no known restriction.
+inline std::vector<int> allowed_cpus()
+{
+	std::vector<int> cpus;
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+		}
+	}
+#endif
+	return cpus;
+}
+
+// CPU for every thread index, in order; empty when threads are not pinned. For compact and scatter, the CPUs
+// of every NUMA node are limited to allowed_cpus(), so a restricted cpuset never gets a thread pinned outside it;
+// a cpu_list is used as given, and a CPU that cannot be pinned is reported by the engine.
+inline std::vector<int> affinity_cpu_order(const affinity_policy& policy)
+{
+	std::vector<int> order;
+	if (policy.kind == affinity_kind::cpu_list)
+		return policy.cpus;
+	if (policy.kind == affinity_kind::none)
+		return order;
+
+	const std::vector<int> allowed = allowed_cpus();
+	std::vector<std::vector<int> > nodes;
+	const std::vector<std::vector<int> > all_nodes = numa_node_cpus();
+	for (size_t n = 0; n < all_nodes.size(); ++n)
+	{
+		std::vector<int> cpus;
+		for (size_t i = 0; i < all_nodes[n].size(); ++i)
+		{
+			if (allowed.empty() || std::binary_search(allowed.begin(), allowed.end(), all_nodes[n][i]))
+				cpus.push_back(all_nodes[n][i]);
+		}
+		if (!cpus.empty())
+			nodes.push_back(cpus);
+	}
+	if (nodes.empty() && !allowed.empty())
+		nodes.push_back(allowed);
+	if (policy.kind == affinity_kind::compact)
+	{
+		for (size_t n = 0; n < nodes.size(); ++n)
+			order.insert(order.end(), nodes[n].begin(), nodes[n].end());
+	}
+	else
+	{
+		for (size_t i = 0; ; ++i)
+		{
+			bool added = false;
+			for (size_t n = 0; n < nodes.size(); ++n)
+			{
+				if (i < nodes[n].size())
+				{
+					order.push_back(nodes[n][i]);
+					added = true;
+				}
+			}
+			if (!added)
+				break;
+		}
+	}
+	return order;
+}
+
+// Pins the current thread to cpu for its lifetime and restores the previous affinity afterwards,
+// since the calling thread also runs thread_index 0. Does nothing on platforms other than Linux or when cpu < 0.
+// When pinning fails, such as for a CPU outside the cpuset, the thread runs unpinned and error() tells why.
+class scoped_affinity
+{
+public:
+	explicit scoped_affinity(int cpu) : pinned(false), error_code(0)
+	{
+#if defined(__linux__)
+		if (cpu < 0)
+			return;
+		if (cpu >= CPU_SETSIZE)
+		{
+			error_code = EINVAL;
+			return;
+		}
+		error_code = pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous);
+		if (error_code != 0)
+			return;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		error_code = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		pinned = (error_code == 0);
+#endif
+	}
+
+	~scoped_affinity()
+	{
+#if defined(__linux__)
+		if (pinned)
+			pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+#endif
+	}
+
+	bool is_pinned() const
+	{
+		return pinned;
+	}
+
+	// 0, or the errno value of the failure to pin
+	int error() const
+	{
+		return error_code;
+	}
+
+private:
+	scoped_affinity(const scoped_affinity&) = delete;
+	scoped_affinity& operator=(const scoped_affinity&) = delete;
+
+	bool pinned;
+	int error_code;
+#if defined(__linux__)
+	cpu_set_t previous;
+#endif
+};
+
+#if defined(__linux__)
+// Path of the cgroup of this process for controller, from /proc/self/cgroup: the "0::" line on cgroup v2
+// (controller empty), or the line listing controller on cgroup v1. Empty when the process is in no such cgroup.
+inline bool own_cgroup_path(const std::string& controller, std::string& path)
+{
+	std::ifstream cgroup_file("/proc/self/cgroup");
+	std::string line;
+	while (std::getline(cgroup_file, line))
+	{
+		// hierarchy-ID:controller-list:path
+		const size_t first = line.find(':');
+		const size_t second = (first == std::string::npos) ? std::string::npos : line.find(':', first + 1);
+		if (second == std::string::npos)
+			continue;
+		const std::string controllers = line.substr(first + 1, second - first - 1);
+		bool match = controller.empty() && controllers.empty() && line.compare(0, first, "0") == 0;
+		std::istringstream iss(controllers);
+		std::string name;
+		while (!controller.empty() && std::getline(iss, name, ','))
+		{
+			if (name == controller)
+				match = true;
+		}
+		if (match)
+		{
+			path = line.substr(second + 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+// CPU quota divided by period of the cgroup of this process and of its ancestors, the lowest one applying,
+// or -1.0 when unlimited. Within a cgroup namespace the process sees its own cgroup as the root.
+inline double cgroup_cpu_limit()
+{
+	double limit = -1.0;
+	std::string path;
+	if (own_cgroup_path("", path))
+	{
+		while (true)
+		{
+			std::ifstream cpu_max("/sys/fs/cgroup" + path + "/cpu.max");
+			std::string max_text;
+			double period = 0.0;
+			if (cpu_max >> max_text >> period && max_text != "max" && period > 0.0)
+			{
+				const double quota = std::atof(max_text.c_str()) / period;
+				if (quota > 0.0 && (limit < 0.0 || quota < limit))
+					limit = quota;
+			}
+			if (path.empty() || path == "/")
+				break;
+			path = path.substr(0, path.rfind('/'));
+		}
+	}
+	// hybrid hierarchies list both, with the cpu controller on v1
+	if (limit < 0.0 && own_cgroup_path("cpu", path))
+	{
+		const char* const mounts[] = { "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct" };
+		for (size_t m = 0; m < 2 && limit < 0.0; ++m)
+		{
+			std::string dir = path;
+			while (true)
+			{
+				std::ifstream quota_file(std::string(mounts[m]) + dir + "/cpu.cfs_quota_us");
+				std::ifstream period_file(std::string(mounts[m]) + dir + "/cpu.cfs_period_us");
+				double quota = -1.0;
+				double period = 0.0;
+				if (quota_file >> quota && period_file >> period && quota > 0.0 && period > 0.0)
+				{
+					if (limit < 0.0 || quota / period < limit)
+						limit = quota / period;
+				}
+				if (dir.empty() || dir == "/")
+					break;
+				dir = dir.substr(0, dir.rfind('/'));
+			}
+		}
+	}
+	return limit;
+}
+#endif
+
+// Number of CPUs this process may use: hardware_concurrency, limited by the affinity mask and by the
+// CPU quota (v2 cpu.max or v1 cpu.cfs_quota_us) of the cgroup of the process on Linux.
+inline uint32_t available_cpu_cnt()
+{
+	uint32_t cnt = (std::max)(1u, std::thread::hardware_concurrency());
+#if defined(__linux__)
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+		cnt = (std::min)(cnt, static_cast<uint32_t>(CPU_COUNT(&set)));
+
+	const double limit = cgroup_cpu_limit();
+	if (limit > 0.0)
+		cnt = (std::min)(cnt, (std::max)(1u, static_cast<uint32_t>(std::ceil(limit))));
+#endif
+	return cnt;
+}
+
+// What compute_all_*_auto measured and decided.
+struct auto_plan
+{
+	uint32_t thread_cnt = 0;   // threads used after the warm-up, calling thread included
+	uint64_t chunk_size = 0;   // arrangements claimed at a time by a thread
+	uint64_t warmup_cnt = 0;   // arrangements processed by the warm-up on the calling thread
+	double item_ns = 0.0;      // measured cost of one arrangement, callback included
+};
+
+const double auto_warmup_ns = 2e6;        // warm-up length
+const double auto_min_thread_ns = 2e6;    // a thread is only worth spawning for at least this much work
+const double auto_chunk_ns = 2e5;         // work claimed at a time, long enough to make claiming negligible
+
+// Thread count and chunk size for remaining arrangements costing item_ns each.
+template<typename int_type>
+void plan_auto(const int_type& remaining, double item_ns, uint32_t cpu_cnt, auto_plan& plan)
+{
+	const double remaining_ns = item_ns * static_cast<double>(remaining);
+	const double thread_cnt = std::floor(remaining_ns / auto_min_thread_ns);
+	plan.thread_cnt = static_cast<uint32_t>((std::max)(1.0, (std::min)(static_cast<double>(cpu_cnt), thread_cnt)));
+
+	// at least 4 chunks per thread so that threads finishing early can help the others
+	double chunk_size = auto_chunk_ns / (std::max)(item_ns, 1.0);
+	chunk_size = (std::min)(chunk_size, static_cast<double>(remaining) / (4.0 * plan.thread_cnt));
+	chunk_size = (std::max)(chunk_size, static_cast<double>(remaining) / 1073741824.0); // at most 2^30 chunks
+	plan.chunk_size = static_cast<uint64_t>((std::max)(1.0, (std::min)(chunk_size, 4611686018427387904.0)));
+}
+
+// Runs task(thread_index) for thread_index 1 to helper_cnt on pool and task(0) on the calling thread, and returns
+// once every pool task that started is done. task must return only when there is no work left to claim, so a pool
+// task starting after the calling thread returned does nothing; a caller that is itself a pool worker thus never
+// waits for a task queued behind it.
+template<typename task_type>
+void run_on_pool(thread_pool& pool, uint32_t helper_cnt, task_type& task)
+{
+	struct team_state
+	{
+		team_state() : closed(false), running(0) {}
+
+		std::mutex mutex;
+		std::condition_variable done;
+		bool closed;
+		uint32_t running;
+	};
+	std::shared_ptr<team_state> state = std::make_shared<team_state>();
+	for (uint32_t i = 1; i <= helper_cnt; ++i)
+	{
+		pool.post([state, &task, i]()
+		{
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (state->closed)
+					return;
+				++state->running;
+			}
+			task(i);
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (--state->running == 0)
+				state->done.notify_all();
+		});
+	}
+	task(0u);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->closed = true;
+	state->done.wait(lock, [&state] { return state->running == 0; });
+}
+
+// Log-linear latency histogram in the manner of HdrHistogram: values below 16 ns are exact, larger ones fall
+// into 16 sub-buckets per power of two, so every recorded value is known to within about 6%.
+struct latency_histogram
+{
+	static const uint32_t sub_bucket_cnt = 16;
+	static const uint32_t bucket_cnt = 61 * sub_bucket_cnt;
+
+	uint64_t counts[bucket_cnt] = {};
+	uint64_t count = 0;
+	uint64_t min_ns = 0;
+	uint64_t max_ns = 0;
+	double sum_ns = 0.0;
+
+	static uint32_t bucket_of(uint64_t ns)
+	{
+		if (ns < sub_bucket_cnt)
+			return static_cast<uint32_t>(ns);
+		uint32_t exponent = 4;
+		while (exponent < 63 && (ns >> (exponent + 1)) != 0)
+			++exponent;
+		return (exponent - 3) * sub_bucket_cnt + static_cast<uint32_t>((ns >> (exponent - 4)) & (sub_bucket_cnt - 1));
+	}
+
+	// Highest value that falls into bucket
+	static uint64_t bucket_top(uint32_t bucket)
+	{
+		if (bucket < sub_bucket_cnt)
+			return bucket;
+		const uint32_t shift = bucket / sub_bucket_cnt - 1;
+		return ((uint64_t(sub_bucket_cnt + bucket % sub_bucket_cnt + 1)) << shift) - 1;
+	}
+
+	void record(uint64_t ns)
+	{
+		++counts[bucket_of(ns)];
+		min_ns = (count == 0) ? ns : (std::min)(min_ns, ns);
+		max_ns = (std::max)(max_ns, ns);
+		sum_ns += static_cast<double>(ns);
+		++count;
+	}
+
+	void merge(const latency_histogram& other)
+	{
+		if (other.count == 0)
+			return;
+		for (uint32_t i = 0; i < bucket_cnt; ++i)
+			counts[i] += other.counts[i];
+		min_ns = (count == 0) ? other.min_ns : (std::min)(min_ns, other.min_ns);
+		max_ns = (std::max)(max_ns, other.max_ns);
+		sum_ns += other.sum_ns;
+		count += other.count;
+	}
+
+	// Value at or below which percent of the recorded values lie, e.g. percentile(99.0)
+	uint64_t percentile(double percent) const
+	{
+		if (count == 0)
+			return 0;
+		const uint64_t rank = (std::max)(uint64_t(1), static_cast<uint64_t>(std::ceil(percent / 100.0 * static_cast<double>(count))));
+		uint64_t seen = 0;
+		for (uint32_t i = 0; i < bucket_cnt; ++i)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+				return (std::min)(bucket_top(i), max_ns);
+		}
+		return max_ns;
+	}
+
+	double mean() const
+	{
+		return (count == 0) ? 0.0 : sum_ns / static_cast<double>(count);
+	}
+};
+
+struct instrument_options
+{
+	uint32_t sample_every = 64;   // time one callback in sample_every; 1 times them all, at two clock reads each
+};
+
+struct thread_report
+{
+	int thread_index = 0;
+	double start_ms = 0.0;        // since the start of the run
+	double finish_ms = 0.0;
+	uint64_t items = 0;           // callback invocations
+	latency_histogram callback_ns; // sampled callback durations
+};
+
+struct run_report
+{
+	double wall_ms = 0.0;
+	std::vector<thread_report> threads; // threads that ran, in thread_index order
+	latency_histogram callback_ns;      // all threads merged
+
+	// Busiest thread time over the mean thread time: 1.0 is perfect balance
+	double imbalance() const
+	{
+		double busiest = 0.0;
+		double sum = 0.0;
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			const double busy = threads[i].finish_ms - threads[i].start_ms;
+			busiest = (std::max)(busiest, busy);
+			sum += busy;
+		}
+		return (sum > 0.0) ? busiest * threads.size() / sum : 1.0;
+	}
+
+	// Estimated share of the thread time spent inside the callback, from the sampled durations
+	double callback_share() const
+	{
+		double busy_ns = 0.0;
+		uint64_t items = 0;
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			busy_ns += (threads[i].finish_ms - threads[i].start_ms) * 1e6;
+			items += threads[i].items;
+		}
+		return (busy_ns > 0.0) ? (std::min)(1.0, callback_ns.mean() * items / busy_ns) : 0.0;
+	}
+
+	std::string to_string() const
+	{
+		std::ostringstream oss;
+		oss << "wall " << wall_ms << " ms, imbalance " << imbalance() << ", callback share " << callback_share() << std::endl;
+		oss << "callback ns: p50 " << callback_ns.percentile(50.0) << ", p90 " << callback_ns.percentile(90.0) << ", p99 " << callback_ns.percentile(99.0);
+		oss << ", max " << callback_ns.max_ns << ", mean " << callback_ns.mean() << " over " << callback_ns.count << " samples" << std::endl;
+		for (size_t i = 0; i < threads.size(); ++i)
+		{
+			const thread_report& t = threads[i];
+			oss << "thread " << t.thread_index << ": " << t.start_ms << " - " << t.finish_ms << " ms, " << t.items << " items";
+			oss << ", callback p50 " << t.callback_ns.percentile(50.0) << " ns, p99 " << t.callback_ns.percentile(99.0) << " ns" << std::endl;
+		}
+		return oss.str();
+	}
+};
+
+inline double elapsed_ms(const std::chrono::steady_clock::time_point& begin)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Fills report from the thread reports, each allocated and written by its own thread so that
+// threads never share a cache line while running.
+inline void collect_report(const std::chrono::steady_clock::time_point& begin, std::vector<std::unique_ptr<thread_report> >& reports, run_report& report)
+{
+	report.wall_ms = elapsed_ms(begin);
+	report.threads.clear();
+	report.callback_ns = latency_histogram();
+	for (size_t i = 0; i < reports.size(); ++i)
+	{
+		if (reports[i])
+		{
+			report.callback_ns.merge(reports[i]->callback_ns);
+			report.threads.push_back(*reports[i]);
+		}
+	}
+}
+
+}
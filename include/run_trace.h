@@ -0,0 +1,421 @@
+///////////////////////////////////////////////////////////////////////////////
+// run_trace.h header file
+//
+// Timeline tracing of worker activity in Chrome trace format
+// Copyright 2016 Wong Shao Voon
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+// The traced engines split a shard into chunks, deal them out to the threads in contiguous runs, and let
+// a thread that runs out steal chunks from the back of another thread's run. Every thread records spans
+// for its unranking, chunks, callback batches, steals and the final join into its own preallocated
+// buffer, without locks; the buffers are only read after all threads have joined. Load the JSON from
+// run_trace::to_json into chrome://tracing or https://ui.perfetto.dev.
+
+#pragma once
+
+#include "concurrent_perm.h"
+#include "concurrent_comb.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
+
+namespace concurrent_trace
+{
+
+struct trace_options
+{
+	uint64_t chunks_per_thread = 16;         // chunks dealt to every thread; more chunks give finer stealing
+	uint64_t batch_items = 4096;             // callbacks per "callbacks" span
+	size_t max_events_per_thread = 1 << 16;  // events past this are counted in dropped instead of recorded
+};
+
+struct trace_event
+{
+	const char* name;
+	uint64_t start_ns;
+	uint64_t dur_ns;
+	const char* arg_name;  // nullptr for no argument
+	uint64_t arg;
+	const char* arg2_name;
+	uint64_t arg2;
+};
+
+// Event buffer owned by one thread. The buffers of all threads sit side by side in run_trace::threads,
+// so a full cache line of padding keeps one thread's appends off the line another thread appends to.
+class trace_buffer
+{
+public:
+	trace_buffer() : dropped(0), capacity(0), pad()
+	{
+	}
+
+	void reserve(size_t max_events)
+	{
+		capacity = max_events;
+		events.reserve(max_events);
+	}
+
+	void add(const char* name, uint64_t start_ns, uint64_t end_ns, const char* arg_name = nullptr, uint64_t arg = 0, const char* arg2_name = nullptr, uint64_t arg2 = 0)
+	{
+		if (events.size() >= capacity)
+		{
+			++dropped;
+			return;
+		}
+		trace_event e = { name, start_ns, end_ns - start_ns, arg_name, arg, arg2_name, arg2 };
+		events.push_back(e);
+	}
+
+	std::vector<trace_event> events;
+	uint64_t dropped;
+
+private:
+	size_t capacity;
+	char pad[64];
+};
+
+// Microseconds with nanosecond digits, as Chrome trace timestamps are
+inline void put_trace_us(std::ostream& os, uint64_t ns)
+{
+	const uint64_t fraction = ns % 1000;
+	os << ns / 1000 << '.' << char('0' + fraction / 100) << char('0' + fraction / 10 % 10) << char('0' + fraction % 10);
+}
+
+struct run_trace
+{
+	int process_id = 0;                // the cpu_index of the shard, so the traces of several shards can be merged
+	std::vector<trace_buffer> threads; // by thread_index
+
+	size_t event_cnt() const
+	{
+		size_t cnt = 0;
+		for (size_t i = 0; i < threads.size(); ++i)
+			cnt += threads[i].events.size();
+		return cnt;
+	}
+
+	uint64_t dropped() const
+	{
+		uint64_t cnt = 0;
+		for (size_t i = 0; i < threads.size(); ++i)
+			cnt += threads[i].dropped;
+		return cnt;
+	}
+
+	// Chrome trace JSON: complete ("X") events, timestamps in microseconds since the start of the run
+	std::string to_json() const
+	{
+		std::ostringstream oss;
+		oss << "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":" << dropped() << "},\"traceEvents\":[";
+		bool first = true;
+		for (size_t t = 0; t < threads.size(); ++t)
+		{
+			oss << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << process_id << ",\"tid\":" << t << ",\"args\":{\"name\":\"worker " << t << "\"}}";
+			first = false;
+			for (size_t i = 0; i < threads[t].events.size(); ++i)
+			{
+				const trace_event& e = threads[t].events[i];
+				oss << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":" << process_id << ",\"tid\":" << t << ",\"ts\":";
+				put_trace_us(oss, e.start_ns);
+				oss << ",\"dur\":";
+				put_trace_us(oss, e.dur_ns);
+				if (e.arg_name != nullptr)
+				{
+					oss << ",\"args\":{\"" << e.arg_name << "\":" << e.arg;
+					if (e.arg2_name != nullptr)
+						oss << ",\"" << e.arg2_name << "\":" << e.arg2;
+					oss << "}";
+				}
+				oss << "}";
+			}
+		}
+		oss << "\n]}\n";
+		return oss.str();
+	}
+
+	bool write_json(const std::string& path, std::string& error) const
+	{
+		std::ofstream ofs(path.c_str(), std::ios::binary);
+		ofs << to_json();
+		if (!ofs)
+		{
+			error = "Error: cannot write " + path;
+			return false;
+		}
+		return true;
+	}
+};
+
+// Chunks [begin, end) of one thread packed in 64 bits, so the owner and thieves claim with one CAS;
+// padded to keep the runs of different threads on different cache lines.
+struct chunk_run
+{
+	std::atomic<uint64_t> bounds;
+	char pad[64 - sizeof(std::atomic<uint64_t>)];
+
+	void assign(uint64_t begin, uint64_t end)
+	{
+		bounds.store((begin << 32) | end);
+	}
+
+	bool take_front(uint64_t& chunk)
+	{
+		uint64_t b = bounds.load();
+		while ((b >> 32) < (b & 0xFFFFFFFFULL))
+		{
+			if (bounds.compare_exchange_weak(b, b + (uint64_t(1) << 32)))
+			{
+				chunk = b >> 32;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool take_back(uint64_t& chunk)
+	{
+		uint64_t b = bounds.load();
+		while ((b >> 32) < (b & 0xFFFFFFFFULL))
+		{
+			if (bounds.compare_exchange_weak(b, b - 1))
+			{
+				chunk = (b & 0xFFFFFFFFULL) - 1;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// Nanoseconds since the start of a run; handed to every chunk by reference
+class trace_clock
+{
+public:
+	trace_clock() : begin(std::chrono::steady_clock::now())
+	{
+	}
+
+	uint64_t operator()() const
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+	}
+
+private:
+	std::chrono::steady_clock::time_point begin;
+};
+
+// Runs [offset, offset + elem_cnt) as chunks on thread_cnt threads with stealing, and records into trace.
+// run_chunk(thread_index, chunk, start_index, end_index, buffer, now_ns) returns false to stop its thread.
+template<typename int_type, typename chunk_runner_type>
+void run_traced_range(int_type thread_cnt, int_type offset, int_type elem_cnt, const trace_options& options, run_trace& trace, chunk_runner_type run_chunk)
+{
+	uint64_t chunk_cnt = (std::max)(options.chunks_per_thread, uint64_t(1)) * static_cast<uint64_t>(thread_cnt);
+	chunk_cnt = (std::min)(chunk_cnt, uint64_t(0x7FFFFFFF));
+	if (int_type(chunk_cnt) > elem_cnt)
+		chunk_cnt = static_cast<uint64_t>(elem_cnt);
+	if (int_type(chunk_cnt) < thread_cnt)
+		thread_cnt = int_type((std::max)(chunk_cnt, uint64_t(1)));
+
+	const size_t threads = static_cast<size_t>(thread_cnt);
+	trace.threads.assign(threads, trace_buffer());
+	std::unique_ptr<chunk_run[]> runs(new chunk_run[threads]);
+	for (size_t t = 0; t < threads; ++t)
+	{
+		trace.threads[t].reserve(options.max_events_per_thread);
+		runs[t].assign(chunk_cnt * t / threads, chunk_cnt * (t + 1) / threads);
+	}
+
+	const int_type each_chunk_elem_cnt = (chunk_cnt == 0) ? int_type(0) : int_type(elem_cnt / int_type(chunk_cnt));
+	const uint64_t remainder = (chunk_cnt == 0) ? 0 : static_cast<uint64_t>(elem_cnt % int_type(chunk_cnt));
+	const trace_clock now_ns;
+
+	auto thread_proc = [&](size_t t)
+	{
+		trace_buffer& buffer = trace.threads[t];
+		while (true)
+		{
+			uint64_t chunk = 0;
+			if (!runs[t].take_front(chunk))
+			{
+				const uint64_t steal_start = now_ns();
+				bool stolen = false;
+				for (size_t v = 1; v < threads && !stolen; ++v)
+				{
+					const size_t victim = (t + v) % threads;
+					if (runs[victim].take_back(chunk))
+					{
+						stolen = true;
+						buffer.add("steal", steal_start, now_ns(), "victim", victim, "chunk", chunk);
+					}
+				}
+				if (!stolen)
+					return;
+			}
+			const int_type start_index = offset + each_chunk_elem_cnt * int_type(chunk) + int_type((std::min)(chunk, remainder));
+			const int_type end_index = start_index + each_chunk_elem_cnt + int_type(chunk < remainder ? 1 : 0);
+			if (!run_chunk(int_type(t), chunk, start_index, end_index, buffer, now_ns))
+				return;
+		}
+	};
+
+	std::vector<std::shared_ptr<std::thread> > workers;
+	for (size_t t = 1; t < threads; ++t)
+	{
+		workers.push_back(std::shared_ptr<std::thread>(new std::thread(thread_proc, t)));
+	}
+	thread_proc(0);
+
+	const uint64_t join_start = now_ns();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i]->join();
+	}
+	if (threads > 0)
+		trace.threads[0].add("join", join_start, now_ns(), "threads", threads);
+}
+
+// Records the callbacks of a chunk in spans of batch_items, and notes whether the callback asked to stop
+template<typename callback_type, typename clock_type>
+class batch_recorder
+{
+public:
+	batch_recorder(callback_type& callback, trace_buffer& buffer, const clock_type& now_ns, uint64_t batch_items)
+		: callback(callback), buffer(buffer), now_ns(now_ns), batch_items((std::max)(batch_items, uint64_t(1))), items(0), batch_start(now_ns()), stopped(false)
+	{
+	}
+
+	template<typename... arg_types>
+	bool operator()(const arg_types&... args)
+	{
+		const bool result = callback(args...);
+		if (++items == batch_items)
+			close();
+		stopped = !result;
+		return result;
+	}
+
+	void close()
+	{
+		if (items == 0)
+			return;
+		const uint64_t end = now_ns();
+		buffer.add("callbacks", batch_start, end, "items", items);
+		batch_start = end;
+		items = 0;
+	}
+
+	bool stopped_early() const
+	{
+		return stopped;
+	}
+
+private:
+	callback_type& callback;
+	trace_buffer& buffer;
+	const clock_type& now_ns;
+	const uint64_t batch_items;
+	uint64_t items;
+	uint64_t batch_start;
+	bool stopped;
+};
+
+// Like compute_all_perm_shard, with the chunks of the shard traced into trace. Every thread keeps one
+// copy of callback for all its chunks; returning false from it stops that thread.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_perm::no_predicate_type>
+bool compute_all_perm_traced_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, const container_type& cont, callback_type callback, error_callback_type err_callback, const trace_options& options, run_trace& trace, predicate_type pred=predicate_type())
+{
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt << ") <= 0";
+
+		err_callback(0, cont, oss.str());
+		return false;
+	}
+
+	trace.process_id = static_cast<int>(cpu_index);
+	trace.threads.clear();
+	return concurrent_perm::run_perm_shard(cpu_index, cpu_cnt, int_type(1), cont, err_callback,
+		[&](const int_type& /*shard_thread_index*/, int_type shard_start, int_type shard_end)
+		{
+			std::vector<callback_type> callbacks(static_cast<size_t>(thread_cnt), callback);
+			run_traced_range(thread_cnt, shard_start, int_type(shard_end - shard_start), options, trace,
+				[&](const int_type& thread_index, uint64_t chunk, int_type start_index, int_type end_index, trace_buffer& buffer, const trace_clock& now_ns) -> bool
+				{
+					const uint64_t chunk_start = now_ns();
+					std::vector<uint32_t> seed;
+					concurrent_perm::find_perm(cont.size(), start_index, seed);
+					buffer.add("unrank", chunk_start, now_ns(), "chunk", chunk);
+
+					batch_recorder<callback_type, trace_clock> recorder(callbacks[static_cast<size_t>(thread_index)], buffer, now_ns, options.batch_items);
+					concurrent_perm::worker_thread_proc_seeded(thread_index, cont, seed, start_index, end_index, std::ref(recorder), err_callback, pred);
+					recorder.close();
+					buffer.add("chunk", chunk_start, now_ns(), "chunk", chunk);
+					return !recorder.stopped_early();
+				});
+		});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_perm::no_predicate_type>
+bool compute_all_perm_traced(int_type thread_cnt, const container_type& cont, callback_type callback, error_callback_type err_callback, const trace_options& options, run_trace& trace, predicate_type pred=predicate_type())
+{
+	return compute_all_perm_traced_shard(int_type(0), int_type(1), thread_cnt, cont, callback, err_callback, options, trace, pred);
+}
+
+// Like compute_all_comb_shard, with the chunks of the shard traced into trace. Every thread keeps one
+// copy of callback for all its chunks; returning false from it stops that thread.
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_comb::no_predicate_type>
+bool compute_all_comb_traced_shard(int_type cpu_index, int_type cpu_cnt, int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, const trace_options& options, run_trace& trace, predicate_type pred=predicate_type())
+{
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt << ") <= 0";
+
+		err_callback(0, cont.size(), cont, oss.str());
+		return false;
+	}
+
+	trace.process_id = static_cast<int>(cpu_index);
+	trace.threads.clear();
+	return concurrent_comb::run_comb_shard(cpu_index, cpu_cnt, int_type(1), subset, cont, err_callback,
+		[&](const int_type /*shard_thread_index*/, int_type shard_start, int_type shard_end)
+		{
+			std::vector<callback_type> callbacks(static_cast<size_t>(thread_cnt), callback);
+			run_traced_range(thread_cnt, shard_start, int_type(shard_end - shard_start), options, trace,
+				[&](const int_type& thread_index, uint64_t chunk, int_type start_index, int_type end_index, trace_buffer& buffer, const trace_clock& now_ns) -> bool
+				{
+					const uint64_t chunk_start = now_ns();
+					std::vector<uint32_t> seed(subset);
+					std::iota(seed.begin(), seed.end(), 0);
+					concurrent_comb::find_comb(cont.size(), subset, start_index, seed);
+					buffer.add("unrank", chunk_start, now_ns(), "chunk", chunk);
+
+					batch_recorder<callback_type, trace_clock> recorder(callbacks[static_cast<size_t>(thread_index)], buffer, now_ns, options.batch_items);
+					concurrent_comb::worker_thread_proc_seeded(thread_index, cont, seed, start_index, end_index, std::ref(recorder), err_callback, pred);
+					recorder.close();
+					buffer.add("chunk", chunk_start, now_ns(), "chunk", chunk);
+					return !recorder.stopped_early();
+				});
+		});
+}
+
+template<typename int_type, typename container_type, typename callback_type, typename error_callback_type, typename predicate_type=concurrent_comb::no_predicate_type>
+bool compute_all_comb_traced(int_type thread_cnt, uint32_t subset, const container_type& cont, callback_type callback, error_callback_type err_callback, const trace_options& options, run_trace& trace, predicate_type pred=predicate_type())
+{
+	return compute_all_comb_traced_shard(int_type(0), int_type(1), thread_cnt, subset, cont, callback, err_callback, options, trace, pred);
+}
+
+}
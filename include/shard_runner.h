@@ -0,0 +1,1200 @@
+///////////////////////////////////////////////////////////////////////////////
+// shard_runner.h header file
+//
+// Multi-process shard driver for concurrent_perm and concurrent_comb
+// Copyright 2016 Wong Shao Voon
+// Distributed under the Boost Software License, Version 1.0. (See
+// accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+// See http://www.boost.org/libs/foreach for documentation
+//
+// Runs each shard (cpu_index out of cpu_cnt) in its own process and streams
+// its results, progress and errors back to the coordinator over a pipe,
+// or leases chunk ranges to workers on demand over TCP.
+// POSIX only: on other platforms this header declares nothing.
+
+#pragma once
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+#include <exception>
+#include <type_traits>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+namespace concurrent_shard
+{
+
+enum class message_type : uint8_t
+{
+	progress = 1, // payload: done and total as two little-endian uint64
+	result = 2, // payload: opaque bytes, appended to the results of the shard
+	error = 3 // payload: error text
+};
+
+// A message is a 1 byte type and a 4 byte little-endian payload length, followed by the payload.
+const size_t message_header_size = 5;
+
+inline void put_uint(std::string& buffer, uint64_t value, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+	}
+}
+
+inline uint64_t get_uint(const char* data, size_t bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+	}
+	return value;
+}
+
+// Writes the whole buffer, retrying after signals and partial writes
+inline bool write_all(int fd, const char* data, size_t size)
+{
+	while (size > 0)
+	{
+		const ssize_t written = ::write(fd, data, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += written;
+		size -= static_cast<size_t>(written);
+	}
+	return true;
+}
+
+// Worker side of the pipe. Messages are written whole under a lock, so one channel
+// can be shared by all the threads of a shard.
+class shard_channel
+{
+public:
+	explicit shard_channel(int fd) : fd(fd)
+	{
+	}
+
+	bool progress(uint64_t done, uint64_t total)
+	{
+		std::string payload;
+		put_uint(payload, done, 8);
+		put_uint(payload, total, 8);
+		return send(message_type::progress, payload);
+	}
+
+	bool result(const std::string& data)
+	{
+		return send(message_type::result, data);
+	}
+
+	bool error(const std::string& text)
+	{
+		return send(message_type::error, text);
+	}
+
+private:
+	bool send(message_type type, const std::string& payload)
+	{
+		if (payload.size() > 0xffffffffu)
+			return false;
+
+		std::string frame;
+		frame.reserve(message_header_size + payload.size());
+		frame.push_back(static_cast<char>(type));
+		put_uint(frame, payload.size(), 4);
+		frame += payload;
+
+		std::lock_guard<std::mutex> lock(fd_mutex);
+		return write_all(fd, frame.data(), frame.size());
+	}
+
+	int fd;
+	std::mutex fd_mutex;
+};
+
+// Appends the raw bytes of trivially copyable values, such as the chunk_results of compute_all_perm_reduce_shard.
+// Both ends must have the same value layout and endianness.
+template<typename value_type>
+void append_values(std::string& data, const std::vector<value_type>& values)
+{
+	static_assert(std::is_trivially_copyable<value_type>::value, "append_values needs a trivially copyable value_type");
+	if (!values.empty())
+		data.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(value_type));
+}
+
+template<typename value_type>
+bool read_values(const std::string& data, std::vector<value_type>& values)
+{
+	static_assert(std::is_trivially_copyable<value_type>::value, "read_values needs a trivially copyable value_type");
+	if (data.size() % sizeof(value_type) != 0)
+		return false;
+	const size_t previous = values.size();
+	values.resize(previous + data.size() / sizeof(value_type));
+	if (!data.empty())
+		std::memcpy(&values[previous], data.data(), data.size());
+	return true;
+}
+
+// Parses a "cpu_index/cpu_cnt" argument, as passed to the commands of run_command_shards
+inline bool parse_shard_arg(const char* text, int& cpu_index, int& cpu_cnt)
+{
+	char slash = 0;
+	std::istringstream iss(text);
+	if (!(iss >> cpu_index >> slash >> cpu_cnt) || slash != '/' || !iss.eof())
+		return false;
+	return cpu_cnt > 0 && cpu_index >= 0 && cpu_index < cpu_cnt;
+}
+
+// Reads the messages of every shard until all pipes are closed, then reaps the processes.
+// results[i] receives the result payloads of shard i in the order it sent them.
+template<typename progress_callback_type, typename error_callback_type>
+bool collect_shards(const std::vector<pid_t>& pids, const std::vector<int>& fds, std::vector<std::string>& results, progress_callback_type progress_callback, error_callback_type err_callback)
+{
+	const size_t cnt = fds.size();
+	results.assign(cnt, std::string());
+	std::vector<std::string> buffers(cnt);
+	std::vector<struct pollfd> polls(cnt);
+	for (size_t i = 0; i < cnt; ++i)
+	{
+		polls[i].fd = fds[i];
+		polls[i].events = POLLIN;
+		polls[i].revents = 0;
+	}
+
+	bool success = true;
+	size_t open_cnt = cnt;
+	std::vector<char> block(1 << 16);
+	while (open_cnt > 0)
+	{
+		if (::poll(polls.data(), static_cast<nfds_t>(cnt), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			err_callback(0, std::string("Error: poll failed: ") + std::strerror(errno));
+			success = false;
+			break;
+		}
+
+		for (size_t i = 0; i < cnt; ++i)
+		{
+			if (polls[i].fd < 0 || polls[i].revents == 0)
+				continue;
+
+			const ssize_t got = ::read(polls[i].fd, block.data(), block.size());
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got <= 0)
+			{
+				::close(polls[i].fd);
+				polls[i].fd = -1;
+				--open_cnt;
+				if (!buffers[i].empty())
+				{
+					std::ostringstream oss;
+					oss << "Error: shard " << i << " sent a truncated message";
+					err_callback(static_cast<int>(i), oss.str());
+					success = false;
+				}
+				continue;
+			}
+
+			std::string& buffer = buffers[i];
+			buffer.append(block.data(), static_cast<size_t>(got));
+			size_t pos = 0;
+			while (buffer.size() - pos >= message_header_size)
+			{
+				const size_t length = static_cast<size_t>(get_uint(&buffer[pos + 1], 4));
+				if (buffer.size() - pos < message_header_size + length)
+					break;
+
+				const char* payload = &buffer[pos + message_header_size];
+				switch (static_cast<message_type>(buffer[pos]))
+				{
+				case message_type::progress:
+					if (length == 16)
+						progress_callback(static_cast<int>(i), get_uint(payload, 8), get_uint(payload + 8, 8));
+					break;
+				case message_type::result:
+					results[i].append(payload, length);
+					break;
+				case message_type::error:
+					err_callback(static_cast<int>(i), std::string(payload, length));
+					success = false;
+					break;
+				default:
+					{
+						std::ostringstream oss;
+						oss << "Error: shard " << i << " sent an unknown message type(" << static_cast<int>(static_cast<unsigned char>(buffer[pos])) << ")";
+						err_callback(static_cast<int>(i), oss.str());
+						success = false;
+					}
+					break;
+				}
+				pos += message_header_size + length;
+			}
+			buffer.erase(0, pos);
+		}
+	}
+
+	for (size_t i = 0; i < cnt; ++i)
+	{
+		if (polls[i].fd >= 0)
+			::close(polls[i].fd);
+
+		int status = 0;
+		pid_t reaped = 0;
+		do
+		{
+			reaped = ::waitpid(pids[i], &status, 0);
+		} while (reaped < 0 && errno == EINTR);
+
+		if (reaped < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			std::ostringstream oss;
+			oss << "Error: shard " << i;
+			if (reaped < 0)
+				oss << " could not be waited for";
+			else if (WIFSIGNALED(status))
+				oss << " was killed by signal " << WTERMSIG(status);
+			else
+				oss << " exited with status " << WEXITSTATUS(status);
+
+			err_callback(static_cast<int>(i), oss.str());
+			success = false;
+		}
+	}
+
+	return success;
+}
+
+// Forks cpu_cnt processes; process i calls shard(i, cpu_cnt, channel) and exits with status 0 if it returns true.
+// The shard reports through the channel; uncaught exceptions are sent as errors.
+// Fork before starting other threads (including thread_pool::instance): only the forking thread exists in the children.
+// Returns true if every shard exited with status 0 and sent no error.
+template<typename shard_type, typename progress_callback_type, typename error_callback_type>
+bool run_local_shards(int cpu_cnt, shard_type shard, std::vector<std::string>& results, progress_callback_type progress_callback, error_callback_type err_callback)
+{
+	results.clear();
+	if (cpu_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: cpu_cnt(" << cpu_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, oss.str());
+		return false;
+	}
+
+	// unflushed output would be written again by every child
+	std::cout.flush();
+	std::cerr.flush();
+	std::fflush(nullptr);
+
+	std::vector<pid_t> pids;
+	std::vector<int> fds;
+	for (int i = 0; i < cpu_cnt; ++i)
+	{
+		int pipe_fds[2];
+		pid_t pid = -1;
+		if (::pipe(pipe_fds) == 0)
+		{
+			pid = ::fork();
+			if (pid < 0)
+			{
+				::close(pipe_fds[0]);
+				::close(pipe_fds[1]);
+			}
+		}
+
+		if (pid < 0)
+		{
+			std::ostringstream oss;
+			oss << "Error: cannot start shard " << i << ": " << std::strerror(errno);
+			err_callback(i, oss.str());
+			for (size_t j = 0; j < pids.size(); ++j)
+				::kill(pids[j], SIGKILL);
+			collect_shards(pids, fds, results, progress_callback, [](int, const std::string&) {});
+			return false;
+		}
+
+		if (pid == 0)
+		{
+			::close(pipe_fds[0]);
+			for (size_t j = 0; j < fds.size(); ++j)
+				::close(fds[j]);
+
+			bool ok = false;
+			{
+				shard_channel channel(pipe_fds[1]);
+				try
+				{
+					ok = shard(i, cpu_cnt, channel);
+				}
+				catch (const std::exception& e)
+				{
+					channel.error(std::string("Error: ") + e.what());
+				}
+				catch (...)
+				{
+					channel.error("Error: unknown exception");
+				}
+			}
+			std::cout.flush();
+			std::cerr.flush();
+			std::fflush(nullptr);
+			// skip the static destructors and atexit handlers of the parent
+			::_exit(ok ? 0 : 1);
+		}
+
+		::close(pipe_fds[1]);
+		pids.push_back(pid);
+		fds.push_back(pipe_fds[0]);
+	}
+
+	return collect_shards(pids, fds, results, progress_callback, err_callback);
+}
+
+// Runs each command with /bin/sh -c and reads its messages from its stdout, so a command such as
+// "ssh host1 ./worker 0/4" runs a shard on another machine. The worker writes with shard_channel(STDOUT_FILENO)
+// and must send everything else to stderr.
+// Returns true if every command exited with status 0 and sent no error.
+template<typename progress_callback_type, typename error_callback_type>
+bool run_command_shards(const std::vector<std::string>& commands, std::vector<std::string>& results, progress_callback_type progress_callback, error_callback_type err_callback)
+{
+	results.clear();
+	if (commands.empty())
+	{
+		err_callback(0, "Error: no commands");
+		return false;
+	}
+
+	std::cout.flush();
+	std::cerr.flush();
+	std::fflush(nullptr);
+
+	std::vector<pid_t> pids;
+	std::vector<int> fds;
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		int pipe_fds[2];
+		pid_t pid = -1;
+		if (::pipe(pipe_fds) == 0)
+		{
+			pid = ::fork();
+			if (pid < 0)
+			{
+				::close(pipe_fds[0]);
+				::close(pipe_fds[1]);
+			}
+		}
+
+		if (pid < 0)
+		{
+			std::ostringstream oss;
+			oss << "Error: cannot start command " << i << ": " << std::strerror(errno);
+			err_callback(static_cast<int>(i), oss.str());
+			for (size_t j = 0; j < pids.size(); ++j)
+				::kill(pids[j], SIGKILL);
+			collect_shards(pids, fds, results, progress_callback, [](int, const std::string&) {});
+			return false;
+		}
+
+		if (pid == 0)
+		{
+			::close(pipe_fds[0]);
+			for (size_t j = 0; j < fds.size(); ++j)
+				::close(fds[j]);
+			if (pipe_fds[1] != STDOUT_FILENO)
+			{
+				::dup2(pipe_fds[1], STDOUT_FILENO);
+				::close(pipe_fds[1]);
+			}
+			::execl("/bin/sh", "sh", "-c", commands[i].c_str(), static_cast<char*>(nullptr));
+			::_exit(127);
+		}
+
+		::close(pipe_fds[1]);
+		pids.push_back(pid);
+		fds.push_back(pipe_fds[0]);
+	}
+
+	return collect_shards(pids, fds, results, progress_callback, err_callback);
+}
+
+// Line-based text protocol over a connected socket, used by lease_coordinator and lease_client
+class line_socket
+{
+public:
+	explicit line_socket(int fd = -1) : fd(fd)
+	{
+	}
+
+	~line_socket()
+	{
+		close();
+	}
+
+	line_socket(const line_socket&) = delete;
+	line_socket& operator=(const line_socket&) = delete;
+
+	int handle() const
+	{
+		return fd;
+	}
+
+	void close()
+	{
+		reset(-1);
+	}
+
+	void reset(int new_fd)
+	{
+		if (fd >= 0)
+			::close(fd);
+		fd = new_fd;
+		buffer.clear();
+	}
+
+	bool write_line(const std::string& line)
+	{
+		const std::string data = line + "\n";
+		const char* p = data.data();
+		size_t size = data.size();
+		while (size > 0)
+		{
+#if defined(MSG_NOSIGNAL)
+			const ssize_t sent = ::send(fd, p, size, MSG_NOSIGNAL);
+#else
+			const ssize_t sent = ::send(fd, p, size, 0);
+#endif
+			if (sent < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			p += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+
+	// Reads once into the buffer; returns false on end of stream or error
+	bool fill()
+	{
+		char block[4096];
+		ssize_t got = 0;
+		do
+		{
+			got = ::recv(fd, block, sizeof(block), 0);
+		} while (got < 0 && errno == EINTR);
+		if (got <= 0)
+			return false;
+		buffer.append(block, static_cast<size_t>(got));
+		return true;
+	}
+
+	// Takes a complete line out of the buffer, if there is one
+	bool take_line(std::string& line)
+	{
+		const size_t pos = buffer.find('\n');
+		if (pos == std::string::npos)
+			return false;
+		line = buffer.substr(0, pos);
+		buffer.erase(0, pos + 1);
+		return true;
+	}
+
+	bool read_line(std::string& line)
+	{
+		while (!take_line(line))
+		{
+			if (!fill())
+				return false;
+		}
+		return true;
+	}
+
+private:
+	int fd;
+	std::string buffer;
+};
+
+inline void set_socket_options(int fd)
+{
+	int one = 1;
+	::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#if defined(SO_NOSIGPIPE)
+	::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+struct lease_stats
+{
+	lease_stats() : leases(0), progress_reports(0), renewals(0), expired(0), splits(0), stale_reports(0), waits(0), aborted(false)
+	{
+	}
+
+	uint64_t leases; // ranges handed out, including split halves and re-leased ranges
+	uint64_t progress_reports;
+	uint64_t renewals; // heartbeats that kept a lease alive while its worker was inside a claim
+	uint64_t expired; // leases whose worker stopped reporting and whose rest was put back
+	uint64_t splits; // leases cut in half for an idle worker
+	uint64_t stale_reports; // reports on leases that had expired
+	uint64_t waits; // lease requests told to retry later
+	bool aborted;
+};
+
+// Hands out ranges of chunks [0, chunk_cnt) to workers over TCP, on demand.
+// Protocol, one line per message:
+//   worker: LEASE                   coordinator: RANGE <id> <begin> <end> <timeout_ms> | WAIT <ms> | DONE
+//   worker: PROGRESS <id> <next>    coordinator: CONTINUE <limit> | COMPLETE | STALE
+//   worker: RENEW <id>              coordinator: RENEWED | STALE
+//   worker: ABORT <text>            coordinator: DONE
+// PROGRESS reports that chunks below next are done and claims the chunks up to limit; it is also the
+// completion acknowledgement once next reaches the end of the lease. RENEW is the heartbeat of a worker
+// still inside a claim, so a claim may take longer than lease_timeout. A lease neither reported on nor
+// renewed within lease_timeout expires and its unfinished chunks are leased again, so a chunk claimed
+// by a worker that died is processed again by another one. When no chunk is left to lease, the unclaimed half
+// of the lease with the most chunks left is split off for the idle worker.
+class lease_coordinator
+{
+public:
+	explicit lease_coordinator(uint64_t chunk_cnt, uint64_t lease_chunks = 256, std::chrono::milliseconds lease_timeout = std::chrono::milliseconds(10000), uint64_t claim_chunks = 4)
+		: chunk_cnt(chunk_cnt)
+		, lease_chunks((std::max)(uint64_t(1), lease_chunks))
+		, lease_timeout(lease_timeout)
+		, claim_chunks((std::max)(uint64_t(1), claim_chunks))
+		, listen_fd(-1)
+		, listen_port(0)
+		, next_lease_id(1)
+		, done_cnt(0)
+		, stopping(false)
+	{
+		if (chunk_cnt > 0)
+			free_ranges.push_back(std::make_pair(uint64_t(0), chunk_cnt));
+	}
+
+	~lease_coordinator()
+	{
+		if (listen_fd >= 0)
+			::close(listen_fd);
+	}
+
+	lease_coordinator(const lease_coordinator&) = delete;
+	lease_coordinator& operator=(const lease_coordinator&) = delete;
+
+	// Port 0 picks a free port, returned by port()
+	bool listen(const std::string& address, uint16_t port, std::string& error)
+	{
+		struct sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if (::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1)
+		{
+			error = "Error: invalid IPv4 address(" + address + ")";
+			return false;
+		}
+
+		listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		int one = 1;
+		if (listen_fd < 0
+			|| ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+			|| ::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+			|| ::listen(listen_fd, SOMAXCONN) != 0)
+		{
+			error = std::string("Error: cannot listen: ") + std::strerror(errno);
+			return false;
+		}
+
+		socklen_t len = sizeof(addr);
+		::getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+		listen_port = ntohs(addr.sin_port);
+		return true;
+	}
+
+	uint16_t port() const
+	{
+		return listen_port;
+	}
+
+	// Makes serve return false at its next poll, from any thread
+	void stop()
+	{
+		stopping.store(true);
+	}
+
+	// Serves workers until every chunk is acknowledged, a worker aborts or stop is called.
+	// After the last acknowledgement, workers still connected are told DONE until they disconnect
+	// or lease_timeout passes. Returns true if every chunk was acknowledged.
+	template<typename error_callback_type>
+	bool serve(error_callback_type err_callback)
+	{
+		if (listen_fd < 0)
+		{
+			err_callback("Error: listen was not called");
+			return false;
+		}
+
+		std::vector<std::shared_ptr<line_socket> > clients;
+		std::chrono::steady_clock::time_point finish_deadline;
+		bool finishing = false;
+		while (!stopping.load())
+		{
+			const bool finished = stats_.aborted || done_cnt == chunk_cnt;
+			if (finished && !finishing)
+			{
+				finishing = true;
+				finish_deadline = std::chrono::steady_clock::now() + lease_timeout;
+			}
+			if (finishing && (clients.empty() || std::chrono::steady_clock::now() > finish_deadline))
+				break;
+
+			std::vector<struct pollfd> polls(clients.size() + 1);
+			polls[0].fd = listen_fd;
+			polls[0].events = POLLIN;
+			for (size_t i = 0; i < clients.size(); ++i)
+			{
+				polls[i + 1].fd = clients[i]->handle();
+				polls[i + 1].events = POLLIN;
+			}
+
+			if (::poll(polls.data(), static_cast<nfds_t>(polls.size()), 100) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				err_callback(std::string("Error: poll failed: ") + std::strerror(errno));
+				return false;
+			}
+
+			if (polls[0].revents & POLLIN)
+			{
+				const int fd = ::accept(listen_fd, nullptr, nullptr);
+				if (fd >= 0)
+				{
+					set_socket_options(fd);
+					clients.push_back(std::shared_ptr<line_socket>(new line_socket(fd)));
+				}
+			}
+
+			std::vector<std::shared_ptr<line_socket> > alive;
+			for (size_t i = 0; i + 1 < polls.size(); ++i)
+			{
+				line_socket& client = *clients[i];
+				bool open = true;
+				if (polls[i + 1].revents != 0)
+				{
+					open = client.fill();
+					std::string line;
+					while (open && client.take_line(line))
+					{
+						open = client.write_line(handle(line));
+					}
+				}
+				if (open)
+					alive.push_back(clients[i]);
+			}
+			// accepted connections were appended after the polled ones
+			for (size_t i = polls.size() - 1; i < clients.size(); ++i)
+			{
+				alive.push_back(clients[i]);
+			}
+			clients.swap(alive);
+		}
+
+		if (stats_.aborted && !abort_reason.empty())
+			err_callback(abort_reason);
+		return !stats_.aborted && done_cnt == chunk_cnt;
+	}
+
+	const lease_stats& stats() const
+	{
+		return stats_;
+	}
+
+	uint64_t done_chunk_cnt() const
+	{
+		return done_cnt;
+	}
+
+private:
+	struct lease_state
+	{
+		uint64_t next; // chunks below next are done
+		uint64_t claimed; // chunks below claimed may be in progress
+		uint64_t end;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	std::string handle(const std::string& line)
+	{
+		std::istringstream iss(line);
+		std::string command;
+		iss >> command;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		if (command == "LEASE")
+		{
+			if (stats_.aborted || done_cnt == chunk_cnt)
+				return "DONE";
+
+			expire(now);
+			uint64_t begin = 0;
+			uint64_t end = 0;
+			if (!free_ranges.empty())
+			{
+				begin = free_ranges.front().first;
+				end = (std::min)(free_ranges.front().second, begin + lease_chunks);
+				if (end == free_ranges.front().second)
+					free_ranges.pop_front();
+				else
+					free_ranges.front().first = end;
+			}
+			else
+			{
+				lease_state* slowest = nullptr;
+				for (auto it = leases.begin(); it != leases.end(); ++it)
+				{
+					if (slowest == nullptr || it->second.end - it->second.claimed > slowest->end - slowest->claimed)
+						slowest = &it->second;
+				}
+				if (slowest == nullptr || slowest->end - slowest->claimed < 2)
+				{
+					++stats_.waits;
+					return "WAIT 50";
+				}
+				begin = slowest->claimed + (slowest->end - slowest->claimed) / 2;
+				end = slowest->end;
+				slowest->end = begin;
+				++stats_.splits;
+			}
+
+			const uint64_t id = next_lease_id++;
+			lease_state& lease = leases[id];
+			lease.next = begin;
+			lease.claimed = begin;
+			lease.end = end;
+			lease.deadline = now + lease_timeout;
+			++stats_.leases;
+
+			std::ostringstream oss;
+			oss << "RANGE " << id << " " << begin << " " << end << " " << lease_timeout.count();
+			return oss.str();
+		}
+		else if (command == "PROGRESS")
+		{
+			uint64_t id = 0;
+			uint64_t next = 0;
+			if (!(iss >> id >> next))
+				return "ERROR malformed PROGRESS";
+
+			++stats_.progress_reports;
+			auto it = leases.find(id);
+			if (it == leases.end() || stats_.aborted)
+			{
+				++stats_.stale_reports;
+				return "STALE";
+			}
+
+			lease_state& lease = it->second;
+			if (next < lease.next || next > lease.claimed)
+				return "ERROR progress outside of the claimed chunks";
+
+			done_cnt += next - lease.next;
+			lease.next = next;
+			lease.deadline = now + lease_timeout;
+			if (next == lease.end)
+			{
+				leases.erase(it);
+				return "COMPLETE";
+			}
+
+			lease.claimed = (std::min)(lease.end, next + claim_chunks);
+			std::ostringstream oss;
+			oss << "CONTINUE " << lease.claimed;
+			return oss.str();
+		}
+		else if (command == "RENEW")
+		{
+			uint64_t id = 0;
+			if (!(iss >> id))
+				return "ERROR malformed RENEW";
+
+			auto it = leases.find(id);
+			if (it == leases.end() || stats_.aborted)
+				return "STALE";
+
+			it->second.deadline = now + lease_timeout;
+			++stats_.renewals;
+			return "RENEWED";
+		}
+		else if (command == "ABORT")
+		{
+			stats_.aborted = true;
+			std::getline(iss >> std::ws, abort_reason);
+			return "DONE";
+		}
+
+		return "ERROR unknown command";
+	}
+
+	void expire(std::chrono::steady_clock::time_point now)
+	{
+		for (auto it = leases.begin(); it != leases.end(); )
+		{
+			if (it->second.deadline < now)
+			{
+				free_ranges.push_back(std::make_pair(it->second.next, it->second.end));
+				++stats_.expired;
+				it = leases.erase(it);
+			}
+			else
+				++it;
+		}
+	}
+
+	const uint64_t chunk_cnt;
+	const uint64_t lease_chunks;
+	const std::chrono::milliseconds lease_timeout;
+	const uint64_t claim_chunks;
+	int listen_fd;
+	uint16_t listen_port;
+	uint64_t next_lease_id;
+	uint64_t done_cnt;
+	std::deque<std::pair<uint64_t, uint64_t> > free_ranges;
+	std::map<uint64_t, lease_state> leases;
+	lease_stats stats_;
+	std::string abort_reason;
+	std::atomic<bool> stopping;
+};
+
+enum class lease_reply
+{
+	range, // a lease was given
+	proceed, // chunks up to limit are claimed
+	wait, // retry after wait_ms
+	complete, // the lease is acknowledged
+	stale, // the lease expired and was given to another worker
+	renewed, // the lease deadline was pushed back
+	done, // there is nothing left to do
+	error
+};
+
+// Worker side of the lease_coordinator protocol
+class lease_client
+{
+public:
+	lease_client() : timeout_ms(0)
+	{
+	}
+
+	bool connect(const std::string& host, uint16_t port, std::string& error)
+	{
+		struct addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo* found = nullptr;
+		const std::string service = std::to_string(port);
+		const int rc = ::getaddrinfo(host.c_str(), service.c_str(), &hints, &found);
+		if (rc != 0)
+		{
+			error = "Error: cannot resolve " + host + ": " + ::gai_strerror(rc);
+			return false;
+		}
+
+		int fd = -1;
+		for (struct addrinfo* ai = found; ai != nullptr && fd < 0; ai = ai->ai_next)
+		{
+			fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+			{
+				::close(fd);
+				fd = -1;
+			}
+		}
+		::freeaddrinfo(found);
+		if (fd < 0)
+		{
+			error = "Error: cannot connect to " + host + ":" + service;
+			return false;
+		}
+
+		set_socket_options(fd);
+		socket.reset(fd);
+		return true;
+	}
+
+	lease_reply lease(uint64_t& id, uint64_t& begin, uint64_t& end, uint64_t& wait_ms)
+	{
+		std::istringstream iss;
+		std::string reply;
+		if (!request("LEASE", iss, reply))
+			return lease_reply::error;
+		if (reply == "RANGE" && (iss >> id >> begin >> end))
+		{
+			if (!(iss >> timeout_ms))
+				timeout_ms = 0;
+			return lease_reply::range;
+		}
+		if (reply == "WAIT" && (iss >> wait_ms))
+			return lease_reply::wait;
+		if (reply == "DONE")
+			return lease_reply::done;
+		return lease_reply::error;
+	}
+
+	lease_reply progress(uint64_t id, uint64_t next, uint64_t& limit)
+	{
+		std::ostringstream oss;
+		oss << "PROGRESS " << id << " " << next;
+		std::istringstream iss;
+		std::string reply;
+		if (!request(oss.str(), iss, reply))
+			return lease_reply::error;
+		if (reply == "CONTINUE" && (iss >> limit))
+			return lease_reply::proceed;
+		if (reply == "COMPLETE")
+			return lease_reply::complete;
+		if (reply == "STALE")
+			return lease_reply::stale;
+		return lease_reply::error;
+	}
+
+	lease_reply renew(uint64_t id)
+	{
+		std::ostringstream oss;
+		oss << "RENEW " << id;
+		std::istringstream iss;
+		std::string reply;
+		if (!request(oss.str(), iss, reply))
+			return lease_reply::error;
+		if (reply == "RENEWED")
+			return lease_reply::renewed;
+		if (reply == "STALE")
+			return lease_reply::stale;
+		return lease_reply::error;
+	}
+
+	// lease_timeout of the coordinator, sent with the last range; 0 when it sent none
+	uint64_t lease_timeout_ms() const
+	{
+		return timeout_ms;
+	}
+
+	bool abort(const std::string& reason)
+	{
+		std::istringstream iss;
+		std::string reply;
+		return request("ABORT " + reason, iss, reply) && reply == "DONE";
+	}
+
+private:
+	bool request(const std::string& line, std::istringstream& iss, std::string& reply)
+	{
+		std::string answer;
+		if (!socket.write_line(line) || !socket.read_line(answer))
+			return false;
+		iss.str(answer);
+		iss >> reply;
+		return true;
+	}
+
+	line_socket socket;
+	uint64_t timeout_ms;
+};
+
+// Runs thread_cnt threads, each with its own connection to the coordinator at host:port, that lease chunk
+// ranges and call chunk_worker(thread_index, chunk_begin, chunk_end) on every claimed range until the
+// coordinator has nothing left. Each thread gets its own copy of chunk_worker. If chunk_worker returns false,
+// the job is aborted for every worker. Returns true if the coordinator said DONE to every thread.
+// A heartbeat thread with its own connection renews the leases of the threads inside chunk_worker four times
+// per lease_timeout, so a claim of slow arrangements does not lose its lease before it is reported.
+template<typename chunk_worker_type, typename error_callback_type>
+bool run_lease_worker(const std::string& host, uint16_t port, int thread_cnt, chunk_worker_type chunk_worker, error_callback_type err_callback)
+{
+	if (thread_cnt <= 0)
+	{
+		std::ostringstream oss;
+		oss << "Error: thread_cnt(" << thread_cnt;
+		oss << ") <= 0";
+
+		err_callback(0, oss.str());
+		return false;
+	}
+
+	std::mutex err_mutex;
+	std::atomic<bool> failed(false);
+
+	// lease id of every thread inside chunk_worker, 0 for the others
+	std::mutex heartbeat_mutex;
+	std::condition_variable heartbeat_cv;
+	std::vector<uint64_t> active_ids(static_cast<size_t>(thread_cnt), 0);
+	uint64_t heartbeat_ms = 0;
+	bool heartbeat_stop = false;
+	auto heartbeat = [&]()
+	{
+		lease_client client;
+		bool connected = false;
+		std::unique_lock<std::mutex> lock(heartbeat_mutex);
+		while (!heartbeat_stop)
+		{
+			heartbeat_cv.wait_for(lock, std::chrono::milliseconds(heartbeat_ms == 0 ? 50 : heartbeat_ms));
+			if (heartbeat_stop || heartbeat_ms == 0)
+				continue;
+			std::vector<uint64_t> ids;
+			for (size_t i = 0; i < active_ids.size(); ++i)
+			{
+				if (active_ids[i] != 0)
+					ids.push_back(active_ids[i]);
+			}
+			if (ids.empty())
+				continue;
+
+			lock.unlock();
+			std::string error;
+			if (!connected)
+				connected = client.connect(host, port, error);
+			// a failed renewal is retried at the next beat; a stale lease is found out by its worker's next report
+			for (size_t i = 0; connected && i < ids.size(); ++i)
+			{
+				if (client.renew(ids[i]) == lease_reply::error)
+					connected = false;
+			}
+			lock.lock();
+		}
+	};
+	std::thread heartbeat_thread(heartbeat);
+
+	auto worker = [&](const int thread_index)
+	{
+		chunk_worker_type thread_chunk_worker = chunk_worker;
+		auto fail = [&](const std::string& error)
+		{
+			failed.store(true);
+			std::lock_guard<std::mutex> lock(err_mutex);
+			err_callback(thread_index, error);
+		};
+
+		lease_client client;
+		std::string error;
+		if (!client.connect(host, port, error))
+		{
+			fail(error);
+			return;
+		}
+
+		while (true)
+		{
+			uint64_t id = 0;
+			uint64_t begin = 0;
+			uint64_t end = 0;
+			uint64_t wait_ms = 0;
+			const lease_reply reply = client.lease(id, begin, end, wait_ms);
+			if (reply == lease_reply::done)
+				return;
+			if (reply == lease_reply::wait)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+				continue;
+			}
+			if (reply != lease_reply::range)
+			{
+				fail("Error: lease request failed");
+				return;
+			}
+			if (client.lease_timeout_ms() > 0)
+			{
+				std::lock_guard<std::mutex> lock(heartbeat_mutex);
+				heartbeat_ms = (std::max)(uint64_t(1), client.lease_timeout_ms() / 4);
+			}
+
+			uint64_t next = begin;
+			while (true)
+			{
+				uint64_t limit = 0;
+				const lease_reply status = client.progress(id, next, limit);
+				if (status == lease_reply::complete || status == lease_reply::stale)
+					break;
+				if (status != lease_reply::proceed)
+				{
+					fail("Error: progress report failed");
+					return;
+				}
+				{
+					std::lock_guard<std::mutex> lock(heartbeat_mutex);
+					active_ids[static_cast<size_t>(thread_index)] = id;
+				}
+				const bool proceed = thread_chunk_worker(thread_index, next, limit);
+				{
+					std::lock_guard<std::mutex> lock(heartbeat_mutex);
+					active_ids[static_cast<size_t>(thread_index)] = 0;
+				}
+				if (!proceed)
+				{
+					client.abort("chunk worker stopped");
+					failed.store(true);
+					return;
+				}
+				next = limit;
+			}
+		}
+	};
+
+	std::vector<std::shared_ptr<std::thread> > threads;
+	for (int i = 1; i < thread_cnt; ++i)
+	{
+		threads.push_back(std::shared_ptr<std::thread>(new std::thread(worker, i)));
+	}
+	worker(0);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i]->join();
+	}
+	{
+		std::lock_guard<std::mutex> lock(heartbeat_mutex);
+		heartbeat_stop = true;
+	}
+	heartbeat_cv.notify_one();
+	heartbeat_thread.join();
+
+	return !failed.load();
+}
+
+}
+
+#endif